@@ -240,6 +240,7 @@ SOURCES += src\protobuf\google\protobuf\any.cc \
     src\asyncrpcqueue.cpp \
     src\base58.cpp \
     src\bech32.cpp \
+    src\blockencodings.cpp \
     src\bloom.cpp \
     src\chain.cpp \
     src\chainparamsbase.cpp \
@@ -436,6 +437,7 @@ SOURCES += src\protobuf\google\protobuf\any.cc \
     src\timedata.cpp \
     src\torcontrol.cpp \
     src\transaction_builder.cpp \
+    src\txcache.cpp \
     src\txdb.cpp \
     src\txmempool.cpp \
     src\uint256.cpp \
@@ -7,6 +7,7 @@
 
 #include "primitives/block.h"
 
+#include <atomic>
 #include <memory>
 
 class CTxMemPool;
@@ -21,7 +22,7 @@ public:
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    inline void SerializationOp(Stream& s, Operation ser_action) {
         READWRITE(tx); //TODO: Compress tx encoding
     }
 };
@@ -35,7 +36,7 @@ public:
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    inline void SerializationOp(Stream& s, Operation ser_action) {
         READWRITE(blockhash);
         uint64_t indexes_size = (uint64_t)indexes.size();
         READWRITE(COMPACTSIZE(indexes_size));
@@ -81,7 +82,7 @@ public:
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    inline void SerializationOp(Stream& s, Operation ser_action) {
         READWRITE(blockhash);
         uint64_t txn_size = (uint64_t)txn.size();
         READWRITE(COMPACTSIZE(txn_size));
@@ -109,7 +110,7 @@ struct PrefilledTransaction {
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    inline void SerializationOp(Stream& s, Operation ser_action) {
         uint64_t idx = index;
         READWRITE(COMPACTSIZE(idx));
         if (idx > std::numeric_limits<uint16_t>::max())
@@ -124,8 +125,6 @@ typedef enum ReadStatus_t
     READ_STATUS_OK,
     READ_STATUS_INVALID, // Invalid object, peer is sending bogus crap
     READ_STATUS_FAILED, // Failed to process object
-    READ_STATUS_CHECKBLOCK_FAILED, // Used only by FillBlock to indicate a
-                                   // failure in CheckBlock.
 } ReadStatus;
 
 class CBlockHeaderAndShortTxIDs {
@@ -148,7 +147,7 @@ public:
     // Dummy for deserialization
     CBlockHeaderAndShortTxIDs() {}
 
-    CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID);
+    explicit CBlockHeaderAndShortTxIDs(const CBlock& block);
 
     uint64_t GetShortID(const uint256& txhash) const;
 
@@ -157,7 +156,7 @@ public:
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    inline void SerializationOp(Stream& s, Operation ser_action) {
         READWRITE(header);
         READWRITE(nonce);
 
@@ -194,16 +193,36 @@ public:
 class PartiallyDownloadedBlock {
 protected:
     std::vector<CTransactionRef> txn_available;
-    size_t prefilled_count = 0, mempool_count = 0, extra_count = 0;
+    size_t prefilled_count = 0, mempool_count = 0;
     CTxMemPool* pool;
 public:
     CBlockHeader header;
     explicit PartiallyDownloadedBlock(CTxMemPool* poolIn) : pool(poolIn) {}
 
-    // extra_txn is a list of extra transactions to look at, in <witness hash, reference> form
-    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn);
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
     bool IsTxAvailable(size_t index) const;
     ReadStatus FillBlock(CBlock& block, const std::vector<CTransactionRef>& vtx_missing);
+
+    size_t GetMempoolCount() const { return mempool_count; }
 };
 
+/** Counters of compact block relay, reported by getnetworkinfo */
+struct CCompactBlockStats
+{
+    std::atomic<uint64_t> nReceived;         //! cmpctblock messages that started a reconstruction
+    std::atomic<uint64_t> nReconstructed;    //! blocks rebuilt without another round trip
+    std::atomic<uint64_t> nRoundTrips;       //! getblocktxn requests sent for missing transactions
+    std::atomic<uint64_t> nRoundTripsFilled; //! blocks completed by a blocktxn answer
+    std::atomic<uint64_t> nFullBlockFallbacks; //! reconstructions abandoned for a full block download
+    std::atomic<uint64_t> nTxFromMempool;    //! transactions found in our mempool
+    std::atomic<uint64_t> nTxRequested;      //! transactions requested with getblocktxn
+    std::atomic<uint64_t> nSent;             //! cmpctblock messages sent to peers
+    std::atomic<uint64_t> nBlockTxnServed;   //! getblocktxn requests answered
+
+    CCompactBlockStats() : nReceived(0), nReconstructed(0), nRoundTrips(0), nRoundTripsFilled(0),
+        nFullBlockFallbacks(0), nTxFromMempool(0), nTxRequested(0), nSent(0), nBlockTxnServed(0) {}
+};
+
+extern CCompactBlockStats cmpctBlockStats;
+
 #endif
@@ -65,6 +65,7 @@ Details.
 #include "../wallet/wallet.h"
 #include <univalue.h>
 #include <exception>
+#include <tuple>
 #include "../squishy_defs.h"
 #include "../utlist.h"
 #include "../uthash.h"
@@ -293,7 +294,32 @@ bool myIsutxo_spentinmempool(uint256 &spenttxid,int32_t &spentvini,uint256 txid,
 bool myAddtomempool(const CTransaction &tx, CValidationState *pstate = nullptr, bool fSkipExpiry = false);
 bool mytxid_inmempool(uint256 txid);
 int32_t myIsutxo_spent(uint256 &spenttxid,uint256 txid,int32_t vout);
+/****
+ * @brief get the mempool transactions calling a contract function
+ * @param[out] txs the transactions
+ * @param[in] evalcode the contract
+ * @param[in] funcid the function
+ * @returns number of transactions added
+ */
 int32_t myGet_mempool_txs(std::vector<CTransaction> &txs,uint8_t evalcode,uint8_t funcid);
+/****
+ * @brief the contract functions a transaction calls, from the opreturn in its last vout
+ * Token oprets report the token function and the function of each wrapped contract data blob.
+ * @param[in] tx the transaction
+ * @param[out] funcs (evalcode, funcid) pairs
+ * @returns true if the last vout holds contract data
+ */
+bool GetCCOpretFuncs(const CTransaction &tx, std::vector<std::pair<uint8_t, uint8_t> > &funcs);
+/****
+ * @brief the contract functions a transaction calls with the creation txid each call refers to
+ * The reference is the tokenid for token oprets. Oracles, channels, heir, rewards and dice calls
+ * refer to the creation txid stored in their contract data, creation transactions of those and of
+ * lotto and gateways refer to themselves. Other contract data gets a null reference.
+ * @param[in] tx the transaction
+ * @param[out] refs (evalcode, funcid, reference txid) tuples
+ * @returns true if the last vout holds contract data
+ */
+bool GetCCOpretRefs(const CTransaction &tx, std::vector<std::tuple<uint8_t, uint8_t, uint256> > &refs);
 /// \endcond
 
 /// \cond INTERNAL
@@ -361,8 +387,18 @@ int64_t AddTokenCCInputs(struct CCcontract_info *cp, CMutableTransaction &mtx, C
 /// @param tx transaction object to check
 /// @param v vout number (starting from 0)
 /// @param reftokenid id of the token. The vout is checked if it has this tokenid
+/// @param ptokenbasetx the tokenbase tx if it is already loaded or not indexed yet, NULL to look it up
 /// @returns true if vout is true token with the reftokenid id
-int64_t IsTokensvout(bool goDeeper, bool checkPubkeys, struct CCcontract_info *cp, Eval* eval, const CTransaction& tx, int32_t v, uint256 reftokenid);
+int64_t IsTokensvout(bool goDeeper, bool checkPubkeys, struct CCcontract_info *cp, Eval* eval, const CTransaction& tx, int32_t v, uint256 reftokenid, const CTransaction *ptokenbasetx = NULL);
+
+/// Finds the token outputs of a transaction the way IsTokensvout() recognizes them, without loading the previous token transactions
+/// @param tx transaction object to check
+/// @param blockTxs the transactions of the block with tx, searched for a tokenbase tx that is not indexed yet
+/// @param[out] tokenid id of the token (the transaction id for the tokenbase tx)
+/// @param[out] outputs vout numbers and amounts of the token outputs
+/// @param[out] supply the amount created if tx is the tokenbase tx, zero otherwise
+/// @returns false if the transaction has no token opreturn or is a tokenbase tx not funded by its originator
+bool GetTokenOutputs(const CTransaction &tx, const std::vector<CTransaction> &blockTxs, uint256 &tokenid, std::vector<std::pair<int32_t, CAmount> > &outputs, CAmount &supply);
 
 /// Decodes transaction object into hex encoding
 /// @param tx transaction object
@@ -446,6 +482,11 @@ int64_t AddCClibtxfee(struct CCcontract_info *cp, CMutableTransaction &mtx, CPub
 /// @param vopretNonfungible non-fungible token data. The first byte is the evalcode of the contract that validates the NFT-data
 void GetNonfungibleData(uint256 tokenid, vscript_t &vopretNonfungible);
 
+/// Returns non-fungible data of token if this is a NFT, from an already loaded token creation tx
+/// @param tokenbasetx the token creation tx
+/// @param vopretNonfungible non-fungible token data. The first byte is the evalcode of the contract that validates the NFT-data
+void GetNonfungibleData(const CTransaction &tokenbasetx, vscript_t &vopretNonfungible);
+
 /// @private
 bool ExtractTokensCCVinPubkeys(const CTransaction &tx, std::vector<CPubKey> &vinPubkeys);
 
@@ -837,13 +878,16 @@ void SetCCunspents(std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValu
 void SetCCtxids(std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,char *coinaddr,bool CCflag = true);
 
 /// overloaded SetCCtxids returns a vector of filtered txids which have outputs on an address
+/// Uses the CC index when it is available, the txids are returned newest first
 /// @param[out] txids returned vector of txids
 /// @param coinaddr address where the unspent outputs are searched
 /// @param ccflag if true the function searches for cc outputs, otherwise for normal outputs
 /// @param evalcode evalcode of cc module for which outputs will be filtered
-/// @param filtertxid txid for which outputs will be filtered
-/// @param func funcid for which outputs will be filtered
-void SetCCtxids(std::vector<uint256> &txids,char *coinaddr,bool ccflag, uint8_t evalcode, uint256 filtertxid, uint8_t func);
+/// @param filtertxid creation txid for which outputs will be filtered, zeroid for any
+/// @param func funcid for which outputs will be filtered, 0 for any
+/// @param skip number of matching txids to leave out
+/// @param limit maximum number of txids to return, 0 for no limit
+void SetCCtxids(std::vector<uint256> &txids,char *coinaddr,bool ccflag, uint8_t evalcode, uint256 filtertxid, uint8_t func, int32_t skip = 0, int32_t limit = 0);
 
 /// In NSPV mode adds normal (not cc) inputs to the transaction object vin array for the specified total amount using available utxos on mypk's TX_PUBKEY address
 /// @param mtx mutable transaction object
@@ -268,12 +268,50 @@ void FilterOutNonCCOprets(const std::vector<std::pair<uint8_t, vscript_t>>  &opr
     }
 }
 
+// checks the tokenbase tx creates no more tokens than its originator funded with normal inputs (imported tokens are checked by eval::ImportCoin())
+static bool IsTokenbaseFunded(const CTransaction &tx, uint256 reftokenid, const std::string &indentStr)
+{
+    if (tx.IsCoinImport())
+        return true;
+
+    vscript_t vorigPubkey;
+    std::string  dummyName, dummyDescription;
+    std::vector<std::pair<uint8_t, vscript_t>>  oprets;
+
+    if (DecodeTokenCreateOpRet(tx.vout.back().scriptPubKey, vorigPubkey, dummyName, dummyDescription, oprets) == 0) {
+        LOGSTREAM((char *)"cctokens", CCLOG_INFO, stream << indentStr << "IsTokensvout() could not decode create opret" << " for txid=" << tx.GetHash().GetHex() << " for tokenid=" << reftokenid.GetHex() << std::endl);
+        return false;
+    }
+
+    CPubKey origPubkey = pubkey2pk(vorigPubkey);
+
+    // TODO: add voutPubkeys for 'c' tx
+
+    // note: this would not work if there are several pubkeys in the tokencreator's wallet (AddNormalinputs does not use pubkey param):
+    // for tokenbase tx check that normal inputs sent from origpubkey > cc outputs
+    int64_t ccOutputs = 0;
+    for (auto vout : tx.vout)
+        if (vout.scriptPubKey.IsPayToCryptoCondition()  //TODO: add voutPubkey validation
+            && !IsTokenMarkerVout(vout))  // should not be marker here
+            ccOutputs += vout.nValue;
+
+    int64_t normalInputs = TotalPubkeyNormalInputs(tx, origPubkey);  // check if normal inputs are really signed by originator pubkey (someone not cheating with originator pubkey)
+    LOGSTREAM("cctokens", CCLOG_DEBUG2, stream << indentStr << "IsTokensvout() normalInputs=" << normalInputs << " ccOutputs=" << ccOutputs << " for tokenbase=" << reftokenid.GetHex() << std::endl);
+
+    if (normalInputs >= ccOutputs) {
+        LOGSTREAM("cctokens", CCLOG_DEBUG2, stream << indentStr << "IsTokensvout() assured normalInputs >= ccOutputs" << " for tokenbase=" << reftokenid.GetHex() << std::endl);
+        return true;
+    }
+    LOGSTREAM("cctokens", CCLOG_INFO, stream << indentStr << "IsTokensvout() skipping vout not fulfilled normalInputs >= ccOutput" << " for tokenbase=" << reftokenid.GetHex() << " normalInputs=" << normalInputs << " ccOutputs=" << ccOutputs << std::endl);
+    return false;
+}
+
 // Checks if the vout is a really Tokens CC vout
 // also checks tokenid in opret or txid if this is 'c' tx
 // goDeeper is true: the func also validates amounts of the passed transaction: 
 // it should be either sum(cc vins) == sum(cc vouts) or the transaction is the 'tokenbase' ('c') tx
 // checkPubkeys is true: validates if the vout is token vout1 or token vout1of2. Should always be true!
-int64_t IsTokensvout(bool goDeeper, bool checkPubkeys /*<--not used, always true*/, struct CCcontract_info *cp, Eval* eval, const CTransaction& tx, int32_t v, uint256 reftokenid)
+int64_t IsTokensvout(bool goDeeper, bool checkPubkeys /*<--not used, always true*/, struct CCcontract_info *cp, Eval* eval, const CTransaction& tx, int32_t v, uint256 reftokenid, const CTransaction *ptokenbasetx)
 {
 
 	// this is just for log messages indentation fur debugging recursive calls:
@@ -336,7 +374,10 @@ int64_t IsTokensvout(bool goDeeper, bool checkPubkeys /*<--not used, always true
             LOGSTREAM((char *)"cctokens", CCLOG_DEBUG2, stream << "IsTokensvout() vopretExtra=" << HexStr(vopretExtra) << std::endl);
 
             // get non-fungible data
-            GetNonfungibleData(reftokenid, vopretNonfungible);
+            if (ptokenbasetx != NULL)
+                GetNonfungibleData(*ptokenbasetx, vopretNonfungible);
+            else
+                GetNonfungibleData(reftokenid, vopretNonfungible);
             FilterOutTokensUnspendablePk(voutPubkeysInOpret, voutPubkeys);  // cannot send tokens to token unspendable cc addr (only marker is allowed there)
 
             // NOTE: evalcode order in vouts is important: 
@@ -434,56 +475,8 @@ int64_t IsTokensvout(bool goDeeper, bool checkPubkeys /*<--not used, always true
 
 			}
 			else	{  // funcid == 'c'
-               
-                if (!tx.IsCoinImport())   {
-
-                    vscript_t vorigPubkey;
-                    std::string  dummyName, dummyDescription;
-                    std::vector<std::pair<uint8_t, vscript_t>>  oprets;
-
-                    if (DecodeTokenCreateOpRet(tx.vout.back().scriptPubKey, vorigPubkey, dummyName, dummyDescription, oprets) == 0) {
-                        LOGSTREAM((char *)"cctokens", CCLOG_INFO, stream << indentStr << "IsTokensvout() could not decode create opret" << " for txid=" << tx.GetHash().GetHex() << " for tokenid=" << reftokenid.GetHex() << std::endl);
-                        return 0;
-                    }
-
-                    CPubKey origPubkey = pubkey2pk(vorigPubkey);
-
-
-                    // TODO: add voutPubkeys for 'c' tx
-
-                    /* this would not work for imported tokens:
-                    // for 'c' recognize the tokens only to token originator pubkey (but not to unspendable <-- closed sec violation)
-                    // maybe this is like gatewayclaim to single-eval token?
-                    if (evalCodeNonfungible == 0)  // do not allow to convert non-fungible to fungible token
-                        testVouts.push_back(std::make_pair(MakeCC1vout(EVAL_TOKENS, tx.vout[v].nValue, origPubkey), std::string("single-eval cc1 orig-pk")));
-                    // maybe this is like FillSell for non-fungible token?
-                    if (evalCode1 != 0)
-                        testVouts.push_back(std::make_pair(MakeTokensCC1vout(evalCode1, tx.vout[v].nValue, origPubkey), std::string("dual-eval-token cc1 orig-pk")));   */
-
-                    // note: this would not work if there are several pubkeys in the tokencreator's wallet (AddNormalinputs does not use pubkey param):
-                    // for tokenbase tx check that normal inputs sent from origpubkey > cc outputs
-                    int64_t ccOutputs = 0;
-                    for (auto vout : tx.vout)
-                        if (vout.scriptPubKey.IsPayToCryptoCondition()  //TODO: add voutPubkey validation
-                            && !IsTokenMarkerVout(vout))  // should not be marker here
-                            ccOutputs += vout.nValue;
-
-                    int64_t normalInputs = TotalPubkeyNormalInputs(tx, origPubkey);  // check if normal inputs are really signed by originator pubkey (someone not cheating with originator pubkey)
-                    LOGSTREAM("cctokens", CCLOG_DEBUG2, stream << indentStr << "IsTokensvout() normalInputs=" << normalInputs << " ccOutputs=" << ccOutputs << " for tokenbase=" << reftokenid.GetHex() << std::endl);
-
-                    if (normalInputs >= ccOutputs) {
-                        LOGSTREAM("cctokens", CCLOG_DEBUG2, stream << indentStr << "IsTokensvout() assured normalInputs >= ccOutputs" << " for tokenbase=" << reftokenid.GetHex() << std::endl);
-                        if (!IsTokenMarkerVout(tx.vout[v]))  // exclude marker
-                            return tx.vout[v].nValue;
-                        else
-                            return 0; // vout is good, but do not take marker into account
-                    } 
-                    else {
-                        LOGSTREAM("cctokens", CCLOG_INFO, stream << indentStr << "IsTokensvout() skipping vout not fulfilled normalInputs >= ccOutput" << " for tokenbase=" << reftokenid.GetHex() << " normalInputs=" << normalInputs << " ccOutputs=" << ccOutputs << std::endl);
-                    }
-                }
-                else   {
-                    // imported tokens are checked in the eval::ImportCoin() validation code
+                // imported tokens are checked in the eval::ImportCoin() validation code
+                if (IsTokenbaseFunded(tx, reftokenid, indentStr))   {
                     if (!IsTokenMarkerVout(tx.vout[v]))  // exclude marker
                         return tx.vout[v].nValue;
                     else
@@ -590,7 +583,12 @@ void GetNonfungibleData(uint256 tokenid, vscript_t &vopretNonfungible)
         LOGSTREAM((char *)"cctokens", CCLOG_INFO, stream << "GetNonfungibleData() cound not load token creation tx=" << tokenid.GetHex() << std::endl);
         return;
     }
+    GetNonfungibleData(tokenbasetx, vopretNonfungible);
+}
 
+// get non-fungible data from an already loaded 'tokenbase' tx
+void GetNonfungibleData(const CTransaction &tokenbasetx, vscript_t &vopretNonfungible)
+{
     vopretNonfungible.clear();
     // check if it is non-fungible tx and get its second evalcode from non-fungible payload
     if (tokenbasetx.vout.size() > 0) {
@@ -605,6 +603,42 @@ void GetNonfungibleData(uint256 tokenid, vscript_t &vopretNonfungible)
 }
 
 
+bool GetTokenOutputs(const CTransaction &tx, const std::vector<CTransaction> &blockTxs, uint256 &tokenid, std::vector<std::pair<int32_t, CAmount> > &outputs, CAmount &supply)
+{
+    uint8_t evalCode, funcId; std::vector<CPubKey> voutPubkeys; std::vector<std::pair<uint8_t, vscript_t>> oprets;
+    struct CCcontract_info *cpTokens, tokensC;
+    const CTransaction *ptokenbasetx = NULL;
+
+    outputs.clear();
+    supply = 0;
+    if (tx.vout.size() < 2 || (funcId = DecodeTokenOpRet(tx.vout.back().scriptPubKey, evalCode, tokenid, voutPubkeys, oprets)) == 0)
+        return false;
+    if (funcId == 'c') {
+        tokenid = tx.GetHash();
+        if (!IsTokenbaseFunded(tx, tokenid, std::string()))
+            return false;
+        supply = tx.vout[1].nValue;   // as CCfullsupply() reports it
+        ptokenbasetx = &tx;
+    }
+    else {
+        // the tokenbase could be in the same block, it is not indexed yet then
+        for (const CTransaction &blocktx : blockTxs)
+            if (blocktx.GetHash() == tokenid) {
+                ptokenbasetx = &blocktx;
+                break;
+            }
+    }
+    cpTokens = CCinit(&tokensC, EVAL_TOKENS);
+    for (int32_t v = 0; v < (int32_t)tx.vout.size() - 1; v++)
+    {
+        int64_t nValue;
+        if (tx.vout[v].scriptPubKey.IsPayToCryptoCondition() && !IsTokenMarkerVout(tx.vout[v]) &&
+            (nValue = IsTokensvout(false, true, cpTokens, NULL, tx, v, tokenid, ptokenbasetx)) > 0)
+            outputs.push_back(std::make_pair(v, nValue));
+    }
+    return true;
+}
+
 // overload, adds inputs from token cc addr
 int64_t AddTokenCCInputs(struct CCcontract_info *cp, CMutableTransaction &mtx, CPubKey pk, uint256 tokenid, int64_t total, int32_t maxinputs) {
     vscript_t vopretNonfungibleDummy;
@@ -625,6 +659,37 @@ int64_t AddTokenCCInputs(struct CCcontract_info *cp, CMutableTransaction &mtx, C
         cp->additionalTokensEvalcode2 = vopretNonfungible.begin()[0];
 
 	GetTokensCCaddress(cp, tokenaddr, pk);
+
+    // the token index holds only the validated token utxos of this tokenid, no need to load and check their txs
+    uint160 hashBytes; int type;
+    std::vector<std::pair<CTokenUnspentKey, CAmount> > tokenOutputs;
+    if (CBitcoinAddress(tokenaddr).GetIndexKey(hashBytes, type, true) && GetTokenAddressUnspent(tokenid, hashBytes, type, tokenOutputs))
+    {
+        threshold = total / (maxinputs != 0 ? maxinputs : CC_MAXVINS);
+        for (std::vector<std::pair<CTokenUnspentKey, CAmount> >::const_iterator it = tokenOutputs.begin(); it != tokenOutputs.end(); it++)
+        {
+            uint256 vintxid = it->first.txhash;
+            int32_t vout = (int32_t)it->first.index;
+
+            if (it->second < threshold)
+                continue;
+            size_t ivin;
+            for (ivin = 0; ivin < mtx.vin.size(); ivin ++)
+                if (vintxid == mtx.vin[ivin].prevout.hash && it->first.index == mtx.vin[ivin].prevout.n)
+                    break;
+            if (ivin != mtx.vin.size() || myIsutxo_spentinmempool(ignoretxid,ignorevin,vintxid, vout) != 0)
+                continue;
+
+            if (total != 0 && maxinputs != 0)  // if it is not just to calc amount...
+                mtx.vin.push_back(CTxIn(vintxid, vout, CScript()));
+            totalinputs += it->second;
+            n++;
+            if ((total > 0 && totalinputs >= total) || (maxinputs > 0 && n >= maxinputs))
+                break;
+        }
+        return(totalinputs);
+    }
+
 	SetCCunspents(unspentOutputs, tokenaddr,true);
 
 
@@ -978,6 +1043,9 @@ UniValue TokenInfo(uint256 tokenid)
             supply += output;
 	result.push_back(Pair("supply", supply));
 	result.push_back(Pair("description", description));
+    CTokenStats stats;
+    if (GetTokenStats(tokenid, stats))
+        result.push_back(Pair("holders", stats.holders));
 
     GetOpretBlob(oprets, OPRETID_NONFUNGIBLEDATA, vopretNonfungible);
     if( !vopretNonfungible.empty() )    
@@ -1040,6 +1108,12 @@ UniValue TokenList()
         }
     };
 
+    if (GetTokenList(txids)) {
+        for (std::vector<uint256>::const_iterator it = txids.begin(); it != txids.end(); it++)
+            result.push_back(it->GetHex());
+        return(result);
+    }
+
 	SetCCtxids(txids, cp->normaladdr,false,cp->evalcode,zeroid,'c');                      // find by old normal addr marker
    	for (std::vector<uint256>::const_iterator it = txids.begin(); it != txids.end(); it++) 	{
         addTokenId(*it);
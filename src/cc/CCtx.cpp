@@ -443,9 +443,9 @@ void SetCCtxids(std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex
     }
 }
 
-void SetCCtxids(std::vector<uint256> &txids,char *coinaddr,bool ccflag, uint8_t evalcode, uint256 filtertxid, uint8_t func)
+void SetCCtxids(std::vector<uint256> &txids,char *coinaddr,bool ccflag, uint8_t evalcode, uint256 filtertxid, uint8_t func, int32_t skip, int32_t limit)
 {
-    int32_t type=0,i,n; char *ptr; std::string addrstr; uint160 hashBytes; std::vector<std::pair<uint160, int> > addresses;
+    int32_t type=0,i,n; char *ptr; std::string addrstr; uint160 hashBytes;
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
     if ( SQUISHY_NSPV_SUPERLITE )
     {
@@ -460,16 +460,22 @@ void SetCCtxids(std::vector<uint256> &txids,char *coinaddr,bool ccflag, uint8_t
     CBitcoinAddress address(addrstr);
     if ( address.GetIndexKey(hashBytes, type, ccflag) == 0 )
         return;
-    addresses.push_back(std::make_pair(hashBytes,type));
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++)
+    if ( GetCCIndex(evalcode, func, filtertxid, hashBytes, type, txids, skip, limit) )
+        return;
+    // no CC index: every tx sent to the address, callers decode the opreturn to filter
+    if ( GetAddressIndex(hashBytes, type, addressIndex) == 0 )
+        return;
+    std::vector<uint256> tmp_txids;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_reverse_iterator it=addressIndex.rbegin(); it!=addressIndex.rend(); it++)
     {
-        if ( GetAddressIndex((*it).first, (*it).second, addressIndex) == 0 )
-            return;
-        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it1=addressIndex.begin(); it1!=addressIndex.end(); it1++)
-        {
-            if (it1->second>=0) txids.push_back(it1->first.txhash);
-        }
-    } 
+        if ( it->second >= 0 && (tmp_txids.empty() || tmp_txids.back() != it->first.txhash) )
+            tmp_txids.push_back(it->first.txhash);
+    }
+    n = (int32_t)tmp_txids.size();
+    if ( limit > 0 && skip + limit < n )
+        n = skip + limit;
+    for (i=(skip > 0 ? skip : 0); i<n; i++)
+        txids.push_back(tmp_txids[i]);
 }
 
 int64_t CCutxovalue(char *coinaddr,uint256 utxotxid,int32_t utxovout,int32_t CCflag)
@@ -534,6 +540,16 @@ int32_t CCgetspenttxid(uint256 &spenttxid,int32_t &vini,int32_t &height,uint256
 int64_t CCaddress_balance(char *coinaddr,int32_t CCflag)
 {
     int64_t sum = 0; std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    if ( SQUISHY_NSPV_SUPERLITE == 0 )
+    {
+        int32_t type = 0; uint160 hashBytes; CAddressBalanceValue balance;
+        CBitcoinAddress address(coinaddr);
+        if ( address.GetIndexKey(hashBytes, type, CCflag != 0) == 0 )
+            return(0);
+        if ( GetAddressBalance(hashBytes, type, balance) == 0 )
+            return(0);
+        return(balance.balance);
+    }
     SetCCunspents(unspentOutputs,coinaddr,CCflag!=0?true:false);
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
     {
@@ -544,7 +560,9 @@ int64_t CCaddress_balance(char *coinaddr,int32_t CCflag)
 
 int64_t CCfullsupply(uint256 tokenid)
 {
-    uint256 hashBlock; int32_t numvouts; CTransaction tx; std::vector<uint8_t> origpubkey; std::string name,description;
+    uint256 hashBlock; int32_t numvouts; CTransaction tx; std::vector<uint8_t> origpubkey; std::string name,description; CTokenStats stats;
+    if ( GetTokenStats(tokenid,stats) )
+        return(stats.supply);
     if ( myGetTransaction(tokenid,tx,hashBlock) != 0 && (numvouts= tx.vout.size()) > 0 )
     {
         if (DecodeTokenCreateOpRet(tx.vout[numvouts-1].scriptPubKey,origpubkey,name,description))
@@ -560,8 +578,10 @@ int64_t CCtoken_balance(char *coinaddr,uint256 reftokenid)
     int64_t price,sum = 0; int32_t numvouts; CTransaction tx; uint256 tokenid,txid,hashBlock; 
 	std::vector<uint8_t>  vopretExtra;
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
-	uint8_t evalCode;
+	uint8_t evalCode; uint160 hashBytes; int type;
 
+    if ( CBitcoinAddress(coinaddr).GetIndexKey(hashBytes,type,true) && GetTokenAddressBalance(reftokenid,hashBytes,type,sum) )
+        return(sum);
     SetCCunspents(unspentOutputs,coinaddr,true);
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
     {
@@ -627,14 +627,104 @@ int32_t myGet_mempool_txs(std::vector<CTransaction> &txs,uint8_t evalcode,uint8_
         }
         return (NSPV_mempoolresult.numtxids);
     }
-    BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
+    std::vector<uint256> txids;
+    LOCK(mempool.cs);
+    mempool.getCCFuncTxids(evalcode,funcid,txids);
+    for (const uint256 &txid : txids)
     {
-        txs.push_back(e.GetTx());
-        i++;
+        CTransaction tx;
+        if ( mempool.lookup(txid,tx) )
+        {
+            txs.push_back(tx);
+            i++;
+        }
     }
     return(i);
 }
 
+/****
+ * @brief the creation txid contract data refers to, for contracts with a known opreturn layout
+ * @param vopret the contract data
+ * @param self the txid of the transaction, used for creation funcids
+ * @returns the reference txid, null if the layout of the contract data is not known
+ */
+static uint256 GetOpretRefTxid(const std::vector<uint8_t> &vopret, const uint256 &self)
+{
+    uint256 reftxid; int32_t offset;
+    switch ( vopret[0] )
+    {
+        case EVAL_ORACLES:
+            if ( vopret[1] == 'C' )
+                return(self);
+            offset = 2; // oracletxid
+            break;
+        case EVAL_CHANNELS:
+            if ( vopret[1] == 'O' )
+                return(self);
+            offset = 2; // opentxid
+            break;
+        case EVAL_HEIR:
+            if ( vopret[1] == 'F' )
+                return(self);
+            offset = 2; // fundingtxid
+            break;
+        case EVAL_REWARDS:
+        case EVAL_DICE:
+            if ( vopret[1] == 'F' )
+                return(self);
+            offset = 2 + sizeof(uint64_t); // sbits then fundingtxid
+            break;
+        case EVAL_LOTTO:
+            return(vopret[1] == 'F' ? self : reftxid);
+        case EVAL_GATEWAYS:
+        case EVAL_IMPORTGATEWAY:
+            return(vopret[1] == 'B' ? self : reftxid);
+        default:
+            return(reftxid);
+    }
+    if ( vopret.size() >= offset + sizeof(reftxid) )
+        memcpy(reftxid.begin(), &vopret[offset], sizeof(reftxid));
+    return(reftxid);
+}
+
+bool GetCCOpretRefs(const CTransaction &tx, std::vector<std::tuple<uint8_t, uint8_t, uint256> > &refs)
+{
+    std::vector<uint8_t> vopret;
+    refs.clear();
+    if ( tx.vout.size() == 0 || !GetOpReturnData(tx.vout.back().scriptPubKey,vopret) || vopret.size() < 2 )
+        return false;
+    const uint256 &txid = tx.GetHash();
+    if ( vopret[0] == EVAL_TOKENS && vopret.size() > 2 )
+    {
+        uint8_t evalCodeTokens; uint256 tokenid; std::vector<CPubKey> voutPubkeys; std::vector<std::pair<uint8_t, vscript_t>> oprets;
+        if ( DecodeTokenOpRet(tx.vout.back().scriptPubKey,evalCodeTokens,tokenid,voutPubkeys,oprets) != 0 )
+        {
+            // the token creation tx is the tokenid
+            refs.push_back(std::make_tuple(vopret[0],vopret[1],tokenid.IsNull() ? txid : tokenid));
+            for (const auto &opret : oprets)
+            {
+                // channels, gateways, heir... keep their own opreturn inside the token one
+                if ( opret.first < OPRETID_FIRSTNONCCDATA && opret.second.size() >= 2 )
+                    refs.push_back(std::make_tuple(opret.second[0],opret.second[1],GetOpretRefTxid(opret.second,txid)));
+            }
+            return true;
+        }
+    }
+    refs.push_back(std::make_tuple(vopret[0],vopret[1],GetOpretRefTxid(vopret,txid)));
+    return true;
+}
+
+bool GetCCOpretFuncs(const CTransaction &tx, std::vector<std::pair<uint8_t, uint8_t> > &funcs)
+{
+    std::vector<std::tuple<uint8_t, uint8_t, uint256> > refs;
+    funcs.clear();
+    if ( !GetCCOpretRefs(tx,refs) )
+        return false;
+    for (const auto &ref : refs)
+        funcs.push_back(std::make_pair(std::get<0>(ref),std::get<1>(ref)));
+    return true;
+}
+
 int32_t CCCointxidExists(char const *logcategory,uint256 cointxid)
 {
     char txidaddr[64]; std::string coin; int32_t numvouts; uint256 hashBlock;
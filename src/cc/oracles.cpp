@@ -1098,10 +1098,11 @@ UniValue OracleDataSamples(uint256 reforacletxid,char* batonaddr,int32_t num)
                     }
                 }
             }
+            // newest first
             SetCCtxids(txids,batonaddr,true,EVAL_ORACLES,reforacletxid,'D');
             if (txids.size()>0)
             {
-                for (std::vector<uint256>::const_iterator it=txids.end()-1; it!=txids.begin(); it--)
+                for (std::vector<uint256>::const_iterator it=txids.begin(); it!=txids.end(); it++)
                 {
                     txid=*it;
                     if (myGetTransaction(txid,tx,hashBlock) != 0 && (numvouts=tx.vout.size()) > 0 )
@@ -27,6 +27,7 @@
 using namespace std;
 
 #include "main.h"
+#include "memusage.h"
 #include "txdb.h"
 
 /**
@@ -100,6 +101,11 @@ void CBlockIndex::TrimSolution()
     }
 }
 
+size_t CBlockIndex::SolutionDynamicUsage() const
+{
+    return memusage::DynamicUsage(nSolution);
+}
+
 CBlockHeader CBlockIndex::GetBlockHeader() const
 {
     AssertLockHeld(cs_main);
@@ -128,7 +128,12 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_ACTIVATES_UPGRADE  =   128, //! block activates a network upgrade
-    BLOCK_IN_TMPFILE         =   256 
+    BLOCK_IN_TMPFILE         =   256,
+    BLOCK_HAVE_SUPPLY        =   512, //! nChainSupply, nChainZFunds and nChainSproutFunds are set
+    BLOCK_HAVE_SEGID         =  1024, //! segid is set, persisted for every block
+    //! in memory only, the data they flag is persisted in a CDiskBlockExtra record
+    //! because older clients keep unknown status bits when they rewrite an index entry
+    BLOCK_HAVE_EXTRA_MASK    =   BLOCK_HAVE_SUPPLY | BLOCK_HAVE_SEGID,
 };
 
 //! Short-hand for the highest consensus validity we implement.
@@ -209,6 +214,13 @@ public:
     //! Will be boost::none if nChainTx is zero.
     boost::optional<CAmount> nChainSaplingValue;
 
+    //! Coin supply, shielded funds and sprout funds created by the blocks from height 1
+    //! up to and including this block, as reported by coinsupply.
+    //! Only meaningful if nStatus has BLOCK_HAVE_SUPPLY.
+    CAmount nChainSupply;
+    CAmount nChainZFunds;
+    CAmount nChainSproutFunds;
+
     //! block header
     int nVersion;
     uint256 hashMerkleRoot;
@@ -250,6 +262,7 @@ public:
         nChainSproutValue = boost::none;
         nSaplingValue = 0;
         nChainSaplingValue = boost::none;
+        nChainSupply = nChainZFunds = nChainSproutFunds = 0;
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
@@ -302,6 +315,9 @@ public:
     //! Clear the Equihash solution to save memory. Requires cs_main.
     void TrimSolution();
 
+    //! Heap memory held by the Equihash solution, 0 once trimmed.
+    size_t SolutionDynamicUsage() const;
+
     uint256 GetBlockHash() const
     {
         assert(phashBlock);
@@ -394,6 +410,7 @@ public:
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex, std::function<std::vector<unsigned char>()> getSolution) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        nStatus &= ~BLOCK_HAVE_EXTRA_MASK;
         if (!HasSolution()) {
             nSolution = getSolution();
         }
@@ -511,6 +528,50 @@ private:
     }
 };
 
+/** Block index data added after the CDiskBlockIndex format, stored under its own key. */
+class CDiskBlockExtra
+{
+public:
+    uint32_t nFlags; //! the BLOCK_HAVE_EXTRA_MASK bits of the block's nStatus
+    CAmount nChainSupply;
+    CAmount nChainZFunds;
+    CAmount nChainSproutFunds;
+    int8_t segid;
+
+    CDiskBlockExtra() : nFlags(0), nChainSupply(0), nChainZFunds(0), nChainSproutFunds(0), segid(-2) {}
+
+    explicit CDiskBlockExtra(const CBlockIndex* pindex) :
+        nFlags(pindex->nStatus & BLOCK_HAVE_EXTRA_MASK), nChainSupply(pindex->nChainSupply),
+        nChainZFunds(pindex->nChainZFunds), nChainSproutFunds(pindex->nChainSproutFunds), segid(pindex->segid) {}
+
+    //! Copy the data to a block index loaded from its CDiskBlockIndex
+    void ApplyTo(CBlockIndex* pindex) const
+    {
+        pindex->nStatus = (pindex->nStatus & ~BLOCK_HAVE_EXTRA_MASK) | (nFlags & BLOCK_HAVE_EXTRA_MASK);
+        if (nFlags & BLOCK_HAVE_SUPPLY) {
+            pindex->nChainSupply = nChainSupply;
+            pindex->nChainZFunds = nChainZFunds;
+            pindex->nChainSproutFunds = nChainSproutFunds;
+        }
+        if (nFlags & BLOCK_HAVE_SEGID)
+            pindex->segid = segid;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(VARINT(nFlags));
+        if (nFlags & BLOCK_HAVE_SUPPLY) {
+            READWRITE(nChainSupply);
+            READWRITE(nChainZFunds);
+            READWRITE(nChainSproutFunds);
+        }
+        if (nFlags & BLOCK_HAVE_SEGID)
+            READWRITE(segid);
+    }
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 protected:
@@ -47,6 +47,19 @@
 
 int NOTARISATION_SCAN_LIMIT_BLOCKS = 1440;
 
+/** Upper bound of memoized proof roots, the cache is simply reset when it is reached */
+static const size_t MAX_PROOFROOT_CACHE_ENTRIES = 1024;
+
+struct CProofRoot
+{
+    uint256 MoMoM;
+    std::vector<uint256> moms;
+    uint256 destNotarisationTxid;
+};
+/** CalculateProofRoot results by (symbol, targetCCid, kmdHeight) */
+static std::map<std::tuple<std::string,uint32_t,int>, CProofRoot> proofRootCache;
+static CCriticalSection cs_proofRootCache;
+
 /****
  * Determine the type of crosschain
  * @param symbol the asset chain to check
@@ -139,14 +152,28 @@ uint256 CrossChain::CalculateProofRoot(const char* symbol, uint32_t targetCCid,
     if (kmdHeight < 0 || kmdHeight > chainActive.Height())
         return uint256();
 
+    {
+        LOCK(cs_proofRootCache);
+        auto it = proofRootCache.find(std::make_tuple(std::string(symbol), targetCCid, kmdHeight));
+        if (it != proofRootCache.end())
+        {
+            moms = it->second.moms;
+            destNotarisationTxid = it->second.destNotarisationTxid;
+            return it->second.MoMoM;
+        }
+    }
+
     int seenOwnNotarisations = 0;
     CrosschainType authority = GetSymbolAuthority(symbol);
     std::set<uint256> tmp_moms;
+    uint256 MoMoM;
 
-    for (int i=0; i<NOTARISATION_SCAN_LIMIT_BLOCKS; i++) {
-        if (i > kmdHeight) break;
+    // only visit the blocks that have notarisations, highest first
+    int minHeight = std::max(kmdHeight - NOTARISATION_SCAN_LIMIT_BLOCKS + 1, 0);
+    uint256 blockHash;
+    for (int h = GetPrevNotarisedHeight(kmdHeight, minHeight, blockHash); h >= 0;
+            h = GetPrevNotarisedHeight(h - 1, minHeight, blockHash)) {
         NotarisationsInBlock notarisations;
-        uint256 blockHash = *chainActive[kmdHeight-i]->phashBlock;
         if (!GetBlockNotarisations(blockHash, notarisations))
             continue;
 
@@ -177,19 +204,47 @@ uint256 CrossChain::CalculateProofRoot(const char* symbol, uint32_t targetCCid,
     // Not enough own notarisations found to return determinate MoMoM
     destNotarisationTxid = uint256();
     moms.clear();
-    return uint256();
+    goto cache;
 
 end:
     // add set to vector. Set makes sure there are no dupes included. 
     moms.clear();
     std::copy(tmp_moms.begin(), tmp_moms.end(), std::back_inserter(moms));
-    return GetMerkleRoot(moms);
+    MoMoM = GetMerkleRoot(moms);
+
+cache:
+    {
+        LOCK(cs_proofRootCache);
+        if (proofRootCache.size() >= MAX_PROOFROOT_CACHE_ENTRIES)
+            proofRootCache.clear();
+        CProofRoot &entry = proofRootCache[std::make_tuple(std::string(symbol), targetCCid, kmdHeight)];
+        entry.MoMoM = MoMoM;
+        entry.moms = moms;
+        entry.destNotarisationTxid = destNotarisationTxid;
+    }
+    return MoMoM;
+}
+
+/****
+ * @brief forget the proof roots that depend on a disconnected block
+ * @param kmdHeight the height of the block
+ */
+void CrossChain::EraseProofRootCache(int kmdHeight)
+{
+    LOCK(cs_proofRootCache);
+    for (auto it = proofRootCache.begin(); it != proofRootCache.end(); )
+    {
+        if (std::get<2>(it->first) >= kmdHeight)
+            it = proofRootCache.erase(it);
+        else
+            ++it;
+    }
 }
 
 
 /*****
  * @brief Get a notarisation from a given height
- * @note Will scan notarisations leveldb up to a limit
+ * @note Will only visit the notarised blocks of the notarisations leveldb, up to a limit
  * @param[in] nHeight the height
  * @param[in] f
  * @param[out] found
@@ -201,10 +256,12 @@ int ScanNotarisationsFromHeight(int nHeight, const IsTarget f, Notarisation &fou
     int limit = std::min(nHeight + NOTARISATION_SCAN_LIMIT_BLOCKS, chainActive.Height());
     int start = std::max(nHeight, 1);
 
-    for (int h=start; h<limit; h++) {
+    uint256 blockHash;
+    for (int h = GetNextNotarisedHeight(start, limit-1, blockHash); h >= 0;
+            h = GetNextNotarisedHeight(h+1, limit-1, blockHash)) {
         NotarisationsInBlock notarisations;
 
-        if (!GetBlockNotarisations(*chainActive[h]->phashBlock, notarisations))
+        if (!GetBlockNotarisations(blockHash, notarisations))
             continue;
 
         for(auto entry : notarisations) {
@@ -217,6 +274,24 @@ int ScanNotarisationsFromHeight(int nHeight, const IsTarget f, Notarisation &fou
     return 0;
 }
 
+/*****
+ * @brief Get the first notarisation of a symbol from a given height
+ * @note a single seek in the (symbol, height) index
+ * @param[in] nHeight the height
+ * @param[in] symbol the symbol to look for
+ * @param[out] found
+ * @returns the height of the notarisation
+ */
+int ScanNotarisationsFromHeight(int nHeight, const char *symbol, Notarisation &found)
+{
+    int limit = std::min(nHeight + NOTARISATION_SCAN_LIMIT_BLOCKS, chainActive.Height());
+    int start = std::max(nHeight, 1);
+
+    if (start >= limit)
+        return 0;
+    return ScanNotarisationsDBForward(start, symbol, limit - start, found);
+}
+
 /******
  * @brief
  * @note this happens on the KMD chain
@@ -257,10 +332,7 @@ TxProof CrossChain::GetCrossChainProof(const uint256 txid, const char* targetSym
     // at all. So, the thing we need to do is scan forwards to find the notarisation for B,
     // that is inclusive of A.
     Notarisation nota;
-    auto isTarget = [&](Notarisation &nota) {
-        return strcmp(nota.second.symbol, targetSymbol) == 0;
-    };
-    kmdHeight = ScanNotarisationsFromHeight(kmdHeight, isTarget, nota);
+    kmdHeight = ScanNotarisationsFromHeight(kmdHeight, targetSymbol, nota);
     if (!kmdHeight)
         throw std::runtime_error("Cannot find notarisation for target inclusive of source");
         
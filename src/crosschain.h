@@ -17,6 +17,7 @@
  * transfer or migrate assets from one chain to another
  */
 #include "cc/eval.h"
+#include "notarisationdb.h"
 
 enum CrosschainType {
     CROSSCHAIN_SQUISHY = 1,
@@ -69,6 +70,12 @@ public:
     static uint256 CalculateProofRoot(const char* symbol, uint32_t targetCCid, int kmdHeight,
             std::vector<uint256> &moms, uint256 &destNotarisationTxid);
 
+    /****
+     * @brief forget the proof roots that depend on a disconnected block
+     * @param kmdHeight the height of the block
+     */
+    static void EraseProofRootCache(int kmdHeight);
+
     /*****
      * @brief Takes an importTx that has proof leading to assetchain root and extends proof to cross chain root
      * @param importTx
@@ -107,4 +114,14 @@ private:
      */
     static TxProof GetCrossChainProof(const uint256 txid, const char* targetSymbol, uint32_t targetCCid,
             const TxProof assetChainProof,int32_t offset);
-};
\ No newline at end of file
+};
+
+/*****
+ * @brief Get the first notarisation of a symbol from a given height
+ * @note the predicate overload is a template private to crosschain.cpp
+ * @param[in] nHeight the height
+ * @param[in] symbol the symbol to look for
+ * @param[out] found
+ * @returns the height of the notarisation
+ */
+int ScanNotarisationsFromHeight(int nHeight, const char *symbol, Notarisation &found);
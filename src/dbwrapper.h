@@ -52,6 +52,11 @@ public:
      */
     CDBBatch(const CDBWrapper &_parent) : parent(_parent) { };
 
+    void Clear()
+    {
+        batch.Clear();
+    }
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
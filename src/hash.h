@@ -267,4 +267,10 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
 
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
 
+/** Optimized SipHash-2-4 implementation for uint256.
+ *
+ *  It is identical to the SipHash-2-4 of the 32 bytes of val, keyed by (k0, k1).
+ */
+uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
+
 #endif // BITCOIN_HASH_H
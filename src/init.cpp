@@ -34,6 +34,7 @@
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
+#include "kvdb.h"
 #include "notarisationdb.h"
 #include "squishy.h"
 #include "squishy_globals.h"
@@ -48,11 +49,13 @@
 #include "metrics.h"
 #include "miner.h"
 #include "net.h"
+#include "policy/policy.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "script/standard.h"
 #include "scheduler.h"
 #include "txdb.h"
+#include "txcache.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -285,6 +288,8 @@ void Shutdown()
         pblocktree = nullptr;
         delete pnotarisations;
         pnotarisations = nullptr;
+        delete pkvdb;
+        pkvdb = nullptr;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -405,7 +410,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("[DEPRECATED FROM OVERWINTER] Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
+    strUsage += HelpMessageOpt("-mmapblockfiles", strprintf(_("Memory map block files to read transactions located through the tx index and blocks sent to peers (default: %u)"), DEFAULT_MMAP_BLOCKFILES));
+    strUsage += HelpMessageOpt("-rawblockcache=<n>", strprintf(_("Keep the last <n> blocks sent to peers in memory, 0 to disable (default: %u)"), DEFAULT_RAW_BLOCK_CACHE_SIZE));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef _WIN32
@@ -419,6 +427,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-txlookupcache=<n>", strprintf(_("Keep at most <n> confirmed transactions in memory for tx index lookups, 0 to disable (default: %u)"), DEFAULT_TXLOOKUP_CACHE_SIZE));
     strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain a full address index, used to query for the balance, txids and unspent outputs for addresses (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain a timestamp index for block hashes, used to query blocks hashes by a range of timestamps (default: %u)"), DEFAULT_TIMESTAMPINDEX));
     strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain a full spent index, used to query the spending txid and input index for an outpoint (default: %u)"), DEFAULT_SPENTINDEX));
@@ -428,6 +437,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), 100));
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), 86400));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
+    strUsage += HelpMessageOpt("-cmpctblocks", strprintf(_("Relay new blocks as compact blocks, rebuilt from the mempool (default: %u)"), DEFAULT_CMPCTBLOCKS));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s)"));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)"));
@@ -446,6 +456,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-enforcenodebloom", strprintf("Enforce minimum protocol version to limit use of Bloom filters (default: %u)", 0));
     strUsage += HelpMessageOpt("-nspv_msg", strprintf(_("Enable NSPV messages processing (default: %u)"), DEFAULT_NSPV_PROCESSING));
+    strUsage += HelpMessageOpt("-nspvthreads=<n>", strprintf(_("Number of threads answering NSPV requests (default: %u)"), DEFAULT_NSPV_THREADS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), 7770, 17770));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), 1));
@@ -523,9 +534,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), 1));
     if (showDebug)
     {
+        strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
+        strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", 0));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> entries (default: %u)", 50000));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit sum of signature cache and script execution cache sizes to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying (default: %s)"),
@@ -1211,6 +1226,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif // ENABLE_WALLET
 
     fIsBareMultisigStd = GetBoolArg("-permitbaremultisig", true);
+    fCompactBlocks = GetBoolArg("-cmpctblocks", DEFAULT_CMPCTBLOCKS);
     nMaxDatacarrierBytes = GetArg("-datacarriersize", nMaxDatacarrierBytes);
 
     fAlerts = GetBoolArg("-alerts", DEFAULT_ALERTS);
@@ -1346,10 +1362,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    InitSignatureCache();
+    InitScriptExecutionCache();
+
+    LogPrintf("Using %u threads for script and Sapling proof verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadSaplingCheck);
     }
 
     // Start the lightweight task scheduler thread
@@ -1557,6 +1578,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 #endif
 
+    // CreateNewBlock reuses what it worked out about mempool transactions until they confirm
+    RegisterValidationInterface(&templateTxCache);
+
     if ( SQUISHY_NSPV_SUPERLITE )
     {
         std::vector<boost::filesystem::path> vImportFiles;
@@ -1607,6 +1631,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
+    txLookupCache.SetMaxEntries(std::max((int64_t)0, GetArg("-txlookupcache", DEFAULT_TXLOOKUP_CACHE_SIZE)));
+    blockFileMapper.SetEnabled(GetBoolArg("-mmapblockfiles", DEFAULT_MMAP_BLOCKFILES));
+    LogPrintf("* Caching up to %d transactions for tx index lookups%s\n", GetArg("-txlookupcache", DEFAULT_TXLOOKUP_CACHE_SIZE),
+        blockFileMapper.IsEnabled() ? ", block files are memory mapped" : "");
+    rawBlockCache.SetMaxEntries(std::max((int64_t)0, GetArg("-rawblockcache", DEFAULT_RAW_BLOCK_CACHE_SIZE)));
+
     if ( fReindex == 0 )
     {
         bool checkval,fAddressIndex,fSpentIndex;
@@ -1647,16 +1677,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinscatcher;
                 delete pblocktree;
                 delete pnotarisations;
+                delete pkvdb;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, dbCompression, dbMaxOpenFiles);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
                 pnotarisations = new NotarisationDB(100*1024*1024, false, fReindex);
+                // rebuilt from the state file, which a reindex removes
+                pkvdb = new CKVDB(1 << 21, false, fReindex);
 
 
                 if (fReindex) {
                     boost::filesystem::remove(GetDataDir() / SQUISHY_STATE_FILENAME);
+                    boost::filesystem::remove(GetDataDir() / (std::string(SQUISHY_STATE_FILENAME) + ".snapshot"));
                     boost::filesystem::remove(GetDataDir() / "signedmasks");
                     pblocktree->WriteReindexing(true);
                     //If we're reindexing in prune mode, wipe away unusable block files and all undo data files
@@ -2002,6 +2036,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (fTxIndex)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "backfill", &ThreadBackfillBlockIndex));
+    if (GetBoolArg("-nspv_msg", DEFAULT_NSPV_PROCESSING)) {
+        int nNSPVThreads = std::max((int)GetArg("-nspvthreads", DEFAULT_NSPV_THREADS), 1);
+        for (int i = 0; i < nNSPVThreads; i++)
+            threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "nspv", &ThreadNSPVRequests));
+    }
     {
         CBlockIndex *tip = nullptr;
         {
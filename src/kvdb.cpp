@@ -0,0 +1,104 @@
+#include "kvdb.h"
+#include "util.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+
+
+CKVDB *pkvdb;
+
+static const char DB_KV_HISTORY = 'h';
+static const char DB_KV_BLOCK = 'b';
+static const char DB_KV_EXPIRY = 'x';
+static const char DB_KV_BEST_HEIGHT = 'B';
+
+
+CKVDB::CKVDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "kv", nCacheSize, fMemory, fWipe, false, 64) { }
+
+bool CKVDB::ReadLatest(const uint256 &keyhash, CKVRecord &record) const
+{
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CKVDB*>(this)->NewIterator());
+    pcursor->Seek(std::make_pair(DB_KV_HISTORY, keyhash));
+    if (!pcursor->Valid())
+        return false;
+    std::pair<char, CKVHistoryKey> keyObj;
+    if (!pcursor->GetKey(keyObj) || keyObj.first != DB_KV_HISTORY || keyObj.second.keyhash != keyhash)
+        return false;
+    return pcursor->GetValue(record);
+}
+
+bool CKVDB::HaveUpdate(const CKVHistoryKey &update) const
+{
+    return Exists(std::make_pair(DB_KV_HISTORY, update));
+}
+
+bool CKVDB::WriteUpdate(const CKVHistoryKey &update, const CKVRecord &record, int32_t expiry)
+{
+    // the height in the update is chosen by its sender, keep the index ordered by clamping it
+    expiry = std::max(expiry, 0);
+    CDBBatch batch(*this);
+    batch.Write(std::make_pair(DB_KV_HISTORY, update), record);
+    batch.Write(std::make_pair(DB_KV_BLOCK, CKVHeightKey(update.blockHeight, update)), expiry);
+    batch.Write(std::make_pair(DB_KV_EXPIRY, CKVHeightKey(expiry, update)), '\0');
+    if (update.blockHeight > ReadBestHeight())
+        batch.Write(DB_KV_BEST_HEIGHT, update.blockHeight);
+    return WriteBatch(batch);
+}
+
+bool CKVDB::Rollback(int32_t height)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    CDBBatch batch(*this);
+
+    pcursor->Seek(std::make_pair(DB_KV_BLOCK, CKVHeightKey(std::max(height, 0), CKVHistoryKey())));
+    while (pcursor->Valid()) {
+        std::pair<char, CKVHeightKey> keyObj;
+        if (!pcursor->GetKey(keyObj) || keyObj.first != DB_KV_BLOCK)
+            break;
+        int32_t expiry;
+        if (!pcursor->GetValue(expiry))
+            return error("failed to get KV block index value");
+        const CKVHistoryKey &update = keyObj.second.update;
+        batch.Erase(std::make_pair(DB_KV_HISTORY, update));
+        batch.Erase(std::make_pair(DB_KV_EXPIRY, CKVHeightKey(expiry, update)));
+        batch.Erase(keyObj);
+        pcursor->Next();
+    }
+    if (ReadBestHeight() >= height)
+        batch.Write(DB_KV_BEST_HEIGHT, height - 1);
+    return WriteBatch(batch);
+}
+
+int CKVDB::Purge(int32_t height, int limit)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    CDBBatch batch(*this);
+    int nPurged = 0;
+
+    pcursor->Seek(std::make_pair(DB_KV_EXPIRY, CKVHeightKey(0, CKVHistoryKey())));
+    while (pcursor->Valid() && nPurged < limit) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CKVHeightKey> keyObj;
+        if (!pcursor->GetKey(keyObj) || keyObj.first != DB_KV_EXPIRY || keyObj.second.height >= height)
+            break;
+        const CKVHistoryKey &update = keyObj.second.update;
+        batch.Erase(std::make_pair(DB_KV_HISTORY, update));
+        batch.Erase(std::make_pair(DB_KV_BLOCK, CKVHeightKey(update.blockHeight, update)));
+        batch.Erase(keyObj);
+        nPurged++;
+        pcursor->Next();
+    }
+    if (nPurged > 0 && !WriteBatch(batch))
+        return -1;
+    return nPurged;
+}
+
+int32_t CKVDB::ReadBestHeight() const
+{
+    int32_t height;
+    if (!Read(DB_KV_BEST_HEIGHT, height))
+        return -1;
+    return height;
+}
@@ -0,0 +1,146 @@
+#ifndef KVDB_H
+#define KVDB_H
+
+#include "dbwrapper.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <vector>
+
+/****
+ * The state of a KV key after one update, as stored in the history of the key
+ */
+struct CKVRecord
+{
+    std::vector<uint8_t> key;
+    std::vector<uint8_t> value;
+    uint256 pubkey;
+    int32_t height;    // height given by the update, the expiry counts from it
+    uint32_t flags;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(key);
+        READWRITE(value);
+        READWRITE(pubkey);
+        READWRITE(height);
+        READWRITE(flags);
+    }
+
+    CKVRecord() : height(0), flags(0) {}
+};
+
+/****
+ * Position of an update in the history of its key: the hash of the key,
+ * then the block height in descending order so the newest update comes first
+ */
+struct CKVHistoryKey
+{
+    uint256 keyhash;
+    int32_t blockHeight;
+    uint256 txhash;
+    uint32_t vout;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 72;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        keyhash.Serialize(s);
+        ser_writedata32be(s, ~(uint32_t)blockHeight);
+        txhash.Serialize(s);
+        ser_writedata32be(s, vout);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        keyhash.Unserialize(s);
+        blockHeight = (int32_t)~ser_readdata32be(s);
+        txhash.Unserialize(s);
+        vout = ser_readdata32be(s);
+    }
+
+    CKVHistoryKey(const uint256 &keyhashIn, int32_t height, const uint256 &txid, uint32_t voutIn) :
+        keyhash(keyhashIn), blockHeight(height), txhash(txid), vout(voutIn) {}
+    CKVHistoryKey() : blockHeight(0), vout(0) {}
+};
+
+/****
+ * Entry of the height ordered block and expiry indexes, pointing at an update.
+ * Heights are stored big endian so a seek walks the updates in height order.
+ */
+struct CKVHeightKey
+{
+    int32_t height;
+    CKVHistoryKey update;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 4 + update.GetSerializeSize(nType, nVersion);
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, (uint32_t)height);
+        update.Serialize(s);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        height = (int32_t)ser_readdata32be(s);
+        update.Unserialize(s);
+    }
+
+    CKVHeightKey(int32_t heightIn, const CKVHistoryKey &updateIn) : height(heightIn), update(updateIn) {}
+    CKVHeightKey() : height(0) {}
+};
+
+/****
+ * The KV contract data: every update of every key with the height of the
+ * block that made it, so disconnected blocks can be rolled back, and an
+ * expiry index so expired updates can be purged in batches.
+ */
+class CKVDB : public CDBWrapper
+{
+public:
+    CKVDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    /****
+     * @param keyhash the hash of the key
+     * @param[out] record the newest update of the key
+     * @returns true if the key has an update
+     */
+    bool ReadLatest(const uint256 &keyhash, CKVRecord &record) const;
+    /****
+     * @param update where the update would be stored
+     * @returns true if the update is already stored
+     */
+    bool HaveUpdate(const CKVHistoryKey &update) const;
+    /****
+     * Store an update with its block and expiry index entries
+     * @param update where to store it
+     * @param record the state of the key after the update
+     * @param expiry the last height the update is valid at
+     * @returns true on success
+     */
+    bool WriteUpdate(const CKVHistoryKey &update, const CKVRecord &record, int32_t expiry);
+    /****
+     * Erase the updates of the blocks at and above a height
+     * @param height the first height to roll back
+     * @returns true on success
+     */
+    bool Rollback(int32_t height);
+    /****
+     * Erase updates that expired before a height
+     * @param height updates with an expiry below it are erased
+     * @param limit the maximum number of updates to erase
+     * @returns the number of updates erased, -1 on a database error
+     */
+    int Purge(int32_t height, int limit);
+    /****
+     * @returns the highest block height with a stored update, -1 if none
+     */
+    int32_t ReadBestHeight() const;
+};
+
+extern CKVDB *pkvdb;
+
+#endif  /* KVDB_H */
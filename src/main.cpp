@@ -28,11 +28,15 @@
 #include "alert.h"
 #include "arith_uint256.h"
 #include "importcoin.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "crosschain.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "deprecation.h"
 #include "init.h"
 #include "merkleblock.h"
@@ -43,6 +47,7 @@
 #include "script/interpreter.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "txcache.h"
 #include "ui_interface.h"
 #include "undo.h"
 #include "util.h"
@@ -51,6 +56,7 @@
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "wallet/asyncrpcoperation_shieldcoinbase.h"
 #include "policy/fees.h"
+#include "policy/policy.h"
 #include "notaries_staked.h"
 #include "squishy_extern_globals.h"
 #include "squishy_gateway.h"
@@ -104,7 +110,10 @@ bool fExperimentalMode = true;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fCompactBlocks = DEFAULT_CMPCTBLOCKS;
 bool fAddressIndex = false;
+bool fCCIndex = false;
+bool fTokenIndex = false;
 bool fTimestampIndex = false;
 bool fSpentIndex = false;
 bool fHavePruned = false;
@@ -122,6 +131,8 @@ int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 
 unsigned int expiryDelta = DEFAULT_TX_EXPIRY_DELTA;
 
+CNSPVServerStats nspvServerStats;
+
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
 
@@ -249,9 +260,13 @@ namespace {
         int64_t nTime;  //! Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //! Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //! The timeout for this block request (for disconnecting a slow peer)
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock;  //! Set while waiting for the missing transactions of a cmpctblock.
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+    /** Peers we asked to push new blocks to us as cmpctblock, least recently useful first. Protected by cs_main. */
+    std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
     /** Number of blocks in flight with validated headers. */
     int nQueuedValidatedHeaders = 0;
 
@@ -261,6 +276,13 @@ namespace {
     /** Dirty block index entries. */
     set<CBlockIndex*> setDirtyBlockIndex;
 
+    /** Block index entries written to the block tree db that still hold their Equihash solution. */
+    set<CBlockIndex*> setUntrimmedBlockIndex;
+
+    /** Block index entries holding their Equihash solution, and the heap memory of those solutions. */
+    int64_t nBlockIndexSolutions = 0;
+    size_t nBlockIndexSolutionUsage = 0;
+
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
 } // anon namespace
@@ -389,6 +411,7 @@ namespace {
         mapBlocksInFlight.erase(entry.hash);
         EraseOrphansFor(nodeid);
         nPreferredDownload -= state->fPreferredDownload;
+        lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
         mapNodeState.erase(nodeid);
     }
@@ -397,12 +420,8 @@ namespace {
     {
         /*    int expired = pool.Expire(GetTime() - age);
          if (expired != 0)
-         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
-
-         std::vector<uint256> vNoSpendsRemaining;
-         pool.TrimToSize(limit, &vNoSpendsRemaining);
-         BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
-         pcoinsTip->Uncache(removed);*/
+         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);*/
+        pool.TrimToSize(limit);
     }
 
     // Requires cs_main.
@@ -423,7 +442,8 @@ namespace {
     }
 
     // Requires cs_main.
-    void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+    void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL,
+                             std::shared_ptr<PartiallyDownloadedBlock> partialBlock = nullptr) {
         CNodeState *state = State(nodeid);
         assert(state != NULL);
 
@@ -431,7 +451,7 @@ namespace {
         MarkBlockAsReceived(hash);
 
         int64_t nNow = GetTimeMicros();
-        QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams)};
+        QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams), partialBlock};
         nQueuedValidatedHeaders += newentry.fValidatedHeaders;
         list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
         state->nBlocksInFlight++;
@@ -439,6 +459,31 @@ namespace {
         mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
     }
 
+    // Requires cs_main.
+    // Ask a peer that just gave us a new tip to push its next blocks as cmpctblock,
+    // switching the peer that did so longest ago back to announcing them.
+    void MaybeSetPeerAsAnnouncingHeaderAndIDs(CNode* pfrom) {
+        if (!pfrom->fSupportsCompactBlocks)
+            return;
+        NodeId nodeid = pfrom->GetId();
+        std::list<NodeId>::iterator it = std::find(lNodesAnnouncingHeaderAndIDs.begin(), lNodesAnnouncingHeaderAndIDs.end(), nodeid);
+        if (it != lNodesAnnouncingHeaderAndIDs.end()) {
+            lNodesAnnouncingHeaderAndIDs.erase(it);
+            lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
+            return;
+        }
+        if (lNodesAnnouncingHeaderAndIDs.size() >= MAX_CMPCTBLOCK_HB_PEERS) {
+            NodeId nodeidEvict = lNodesAnnouncingHeaderAndIDs.front();
+            lNodesAnnouncingHeaderAndIDs.pop_front();
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes)
+                if (pnode->GetId() == nodeidEvict)
+                    pnode->PushMessage("sendcmpct", false, CMPCTBLOCKS_VERSION);
+        }
+        pfrom->PushMessage("sendcmpct", true, CMPCTBLOCKS_VERSION);
+        lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
+    }
+
     /** Check whether the last unknown block a peer advertized is not yet known. */
     void ProcessBlockAvailability(NodeId nodeid) {
         CNodeState *state = State(nodeid);
@@ -1167,7 +1212,8 @@ bool ContextualCheckTransaction(int32_t slowflag,const CBlock *block, CBlockInde
         CValidationState &state,
         const int nHeight,
         const int dosLevel,
-        bool (*isInitBlockDownload)(),int32_t validateprices)
+        bool (*isInitBlockDownload)(),int32_t validateprices,
+        std::vector<CSaplingCheck> *pvSaplingChecks)
 {
     bool overwinterActive = NetworkUpgradeActive(nHeight, Params().GetConsensus(), Consensus::UPGRADE_OVERWINTER);
     bool saplingActive = NetworkUpgradeActive(nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING);
@@ -1305,54 +1351,15 @@ bool ContextualCheckTransaction(int32_t slowflag,const CBlock *block, CBlockInde
     if (!tx.vShieldedSpend.empty() ||
         !tx.vShieldedOutput.empty())
     {
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription &spend : tx.vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                ctx,
-                (const unsigned char*)&(*spend.cv.begin()),
-                (const unsigned char*)&(*spend.anchor.begin()),
-                (const unsigned char*)&(*spend.nullifier.begin()),
-                (const unsigned char*)&(*spend.rk.begin()),
-                (const unsigned char*)&(*spend.zkproof.begin()),
-                (const unsigned char*)&(*spend.spendAuthSig.begin()),
-                (const unsigned char*)&(*dataToBeSigned.begin())
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
-        }
-
-        for (const OutputDescription &output : tx.vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                ctx,
-                (const unsigned char*)&(*output.cv.begin()),
-                (const unsigned char*)&(*output.cm.begin()),
-                (const unsigned char*)&(*output.ephemeralKey.begin()),
-                (const unsigned char*)&(*output.zkproof.begin())
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
-        }
-
-        if (!librustzcash_sapling_final_check(
-            ctx,
-            tx.valueBalance,
-            (const unsigned char*)&(*tx.bindingSig.begin()),
-            (const unsigned char*)&(*dataToBeSigned.begin())
-        ))
-        {
-            librustzcash_sapling_verification_ctx_free(ctx);
-            return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid"),
-                                  REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+        CSaplingCheck check(tx, dataToBeSigned);
+        if (pvSaplingChecks != NULL) {
+            // verified by the Sapling check workers, see ContextualCheckBlock
+            pvSaplingChecks->push_back(CSaplingCheck());
+            check.swap(pvSaplingChecks->back());
+        } else if (!check()) {
+            return state.DoS(100, error("ContextualCheckTransaction(): %s", check.GetError()),
+                                  REJECT_INVALID, check.GetRejectReason());
         }
-
-        librustzcash_sapling_verification_ctx_free(ctx);
     }
     return true;
 }
@@ -1981,6 +1988,17 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId);
         unsigned int nSize = entry.GetTxSize();
         
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+            return state.DoS(0, error("AcceptToMemoryPool: %s %s", hash.ToString(), errString), REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
         if (tx.vjoinsplit.size() > 0 && nFees >= ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE) {
             // In future we will we have more accurate and dynamic computation of fees for tx with joinsplits.
@@ -2047,11 +2065,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             return error("AcceptToMemoryPool: ConnectInputs failed %s", hash.ToString());
         }
         
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
+        // Check again against just the consensus-critical script verification
+        // flags ConnectBlock uses, in case of bugs in the standard flags that cause
         // transactions to pass as valid when they're actually invalid. For
         // instance the STRICTENC flag was incorrectly allowing certain
         // CHECKSIG NOT scripts to pass, even though they were invalid.
+        // This also fills the script execution cache ConnectBlock looks in.
         //
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
@@ -2063,11 +2082,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             SQUISHY_CONNECTING = (1<<30) + (int32_t)chainActive.Tip()->nHeight + 1;
         }
 
-        if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+        if (!ContextualCheckInputs(tx, state, view, true, BLOCK_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
         {
             if ( flag != 0 )
                 SQUISHY_CONNECTING = -1;
-            return error("AcceptToMemoryPool: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
+            return error("AcceptToMemoryPool: BUG! PLEASE REPORT THIS! ConnectInputs failed against block but not STANDARD flags %s", hash.ToString());
         }
         if ( flag != 0 )
             SQUISHY_CONNECTING = -1;
@@ -2088,6 +2107,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                     pool.addSpentIndex(entry, view);
                 }
             }
+
+            // Trim the pool, the new transaction may be what gets evicted
+            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            if (!pool.exists(hash))
+                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
         }
     }
     // This should be here still? 
@@ -2159,6 +2183,113 @@ bool GetAddressUnspent(uint160 addressHash, int type,
     return true;
 }
 
+/****
+ * @brief get the confirmed balance, total received and tx count of an address
+ * @param[in] addressHash the address
+ * @param[in] type the address type
+ * @param[out] balance the totals (all zero if the address was never seen)
+ * @returns false if the address index is not enabled
+ */
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &balance)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    pblocktree->ReadAddressBalance(addressHash, type, balance);
+    return true;
+}
+
+/****
+ * @brief get the confirmed CC transactions of a contract from the CC index, newest first
+ * @param[in] evalcode the contract
+ * @param[in] funcid the function, 0 for any
+ * @param[in] reftxid the creation txid the transactions refer to, null for any
+ * @param[in] addressHash only transactions with outputs on this address
+ * @param[in] type the address type
+ * @param[out] txids the transactions found
+ * @param[in] skip number of matching transactions to leave out
+ * @param[in] limit maximum number of transactions to return, 0 for no limit
+ * @returns false if the CC index is not available
+ */
+bool GetCCIndex(uint8_t evalcode, uint8_t funcid, const uint256 &reftxid, uint160 addressHash, int type,
+                std::vector<uint256> &txids, int skip, int limit)
+{
+    if (!fCCIndex)
+        return false;
+
+    std::vector<CCCIndexKey> keys;
+    if (!pblocktree->ReadCCIndex(evalcode, funcid, reftxid, CAddressIndexIteratorKey(type, addressHash), keys, skip, limit))
+        return error("unable to get txids from the CC index");
+    for (std::vector<CCCIndexKey>::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        txids.push_back(it->txhash);
+    return true;
+}
+
+/****
+ * @brief get the units of a token held by an address
+ * @param[in] tokenid the token
+ * @param[in] addressHash the address
+ * @param[in] type the address type
+ * @param[out] balance the units in its confirmed unspent token outputs
+ * @returns false if the token index is not available
+ */
+bool GetTokenAddressBalance(const uint256 &tokenid, uint160 addressHash, int type, CAmount &balance)
+{
+    if (!fTokenIndex)
+        return false;
+
+    pblocktree->ReadTokenBalance(CTokenAddressKey(tokenid, type, addressHash), balance);
+    return true;
+}
+
+/****
+ * @brief get the confirmed unspent outputs of a token on an address
+ * @param[in] tokenid the token
+ * @param[in] addressHash the address
+ * @param[in] type the address type
+ * @param[out] unspentOutputs the outputs and their amounts
+ * @returns false if the token index is not available
+ */
+bool GetTokenAddressUnspent(const uint256 &tokenid, uint160 addressHash, int type,
+                            std::vector<std::pair<CTokenUnspentKey, CAmount> > &unspentOutputs)
+{
+    if (!fTokenIndex)
+        return false;
+
+    if (!pblocktree->ReadTokenUnspent(CTokenAddressKey(tokenid, type, addressHash), unspentOutputs))
+        return error("unable to get token utxos for address");
+    return true;
+}
+
+/****
+ * @brief get the supply, units in unspent outputs and number of holders of a token
+ * @param[in] tokenid the token
+ * @param[out] stats the totals
+ * @returns false if the token index is not available or the token was not created on chain
+ */
+bool GetTokenStats(const uint256 &tokenid, CTokenStats &stats)
+{
+    if (!fTokenIndex)
+        return false;
+
+    return pblocktree->ReadTokenStats(tokenid, stats) && stats.supply > 0;
+}
+
+/****
+ * @brief get all tokens created on chain
+ * @param[out] tokenids the tokenbase txids
+ * @returns false if the token index is not available
+ */
+bool GetTokenList(std::vector<uint256> &tokenids)
+{
+    if (!fTokenIndex)
+        return false;
+
+    if (!pblocktree->ReadTokenList(tokenids))
+        return error("unable to get the token list");
+    return true;
+}
+
 struct CompareBlocksByHeightMain
 {
     bool operator()(const CBlockIndex* a, const CBlockIndex* b) const
@@ -2237,26 +2368,45 @@ bool myGetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlo
 
     if (fTxIndex) 
     {
+        int64_t nTimeStart = GetTimeMicros();
+        if ( txLookupCache.Lookup(hash, txOut, hashBlock) )
+        {
+            txLookupCache.RecordHit(GetTimeMicros() - nTimeStart);
+            return true;
+        }
         CDiskTxPos postx;
         //LogPrintf("ReadTxIndex\n");
         if (pblocktree->ReadTxIndex(hash, postx)) 
         {
-            //LogPrintf("OpenBlockFile\n");
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
-            CBlockHeader header;
-            //LogPrintf("seek and read\n");
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            CTransactionRef ptx;
+            if ( !blockFileMapper.ReadTransaction(postx, ptx, hashBlock, txLookupCache) )
+            {
+                //LogPrintf("OpenBlockFile\n");
+                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                if (file.IsNull())
+                    return error("%s: OpenBlockFile failed", __func__);
+                CBlockHeader header;
+                uint32_t nHeaderSize;
+                //LogPrintf("seek and read\n");
+                try {
+                    file >> header;
+                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                    ptx = std::make_shared<const CTransaction>(deserialize, file);
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                }
+                // the header was read only to skip it, its hash is usually already known
+                if ( !txLookupCache.LookupHeader(postx, hashBlock, nHeaderSize) )
+                {
+                    hashBlock = header.GetHash();
+                    txLookupCache.InsertHeader(postx, hashBlock, ::GetSerializeSize(header, SER_DISK, CLIENT_VERSION));
+                }
             }
-            hashBlock = header.GetHash();
-            if (txOut.GetHash() != hash)
+            if (ptx->GetHash() != hash)
                 return error("%s: txid mismatch", __func__);
+            txOut = *ptx;
+            txLookupCache.Insert(ptx, hashBlock);
+            txLookupCache.RecordMiss(GetTimeMicros() - nTimeStart);
             //LogPrintf("found on disk %s\n",hash.GetHex().c_str());
             return true;
         }
@@ -2429,6 +2579,63 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex,bool checkPOW)
     return true;
 }
 
+/** Bytes at the start of a serialized block enough to hold its header, with any equihash solution in use */
+static const size_t MAX_SERIALIZED_HEADER_SIZE = 4096;
+
+bool ReadRawBlockFromDisk(std::shared_ptr<const std::vector<uint8_t> > &pblock, const CBlockIndex* pindex, bool fCache)
+{
+    if ( pindex == 0 )
+        return false;
+    const uint256 hash = pindex->GetBlockHash();
+    if ( rawBlockCache.Lookup(hash, pblock) )
+        return true;
+
+    const CDiskBlockPos pos = pindex->GetBlockPos();
+    const CMessageHeader::MessageStartChars& messageStart = Params().MessageStart();
+    std::shared_ptr<std::vector<uint8_t> > pread = std::make_shared<std::vector<uint8_t> >();
+    if ( !blockFileMapper.ReadRawBlock(pos, (const unsigned char *)messageStart, *pread) )
+    {
+        // the block is preceded by the message start and its size, as written by WriteBlockToDisk
+        CDiskBlockPos hpos = pos;
+        if ( hpos.nPos < MESSAGE_START_SIZE + sizeof(uint32_t) )
+            return error("%s: invalid position %s", __func__, pos.ToString());
+        hpos.nPos -= MESSAGE_START_SIZE + sizeof(uint32_t);
+        CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+        try {
+            CMessageHeader::MessageStartChars blockStart;
+            unsigned int nSize;
+            filein >> FLATDATA(blockStart) >> nSize;
+            if (memcmp(blockStart, messageStart, MESSAGE_START_SIZE) != 0)
+                return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+            if (nSize == 0 || nSize > MAX_SIZE)
+                return error("%s: invalid block size %u at %s", __func__, nSize, pos.ToString());
+            pread->resize(nSize);
+            filein.read((char *)pread->data(), nSize);
+        } catch (const std::exception& e) {
+            return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    // Only the header is deserialized, to make sure the position holds the block asked for
+    CBlockHeader header;
+    try {
+        const char *pbegin = (const char *)pread->data();
+        CDataStream ssHeader(pbegin, pbegin + std::min(pread->size(), MAX_SERIALIZED_HEADER_SIZE), SER_NETWORK, PROTOCOL_VERSION);
+        ssHeader >> header;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    if (header.GetHash() != hash)
+        return error("%s: GetHash() doesn't match index for %s at %s", __func__, pindex->ToString(), pos.ToString());
+
+    pblock = pread;
+    if ( fCache )
+        rawBlockCache.Insert(hash, pblock);
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int32_t numhalvings,i; uint64_t numerator; CAmount nSubsidy = 3 * COIN;
@@ -2745,6 +2952,62 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CSaplingCheck::operator()() {
+    const CTransaction &tx = *ptx;
+    auto ctx = librustzcash_sapling_verification_ctx_init();
+
+    for (const SpendDescription &spend : tx.vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
+            ctx,
+            (const unsigned char*)&(*spend.cv.begin()),
+            (const unsigned char*)&(*spend.anchor.begin()),
+            (const unsigned char*)&(*spend.nullifier.begin()),
+            (const unsigned char*)&(*spend.rk.begin()),
+            (const unsigned char*)&(*spend.zkproof.begin()),
+            (const unsigned char*)&(*spend.spendAuthSig.begin()),
+            (const unsigned char*)&(*dataToBeSigned.begin())
+        ))
+        {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            strError = "Sapling spend description invalid";
+            strRejectReason = "bad-txns-sapling-spend-description-invalid";
+            return false;
+        }
+    }
+
+    for (const OutputDescription &output : tx.vShieldedOutput) {
+        if (!librustzcash_sapling_check_output(
+            ctx,
+            (const unsigned char*)&(*output.cv.begin()),
+            (const unsigned char*)&(*output.cm.begin()),
+            (const unsigned char*)&(*output.ephemeralKey.begin()),
+            (const unsigned char*)&(*output.zkproof.begin())
+        ))
+        {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            strError = "Sapling output description invalid";
+            strRejectReason = "bad-txns-sapling-output-description-invalid";
+            return false;
+        }
+    }
+
+    if (!librustzcash_sapling_final_check(
+        ctx,
+        tx.valueBalance,
+        (const unsigned char*)&(*tx.bindingSig.begin()),
+        (const unsigned char*)&(*dataToBeSigned.begin())
+    ))
+    {
+        librustzcash_sapling_verification_ctx_free(ctx);
+        strError = "Sapling binding signature invalid";
+        strRejectReason = "bad-txns-sapling-binding-signature-invalid";
+        return false;
+    }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2847,6 +3110,62 @@ namespace Consensus {
     }
 }// namespace Consensus
 
+/**
+ * Transactions whose scripts all passed, as SHA256(nonce || txid || flags || branch id).
+ * Filled by AcceptToMemoryPool so ConnectBlock can skip their script checks.
+ * Only accessed under cs_main.
+ */
+static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+static uint256 scriptExecutionCacheNonce;
+static bool fScriptExecutionCache = false;
+
+void InitScriptExecutionCache()
+{
+    // a quarter of -maxsigcachesize, the signature caches get the rest
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    GetRandBytes(scriptExecutionCacheNonce.begin(), 32);
+    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize / 4);
+    fScriptExecutionCache = true;
+    LogPrintf("Using %zu MiB out of %zu requested for script execution cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>22, nElems);
+}
+
+/**
+ * Crypto-condition evals depend on chain state, not only on the transaction,
+ * so transactions that may run one are never taken from the script execution cache
+ */
+bool MayRunCryptoConditions(const CTransaction& tx, const CCoinsViewCache &inputs)
+{
+    for (const CTxIn &txin : tx.vin)
+    {
+        const CScript &scriptPubKey = inputs.GetSpendFor(txin);
+        if (scriptPubKey.IsPayToCryptoCondition())
+            return true;
+        if (scriptPubKey.IsPayToScriptHash())
+        {
+            // look for crypto-condition opcodes in the redeem script
+            CScript::const_iterator pc = txin.scriptSig.begin();
+            std::vector<unsigned char> vchRedeem;
+            opcodetype opcode;
+            while (pc < txin.scriptSig.end())
+            {
+                if (!txin.scriptSig.GetOp(pc, opcode, vchRedeem))
+                    return true;
+            }
+            CScript redeemScript(vchRedeem.begin(), vchRedeem.end());
+            pc = redeemScript.begin();
+            while (pc < redeemScript.end())
+            {
+                if (!redeemScript.GetOp(pc, opcode))
+                    return true;
+                if (opcode == OP_CHECKCRYPTOCONDITION || opcode == OP_CHECKCRYPTOCONDITIONVERIFY)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
 bool ContextualCheckInputs(
                            const CTransaction& tx,
                            CValidationState &state,
@@ -2875,6 +3194,20 @@ bool ContextualCheckInputs(
         // Skip ECDSA signature verification when connecting blocks
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
+        uint256 hashCacheEntry;
+        bool fCacheable = false;
+        if (fScriptChecks && fScriptExecutionCache && !MayRunCryptoConditions(tx, inputs)) {
+            AssertLockHeld(cs_main);
+            fCacheable = true;
+            CSHA256().Write(scriptExecutionCacheNonce.begin(), 32).Write(tx.GetHash().begin(), 32)
+                .Write((const unsigned char*)&flags, sizeof(flags))
+                .Write((const unsigned char*)&consensusBranchId, sizeof(consensusBranchId))
+                .Finalize(hashCacheEntry.begin());
+            // all scripts of this transaction already passed with these flags
+            if (scriptExecutionCache.contains(hashCacheEntry, !cacheStore))
+                fScriptChecks = false;
+        }
+
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
@@ -2909,6 +3242,9 @@ bool ContextualCheckInputs(
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+            // queued checks have not run yet, only remember inline results
+            if (fCacheable && cacheStore && !pvChecks)
+                scriptExecutionCache.insert(hashCacheEntry);
         }
     }
 
@@ -3036,6 +3372,9 @@ void ConnectNotarisations(const CBlock &block, int height)
     // Record Notarisations
     NotarisationsInBlock notarisations = ScanBlockNotarisations(block, height);
     if (notarisations.size() > 0) {
+        CDBBatch heightBatch = CDBBatch(pnotarisations->heights);
+        WriteNotarisationHeights(notarisations, block.GetHash(), height, heightBatch);
+        pnotarisations->heights.WriteBatch(heightBatch, true);
         CDBBatch batch = CDBBatch(*pnotarisations);
         batch.Write(block.GetHash(), notarisations);
         WriteBackNotarisations(notarisations, batch);
@@ -3046,11 +3385,14 @@ void ConnectNotarisations(const CBlock &block, int height)
 }
 
 
-void DisconnectNotarisations(const CBlock &block)
+void DisconnectNotarisations(const CBlock &block, int height)
 {
     // Delete from notarisations cache
     NotarisationsInBlock nibs;
     if (GetBlockNotarisations(block.GetHash(), nibs)) {
+        CDBBatch heightBatch = CDBBatch(pnotarisations->heights);
+        EraseNotarisationHeights(nibs, height, heightBatch);
+        pnotarisations->heights.WriteBatch(heightBatch, true);
         CDBBatch batch = CDBBatch(*pnotarisations);
         batch.Erase(block.GetHash());
         EraseBackNotarisations(nibs, batch);
@@ -3058,6 +3400,8 @@ void DisconnectNotarisations(const CBlock &block)
         LogPrintf("DisconnectTip: deleted %i block notarisations in block: %s\n",
             nibs.size(), block.GetHash().GetHex().data());
     }
+    // any block at this height may change the MoMs of proofs rooted at or above it
+    CrossChain::EraseProofRootCache(height);
 }
 
 int8_t GetAddressType(const CScript &scriptPubKey, CTxDestination &vDest, txnouttype &txType, vector<vector<unsigned char>> &vSols)
@@ -3088,6 +3432,98 @@ int8_t GetAddressType(const CScript &scriptPubKey, CTxDestination &vDest, txnout
     return keyType;
 }
 
+/****
+ * Collect the CC index records of a transaction: one per contract opreturn it
+ * carries, each listing the addresses the transaction pays to
+ * @param tx the transaction
+ * @param nHeight the height of its block
+ * @param ccIndex where to add the records
+ */
+static void GetCCIndexRecords(const CTransaction &tx, int nHeight, std::vector<std::pair<CCCIndexKey, CCCIndexValue> > &ccIndex)
+{
+    bool fCC = false;
+    for (const CTxOut &out : tx.vout)
+        fCC |= out.scriptPubKey.IsPayToCryptoCondition();
+    for (const CTxIn &in : tx.vin)
+        fCC |= IsCCInput(in.scriptSig);
+    std::vector<std::tuple<uint8_t, uint8_t, uint256> > refs;
+    if (!fCC || !GetCCOpretRefs(tx, refs))
+        return;
+
+    CCCIndexValue value;
+    for (const CTxOut &out : tx.vout)
+    {
+        vector<vector<unsigned char>> vSols;
+        CTxDestination vDest;
+        txnouttype txType = TX_PUBKEYHASH;
+        int keyType = GetAddressType(out.scriptPubKey, vDest, txType, vSols);
+        if ( keyType == 0 || out.nValue < 0 )
+            continue;
+        for (auto addr : vSols)
+        {
+            uint160 addrHash = addr.size() == 20 ? uint160(addr) : Hash160(addr);
+            if (!value.HasAddress(keyType, addrHash))
+                value.addresses.push_back(CAddressIndexIteratorKey(keyType, addrHash));
+        }
+    }
+    for (const auto &ref : refs)
+        ccIndex.push_back(make_pair(CCCIndexKey(std::get<0>(ref), std::get<1>(ref), std::get<2>(ref), nHeight, tx.GetHash()), value));
+}
+
+/****
+ * Collect the token index records of a transaction. Spent token outputs are
+ * found through the index itself, created ones are only taken as tokens when
+ * the tx is the tokenbase or moves exactly the units it spends.
+ * @param tx the transaction
+ * @param block the block with tx, for tokenbase txs that are not indexed yet
+ * @param blockOutputs token outputs created earlier in the same block
+ * @param tokenIndex where to add spent (negative) and created (positive) outputs
+ * @param tokenSupplies where to add the units created by a tokenbase tx
+ */
+static void GetTokenIndexRecords(const CTransaction &tx, const CBlock &block, std::map<COutPoint, CTokenOutputValue> &blockOutputs,
+        std::vector<std::pair<CTokenUnspentKey, CAmount> > &tokenIndex, std::vector<std::pair<uint256, CAmount> > &tokenSupplies)
+{
+    std::map<uint256, CAmount> inputs;
+    for (const CTxIn &in : tx.vin)
+    {
+        if (!IsCCInput(in.scriptSig))
+            continue;
+        CTokenOutputValue value;
+        std::map<COutPoint, CTokenOutputValue>::const_iterator it = blockOutputs.find(in.prevout);
+        if (it != blockOutputs.end())
+            value = it->second;
+        else if (!pblocktree->ReadTokenOutput(in.prevout, value))
+            continue;
+        tokenIndex.push_back(make_pair(CTokenUnspentKey(value.address, in.prevout.hash, in.prevout.n), -value.satoshis));
+        inputs[value.address.tokenid] += value.satoshis;
+    }
+
+    uint256 tokenid; CAmount supply, total = 0;
+    std::vector<std::pair<int32_t, CAmount> > outputs;
+    if (!GetTokenOutputs(tx, block.vtx, tokenid, outputs, supply))
+        return;
+    for (const auto &output : outputs)
+        total += output.second;
+    const uint256 &txhash = tx.GetHash();
+    if (tokenid == txhash)
+        tokenSupplies.push_back(make_pair(tokenid, supply));
+    else if (total != inputs[tokenid])
+        return;
+    for (const auto &output : outputs)
+    {
+        vector<vector<unsigned char>> vSols;
+        CTxDestination vDest;
+        txnouttype txType = TX_PUBKEYHASH;
+        int keyType = GetAddressType(tx.vout[output.first].scriptPubKey, vDest, txType, vSols);
+        if ( keyType == 0 || vSols.empty() )
+            continue;
+        uint160 addrHash = vSols[0].size() == 20 ? uint160(vSols[0]) : Hash160(vSols[0]);
+        CTokenAddressKey address(tokenid, keyType, addrHash);
+        tokenIndex.push_back(make_pair(CTokenUnspentKey(address, txhash, output.first), output.second));
+        blockOutputs[COutPoint(txhash, output.first)] = CTokenOutputValue(address, output.second);
+    }
+}
+
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
@@ -3106,14 +3542,28 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
+    // cached lookups would still report this block as the containing one
+    txLookupCache.EraseBlock(block);
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
     std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<std::pair<CCCIndexKey, CCCIndexValue> > ccIndex;
+    std::vector<std::pair<CTokenUnspentKey, CAmount> > tokenIndex;
+    std::vector<std::pair<uint256, CAmount> > tokenSupplies;
+    if (fTokenIndex) {
+        // the token records are replayed in block order, the index still holds every output of this block
+        std::map<COutPoint, CTokenOutputValue> blockOutputs;
+        for (const CTransaction &tx : block.vtx)
+            if (!tx.IsCoinBase())
+                GetTokenIndexRecords(tx, block, blockOutputs, tokenIndex, tokenSupplies);
+    }
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
+        if (fCCIndex && !tx.IsCoinBase())
+            GetCCIndexRecords(tx, pindex->nHeight, ccIndex);
         if (fAddressIndex) {
 
             for (unsigned int k = tx.vout.size(); k-- > 0;) {
@@ -3233,6 +3683,11 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         }
     }
 
+    if (fCCIndex && !pblocktree->EraseCCIndex(ccIndex))
+        return AbortNode(state, "Failed to delete CC index");
+    if (fTokenIndex && !pblocktree->EraseTokenIndex(tokenIndex, tokenSupplies))
+        return AbortNode(state, "Failed to delete token index");
+
     return fClean;
 }
 
@@ -3268,6 +3723,114 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CSaplingCheck> saplingcheckqueue(8);
+
+void ThreadSaplingCheck() {
+    RenameThread("zcash-saplingch");
+    saplingcheckqueue.Thread();
+}
+
+/****
+ * @brief add the coins created by a block to the cumulative supply of its parent
+ * @note pindex->newcoins, zfunds and sproutfunds must be set
+ * @param pindex the block, after its parent
+ * @returns false if the parent's cumulative supply is not known yet
+ */
+static bool SetChainSupply(CBlockIndex *pindex)
+{
+    const CBlockIndex *pprev = pindex->pprev;
+    if ( pprev == 0 || pprev->nHeight == 0 ) // coinsupply starts at height 1
+    {
+        pindex->nChainSupply = pindex->newcoins;
+        pindex->nChainZFunds = pindex->zfunds;
+        pindex->nChainSproutFunds = pindex->sproutfunds;
+    }
+    else if ( (pprev->nStatus & BLOCK_HAVE_SUPPLY) != 0 )
+    {
+        pindex->nChainSupply = pprev->nChainSupply + pindex->newcoins;
+        pindex->nChainZFunds = pprev->nChainZFunds + pindex->zfunds;
+        pindex->nChainSproutFunds = pprev->nChainSproutFunds + pindex->sproutfunds;
+    }
+    else return false;
+    pindex->nStatus |= BLOCK_HAVE_SUPPLY;
+    return true;
+}
+
+/****
+ * @brief fill in the cumulative coin supply and the segid of the active chain for block
+ * indexes written before they were persisted, oldest first, so that coinsupply takes O(1)
+ * and segid lookups never load blocks
+ */
+void ThreadBackfillBlockIndex()
+{
+    // segids only mean something on staked chains
+    const unsigned int BLOCK_HAVE_BACKFILL = BLOCK_HAVE_SUPPLY | (ASSETCHAINS_STAKED != 0 ? BLOCK_HAVE_SEGID : 0);
+    RenameThread("squishy-backfill");
+    while ( IsInitialBlockDownload() ) // connected blocks are filled in by ConnectBlock
+        MilliSleep(10000);
+    CBlockIndex *pindex; CBlock block; int64_t vinsum,newcoins=0,zfunds=0,sproutfunds=0; int32_t nHeight = 1, nFilled = 0; int8_t segid; bool fSupply,fSegid;
+    while ( true )
+    {
+        boost::this_thread::interruption_point();
+        {
+            LOCK(cs_main);
+            while ( (pindex= chainActive[nHeight]) != 0 && (pindex->nStatus & BLOCK_HAVE_BACKFILL) == BLOCK_HAVE_BACKFILL )
+                nHeight++;
+            if ( pindex != 0 )
+            {
+                fSupply = (pindex->nStatus & BLOCK_HAVE_SUPPLY) == 0;
+                fSegid = ASSETCHAINS_STAKED != 0 && (pindex->nStatus & BLOCK_HAVE_SEGID) == 0;
+                segid = pindex->segid;
+            }
+        }
+        if ( pindex == 0 )
+            break;
+        if ( squishy_blockload(block,pindex) != 0 || (fSupply && !squishy_blockvinsum(&vinsum,&block)) )
+        {
+            LogPrintf("%s: cannot load the inputs of block.%d, coinsupply and segid will load blocks\n",__func__,nHeight);
+            return;
+        }
+        if ( fSupply )
+            newcoins = squishy_blocknewcoins(&zfunds,&sproutfunds,nHeight,&block,vinsum);
+        if ( fSegid && segid == -2 )
+            segid = squishy_blocksegid(nHeight,block,squishy_txprevout);
+        {
+            LOCK(cs_main);
+            if ( chainActive[nHeight] != pindex ) // reorganized meanwhile, scan again from the start
+            {
+                nHeight = 1;
+                continue;
+            }
+            if ( fSupply )
+            {
+                pindex->newcoins = newcoins;
+                pindex->zfunds = zfunds;
+                pindex->sproutfunds = sproutfunds;
+                if ( !SetChainSupply(pindex) )
+                {
+                    nHeight = 1;
+                    continue;
+                }
+            }
+            if ( fSegid )
+            {
+                if ( pindex->segid == -2 )
+                    pindex->segid = segid;
+                pindex->nStatus |= BLOCK_HAVE_SEGID;
+            }
+            setDirtyBlockIndex.insert(pindex);
+        }
+        if ( (++nFilled % 10000) == 0 )
+            LogPrintf("%s: block index filled in up to height %d\n",__func__,nHeight);
+        nHeight++;
+    }
+    if ( nFilled != 0 )
+    {
+        LogPrintf("%s: coin supply and segid filled in for %d blocks\n",__func__,nFilled);
+        FlushStateToDisk();
+    }
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -3474,7 +4037,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                              REJECT_INVALID, "bad-txns-BIP30");
     }
 
-    unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    unsigned int flags = BLOCK_SCRIPT_VERIFY_FLAGS;
 
     // DERSIG (BIP66) is also always enforced, but does not have a flag.
 
@@ -3499,7 +4062,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CAmount nFees = 0;
     int nInputs = 0;
     uint64_t valueout;
-    int64_t voutsum = 0, prevsum = 0, interest, sum = 0, stakeTxValue = 0;
+    int64_t voutsum = 0, prevsum = 0, interest, sum = 0, stakeTxValue = 0, vinsum = 0;
     unsigned int nSigOps = 0;
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
@@ -3508,6 +4071,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
     std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<std::pair<CCCIndexKey, CCCIndexValue> > ccIndex;
+    std::vector<std::pair<CTokenUnspentKey, CAmount> > tokenIndex;
+    std::vector<std::pair<uint256, CAmount> > tokenSupplies;
+    std::map<COutPoint, CTokenOutputValue> tokenBlockOutputs;
     // Construct the incremental merkle tree at the current
     // block position,
     auto old_sprout_tree_root = view.GetBestAnchor(SPROUT);
@@ -3534,6 +4101,22 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Grab the consensus branch ID for the block's height
     auto consensusBranchId = CurrentEpochBranchId(pindex->nHeight, Params().GetConsensus());
 
+    // the segid needs the utxo spent by the staking tx, look it up before the loop spends it
+    int8_t blocksegid = -2;
+    if ( !fJustCheck && ASSETCHAINS_STAKED != 0 && pindex->segid == -2 )
+    {
+        blocksegid = squishy_blocksegid(pindex->nHeight,block,[&view](const COutPoint &prevout,uint64_t *valuep,char *destaddr) {
+            CTxDestination address;
+            const CCoins *coins = view.AccessCoins(prevout.hash);
+            if ( coins == NULL || !coins->IsAvailable(prevout.n) )
+                return false;
+            *valuep = coins->vout[prevout.n].nValue;
+            if ( ExtractDestination(coins->vout[prevout.n].scriptPubKey,address) )
+                strcpy(destaddr,CBitcoinAddress(address).ToString().c_str());
+            return true;
+        });
+    }
+
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
     for (unsigned int i = 0; i < block.vtx.size(); i++)
@@ -3611,6 +4194,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         {
             nFees += (stakeTxValue= view.GetValueIn(chainActive.Tip()->nHeight,interest,tx) - valueout);
             sum += interest;
+            for (size_t j = 0; j < tx.vin.size(); j++)
+                vinsum += view.GetOutputFor(tx.vin[j]).nValue;
 
             std::vector<CScriptCheck> vChecks;
             if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, false, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
@@ -3618,6 +4203,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             control.Add(vChecks);
         }
 
+        if (fCCIndex && !fJustCheck && !tx.IsCoinBase())
+            GetCCIndexRecords(tx, pindex->nHeight, ccIndex);
+        if (fTokenIndex && !fJustCheck && !tx.IsCoinBase())
+            GetTokenIndexRecords(tx, block, tokenBlockOutputs, tokenIndex, tokenSupplies);
+
         if (fAddressIndex) {
             for (unsigned int k = 0; k < tx.vout.size(); k++) {
                 const CTxOut &out = tx.vout[k];
@@ -3730,6 +4320,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (fJustCheck)
         return true;
 
+    pindex->newcoins = squishy_blocknewcoins(&pindex->zfunds,&pindex->sproutfunds,pindex->nHeight,&block,vinsum);
+    if ( SetChainSupply(pindex) )
+        setDirtyBlockIndex.insert(pindex);
+    // squishy_checkPOW sets the segid of new staker blocks, the others get it here
+    if ( ASSETCHAINS_STAKED != 0 )
+    {
+        if ( pindex->segid == -2 )
+            pindex->segid = blocksegid;
+        pindex->nStatus |= BLOCK_HAVE_SEGID;
+        setDirtyBlockIndex.insert(pindex);
+    }
+
     // Write undo information to disk
     //LogPrintf("nFile.%d isNull %d vs isvalid %d nStatus %x\n",(int32_t)pindex->nFile,pindex->GetUndoPos().IsNull(),pindex->IsValid(BLOCK_VALID_SCRIPTS),(uint32_t)pindex->nStatus);
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
@@ -3779,6 +4381,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
+    if (fCCIndex && !pblocktree->WriteCCIndex(ccIndex))
+        return AbortNode(state, "Failed to write CC index");
+    if (fTokenIndex && !pblocktree->WriteTokenIndex(tokenIndex, tokenSupplies))
+        return AbortNode(state, "Failed to write token index");
+
     if (fSpentIndex)
         if (!pblocktree->UpdateSpentIndex(spentIndex))
             return AbortNode(state, "Failed to write transaction index");
@@ -3830,6 +4437,37 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     return true;
 }
 
+/**
+ * Free the Equihash solutions of written block index entries that are
+ * BLOCK_INDEX_SOLUTION_DEPTH below the best header, GetBlockHeader reads
+ * them back from the block tree db. Requires cs_main.
+ */
+static void TrimBlockIndexSolutions()
+{
+    AssertLockHeld(cs_main);
+    int nTrimHeight = (pindexBestHeader ? pindexBestHeader->nHeight : chainActive.Height()) - BLOCK_INDEX_SOLUTION_DEPTH;
+    for (set<CBlockIndex*>::iterator it = setUntrimmedBlockIndex.begin(); it != setUntrimmedBlockIndex.end(); ) {
+        CBlockIndex *pblockindex = *it;
+        if (pblockindex->nHeight > nTrimHeight) {
+            ++it;
+            continue;
+        }
+        if (pblockindex->HasSolution()) {
+            nBlockIndexSolutions--;
+            nBlockIndexSolutionUsage -= pblockindex->SolutionDynamicUsage();
+            pblockindex->TrimSolution();
+        }
+        setUntrimmedBlockIndex.erase(it++);
+    }
+}
+
+size_t BlockIndexDynamicUsage(int64_t &nSolutions)
+{
+    AssertLockHeld(cs_main);
+    nSolutions = nBlockIndexSolutions;
+    return memusage::DynamicUsage(mapBlockIndex) + mapBlockIndex.size() * memusage::MallocUsage(sizeof(CBlockIndex)) + nBlockIndexSolutionUsage;
+}
+
 enum FlushStateMode {
     FLUSH_STATE_NONE,
     FLUSH_STATE_IF_NEEDED,
@@ -3910,11 +4548,14 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                     return AbortNode(state, "Files to write to block index database");
                 }
                 // Now that we have written the block indices to the database, we do not
-                // need to store solutions for these CBlockIndex objects in memory.
-                // cs_main must be held here.
+                // need to store solutions for these CBlockIndex objects in memory. Those
+                // near the best header are what peers ask headers for, they are kept
+                // until they are deep enough. cs_main must be held here.
                 for (CBlockIndex *pblockindex : vBlocks) {
-                    pblockindex->TrimSolution();
+                    if (pblockindex->HasSolution())
+                        setUntrimmedBlockIndex.insert(pblockindex);
                 }
+                TrimBlockIndexSolutions();
             }
             // Finally remove any pruned files
             if (fFlushForPrune)
@@ -4046,9 +4687,12 @@ bool static DisconnectTip(CValidationState &state, bool fBare = false) {
         if (!DisconnectBlock(block, state, pindexDelete, view))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
-        DisconnectNotarisations(block);
+        DisconnectNotarisations(block, pindexDelete->nHeight);
     }
+    if ( ASSETCHAINS_STAKED != 0 )
+        squishy_segidwindow_disconnect(pindexDelete);
     pindexDelete->segid = -2;
+    pindexDelete->nStatus &= ~BLOCK_HAVE_SEGID;
     pindexDelete->nNotaryPay = 0; 
     pindexDelete->newcoins = 0;
     pindexDelete->zfunds = 0;
@@ -4256,6 +4900,8 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
 
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    if ( ASSETCHAINS_STAKED != 0 )
+        squishy_segidwindow_connect(pindexNew);
     if ( SQUISHY_NSPV_FULLNODE )
     {
         // Tell wallet about transactions that went from mempool
@@ -4606,10 +5252,30 @@ bool ActivateBestChain(bool fSkipdpow, CValidationState &state, CBlock *pblock)
             // Don't relay blocks if pruning -- could cause a peer to try to download, resulting
             // in a stalled download if the block file is pruned before the request.
             if (nLocalServices & NODE_NETWORK) {
+                // Peers in high-bandwidth compact block mode get a single new block
+                // pushed as cmpctblock, saving them the inv/getdata round trip.
+                std::unique_ptr<CBlockHeaderAndShortTxIDs> pcmpctblock;
+                if (fCompactBlocks && !fInitialDownload && pindexFork == pindexNewTip->pprev) {
+                    if (pblock != NULL && pblock->GetHash() == hashNewTip)
+                        pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(*pblock));
+                    else {
+                        CBlock block;
+                        if (ReadBlockFromDisk(block, pindexNewTip, 1))
+                            pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(block));
+                    }
+                }
+                CInv inv(MSG_BLOCK, hashNewTip);
                 LOCK(cs_vNodes);
                 BOOST_FOREACH(CNode* pnode, vNodes)
                 if (nNewHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                    pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                {
+                    if (pcmpctblock && pnode->fPreferHeaderAndIDs && !pnode->HasInventoryKnown(inv)) {
+                        pnode->AddInventoryKnown(inv);
+                        pnode->PushMessage("cmpctblock", *pcmpctblock);
+                        cmpctBlockStats.nSent++;
+                    } else
+                        pnode->PushInventory(inv);
+                }
             }
             // Notify external listeners about the new tip.
             GetMainSignals().UpdatedBlockTip(pindexNewTip);
@@ -4741,6 +5407,10 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     // Construct new block index object
     CBlockIndex* pindexNew = new CBlockIndex(block);
     assert(pindexNew);
+    if (pindexNew->HasSolution()) {
+        nBlockIndexSolutions++;
+        nBlockIndexSolutionUsage += pindexNew->SolutionDynamicUsage();
+    }
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -5409,9 +6079,13 @@ bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState
             LogPrint("hfnet","%s[%d]: STRANGE! pindexPrev == nullptr, ht.%ld, hash.%s!\n", __func__, __LINE__, txheight, block.GetHash().ToString());
     }
 
+    // Sapling proofs are verified by the Sapling check workers while the remaining checks run
+    CCheckQueueControl<CSaplingCheck> control(nScriptCheckThreads ? &saplingcheckqueue : NULL);
+
     // Check that all transactions are finalized, also validate interest in each tx
     for (uint32_t i = 0; i < block.vtx.size(); i++) {
         const CTransaction& tx = block.vtx[i];
+        std::vector<CSaplingCheck> vSaplingChecks;
 
         // Interest validation
         if (!squishy_validate_interest(tx, txheight, cmptime))
@@ -5421,9 +6095,11 @@ bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState
         }
 
         // Check transaction contextually against consensus rules at block height
-        if (!ContextualCheckTransaction(slowflag,&block,pindexPrev,tx, state, nHeight, 100)) {
+        if (!ContextualCheckTransaction(slowflag,&block,pindexPrev,tx, state, nHeight, 100, IsInitialBlockDownload, 1,
+                nScriptCheckThreads ? &vSaplingChecks : NULL)) {
             return false; // Failure reason has been set in validation state object
         }
+        control.Add(vSaplingChecks);
 
         int nLockTimeFlags = 0;
         int64_t nLockTimeCutoff = (nLockTimeFlags & LOCKTIME_MEDIAN_TIME_PAST)
@@ -5446,6 +6122,17 @@ bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState
             return state.DoS(100, error("%s: block height mismatch in coinbase", __func__), REJECT_INVALID, "bad-cb-height");
         }
     }
+
+    if (!control.Wait())
+    {
+        // the workers only report failure, check serially to find the transaction and reason
+        for (const CTransaction& tx : block.vtx)
+        {
+            if (!ContextualCheckTransaction(slowflag,&block,pindexPrev,tx, state, nHeight, 100))
+                return false;
+        }
+        return state.DoS(100, error("%s: Sapling proof verification failed", __func__), REJECT_INVALID, "bad-txns-sapling-proof-invalid");
+    }
     return true;
 }
 
@@ -5939,6 +6626,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileMapper.Unmap(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -6253,6 +6941,34 @@ bool static LoadBlockIndexDB()
     // Check whether we have an address index
     pblocktree->ReadFlag("addressindex", fAddressIndex);
     LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+    if ( fAddressIndex && !fReindex )
+    {
+        // address indexes created before the balance and richlist records existed need them built once
+        bool fAddressBalanceIndex = false;
+        pblocktree->ReadFlag("addressbalanceindex", fAddressBalanceIndex);
+        if ( !fAddressBalanceIndex )
+        {
+            uiInterface.InitMessage(_("Building address balance index..."));
+            if ( !pblocktree->BuildAddressBalanceIndex() )
+                return error("%s: failed to build address balance index", __func__);
+            pblocktree->WriteFlag("addressbalanceindex", true);
+        }
+        bool fAddressRichlistIndex = false;
+        pblocktree->ReadFlag("addressrichlistindex", fAddressRichlistIndex);
+        if ( !fAddressRichlistIndex )
+        {
+            uiInterface.InitMessage(_("Building address richlist..."));
+            if ( !pblocktree->BuildAddressRichlistIndex() )
+                return error("%s: failed to build address richlist", __func__);
+            pblocktree->WriteFlag("addressrichlistindex", true);
+        }
+    }
+
+    // Check whether we have the CC and token indexes, they are only created along with a new address index
+    pblocktree->ReadFlag("ccindex", fCCIndex);
+    LogPrintf("%s: CC index %s\n", __func__, fCCIndex ? "enabled" : (fAddressIndex ? "disabled, -reindex to build it" : "disabled"));
+    pblocktree->ReadFlag("tokenindex", fTokenIndex);
+    LogPrintf("%s: token index %s\n", __func__, fTokenIndex ? "enabled" : (fAddressIndex ? "disabled, -reindex to build it" : "disabled"));
 
     // Check whether we have a timestamp index
     pblocktree->ReadFlag("timestampindex", fTimestampIndex);
@@ -6287,6 +7003,10 @@ bool static LoadBlockIndexDB()
     // Set hashFinalSproutRoot for the end of best chain
     it->second->hashFinalSproutRoot = pcoinsTip->GetBestAnchor(SPROUT);
 
+    // notarisation databases created before the (symbol, height) index need it built once
+    if ( !fReindex && !BuildNotarisationHeightIndex() )
+        return error("%s: failed to build notarisation height index", __func__);
+
     PruneBlockIndexCandidates();
 
     double progress;
@@ -6582,6 +7302,9 @@ void UnloadBlockIndex()
     nQueuedValidatedHeaders = 0;
     nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
+    setUntrimmedBlockIndex.clear();
+    nBlockIndexSolutions = 0;
+    nBlockIndexSolutionUsage = 0;
     setDirtyFileInfo.clear();
     mapNodeState.clear();
     recentRejects.reset(NULL);
@@ -6635,6 +7358,13 @@ bool InitBlockIndex() {
         // Use the provided setting for -addressindex in the new database
         fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
         pblocktree->WriteFlag("addressindex", fAddressIndex);
+        // a new address index keeps its balance records from the first block on
+        pblocktree->WriteFlag("addressbalanceindex", fAddressIndex);
+        pblocktree->WriteFlag("addressrichlistindex", fAddressIndex);
+        // the CC and token indexes answer CC queries in place of the address index
+        fCCIndex = fTokenIndex = fAddressIndex;
+        pblocktree->WriteFlag("ccindex", fCCIndex);
+        pblocktree->WriteFlag("tokenindex", fTokenIndex);
         
         // Use the provided setting for -timestampindex in the new database
         fTimestampIndex = GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
@@ -6645,6 +7375,9 @@ bool InitBlockIndex() {
         LogPrintf("fAddressIndex.%d/%d fSpentIndex.%d/%d\n",fAddressIndex,DEFAULT_ADDRESSINDEX,fSpentIndex,DEFAULT_SPENTINDEX);
         LogPrintf("Initializing databases...\n");
     }
+    // a new notarisation database keeps its height index from the first block on
+    if ( pnotarisations != nullptr && !BuildNotarisationHeightIndex() )
+        return error("%s: failed to initialize notarisation height index", __func__);
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
     if (!fReindex) {
         try {
@@ -7106,7 +7839,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -7142,9 +7875,19 @@ void static ProcessGetData(CNode* pfrom)
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
+                    // Send block from disk, full blocks as the bytes stored there
+                    // without a deserialize/serialize round trip
+                    bool fSendRaw = inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK &&
+                        !(pfrom->fSupportsCompactBlocks && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH));
+                    std::shared_ptr<const std::vector<uint8_t> > pblockraw;
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second,1))
+                    // blocks fetched during initial sync are asked for once, caching them would only evict the tip
+                    bool fCacheRaw = mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                    if (fSendRaw && ReadRawBlockFromDisk(pblockraw, (*mi).second, fCacheRaw))
+                    {
+                        pfrom->PushMessage("block", CFlatData((void *)pblockraw->data(), (void *)(pblockraw->data() + pblockraw->size())));
+                    }
+                    else if (!ReadBlockFromDisk(block, (*mi).second,1))
                     {
                         assert(!"cannot load block from disk");
                     }
@@ -7159,6 +7902,18 @@ void static ProcessGetData(CNode* pfrom)
                             //LogPrintf(" send block %d\n",squishy_block2height(&block));
                             pfrom->PushMessage("block", block);
                         }
+                        else if (inv.type == MSG_CMPCT_BLOCK)
+                        {
+                            // Reconstructing old blocks from the mempool is pointless, send them in full
+                            if (pfrom->fSupportsCompactBlocks && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH)
+                            {
+                                CBlockHeaderAndShortTxIDs cmpctblock(block);
+                                pfrom->PushMessage("cmpctblock", cmpctblock);
+                                cmpctBlockStats.nSent++;
+                            }
+                            else
+                                pfrom->PushMessage("block", block);
+                        }
                         else // MSG_FILTERED_BLOCK)
                         {
                             LOCK(pfrom->cs_filter);
@@ -7221,7 +7976,7 @@ void static ProcessGetData(CNode* pfrom)
                 }
             }
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -7246,6 +8001,36 @@ void static ProcessGetData(CNode* pfrom)
 #include "squishy_nSPV_superlite.h"  // nSPV superlite client, issuing requests and handling nSPV responses
 #include "squishy_nSPV_wallet.h"     // nSPV_send and support functions, really all the rest is to support this
 
+/**
+ * Validate a block a peer sent us (in full or as a reconstructed compact block).
+ * Invalid blocks are rejected and punished, a peer that gave us a new tip is
+ * asked to push its next blocks as cmpctblock.
+ */
+void static ProcessReceivedBlock(CNode* pfrom, CBlock& block, const string& strCommand)
+{
+    CValidationState state;
+    // Process all blocks from whitelisted peers, even if not requested,
+    // unless we're still syncing with the network.
+    // Such an unrequested block may still be processed, subject to the
+    // conditions in AcceptBlock().
+    bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
+    ProcessNewBlock(0,0,state, pfrom, &block, forceProcessing, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+    else if (fCompactBlocks) {
+        LOCK(cs_main);
+        if (chainActive.Tip() != NULL && chainActive.Tip()->GetBlockHash() == block.GetHash() && !IsInitialBlockDownload())
+            MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
+    }
+}
+
 void squishy_netevent(std::vector<uint8_t> payload);
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
@@ -7442,6 +8227,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        // Tell the peer we understand compact blocks, but want new blocks announced as usual.
+        // Peers that do not know the message just ignore it.
+        if (fCompactBlocks)
+            pfrom->PushMessage("sendcmpct", false, CMPCTBLOCKS_VERSION);
     }
 
 
@@ -7727,7 +8517,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
                         nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        vToFetch.push_back(CInv(pfrom->fSupportsCompactBlocks ? MSG_CMPCT_BLOCK : MSG_BLOCK, inv.hash));
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -8100,23 +8890,205 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         pfrom->AddInventoryKnown(inv);
 
-        CValidationState state;
-        // Process all blocks from whitelisted peers, even if not requested,
-        // unless we're still syncing with the network.
-        // Such an unrequested block may still be processed, subject to the
-        // conditions in AcceptBlock().
-        bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(0,0,state, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
-                LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
+        ProcessReceivedBlock(pfrom, block, strCommand);
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        // Only short IDs of txids are understood, there is no witness data here
+        if (fCompactBlocks && nCMPCTBLOCKVersion == CMPCTBLOCKS_VERSION)
+        {
+            pfrom->fSupportsCompactBlocks = true;
+            pfrom->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        if (!fCompactBlocks)
+            return true;
+
+        const uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "received cmpctblock %s peer=%d\n", hash.ToString(), pfrom->id);
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+                // Doesn't connect to anything we know, get the headers first
+                if (!IsInitialBlockDownload())
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hash);
+                return true;
+            }
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            int32_t futureblock;
+            if (!AcceptBlockHeader(&futureblock, cmpctblock.header, state, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS) && futureblock == 0)
+                {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS/nDoS);
+                    return error("invalid header received in cmpctblock");
+                }
+                return true;
+            }
+            if (pindex == NULL)
+                return true;
+
+            CInv inv(MSG_BLOCK, hash);
+            pfrom->AddInventoryKnown(inv);
+            UpdateBlockAvailability(pfrom->GetId(), hash);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            bool fInFlightFromPeer = itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId();
+            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+                if (fInFlightFromPeer)
+                    MarkBlockAsReceived(hash);
+                return true;
+            }
+            if (fInFlightFromPeer && itInFlight->second.second->partialBlock)
+                return true; // already waiting for its transactions
+            if (!fInFlightFromPeer) {
+                // An unsolicited (high-bandwidth) announcement is only worth it when
+                // it extends our best chain and nobody else is sending the block yet
+                if (itInFlight != mapBlocksInFlight.end() || IsInitialBlockDownload() ||
+                    pindex->nChainWork <= chainActive.Tip()->nChainWork ||
+                    State(pfrom->GetId())->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER)
+                    return true;
+            }
+
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock = std::make_shared<PartiallyDownloadedBlock>(&mempool);
+            ReadStatus status = partialBlock->InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(hash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid cmpctblock %s from peer=%d", hash.ToString(), pfrom->id);
+            }
+            cmpctBlockStats.nReceived++;
+
+            BlockTransactionsRequest req;
+            if (status == READ_STATUS_OK) {
+                cmpctBlockStats.nTxFromMempool += partialBlock->GetMempoolCount();
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    if (!partialBlock->IsTxAvailable(i))
+                        req.indexes.push_back(i);
+                }
+                if (req.indexes.empty()) {
+                    // Everything was prefilled or in our mempool
+                    std::vector<CTransactionRef> vtx_missing;
+                    status = partialBlock->FillBlock(block, vtx_missing);
+                }
+            }
+
+            if (status != READ_STATUS_OK) {
+                // Short ID collision, fall back to the full block
+                MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+                cmpctBlockStats.nFullBlockFallbacks++;
+                pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            } else if (!req.indexes.empty()) {
+                MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex, partialBlock);
+                req.blockhash = hash;
+                cmpctBlockStats.nRoundTrips++;
+                cmpctBlockStats.nTxRequested += req.indexes.size();
+                pfrom->PushMessage("getblocktxn", req);
+            } else {
+                // Counts as requested so AcceptBlock does not treat it as unsolicited
+                MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+                cmpctBlockStats.nReconstructed++;
+                fBlockReconstructed = true;
+            }
+        }
+
+        if (fBlockReconstructed)
+            ProcessReceivedBlock(pfrom, block, strCommand);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "peer=%d sent getblocktxn for block %s we don't have\n", pfrom->id, req.blockhash.ToString());
+            return true;
+        }
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Only recent blocks are reconstructed by peers, answer like a getdata
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second, 1))
+            return error("getblocktxn: cannot load block %s from disk", req.blockhash.ToString());
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("getblocktxn with out-of-bounds tx indices from peer=%d", pfrom->id);
+            }
+            resp.txn[i] = MakeTransactionRef(block.vtx[req.indexes[i]]);
+        }
+        pfrom->PushMessage("blocktxn", resp);
+        cmpctBlockStats.nBlockTxnServed++;
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(resp.blockhash);
+            if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != pfrom->GetId() ||
+                !itInFlight->second.second->partialBlock) {
+                LogPrint("net", "peer=%d sent blocktxn for block %s we were not expecting\n", pfrom->id, resp.blockhash.ToString());
+                return true;
+            }
+
+            // A partial block can only be filled once
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock = itInFlight->second.second->partialBlock;
+            itInFlight->second.second->partialBlock.reset();
+            ReadStatus status = partialBlock->FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid blocktxn for block %s from peer=%d", resp.blockhash.ToString(), pfrom->id);
+            } else if (status == READ_STATUS_FAILED) {
+                // Short ID collision, the block stays in flight while we get it in full
+                cmpctBlockStats.nFullBlockFallbacks++;
+                pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+            } else {
+                cmpctBlockStats.nRoundTripsFilled++;
+                fBlockReconstructed = true;
             }
         }
 
+        if (fBlockReconstructed)
+            ProcessReceivedBlock(pfrom, block, strCommand);
     }
 
 
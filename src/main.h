@@ -45,6 +45,7 @@
 #include "uint256.h"
 
 #include <algorithm>
+#include <atomic>
 #include <exception>
 #include <map>
 #include <set>
@@ -59,6 +60,7 @@ class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
 class CInv;
+class CSaplingCheck;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -66,6 +68,16 @@ class PrecomputedTransactionData;
 
 struct CNodeStateStats;
 #define DEFAULT_MEMPOOL_EXPIRY 1
+/** Block index entries this far below the best header drop their Equihash solution from memory once written */
+static const int BLOCK_INDEX_SOLUTION_DEPTH = 100;
+/** Default for -limitancestorcount, max number of in-mempool ancestors; generous so CC baton chains fit */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 1000;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 5000;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 1000;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 5000;
 
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = 2000000;//MAX_BLOCK_SIZE;
@@ -95,12 +107,24 @@ static const unsigned int MAX_TEMPFILE_SIZE = 0x1000000; // 16 MiB 0x8000000
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Script verification flags ConnectBlock applies to every transaction */
+static const unsigned int BLOCK_SCRIPT_VERIFY_FLAGS = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Default for -cmpctblocks */
+static const bool DEFAULT_CMPCTBLOCKS = true;
+/** Compact block encoding we speak: short IDs of txids (BIP 152 version 1) */
+static const uint64_t CMPCTBLOCKS_VERSION = 1;
+/** Number of peers asked to push new blocks as cmpctblock without announcing them first */
+static const unsigned int MAX_CMPCTBLOCK_HB_PEERS = 3;
+/** Blocks further below the tip than this are served in full when a compact block is asked for */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** getblocktxn requests for blocks further below the tip than this are answered with the full block */
+static const int MAX_BLOCKTXN_DEPTH = 10;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -129,6 +153,14 @@ static const unsigned int DEFAULT_DB_MAX_OPEN_FILES = 1000;
 static const bool DEFAULT_DB_COMPRESSION = true;
 /** Default NSPV support enabled */
 static const bool DEFAULT_NSPV_PROCESSING = false;
+/** Default for -nspvthreads, the number of threads answering getnSPV requests */
+static const int DEFAULT_NSPV_THREADS = 2;
+/** Maximum number of getnSPV requests waiting for a worker thread */
+static const unsigned int MAX_NSPV_QUEUE = 1024;
+/** Maximum number of getnSPV requests of one peer waiting for a worker thread */
+static const unsigned int MAX_NSPV_PEER_QUEUE = 16;
+/** Maximum number of nSPV responses cached for the current tip */
+static const unsigned int MAX_NSPV_CACHE = 1024;
 
 // Sanity check the magic numbers when we change them
 //BOOST_STATIC_ASSERT(DEFAULT_BLOCK_MAX_SIZE <= MAX_BLOCK_SIZE());
@@ -160,6 +192,7 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fCompactBlocks;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
@@ -171,6 +204,19 @@ extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern int64_t nMaxTipAge;
 
+/** Counters of the getnSPV request server, reported by getnetworkinfo */
+struct CNSPVServerStats
+{
+    std::atomic<uint64_t> nQueued;      //! requests waiting for a worker thread
+    std::atomic<uint64_t> nDropped;     //! requests dropped because a queue was full
+    std::atomic<uint64_t> nCacheHits;   //! responses sent from the response cache
+    std::atomic<uint64_t> nCacheMisses; //! cacheable responses that had to be built
+
+    CNSPVServerStats() : nQueued(0), nDropped(0), nCacheHits(0), nCacheMisses(0) {}
+};
+
+extern CNSPVServerStats nspvServerStats;
+
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
@@ -252,8 +298,16 @@ bool ProcessMessages(CNode* pfrom);
  * @param[in]   fSendTrickle    When true send the trickled data, otherwise trickle the data until true.
  */
 bool SendMessages(CNode* pto, bool fSendTrickle);
+/** Size the cache of transactions whose scripts were all verified, from -maxsigcachesize */
+void InitScriptExecutionCache();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the Sapling proof checking thread */
+void ThreadSaplingCheck();
+/** Persist the cumulative coin supply and segid of block indexes written before they were tracked */
+void ThreadBackfillBlockIndex();
+/** Run an instance of the thread answering getnSPV requests */
+void ThreadNSPVRequests();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -664,6 +718,375 @@ struct CAddressIndexIteratorHeightKey {
     }
 };
 
+/****
+ * Running totals of an address, kept in step with the address index so
+ * balance queries don't have to sum the full history
+ */
+struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+    int64_t txcount;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+        READWRITE(txcount);
+    }
+
+    CAddressBalanceValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        received = 0;
+        txcount = 0;
+    }
+
+    bool IsNull() const {
+        return (balance == 0 && received == 0 && txcount == 0);
+    }
+};
+
+/****
+ * Key of the richlist, ordered by descending balance so the largest holders
+ * are the first records of a forward scan
+ */
+struct CAddressRichlistKey {
+    CAmount balance;
+    unsigned int type;
+    uint160 hashBytes;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 29;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata64be(s, ~(uint64_t)balance);
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        balance = (CAmount)~ser_readdata64be(s);
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+    }
+
+    CAddressRichlistKey(CAmount amount, unsigned int addressType, uint160 addressHash) {
+        balance = amount;
+        type = addressType;
+        hashBytes = addressHash;
+    }
+
+    CAddressRichlistKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        type = 0;
+        hashBytes.SetNull();
+    }
+};
+
+/****
+ * Totals over all addresses of one type: the sum of balances, the number of
+ * addresses holding a positive balance and the number of non-zero utxos
+ */
+struct CAddressTypeStats {
+    CAmount total;
+    int64_t addresses;
+    int64_t utxos;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(total);
+        READWRITE(addresses);
+        READWRITE(utxos);
+    }
+
+    CAddressTypeStats() {
+        SetNull();
+    }
+
+    void SetNull() {
+        total = 0;
+        addresses = 0;
+        utxos = 0;
+    }
+};
+
+/****
+ * Key of the CC index: the evalcode and funcid of a CC transaction's opreturn,
+ * the creation txid it refers to (its own txid for creation txs), then the
+ * height in descending order so the newest records of a prefix come first
+ */
+struct CCCIndexKey {
+    uint8_t evalcode;
+    uint8_t funcid;
+    uint256 reftxid;
+    int blockHeight;
+    uint256 txhash;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 70;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, evalcode);
+        ser_writedata8(s, funcid);
+        reftxid.Serialize(s);
+        ser_writedata32be(s, ~(uint32_t)blockHeight);
+        txhash.Serialize(s);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        evalcode = ser_readdata8(s);
+        funcid = ser_readdata8(s);
+        reftxid.Unserialize(s);
+        blockHeight = (int)~ser_readdata32be(s);
+        txhash.Unserialize(s);
+    }
+
+    CCCIndexKey(uint8_t evalcodeIn, uint8_t funcidIn, uint256 reftxidIn, int height, uint256 txid) {
+        evalcode = evalcodeIn;
+        funcid = funcidIn;
+        reftxid = reftxidIn;
+        blockHeight = height;
+        txhash = txid;
+    }
+
+    CCCIndexKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        evalcode = 0;
+        funcid = 0;
+        reftxid.SetNull();
+        blockHeight = 0;
+        txhash.SetNull();
+    }
+};
+
+/****
+ * Seek position inside the CC index: the evalcode, optionally followed by
+ * the funcid and then the reference txid
+ */
+struct CCCIndexIteratorKey {
+    uint8_t evalcode;
+    uint8_t funcid;
+    uint256 reftxid;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return funcid == 0 ? 1 : (reftxid.IsNull() ? 2 : 34);
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, evalcode);
+        if (funcid != 0) {
+            ser_writedata8(s, funcid);
+            if (!reftxid.IsNull())
+                reftxid.Serialize(s);
+        }
+    }
+
+    CCCIndexIteratorKey(uint8_t evalcodeIn, uint8_t funcidIn, uint256 reftxidIn) {
+        evalcode = evalcodeIn;
+        funcid = funcidIn;
+        reftxid = reftxidIn;
+    }
+};
+
+/****
+ * The addresses a CC transaction has outputs on, used to answer queries
+ * restricted to one (usually CC) address
+ */
+struct CCCIndexValue {
+    std::vector<CAddressIndexIteratorKey> addresses;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(addresses);
+    }
+
+    bool HasAddress(unsigned int type, const uint160 &hashBytes) const {
+        for (const CAddressIndexIteratorKey &address : addresses)
+            if (address.type == type && address.hashBytes == hashBytes)
+                return true;
+        return false;
+    }
+};
+
+/****
+ * Key of the token balance of an address, also the prefix of its token utxos
+ */
+struct CTokenAddressKey {
+    uint256 tokenid;
+    unsigned int type;
+    uint160 hashBytes;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 53;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        tokenid.Serialize(s);
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        tokenid.Unserialize(s);
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+    }
+
+    CTokenAddressKey(uint256 tokenidIn, unsigned int addressType, uint160 addressHash) {
+        tokenid = tokenidIn;
+        type = addressType;
+        hashBytes = addressHash;
+    }
+
+    CTokenAddressKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        tokenid.SetNull();
+        type = 0;
+        hashBytes.SetNull();
+    }
+
+    friend bool operator<(const CTokenAddressKey& a, const CTokenAddressKey& b) {
+        if (a.tokenid != b.tokenid)
+            return a.tokenid < b.tokenid;
+        if (a.type != b.type)
+            return a.type < b.type;
+        return a.hashBytes < b.hashBytes;
+    }
+};
+
+/****
+ * Key of an unspent token output, ordered by token and address so the
+ * utxos of one token on one address are a contiguous range
+ */
+struct CTokenUnspentKey {
+    uint256 tokenid;
+    unsigned int type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int index;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 89;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        tokenid.Serialize(s);
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        txhash.Serialize(s);
+        ser_writedata32(s, index);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        tokenid.Unserialize(s);
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+        txhash.Unserialize(s);
+        index = ser_readdata32(s);
+    }
+
+    CTokenUnspentKey(const CTokenAddressKey &address, uint256 txid, unsigned int indexValue) {
+        tokenid = address.tokenid;
+        type = address.type;
+        hashBytes = address.hashBytes;
+        txhash = txid;
+        index = indexValue;
+    }
+
+    CTokenUnspentKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        tokenid.SetNull();
+        type = 0;
+        hashBytes.SetNull();
+        txhash.SetNull();
+        index = 0;
+    }
+
+    CTokenAddressKey GetAddressKey() const {
+        return CTokenAddressKey(tokenid, type, hashBytes);
+    }
+};
+
+/****
+ * Token and owner of an output, kept after the output is spent so
+ * that spending transactions can be disconnected
+ */
+struct CTokenOutputValue {
+    CTokenAddressKey address;
+    CAmount satoshis;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(address);
+        READWRITE(satoshis);
+    }
+
+    CTokenOutputValue(const CTokenAddressKey &addressIn, CAmount amount) : address(addressIn), satoshis(amount) {}
+
+    CTokenOutputValue() {
+        satoshis = 0;
+    }
+};
+
+/****
+ * Totals of a token: the units created by its tokenbase tx, the units held
+ * in unspent token outputs and the number of addresses holding any
+ */
+struct CTokenStats {
+    CAmount supply;
+    CAmount unspent;
+    int64_t holders;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(supply);
+        READWRITE(unspent);
+        READWRITE(holders);
+    }
+
+    CTokenStats() {
+        SetNull();
+    }
+
+    void SetNull() {
+        supply = 0;
+        unspent = 0;
+        holders = 0;
+    }
+
+    bool IsNull() const {
+        return (supply == 0 && unspent == 0 && holders == 0);
+    }
+};
+
 struct CDiskTxPos : public CDiskBlockPos
 {
     unsigned int nTxOffset; // after header
@@ -737,9 +1160,13 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
                            const Consensus::Params& consensusParams, uint32_t consensusBranchId,
                            std::vector<CScriptCheck> *pvChecks = NULL);
 
+/** True if a transaction may run a crypto-condition eval, whose result depends on chain state */
+bool MayRunCryptoConditions(const CTransaction& tx, const CCoinsViewCache &inputs);
+
 /** Check a transaction contextually against a set of consensus rules */
 bool ContextualCheckTransaction(int32_t slowflag,const CBlock *block, CBlockIndex * const pindexPrev,const CTransaction& tx, CValidationState &state, int nHeight, int dosLevel,
-                                bool (*isInitBlockDownload)() = IsInitialBlockDownload,int32_t validateprices=1);
+                                bool (*isInitBlockDownload)() = IsInitialBlockDownload,int32_t validateprices=1,
+                                std::vector<CSaplingCheck> *pvSaplingChecks = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -830,6 +1257,36 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the Sapling spend, output and binding signature checks
+ * of one transaction, which share a verification context
+ */
+class CSaplingCheck
+{
+private:
+    const CTransaction *ptx;
+    uint256 dataToBeSigned;
+    const char *strError;
+    const char *strRejectReason;
+
+public:
+    CSaplingCheck(): ptx(0), strError(0), strRejectReason(0) {}
+    CSaplingCheck(const CTransaction& txIn, const uint256& dataToBeSignedIn) :
+        ptx(&txIn), dataToBeSigned(dataToBeSignedIn), strError(0), strRejectReason(0) { }
+
+    bool operator()();
+
+    void swap(CSaplingCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(dataToBeSigned, check.dataToBeSigned);
+        std::swap(strError, check.strError);
+        std::swap(strRejectReason, check.strRejectReason);
+    }
+
+    const char *GetError() const { return strError; }
+    const char *GetRejectReason() const { return strRejectReason; }
+};
+
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes);
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(uint160 addressHash, int type,
@@ -837,11 +1294,27 @@ bool GetAddressIndex(uint160 addressHash, int type,
                      int start = 0, int end = 0);
 bool GetAddressUnspent(uint160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &balance);
+bool GetCCIndex(uint8_t evalcode, uint8_t funcid, const uint256 &reftxid, uint160 addressHash, int type,
+                std::vector<uint256> &txids, int skip = 0, int limit = 0);
+bool GetTokenAddressBalance(const uint256 &tokenid, uint160 addressHash, int type, CAmount &balance);
+bool GetTokenAddressUnspent(const uint256 &tokenid, uint160 addressHash, int type,
+                            std::vector<std::pair<CTokenUnspentKey, CAmount> > &unspentOutputs);
+bool GetTokenStats(const uint256 &tokenid, CTokenStats &stats);
+bool GetTokenList(std::vector<uint256> &tokenids);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos,bool checkPOW);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex,bool checkPOW);
+/****
+ * @brief read a block as it is stored on disk, without deserializing it, to send it to peers
+ * @param[out] pblock the serialized block, shared with the raw block cache
+ * @param pindex the block
+ * @param fCache keep the block in the raw block cache once read, only worth it for blocks near the tip
+ * @returns false if the block could not be read or its header does not match the index
+ */
+bool ReadRawBlockFromDisk(std::shared_ptr<const std::vector<uint8_t> > &pblock, const CBlockIndex* pindex, bool fCache);
 bool PruneOneBlockFile(bool tempfile, const int fileNumber);
 
 /** Functions for validating blocks and updating the block tree */
@@ -989,6 +1462,13 @@ int GetSpendHeight(const CCoinsViewCache& inputs);
 
 uint64_t CalculateCurrentUsage();
 
+/****
+ * @brief estimate the memory held by mapBlockIndex, requires cs_main
+ * @param[out] nSolutions the number of entries still holding their Equihash solution
+ * @returns the estimated heap usage of the map and its entries in bytes
+ */
+size_t BlockIndexDynamicUsage(int64_t &nSolutions);
+
 /** Return a CMutableTransaction with contextual default values based on set of consensus rules at height */
 CMutableTransaction CreateNewContextualCMutableTransaction(const Consensus::Params& consensusParams, int nHeight);
 
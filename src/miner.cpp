@@ -68,11 +68,14 @@
 #include "squishy_bitcoind.h"
 #include "squishy_extern_globals.h"
 
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/member.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #ifdef ENABLE_MINING
 #include <functional>
 #endif
+#include <limits>
 #include <mutex>
 
 using namespace std;
@@ -84,22 +87,69 @@ using namespace std;
 
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. Past the high-priority area of the block,
+// CreateNewBlock selects whole packages (a transaction with the ancestors not
+// yet in the block) by ancestor feerate, so a parent is mined together with the
+// child that pays for it. Once part of a package is in the block, what is left
+// of the package of each descendant is kept as a CTxPackageEntry.
 //
-class COrphan
+struct CTxPackageEntry
 {
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+
+    explicit CTxPackageEntry(CTxMemPool::txiter entry) : iter(entry),
+        nSizeWithAncestors(entry->GetSizeWithAncestors()), nModFeesWithAncestors(entry->GetModFeesWithAncestors()) {}
+
+    // what CompareTxMemPoolEntryByAncestorFee looks at
+    const CTransaction& GetTx() const { return iter->GetTx(); }
+    CAmount GetModifiedFee() const { return iter->GetModifiedFee(); }
+    size_t GetTxSize() const { return iter->GetTxSize(); }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+};
+
+// Take an ancestor that went into the block out of a package
+struct update_for_ancestor_added
+{
+    update_for_ancestor_added(int64_t _nSize, CAmount _nFee) : nSize(_nSize), nFee(_nFee) {}
+
+    void operator() (CTxPackageEntry &e)
+    {
+        e.nSizeWithAncestors -= nSize;
+        e.nModFeesWithAncestors -= nFee;
+    }
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+private:
+    int64_t nSize;
+    CAmount nFee;
+};
+
+typedef boost::multi_index_container<
+    CTxPackageEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            boost::multi_index::member<CTxPackageEntry, CTxMemPool::txiter, &CTxPackageEntry::iter>,
+            CTxMemPool::CompareIteratorByHash
+        >,
+        // sorted by what is left of the ancestor score, best first
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxPackageEntry>,
+            CompareTxMemPoolEntryByAncestorFee
+        >
+    >
+> indexed_package_set;
+
+// Sort the transactions of a package parents first
+struct CompareTxIterByAncestorCount
+{
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
     {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
     }
 };
 
@@ -145,6 +195,137 @@ void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams,
     }
 }
 
+CTemplateTxCache templateTxCache;
+
+bool CTemplateTxCache::Get(const uint256 &txid, CTemplateTxInfo &info) const
+{
+    LOCK(cs);
+    std::map<uint256, CTemplateTxInfo>::const_iterator it = mapInfo.find(txid);
+    if ( it == mapInfo.end() )
+        return false;
+    info = it->second;
+    return true;
+}
+
+void CTemplateTxCache::Put(const uint256 &txid, const CTemplateTxInfo &info)
+{
+    LOCK(cs);
+    mapInfo[txid] = info;
+}
+
+size_t CTemplateTxCache::Size() const
+{
+    LOCK(cs);
+    return mapInfo.size();
+}
+
+void CTemplateTxCache::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
+{
+    if ( pblock != NULL )
+    {
+        LOCK(cs);
+        mapInfo.erase(tx.GetHash());
+    }
+}
+
+void CTemplateTxCache::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    // expired and conflicted transactions leave the mempool without a signal
+    LOCK2(mempool.cs, cs);
+    for (std::map<uint256, CTemplateTxInfo>::iterator it = mapInfo.begin(); it != mapInfo.end(); )
+    {
+        if ( !mempool.exists(it->first) )
+            mapInfo.erase(it++);
+        else
+            ++it;
+    }
+}
+
+/*****
+ * Fill in the parts of the CTemplateTxInfo of a mempool transaction that are
+ * missing or were computed at another tip
+ * @param tx the transaction
+ * @param view the coins of the tip, without the block under construction
+ * @param nHeight the height of the block under construction
+ * @param hashTip the hash of the tip
+ * @param info the cached data to update
+ */
+static void UpdateTemplateTxInfo(const CTransaction &tx, const CCoinsViewCache &view, int nHeight, const uint256 &hashTip, CTemplateTxInfo &info)
+{
+    if ( info.nTxSize == 0 )
+    {
+        info.nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        info.nLegacySigOps = GetLegacySigOpCount(tx);
+        info.nOpretSize = 0;
+        BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+            if (txout.scriptPubKey.IsOpReturn()) {
+                CScript::const_iterator it = txout.scriptPubKey.begin() + 1;
+                opcodetype op;
+                std::vector<uint8_t> opretData;
+                if (txout.scriptPubKey.GetOp(it, op, opretData))
+                    info.nOpretSize += opretData.size();
+            }
+        }
+        info.fNotaryTx = !tx.IsCoinImport() && squishy_is_notarytx(tx) == 1;
+    }
+    if ( info.hashTip == hashTip )
+        return;
+
+    info.hashTip = hashTip;
+    info.fMissingInputs = false;
+    info.dPriority = 0;
+    info.nTotalIn = 0;
+    info.vParents.clear();
+    info.vInputPubkeys.clear();
+    if (tx.IsCoinImport())
+    {
+        CAmount nValueIn = GetCoinImportValue(tx); // burn amount
+        info.nTotalIn += nValueIn;
+        info.dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
+    }
+    else
+    {
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            // Read prev transaction
+            if (!view.HaveCoins(txin.prevout.hash))
+            {
+                // This should never happen; all transactions in the memory
+                // pool should connect to either transactions in the chain
+                // or other transactions in the memory pool.
+                CTxMemPool::indexed_transaction_set::const_iterator parent = mempool.mapTx.find(txin.prevout.hash);
+                if (parent == mempool.mapTx.end())
+                {
+                    LogPrintf("ERROR: mempool transaction missing input\n");
+                    info.fMissingInputs = true;
+                    return;
+                }
+                // Has to wait for dependencies
+                info.vParents.push_back(txin.prevout.hash);
+                info.nTotalIn += parent->GetTx().vout[txin.prevout.n].nValue;
+                continue;
+            }
+            const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+            assert(coins);
+
+            CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
+            info.nTotalIn += nValueIn;
+
+            int nConf = nHeight - coins->nHeight;
+
+            // the signers of a notarisation are the notaries paid by its inputs, the unspent coin has the script
+            const CScript &scriptPubKey = coins->vout[txin.prevout.n].scriptPubKey;
+            if ( info.fNotaryTx && scriptPubKey.size() == 35 && scriptPubKey[0] == 33 && scriptPubKey[34] == OP_CHECKSIG )
+                info.vInputPubkeys.push_back(std::vector<uint8_t>(scriptPubKey.begin() + 1, scriptPubKey.begin() + 34));
+            info.dPriority += (double)nValueIn * nConf;
+        }
+        info.nTotalIn += tx.GetShieldedValueIn();
+    }
+
+    // Priority is sum(valuein * age) / modified_txsize
+    info.dPriority = tx.ComputePriority(info.dPriority, info.nTxSize);
+}
+
 extern CCriticalSection cs_metrics;
 
 uint32_t Mining_start,Mining_height;
@@ -291,15 +472,20 @@ CBlockTemplate* CreateNewBlock(const CPubKey _pk,const CScript& _scriptPubKeyIn,
         SaplingMerkleTree sapling_tree;
         assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
         bool fPrintPriority = GetBoolArg("-printpriority", false);
 
-        // This vector will be sorted into a priority queue:
+        // The transactions that may go in the block, with their priority and own fee rate
+        std::map<CTxMemPool::txiter, std::pair<double, CFeeRate>, CTxMemPool::CompareIteratorByHash> mapCandidates;
+
+        // This vector will be sorted into a priority queue, a transaction only
+        // enters it once its mempool parents are in the block:
         vector<TxPriority> vecPriority;
         vecPriority.reserve(mempool.mapTx.size() + 1);
 
+        // what is known about the mempool transactions from earlier templates
+        std::map<uint256, CTemplateTxInfo> mapTxInfo;
+        const uint256 hashTip = pindexPrev->GetBlockHash();
+
         // now add transactions from the mem pool
         int32_t Notarisations = 0; uint64_t txvalue;
         for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
@@ -339,100 +525,49 @@ CBlockTemplate* CreateNewBlock(const CPubKey _pk,const CScript& _scriptPubKeyIn,
                 continue;
             }
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
+            uint256 hash = tx.GetHash();
+            CTemplateTxInfo &info = mapTxInfo[hash];
+            bool fCached = templateTxCache.Get(hash, info);
+            if ( !fCached || info.hashTip != hashTip )
+            {
+                UpdateTemplateTxInfo(tx, view, nHeight, hashTip, info);
+                templateTxCache.Put(hash, info);
+            }
+            if (info.fMissingInputs) continue;
+
+            double dPriority = info.dPriority;
+            CAmount nTotalIn = info.nTotalIn;
             bool fNotarisation = false;
             std::vector<int8_t> TMP_NotarisationNotaries;
-            if (tx.IsCoinImport())
+            if ( !tx.IsCoinImport() && numSN != 0 && notarypubkeys[0][0] != 0 )
             {
-                CAmount nValueIn = GetCoinImportValue(tx); // burn amount
-                nTotalIn += nValueIn;
-                dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
-            } else {
-                TMP_NotarisationNotaries.clear();
-                bool fToCryptoAddress = false;
-                if ( numSN != 0 && notarypubkeys[0][0] != 0 && squishy_is_notarytx(tx) == 1 )
-                    fToCryptoAddress = true;
-
-                BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                // loop over notaries array and extract index of signers.
+                BOOST_FOREACH(const std::vector<uint8_t>& pubkey, info.vInputPubkeys)
                 {
-                    // Read prev transaction
-                    if (!view.HaveCoins(txin.prevout.hash))
-                    {
-                        // This should never happen; all transactions in the memory
-                        // pool should connect to either transactions in the chain
-                        // or other transactions in the memory pool.
-                        if (!mempool.mapTx.count(txin.prevout.hash))
-                        {
-                            LogPrintf("ERROR: mempool transaction missing input\n");
-                            // if (fDebug) assert("mempool transaction missing input" == 0);
-                            fMissingInputs = true;
-                            if (porphan)
-                                vOrphan.pop_back();
-                            break;
-                        }
-
-                        // Has to wait for dependencies
-                        if (!porphan)
-                        {
-                            // Use list for automatic deletion
-                            vOrphan.push_back(COrphan(&tx));
-                            porphan = &vOrphan.back();
-                        }
-                        mapDependers[txin.prevout.hash].push_back(porphan);
-                        porphan->setDependsOn.insert(txin.prevout.hash);
-                        nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                        continue;
-                    }
-                    const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                    assert(coins);
-
-                    CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                    nTotalIn += nValueIn;
-
-                    int nConf = nHeight - coins->nHeight;
-                    
-                    uint8_t *script; int32_t scriptlen; uint256 hash; CTransaction tx1;
-                    // loop over notaries array and extract index of signers.
-                    if ( fToCryptoAddress && myGetTransaction(txin.prevout.hash,tx1,hash) )
+                    for (int8_t i = 0; i < numSN; i++) 
                     {
-                        for (int8_t i = 0; i < numSN; i++) 
+                        if ( memcmp(&pubkey[0],notarypubkeys[i],33) == 0 )
                         {
-                            script = (uint8_t *)&tx1.vout[txin.prevout.n].scriptPubKey[0];
-                            scriptlen = (int32_t)tx1.vout[txin.prevout.n].scriptPubKey.size();
-                            if ( scriptlen == 35 && script[0] == 33 && script[34] == OP_CHECKSIG && memcmp(script+1,notarypubkeys[i],33) == 0 )
-                            {
-                                // We can add the index of each notary to vector, and clear it if this notarisation is not valid later on.
-                                TMP_NotarisationNotaries.push_back(i);                          
-                            }
+                            // We can add the index of each notary to vector, and clear it if this notarisation is not valid later on.
+                            TMP_NotarisationNotaries.push_back(i);                          
                         }
                     }
-                    dPriority += (double)nValueIn * nConf;
                 }
-                if ( numSN != 0 && notarypubkeys[0][0] != 0 && TMP_NotarisationNotaries.size() >= numSN / 5 )
+                if ( TMP_NotarisationNotaries.size() >= numSN / 5 )
                 {
                     // check a notary didnt sign twice (this would be an invalid notarisation later on and cause problems)
                     std::set<int> checkdupes( TMP_NotarisationNotaries.begin(), TMP_NotarisationNotaries.end() );
                     if ( checkdupes.size() != TMP_NotarisationNotaries.size() ) 
                     {
                         LogPrintf( "possible notarisation is signed multiple times by same notary, passed as normal transaction.\n");
-                    } else fNotarisation = true;
+                    }
+                    else fNotarisation = true;
                 }
-                nTotalIn += tx.GetShieldedValueIn();
             }
 
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
             mempool.ApplyDeltas(hash, dPriority, nTotalIn);
 
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
+            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), info.nTxSize);
 
             if ( fNotarisation ) 
             {
@@ -468,12 +603,8 @@ CBlockTemplate* CreateNewBlock(const CPubKey _pk,const CScript& _scriptPubKeyIn,
                 dPriority -= 10;
                 // make sure notarisation is tx[1] in block. 
             }
-            if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            }
-            else
+            mapCandidates[mi] = std::make_pair(dPriority, feeRate);
+            if (info.vParents.empty())
                 vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
         }
 
@@ -482,149 +613,253 @@ CBlockTemplate* CreateNewBlock(const CPubKey _pk,const CScript& _scriptPubKeyIn,
         uint64_t nBlockTx = 0;
         int64_t interest;
         int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
+        CTxMemPool::setEntries inBlock;
+        indexed_package_set mapModifiedTx; // packages with ancestors in the block
 
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        // Opret spam limits
+        bool fOpretMinFee = mapArgs.count("-opretmintxfee") != 0;
+        CFeeRate opretMinFeeRate(400000); // default opretMinFeeRate (1 KMD per 250 Kb = 0.004 per 1 Kb = 400000 sat per 1 Kb)
+        if (fOpretMinFee)
+        {
+            CAmount n = 0;
+            if (ParseMoney(mapArgs["-opretmintxfee"], n) && n > 0)
+                opretMinFeeRate = CFeeRate(n);
+        }
 
-        while (!vecPriority.empty())
+        // Add a package, parents first, if every transaction of it fits and is valid on top of the block so far
+        auto addPackage = [&](const std::vector<CTxMemPool::txiter> &package, const CFeeRate &feeRate) -> bool
         {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+            CCoinsViewCache viewPackage(&view);
+            uint64_t nPackageSize = 0;
+            int nPackageSigOps = 0;
+            std::vector<CAmount> vTxFees;
+            std::vector<unsigned int> vTxSigOps;
+            BOOST_FOREACH(CTxMemPool::txiter it, package)
+            {
+                const CTransaction& tx = it->GetTx();
+                const uint256& hash = tx.GetHash();
+                CTemplateTxInfo &info = mapTxInfo[hash];
+
+                // Size limits
+                unsigned int nTxSize = info.nTxSize;
+
+                if (fOpretMinFee && info.nOpretSize > 256 && feeRate < opretMinFeeRate)
+                    return false;
+
+                if (nBlockSize + nPackageSize + nTxSize >= nBlockMaxSize-512) // room for extra autotx
+                    return false;
+
+                // Legacy limits on sigOps:
+                unsigned int nTxSigOps = info.nLegacySigOps;
+                if (nBlockSigOps + nPackageSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS-1)
+                    return false;
+
+                if (!viewPackage.HaveInputs(tx))
+                    return false;
+                CAmount nTxFees = viewPackage.GetValueIn(chainActive.Tip()->nHeight, interest, tx) - tx.GetValueOut();
+
+                // the input scripts of a transaction only need to pass once per branch, its inputs never change
+                bool fScriptChecks = !info.fScriptsChecked || info.nScriptsBranchId != consensusBranchId;
+                unsigned int nP2SHSigOps = fScriptChecks ? GetP2SHSigOpCount(tx, viewPackage) : info.nP2SHSigOps;
+                nTxSigOps += nP2SHSigOps;
+                if (nBlockSigOps + nPackageSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS-1)
+                    return false;
+                // Note that flags: we don't want to set mempool/IsStandard()
+                // policy here, but we still have to ensure that the block we
+                // create only contains transactions that are valid in new blocks.
+                CValidationState state;
+                PrecomputedTransactionData txdata(tx);
+                if (!ContextualCheckInputs(tx, state, viewPackage, fScriptChecks, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+                    return false;
+                if (fScriptChecks && !MayRunCryptoConditions(tx, viewPackage))
+                {
+                    info.fScriptsChecked = true;
+                    info.nScriptsBranchId = consensusBranchId;
+                    info.nP2SHSigOps = nP2SHSigOps;
+                    templateTxCache.Put(hash, info);
+                }
+                UpdateCoins(tx, viewPackage, nHeight);
+                nPackageSize += nTxSize;
+                nPackageSigOps += nTxSigOps;
+                vTxFees.push_back(nTxFees);
+                vTxSigOps.push_back(nTxSigOps);
+            }
+            viewPackage.Flush();
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+            for (size_t i = 0; i < package.size(); i++)
+            {
+                const CTransaction& tx = package[i]->GetTx();
+                BOOST_FOREACH(const OutputDescription &outDescription, tx.vShieldedOutput) {
+                    sapling_tree.append(outDescription.cm);
+                }
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+                // Added
+                pblock->vtx.push_back(tx);
+                pblocktemplate->vTxFees.push_back(vTxFees[i]);
+                pblocktemplate->vTxSigOps.push_back(vTxSigOps[i]);
+                ++nBlockTx;
+                nFees += vTxFees[i];
+                inBlock.insert(package[i]);
+                mapModifiedTx.erase(package[i]);
 
-            // Opret spam limits
-            if (mapArgs.count("-opretmintxfee"))
-            {
-                CAmount n = 0;
-                CFeeRate opretMinFeeRate;
-                if (ParseMoney(mapArgs["-opretmintxfee"], n) && n > 0)
-                    opretMinFeeRate = CFeeRate(n);
-                else
-                    opretMinFeeRate = CFeeRate(400000); // default opretMinFeeRate (1 KMD per 250 Kb = 0.004 per 1 Kb = 400000 sat per 1 Kb)
-
-                bool fSpamTx = false;
-                unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-                unsigned int nTxOpretSize = 0;
-
-                // calc total oprets size
-                BOOST_FOREACH(const CTxOut& txout, tx.vout) {
-                    if (txout.scriptPubKey.IsOpReturn()) {
-                        CScript::const_iterator it = txout.scriptPubKey.begin() + 1;
-                        opcodetype op;
-                        std::vector<uint8_t> opretData;
-                        if (txout.scriptPubKey.GetOp(it, op, opretData)) {
-                            //std::cerr << HexStr(opretData.begin(), opretData.end()) << std::endl;
-                            nTxOpretSize += opretData.size();
-                        }
-                    }
+                if (fPrintPriority)
+                {
+                    LogPrintf("priority %.1f fee %s txid %s\n", mapCandidates[package[i]].first, feeRate.ToString(), tx.GetHash().ToString());
                 }
+            }
+            nBlockSize += nPackageSize;
+            nBlockSigOps += nPackageSigOps;
 
-                if ((nTxOpretSize > 256) && (feeRate < opretMinFeeRate)) fSpamTx = true;
-                // std::cerr << tx.GetHash().ToString() << " nTxSize." << nTxSize << " nTxOpretSize." << nTxOpretSize << " feeRate." << feeRate.ToString() << " opretMinFeeRate." << opretMinFeeRate.ToString() << " fSpamTx." << fSpamTx << std::endl;
-                if (fSpamTx) continue;
-                // std::cerr << tx.GetHash().ToString() << " vecPriority.size() = " << vecPriority.size() << std::endl;
+            // What is left of the packages of their descendants no longer includes them
+            BOOST_FOREACH(CTxMemPool::txiter it, package)
+            {
+                CTxMemPool::setEntries setDescendants;
+                mempool.CalculateDescendants(it, setDescendants);
+                BOOST_FOREACH(CTxMemPool::txiter desc, setDescendants)
+                {
+                    if (inBlock.count(desc))
+                        continue;
+                    indexed_package_set::iterator mit = mapModifiedTx.find(desc);
+                    if (mit == mapModifiedTx.end())
+                        mit = mapModifiedTx.insert(CTxPackageEntry(desc)).first;
+                    mapModifiedTx.modify(mit, update_for_ancestor_added(it->GetTxSize(), it->GetModifiedFee()));
+                }
             }
+            return true;
+        };
+
+        // High-priority transactions first, regardless of the fees they pay
+        if (nBlockPrioritySize > 0)
+        {
+            TxPriorityCompare comparer(false);
+            std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
-            if (nBlockSize + nTxSize >= nBlockMaxSize-512) // room for extra autotx
+            while (!vecPriority.empty())
             {
-                //LogPrintf("nBlockSize %d + %d nTxSize >= %d nBlockMaxSize\n",(int32_t)nBlockSize,(int32_t)nTxSize,(int32_t)nBlockMaxSize);
-                continue;
+                // Take highest priority transaction off the priority queue:
+                double dPriority = vecPriority.front().get<0>();
+                CFeeRate feeRate = vecPriority.front().get<1>();
+                const CTransaction& tx = *(vecPriority.front().get<2>());
+
+                std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                vecPriority.pop_back();
+
+                // the rest of the block goes by package fee rate
+                if ((nBlockSize + mapTxInfo[tx.GetHash()].nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))
+                    break;
+
+                CTxMemPool::txiter it = mempool.mapTx.find(tx.GetHash());
+                if (!addPackage(std::vector<CTxMemPool::txiter>(1, it), feeRate))
+                    continue;
+
+                // Add transactions that depend on this one to the priority queue once all their parents are in
+                std::set<uint256> setChildren;
+                for (uint32_t n = 0; n < tx.vout.size(); n++)
+                {
+                    std::map<COutPoint, CInPoint>::const_iterator next = mempool.mapNextTx.find(COutPoint(tx.GetHash(), n));
+                    if (next != mempool.mapNextTx.end())
+                        setChildren.insert(next->second.ptx->GetHash());
+                }
+                BOOST_FOREACH(const uint256& child, setChildren)
+                {
+                    CTxMemPool::txiter cit = mempool.mapTx.find(child);
+                    if (cit == mempool.mapTx.end() || !mapCandidates.count(cit))
+                        continue;
+                    bool fReady = true;
+                    BOOST_FOREACH(const uint256& parent, mapTxInfo[child].vParents)
+                    {
+                        CTxMemPool::txiter pit = mempool.mapTx.find(parent);
+                        if (pit == mempool.mapTx.end() || !inBlock.count(pit))
+                            fReady = false;
+                    }
+                    if (fReady)
+                    {
+                        vecPriority.push_back(TxPriority(mapCandidates[cit].first, mapCandidates[cit].second, &cit->GetTx()));
+                        std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                    }
+                }
             }
+        }
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS-1)
+        // Then whole packages, by ancestor fee rate: the best of the mempool order
+        // and of the packages that lost ancestors to the block
+        CTxMemPool::setEntries failedTx;
+        CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+        while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+        {
+            if (mi != mempool.mapTx.get<ancestor_score>().end())
             {
-                //LogPrintf("A nBlockSigOps %d + %d nTxSigOps >= %d MAX_BLOCK_SIGOPS-1\n",(int32_t)nBlockSigOps,(int32_t)nTxSigOps,(int32_t)MAX_BLOCK_SIGOPS);
-                continue;
+                CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+                if (inBlock.count(it) || failedTx.count(it) || mapModifiedTx.count(it) || !mapCandidates.count(it))
+                {
+                    ++mi;
+                    continue;
+                }
             }
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
+
+            indexed_package_set::index<ancestor_score>::type::iterator modit = mapModifiedTx.get<ancestor_score>().begin();
+            CTxMemPool::txiter iter;
+            bool fUsingModified = false;
+            if (mi == mempool.mapTx.get<ancestor_score>().end())
             {
-                //LogPrintf("fee rate skip\n");
-                continue;
+                iter = modit->iter;
+                fUsingModified = true;
             }
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
+            else
             {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                iter = mempool.mapTx.project<0>(mi);
+                if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                        CompareTxMemPoolEntryByAncestorFee()(*modit, CTxPackageEntry(iter)))
+                {
+                    iter = modit->iter;
+                    fUsingModified = true;
+                }
+                else
+                    ++mi;
             }
-
-            if (!view.HaveInputs(tx))
+            uint64_t nPackageSize = fUsingModified ? modit->nSizeWithAncestors : iter->GetSizeWithAncestors();
+            CAmount nPackageFees = fUsingModified ? modit->nModFeesWithAncestors : iter->GetModFeesWithAncestors();
+            if (fUsingModified)
             {
-                //LogPrintf("dont have inputs\n");
-                continue;
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+                if (failedTx.count(iter))
+                    continue;
             }
-            CAmount nTxFees = view.GetValueIn(chainActive.Tip()->nHeight, interest, tx) - tx.GetValueOut();
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS-1)
+            if (nBlockSize + nPackageSize >= nBlockMaxSize-512 || !mapCandidates.count(iter))
             {
-                //LogPrintf("B nBlockSigOps %d + %d nTxSigOps >= %d MAX_BLOCK_SIGOPS-1\n",(int32_t)nBlockSigOps,(int32_t)nTxSigOps,(int32_t)MAX_BLOCK_SIGOPS);
+                failedTx.insert(iter);
                 continue;
             }
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            PrecomputedTransactionData txdata(tx);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+            // Skip free transactions if we're past the minimum block size:
+            double dPriorityDelta = 0;
+            CAmount nFeeDelta = 0;
+            mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriorityDelta, nFeeDelta);
+            CFeeRate packageFeeRate(nPackageFees, nPackageSize);
+            if ((dPriorityDelta <= 0) && (nFeeDelta <= 0) && (packageFeeRate < ::minRelayTxFee) && (nBlockSize + nPackageSize >= nBlockMinSize))
             {
-                //LogPrintf("context failure\n");
+                failedTx.insert(iter);
                 continue;
             }
-            UpdateCoins(tx, view, nHeight);
-
-            BOOST_FOREACH(const OutputDescription &outDescription, tx.vShieldedOutput) {
-                sapling_tree.append(outDescription.cm);
-            }
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
 
-            if (fPrintPriority)
+            // The package is the transaction and its ancestors that are not in the block yet
+            CTxMemPool::setEntries setAncestors;
+            std::string dummy;
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            mempool.CalculateMemPoolAncestors(*iter, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+            std::vector<CTxMemPool::txiter> package(1, iter);
+            bool fCandidates = true;
+            BOOST_FOREACH(CTxMemPool::txiter anc, setAncestors)
             {
-                LogPrintf("priority %.1f fee %s txid %s\n",dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
-            {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
+                if (inBlock.count(anc))
+                    continue;
+                if (!mapCandidates.count(anc))
+                    fCandidates = false;
+                package.push_back(anc);
             }
+            std::sort(package.begin(), package.end(), CompareTxIterByAncestorCount());
+            if (!fCandidates || !addPackage(package, packageFeeRate))
+                failedTx.insert(iter);
         }
 
         nLastBlockTx = nBlockTx;
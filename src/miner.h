@@ -22,10 +22,14 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "sync.h"
+#include "validationinterface.h"
 
 #include <boost/optional.hpp>
 #include <stdint.h>
 
+#include <map>
+
 class CBlockIndex;
 class CScript;
 #ifdef ENABLE_WALLET
@@ -45,6 +49,63 @@ struct CBlockTemplate
 };
 #define SQUISHY_MAXGPUCOUNT 65
 
+/***
+ * What CreateNewBlock works out about a mempool transaction, kept between
+ * templates so that a new template only does this work for the transactions
+ * that arrived since the last one. The input data depends on the coins of the
+ * tip and is recomputed when the tip changes.
+ */
+struct CTemplateTxInfo
+{
+    // independent of the tip
+    unsigned int nTxSize;
+    unsigned int nLegacySigOps;
+    unsigned int nOpretSize;        // total size of the OP_RETURN data, for -opretmintxfee
+    bool fNotaryTx;                 // squishy_is_notarytx
+    bool fScriptsChecked;           // the input scripts passed for nScriptsBranchId, never set for crypto-conditions
+    uint32_t nScriptsBranchId;
+    unsigned int nP2SHSigOps;       // set with fScriptsChecked
+
+    // computed at hashTip
+    uint256 hashTip;
+    bool fMissingInputs;
+    double dPriority;               // before the prioritisetransaction deltas
+    CAmount nTotalIn;               // before the prioritisetransaction deltas
+    std::vector<uint256> vParents;  // for each input spending a mempool transaction, its txid
+    std::vector<std::vector<uint8_t>> vInputPubkeys;   // pubkeys of the pay to pubkey inputs of a notary tx, in input order
+
+    CTemplateTxInfo() : nTxSize(0), nLegacySigOps(0), nOpretSize(0), fNotaryTx(false), fScriptsChecked(false),
+        nScriptsBranchId(0), nP2SHSigOps(0), fMissingInputs(false), dPriority(0), nTotalIn(0) {}
+};
+
+/***
+ * The CTemplateTxInfo of the mempool transactions. Confirmed transactions are
+ * dropped as blocks connect and the ones that left the mempool otherwise when
+ * the tip changes.
+ */
+class CTemplateTxCache : public CValidationInterface
+{
+public:
+    /***
+     * @param txid the transaction
+     * @param[out] info what is known about it
+     * @returns false if nothing is
+     */
+    bool Get(const uint256 &txid, CTemplateTxInfo &info) const;
+    void Put(const uint256 &txid, const CTemplateTxInfo &info);
+    size_t Size() const;
+
+protected:
+    void SyncTransaction(const CTransaction &tx, const CBlock *pblock);
+    void UpdatedBlockTip(const CBlockIndex *pindex);
+
+private:
+    mutable CCriticalSection cs;
+    std::map<uint256, CTemplateTxInfo> mapInfo;
+};
+
+extern CTemplateTxCache templateTxCache;
+
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CPubKey _pk,const CScript& scriptPubKeyIn, int32_t gpucount, bool isStake = false);
 #ifdef ENABLE_WALLET
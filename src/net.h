@@ -349,6 +349,10 @@ public:
     //    until it has initialized its bloom filter.
     bool fRelayTxes;
     bool fSentAddr;
+    // The peer sent sendcmpct with a version we understand, and whether it asked
+    // for new blocks to be pushed as cmpctblock instead of announced with an inv
+    bool fSupportsCompactBlocks;
+    bool fPreferHeaderAndIDs;
     CSemaphoreGrant grantOutbound;
     CCriticalSection cs_filter;
     CBloomFilter* pfilter;
@@ -500,6 +504,12 @@ public:
         }
     }
 
+    bool HasInventoryKnown(const CInv& inv)
+    {
+        LOCK(cs_inventory);
+        return setInventoryKnown.count(inv) != 0;
+    }
+
     void PushInventory(const CInv& inv)
     {
         {
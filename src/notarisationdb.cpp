@@ -7,12 +7,20 @@
 #include "notaries_staked.h"
 
 #include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <set>
 
 
 NotarisationDB *pnotarisations;
 
+static const char DB_NOTARISATION_SYMBOL = 'S';
+static const char DB_NOTARISATION_HEIGHT = 'H';
+static const char DB_NOTARISATION_FLAG = 'F';
+
 
-NotarisationDB::NotarisationDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "notarisations", nCacheSize, fMemory, fWipe, false, 64) { }
+NotarisationDB::NotarisationDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "notarisations", nCacheSize, fMemory, fWipe, false, 64),
+    heights(GetDataDir() / "notarisationheights", nCacheSize / 4, fMemory, fWipe, false, 64) { }
 
 /****
  * Get notarisations within a block
@@ -109,6 +117,84 @@ void EraseBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &
     }
 }
 
+/***
+ * Write the height index entries of a connected block
+ * @param notarisations the notarisations of the block
+ * @param blockHash the block
+ * @param height its height
+ * @param batch the collection of db transactions
+ */
+void WriteNotarisationHeights(const NotarisationsInBlock &notarisations, const uint256 &blockHash, int height, CDBBatch &batch)
+{
+    if (notarisations.empty())
+        return;
+    std::set<std::string> seen;
+    for(const Notarisation &n : notarisations)
+    {
+        // only the first notarisation of a symbol in the block is indexed
+        if (seen.insert(n.second.symbol).second)
+            batch.Write(CNotarisationHeightKey(DB_NOTARISATION_SYMBOL, n.second.symbol, height), std::make_pair(blockHash, n));
+    }
+    batch.Write(CNotarisationHeightKey(DB_NOTARISATION_HEIGHT, "", height), blockHash);
+}
+
+/***
+ * Erase the height index entries of a disconnected block
+ * @param notarisations the notarisations of the block
+ * @param height its height
+ * @param batch the collection of db transactions
+ */
+void EraseNotarisationHeights(const NotarisationsInBlock &notarisations, int height, CDBBatch &batch)
+{
+    for(const Notarisation &n : notarisations)
+        batch.Erase(CNotarisationHeightKey(DB_NOTARISATION_SYMBOL, n.second.symbol, height));
+    batch.Erase(CNotarisationHeightKey(DB_NOTARISATION_HEIGHT, "", height));
+}
+
+/****
+ * Build the height indexes from the notarisations of the active chain,
+ * once, for databases created before they existed
+ * @returns false on a database error
+ */
+bool BuildNotarisationHeightIndex()
+{
+    bool fBuilt = false;
+    if (pnotarisations->heights.Read(std::make_pair(DB_NOTARISATION_FLAG, std::string("heightindex")), fBuilt) && fBuilt)
+        return true;
+
+    LogPrintf("%s: indexing notarisations of %d blocks\n", __func__, chainActive.Height() + 1);
+    CDBBatch batch(pnotarisations->heights);
+    int64_t nBlocks = 0;
+    for (int h = 0; h <= chainActive.Height(); h++)
+    {
+        NotarisationsInBlock notarisations;
+        uint256 blockHash = chainActive[h]->GetBlockHash();
+        if (!GetBlockNotarisations(blockHash, notarisations))
+            continue;
+        WriteNotarisationHeights(notarisations, blockHash, h, batch);
+        if (++nBlocks % 10000 == 0)
+        {
+            if (!pnotarisations->heights.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+    batch.Write(std::make_pair(DB_NOTARISATION_FLAG, std::string("heightindex")), true);
+    if (!pnotarisations->heights.WriteBatch(batch, true))
+        return false;
+    LogPrintf("%s: indexed %d notarised blocks\n", __func__, nBlocks);
+    return true;
+}
+
+/****
+ * Check that an index entry belongs to the active chain, entries above the
+ * tip can survive an unclean shutdown
+ */
+static bool IsActiveNotarisedBlock(int height, const uint256 &blockHash)
+{
+    return height >= 0 && height <= chainActive.Height() && chainActive[height]->GetBlockHash() == blockHash;
+}
+
 /*****
  * Scan notarisationsdb backwards for blocks containing a notarisation
  * for given symbol. Return height of matched notarisation or 0.
@@ -123,22 +209,110 @@ int ScanNotarisationsDB(int height, std::string symbol, int scanLimitBlocks, Not
     if (height < 0 || height > chainActive.Height())
         return 0;
 
-    for (int i=0; i<scanLimitBlocks; i++) 
+    int minHeight = std::max(height - scanLimitBlocks + 1, 0);
+    boost::scoped_ptr<CDBIterator> pcursor(pnotarisations->heights.NewIterator());
+    // land on the last entry at or below height
+    pcursor->Seek(CNotarisationHeightKey(DB_NOTARISATION_SYMBOL, symbol, height + 1));
+    if (pcursor->Valid())
+        pcursor->Prev();
+    else
+        pcursor->SeekToLast();
+    for ( ; pcursor->Valid(); pcursor->Prev())
     {
-        if (i > height) 
+        CNotarisationHeightKey key;
+        if (!pcursor->GetKey(key) || key.prefix != DB_NOTARISATION_SYMBOL || key.symbol != symbol || key.height < minHeight)
             break;
-        NotarisationsInBlock notarisations;
-        uint256 blockHash = *chainActive[height-i]->phashBlock;
-        if (GetBlockNotarisations(blockHash, notarisations))
+        std::pair<uint256,Notarisation> value;
+        if (!pcursor->GetValue(value))
+            continue;
+        if (IsActiveNotarisedBlock(key.height, value.first))
         {
-            for(Notarisation& nota : notarisations) {
-                if (strcmp(nota.second.symbol, symbol.data()) == 0) 
-                {
-                    out = nota;
-                    return height-i;
-                }
-            }
+            out = value.second;
+            return key.height;
+        }
+    }
+    return 0;
+}
+
+/*****
+ * Scan notarisationsdb forwards for blocks containing a notarisation
+ * for given symbol. Return height of matched notarisation or 0.
+ * @param height where to start the search
+ * @param symbol the symbol to look for
+ * @param scanLimitBlocks max number of blocks to search
+ * @param out the first Notarization found
+ * @returns height (0 indicates error)
+ */
+int ScanNotarisationsDBForward(int height, std::string symbol, int scanLimitBlocks, Notarisation& out)
+{
+    if (height < 0 || height > chainActive.Height())
+        return 0;
+
+    boost::scoped_ptr<CDBIterator> pcursor(pnotarisations->heights.NewIterator());
+    for (pcursor->Seek(CNotarisationHeightKey(DB_NOTARISATION_SYMBOL, symbol, height)); pcursor->Valid(); pcursor->Next())
+    {
+        CNotarisationHeightKey key;
+        if (!pcursor->GetKey(key) || key.prefix != DB_NOTARISATION_SYMBOL || key.symbol != symbol || key.height >= height + scanLimitBlocks)
+            break;
+        std::pair<uint256,Notarisation> value;
+        if (!pcursor->GetValue(value))
+            continue;
+        if (IsActiveNotarisedBlock(key.height, value.first))
+        {
+            out = value.second;
+            return key.height;
         }
     }
     return 0;
 }
+
+/*****
+ * Find the nearest block at or below a height that contains notarisations
+ * @param height where to start the search
+ * @param minHeight the lowest height to consider
+ * @param[out] blockHash the block found
+ * @returns its height, or -1 if there is none
+ */
+int GetPrevNotarisedHeight(int height, int minHeight, uint256 &blockHash)
+{
+    if (height < minHeight)
+        return -1;
+    boost::scoped_ptr<CDBIterator> pcursor(pnotarisations->heights.NewIterator());
+    pcursor->Seek(CNotarisationHeightKey(DB_NOTARISATION_HEIGHT, "", height + 1));
+    if (pcursor->Valid())
+        pcursor->Prev();
+    else
+        pcursor->SeekToLast();
+    for ( ; pcursor->Valid(); pcursor->Prev())
+    {
+        CNotarisationHeightKey key;
+        if (!pcursor->GetKey(key) || key.prefix != DB_NOTARISATION_HEIGHT || !key.symbol.empty() || key.height < minHeight)
+            break;
+        if (pcursor->GetValue(blockHash) && IsActiveNotarisedBlock(key.height, blockHash))
+            return key.height;
+    }
+    return -1;
+}
+
+/*****
+ * Find the nearest block at or above a height that contains notarisations
+ * @param height where to start the search
+ * @param maxHeight the highest height to consider
+ * @param[out] blockHash the block found
+ * @returns its height, or -1 if there is none
+ */
+int GetNextNotarisedHeight(int height, int maxHeight, uint256 &blockHash)
+{
+    if (height > maxHeight)
+        return -1;
+    boost::scoped_ptr<CDBIterator> pcursor(pnotarisations->heights.NewIterator());
+    for (pcursor->Seek(CNotarisationHeightKey(DB_NOTARISATION_HEIGHT, "", std::max(height, 0))); pcursor->Valid(); pcursor->Next())
+    {
+        CNotarisationHeightKey key;
+        if (!pcursor->GetKey(key) || key.prefix != DB_NOTARISATION_HEIGHT || !key.symbol.empty() || key.height > maxHeight)
+            break;
+        if (pcursor->GetValue(blockHash) && IsActiveNotarisedBlock(key.height, blockHash))
+            return key.height;
+    }
+    return -1;
+}
@@ -10,6 +10,10 @@ class NotarisationDB : public CDBWrapper
 {
 public:
     NotarisationDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    //! The height ordered indexes, in a database of their own so that their
+    //! keys never sort between the block and notarisation hash keys
+    CDBWrapper heights;
 };
 
 
@@ -18,6 +22,41 @@ extern NotarisationDB *pnotarisations;
 typedef std::pair<uint256,NotarisationData> Notarisation;
 typedef std::vector<Notarisation> NotarisationsInBlock;
 
+/****
+ * Key of the height ordered notarisation indexes.
+ * DB_NOTARISATION_SYMBOL keys hold the block hash and first notarisation of
+ * a symbol at a height, DB_NOTARISATION_HEIGHT keys (empty symbol) hold the
+ * hash of every block that has notarisations. Heights are stored big endian
+ * so a seek lands on the nearest notarised height. They are kept in
+ * NotarisationDB::heights, where an iterator leaves an index on the prefix.
+ */
+struct CNotarisationHeightKey
+{
+    char prefix;
+    std::string symbol;
+    int32_t height;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 1 + GetSizeOfCompactSize(symbol.size()) + symbol.size() + 4;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, prefix);
+        ::Serialize(s, symbol);
+        ser_writedata32be(s, height);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        prefix = ser_readdata8(s);
+        ::Unserialize(s, symbol);
+        height = ser_readdata32be(s);
+    }
+
+    CNotarisationHeightKey(char prefixIn, const std::string &symbolIn, int32_t heightIn) :
+        prefix(prefixIn), symbol(symbolIn), height(heightIn) {}
+    CNotarisationHeightKey() : prefix(0), height(0) {}
+};
+
 /****
  * Get notarisations within a block
  * @param block the block to scan
@@ -61,5 +100,52 @@ void EraseBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &
  * @returns height (0 indicates error)
  */
 int ScanNotarisationsDB(int height, std::string symbol, int scanLimitBlocks, Notarisation& out);
+/*****
+ * Scan notarisationsdb forwards for blocks containing a notarisation
+ * for given symbol. Return height of matched notarisation or 0.
+ * @param height where to start the search
+ * @param symbol the symbol to look for
+ * @param scanLimitBlocks max number of blocks to search
+ * @param out the first Notarization found
+ * @returns height (0 indicates error)
+ */
+int ScanNotarisationsDBForward(int height, std::string symbol, int scanLimitBlocks, Notarisation& out);
+/*****
+ * Find the nearest block at or below a height that contains notarisations
+ * @param height where to start the search
+ * @param minHeight the lowest height to consider
+ * @param[out] blockHash the block found
+ * @returns its height, or -1 if there is none
+ */
+int GetPrevNotarisedHeight(int height, int minHeight, uint256 &blockHash);
+/*****
+ * Find the nearest block at or above a height that contains notarisations
+ * @param height where to start the search
+ * @param maxHeight the highest height to consider
+ * @param[out] blockHash the block found
+ * @returns its height, or -1 if there is none
+ */
+int GetNextNotarisedHeight(int height, int maxHeight, uint256 &blockHash);
+/***
+ * Write the height index entries of a connected block
+ * @param notarisations the notarisations of the block
+ * @param blockHash the block
+ * @param height its height
+ * @param batch the collection of db transactions
+ */
+void WriteNotarisationHeights(const NotarisationsInBlock &notarisations, const uint256 &blockHash, int height, CDBBatch &batch);
+/***
+ * Erase the height index entries of a disconnected block
+ * @param notarisations the notarisations of the block
+ * @param height its height
+ * @param batch the collection of db transactions
+ */
+void EraseNotarisationHeights(const NotarisationsInBlock &notarisations, int height, CDBBatch &batch);
+/****
+ * Build the height indexes from the notarisations of the active chain,
+ * once, for databases created before they existed
+ * @returns false on a database error
+ */
+bool BuildNotarisationHeightIndex();
 
 #endif  /* NOTARISATIONDB_H */
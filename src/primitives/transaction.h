@@ -36,6 +36,7 @@
 #endif
 
 #include <array>
+#include <memory>
 
 #include <boost/variant.hpp>
 
@@ -824,4 +825,8 @@ struct CMutableTransaction
     uint256 GetHash() const;
 };
 
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+static inline CTransactionRef MakeTransactionRef() { return std::make_shared<const CTransaction>(); }
+template <typename Tx> static inline CTransactionRef MakeTransactionRef(Tx&& txIn) { return std::make_shared<const CTransaction>(std::forward<Tx>(txIn)); }
+
 #endif // BITCOIN_PRIMITIVES_TRANSACTION_H
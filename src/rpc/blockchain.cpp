@@ -31,6 +31,7 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txcache.h"
 #include "util.h"
 #include "script/script.h"
 #include "script/script_error.h"
@@ -721,16 +722,23 @@ UniValue getlastsegidstakes(const UniValue& params, bool fHelp, const CPubKey& m
     int32_t pow = 0;
     int32_t notset = 0;
 
-    for (int64_t i = chainActive.Height(); i >  chainActive.Height()-depth; i--)
+    arith_uint256 powsum;
+    // the last SQUISHY_SEGID_WINDOW blocks are counted as the tip moves, older segids are persisted in the block index
+    if ( depth == SQUISHY_SEGID_WINDOW && squishy_segidwindow(chainActive.Height()+1,segids,&pow,&powsum,&notset) )
+        pow -= notset;
+    else
     {
-        int8_t segid = squishy_segid(0,i);
-        //CBlockIndex* pblockindex = chainActive[i];
-        if ( segid >= 0 )
-            segids[segid] += 1;
-        else if ( segid == -1 )
-            pow++;
-        else
-            notset++;
+        for (int64_t i = chainActive.Height(); i >  chainActive.Height()-depth; i--)
+        {
+            int8_t segid = squishy_segid(0,i);
+            //CBlockIndex* pblockindex = chainActive[i];
+            if ( segid >= 0 )
+                segids[segid] += 1;
+            else if ( segid == -1 )
+                pow++;
+            else
+                notset++;
+        }
     }
     
     int8_t posperc = 100*(depth-pow)/depth;
@@ -1343,6 +1351,11 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp, const CPubKey& my
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"size_on_disk\": xxxxxx,   (numeric) the estimated size of the block and undo files on disk\n"
+            "  \"blockindex\": {           (object) memory held by the block index\n"
+            "     \"entries\": xxxxxx,     (numeric) number of block index entries\n"
+            "     \"solutions\": xxxxxx,   (numeric) entries still holding their Equihash solution in memory\n"
+            "     \"usage\": xxxxxx        (numeric) estimated memory usage in bytes\n"
+            "  },\n"
             "  \"commitments\": xxxxxx,    (numeric) the current number of note commitments in the commitment tree\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
@@ -1395,6 +1408,14 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp, const CPubKey& my
     obj.push_back(Pair("size_on_disk",          CalculateCurrentUsage()));
     obj.push_back(Pair("pruned",                fPruneMode));
 
+    int64_t nSolutions;
+    size_t nBlockIndexUsage = BlockIndexDynamicUsage(nSolutions);
+    UniValue blockindex(UniValue::VOBJ);
+    blockindex.push_back(Pair("entries",        (int64_t)mapBlockIndex.size()));
+    blockindex.push_back(Pair("solutions",      nSolutions));
+    blockindex.push_back(Pair("usage",          (int64_t)nBlockIndexUsage));
+    obj.push_back(Pair("blockindex",            blockindex));
+
     SproutMerkleTree tree;
     pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), tree);
     obj.push_back(Pair("commitments",           static_cast<uint64_t>(tree.size())));
@@ -1710,6 +1731,65 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
     return mempoolInfoToJSON();
 }
 
+UniValue gettxcacheinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "gettxcacheinfo\n"
+            "\nReturns statistics of the transaction lookup cache used by contract validation.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx           (numeric) Transactions currently cached\n"
+            "  \"maxentries\": xxxxx        (numeric) Cache capacity (-txlookupcache)\n"
+            "  \"hits\": xxxxx              (numeric) Lookups answered from the cache\n"
+            "  \"misses\": xxxxx            (numeric) Lookups read from the block files\n"
+            "  \"hitrate\": x.xxx           (numeric) hits / (hits + misses)\n"
+            "  \"avghitmicros\": x.xxx      (numeric) Average latency of a hit in microseconds\n"
+            "  \"avgmissmicros\": x.xxx     (numeric) Average latency of a miss in microseconds\n"
+            "  \"mmap\": true|false         (boolean) If block files are memory mapped (-mmapblockfiles)\n"
+            "  \"mappedfiles\": xxxxx       (numeric) Number of block files currently mapped\n"
+            "  \"mappedbytes\": xxxxx       (numeric) Total size of the mappings\n"
+            "  \"rawblocks\": {             (object) Blocks kept as sent to peers (-rawblockcache)\n"
+            "    \"entries\": xxxxx         (numeric) Blocks currently cached\n"
+            "    \"maxentries\": xxxxx      (numeric) Cache capacity\n"
+            "    \"bytes\": xxxxx           (numeric) Total size of the cached blocks\n"
+            "    \"hits\": xxxxx            (numeric) Blocks sent from the cache\n"
+            "    \"misses\": xxxxx          (numeric) Blocks read from the block files\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettxcacheinfo", "")
+            + HelpExampleRpc("gettxcacheinfo", "")
+        );
+
+    CTxLookupCache::Stats stats = txLookupCache.GetStats();
+    uint64_t nMappedBytes;
+    size_t nMappedFiles = blockFileMapper.GetMappedFiles(nMappedBytes);
+    uint64_t nLookups = stats.nHits + stats.nMisses;
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (int64_t)stats.nEntries));
+    ret.push_back(Pair("maxentries", (int64_t)stats.nMaxEntries));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (int64_t)stats.nMisses));
+    ret.push_back(Pair("hitrate", nLookups == 0 ? 0. : (double)stats.nHits / nLookups));
+    ret.push_back(Pair("avghitmicros", stats.nHits == 0 ? 0. : (double)stats.nHitMicros / stats.nHits));
+    ret.push_back(Pair("avgmissmicros", stats.nMisses == 0 ? 0. : (double)stats.nMissMicros / stats.nMisses));
+    ret.push_back(Pair("mmap", blockFileMapper.IsEnabled()));
+    ret.push_back(Pair("mappedfiles", (int64_t)nMappedFiles));
+    ret.push_back(Pair("mappedbytes", (int64_t)nMappedBytes));
+
+    CRawBlockCache::Stats rawStats = rawBlockCache.GetStats();
+    UniValue rawblocks(UniValue::VOBJ);
+    rawblocks.push_back(Pair("entries", (int64_t)rawStats.nEntries));
+    rawblocks.push_back(Pair("maxentries", (int64_t)rawStats.nMaxEntries));
+    rawblocks.push_back(Pair("bytes", (int64_t)rawStats.nBytes));
+    rawblocks.push_back(Pair("hits", (int64_t)rawStats.nHits));
+    rawblocks.push_back(Pair("misses", (int64_t)rawStats.nMisses));
+    ret.push_back(Pair("rawblocks", rawblocks));
+    return ret;
+}
+
 inline CBlockIndex* LookupBlockIndex(const uint256& hash)
 {
     AssertLockHeld(cs_main);
@@ -19,6 +19,7 @@
 
 #include "rpc/server.h"
 
+#include "blockencodings.h"
 #include "clientversion.h"
 #include "main.h"
 #include "net.h"
@@ -536,6 +537,24 @@ UniValue getnetworkinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "  }\n"
             "  ,...\n"
             "  ]\n"
+            "  \"compactblocks\": {                     (object) compact block relay\n"
+            "    \"enabled\": true|false,               (boolean) if compact blocks are relayed (-cmpctblocks)\n"
+            "    \"received\": xxxxx,                   (numeric) cmpctblock messages we started a reconstruction from\n"
+            "    \"reconstructed\": xxxxx,              (numeric) blocks rebuilt without another round trip\n"
+            "    \"roundtrips\": xxxxx,                 (numeric) getblocktxn requests sent for missing transactions\n"
+            "    \"roundtripsfilled\": xxxxx,           (numeric) blocks completed by the blocktxn answer\n"
+            "    \"fullblockfallbacks\": xxxxx,         (numeric) reconstructions abandoned for a full block download\n"
+            "    \"txfrommempool\": xxxxx,              (numeric) transactions found in our mempool\n"
+            "    \"txrequested\": xxxxx,                (numeric) transactions requested from peers\n"
+            "    \"sent\": xxxxx,                       (numeric) cmpctblock messages sent\n"
+            "    \"blocktxnserved\": xxxxx              (numeric) getblocktxn requests answered\n"
+            "  }\n"
+            "  \"nspv\": {                             (object) NSPV request server\n"
+            "    \"queued\": xxxxx,                     (numeric) requests waiting for a worker thread\n"
+            "    \"dropped\": xxxxx,                    (numeric) requests dropped because a queue was full\n"
+            "    \"cachehits\": xxxxx,                  (numeric) responses sent from the response cache\n"
+            "    \"cachemisses\": xxxxx                 (numeric) cacheable responses that had to be built\n"
+            "  }\n"
             "  \"warnings\": \"...\"                    (string) any network warnings (such as alert messages) \n"
             "}\n"
             "\nExamples:\n"
@@ -567,6 +586,24 @@ UniValue getnetworkinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
         }
     }
     obj.push_back(Pair("localaddresses", localAddresses));
+    UniValue cmpct(UniValue::VOBJ);
+    cmpct.push_back(Pair("enabled", fCompactBlocks));
+    cmpct.push_back(Pair("received", (uint64_t)cmpctBlockStats.nReceived));
+    cmpct.push_back(Pair("reconstructed", (uint64_t)cmpctBlockStats.nReconstructed));
+    cmpct.push_back(Pair("roundtrips", (uint64_t)cmpctBlockStats.nRoundTrips));
+    cmpct.push_back(Pair("roundtripsfilled", (uint64_t)cmpctBlockStats.nRoundTripsFilled));
+    cmpct.push_back(Pair("fullblockfallbacks", (uint64_t)cmpctBlockStats.nFullBlockFallbacks));
+    cmpct.push_back(Pair("txfrommempool", (uint64_t)cmpctBlockStats.nTxFromMempool));
+    cmpct.push_back(Pair("txrequested", (uint64_t)cmpctBlockStats.nTxRequested));
+    cmpct.push_back(Pair("sent", (uint64_t)cmpctBlockStats.nSent));
+    cmpct.push_back(Pair("blocktxnserved", (uint64_t)cmpctBlockStats.nBlockTxnServed));
+    obj.push_back(Pair("compactblocks", cmpct));
+    UniValue nspv(UniValue::VOBJ);
+    nspv.push_back(Pair("queued", (uint64_t)nspvServerStats.nQueued));
+    nspv.push_back(Pair("dropped", (uint64_t)nspvServerStats.nDropped));
+    nspv.push_back(Pair("cachehits", (uint64_t)nspvServerStats.nCacheHits));
+    nspv.push_back(Pair("cachemisses", (uint64_t)nspvServerStats.nCacheMisses));
+    obj.push_back(Pair("nspv", nspv));
     obj.push_back(Pair("warnings",       GetWarnings("statusbar")));
     return obj;
 }
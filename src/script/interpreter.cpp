@@ -1403,16 +1403,23 @@ int TransactionSignatureChecker::CheckCryptoCondition(
         LogPrintf("%02x",((uint8_t *)&sighash)[z]);
     LogPrintf(" sighash nIn.%d nHashType.%d %.8f id.%d\n",(int32_t)nIn,(int32_t)nHashType,(double)amount/COIN,(int32_t)consensusBranchId);
      */
+    int out = VerifyCryptoCondition(cond, sighash, condBin, ffillBin);
+    //LogPrintf("out.%d from cc_verify\n",(int32_t)out);
+    cc_free(cond);
+    return out;
+}
+
+
+int TransactionSignatureChecker::VerifyCryptoCondition(const CC *cond, const uint256& sighash,
+        const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin) const
+{
     VerifyEval eval = [] (CC *cond, void *checker) {
         //LogPrintf("checker.%p\n",(TransactionSignatureChecker*)checker);
         return ((TransactionSignatureChecker*)checker)->CheckEvalCondition(cond);
     };
     //LogPrintf("non-checker path\n");
-    int out = cc_verify(cond, (const unsigned char*)&sighash, 32, 0,
+    return cc_verify(cond, (const unsigned char*)&sighash, 32, 0,
                         condBin.data(), condBin.size(), eval, (void*)this);
-    //LogPrintf("out.%d from cc_verify\n",(int32_t)out);
-    cc_free(cond);
-    return out;
 }
 
 
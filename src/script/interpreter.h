@@ -167,6 +167,13 @@ protected:
     const PrecomputedTransactionData* txdata;
 
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+    /**
+     * Verify a parsed fulfillment against its condition: the condition binary,
+     * the ed25519/secp256k1 signatures over sighash and then the eval nodes
+     * @returns 1 if valid
+     */
+    virtual int VerifyCryptoCondition(const CC *cond, const uint256& sighash,
+            const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin) const;
 
 public:
     TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(NULL) {}
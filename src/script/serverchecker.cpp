@@ -22,6 +22,8 @@
 #include "script/cc.h"
 #include "cc/eval.h"
 
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
@@ -29,84 +31,134 @@
 
 #undef __cpuid
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 namespace {
 
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
+ * again when accepted into the block chain). Entries are salted SHA256
+ * hashes of what was verified, kept in a cuckoo cache.
  */
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
+    //! Entries are SHA256(nonce || signature hash || public key || signature):
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
     boost::shared_mutex cs_serverchecker;
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CSignatureCache()
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_serverchecker);
+        // minimal table until InitSignatureCache() sizes it
+        setValid.setup(0);
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+    void
+    ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    //! Entries are SHA256(nonce || signature hash || condition binary || fulfillment):
+    void
+    ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there can be no more than 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxservercheckersize", 50000);
-        if (nMaxCacheSize <= 0) return;
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(condBin.data(), condBin.size()).Write(ffillBin.data(), ffillBin.size()).Finalize(entry.begin());
+    }
 
+    bool
+    Get(const uint256& entry, const bool erase)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_serverchecker);
+        return setValid.contains(entry, erase);
+    }
+
+    void Set(const uint256& entry)
+    {
         boost::unique_lock<boost::shared_mutex> lock(cs_serverchecker);
+        setValid.insert(entry);
+    }
 
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
-
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    uint32_t setup_bytes(size_t n)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_serverchecker);
+        GetRandBytes(nonce.begin(), 32);
+        return setValid.setup_bytes(n);
     }
 };
 
+/* In previous versions of this code, signatureCache was a local static variable
+ * in VerifySignature. We initialize signatureCache outside of VerifySignature
+ * to avoid the atomic operation per call overhead associated with local static
+ * variables even though signatureCache could be made local to VerifySignature.
+ */
+static CSignatureCache signatureCache;
+/**
+ * Crypto-condition fulfillments whose condition binary and ed25519/secp256k1
+ * signatures were found valid, so a CC transaction accepted into the memory
+ * pool only has its eval nodes run again when its block is connected
+ */
+static CSignatureCache ccCache;
+
+}
+
+/**
+ * Size the signature and crypto-condition caches from -maxsigcachesize,
+ * of which they get half and a quarter
+ */
+void InitSignatureCache()
+{
+    // If -maxsigcachesize is set to zero, setup_bytes creates the minimum possible cache (2 elements).
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = signatureCache.setup_bytes(nMaxCacheSize / 2);
+    LogPrintf("Using %zu MiB out of %zu requested for signature cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>21, nElems);
+    nElems = ccCache.setup_bytes(nMaxCacheSize / 4);
+    LogPrintf("Using %zu MiB out of %zu requested for crypto-condition cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>22, nElems);
 }
 
 bool ServerTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    if (signatureCache.Get(entry, !store))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
     return true;
 }
 
+int ServerTransactionSignatureChecker::VerifyCryptoCondition(const CC *cond, const uint256& sighash,
+        const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin) const
+{
+    uint256 entry;
+    ccCache.ComputeEntry(entry, sighash, condBin, ffillBin);
+    if (!ccCache.Get(entry, !store))
+    {
+        // condition binary and signatures only, the eval nodes depend on chain state
+        VerifyEval skipEval = [] (CC *cond, void *context) { return 1; };
+        if (!cc_verify(cond, (const unsigned char*)&sighash, 32, 0,
+                    condBin.data(), condBin.size(), skipEval, NULL))
+            return 0;
+        if (store)
+            ccCache.Set(entry);
+    }
+
+    VerifyEval eval = [] (CC *cond, void *checker) {
+        return ((TransactionSignatureChecker*)checker)->CheckEvalCondition(cond);
+    };
+    return cc_verifyEval(cond, eval, (void*)static_cast<const TransactionSignatureChecker*>(this));
+}
+
 /*
  * The reason that these functions are here is that the what used to be the
  * CachingTransactionSignatureChecker, now the ServerTransactionSignatureChecker,
@@ -22,11 +22,40 @@
 #define BITCOIN_SCRIPT_SERVERCHECKER_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <stdint.h>
+#include <string.h>
 #include <vector>
 
+/** Default for -maxsigcachesize in MiB, shared by the signature, crypto-condition and script execution caches */
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+/** Maximum for -maxsigcachesize in MiB */
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
 class CPubKey;
 
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ *
+ * This may exhibit platform endian dependent behavior but because these are
+ * nonced hashes (random) and this state is only ever used locally it is safe.
+ * All that matters is local consistency.
+ */
+class SignatureCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select <8, "SignatureCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        memcpy(&u, key.begin()+4*hash_select, 4);
+        return u;
+    }
+};
+
 class ServerTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -37,7 +66,11 @@ public:
     ServerTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nIn, const CAmount& amount, bool storeIn) : TransactionSignatureChecker(txToIn, nIn, amount), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+    int VerifyCryptoCondition(const CC *cond, const uint256& sighash,
+            const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin) const;
     int CheckEvalCondition(const CC *cond) const;
 };
 
+void InitSignatureCache();
+
 #endif // BITCOIN_SCRIPT_SERVERCHECKER_H
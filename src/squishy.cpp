@@ -318,6 +318,14 @@ void squishy_stateupdate(int32_t height,uint8_t notarypubs[][33],uint8_t numnota
             }
         }
         fflush(fp);
+        static int32_t lastsnapshotheight; static int64_t lastsnapshottime;
+        if ( height >= lastsnapshotheight + SQUISHY_STATESNAPSHOT_INTERVAL && GetTime() >= lastsnapshottime + SQUISHY_STATESNAPSHOT_MINSECONDS )
+        {
+            squishy_statefname(fname, chainName.symbol().c_str(), SQUISHY_STATE_FILENAME);
+            if ( squishy_statesnapshot_write(sp, fname, height, ftell(fp)) )
+                lastsnapshotheight = height;
+            lastsnapshottime = GetTime();
+        }
     }
 }
 
@@ -21,6 +21,10 @@
 #include "rpc/net.h"
 #include "init.h"
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <boost/thread.hpp>
 
 /************************************************************************
  *
@@ -1209,37 +1213,58 @@ uint32_t squishy_segid32(char *coinaddr)
     return(addrhash.uints[0]);
 }
 
+/****
+ * @brief the segid of a block, from the address its staking tx pays to
+ * @param height the height of the block
+ * @param block the block
+ * @param getprevout looks up the value and address of the utxo spent by the staking tx, returns false if not found
+ * @returns the segid, or -1 if the block is not staked
+ */
+int8_t squishy_blocksegid(int32_t height,const CBlock &block,const std::function<bool(const COutPoint&,uint64_t*,char*)> &getprevout)
+{
+    CTxDestination voutaddress; uint64_t value = 0; char voutaddr[64],destaddr[64]; int32_t txn_count,newStakerActive; uint256 merkleroot; int8_t segid = -1;
+    newStakerActive = squishy_newStakerActive(height, block.nTime);
+    txn_count = block.vtx.size();
+    if ( txn_count > 1 && block.vtx[txn_count-1].vin.size() == 1 && block.vtx[txn_count-1].vout.size() == (size_t)(1+squishy_hasOpRet(height,block.nTime)) )
+    {
+        destaddr[0] = 0;
+        getprevout(block.vtx[txn_count-1].vin[0].prevout,&value,destaddr);
+        if ( ExtractDestination(block.vtx[txn_count-1].vout[0].scriptPubKey,voutaddress) )
+        {
+            strcpy(voutaddr,CBitcoinAddress(voutaddress).ToString().c_str());
+            if ( newStakerActive == 1 && block.vtx[txn_count-1].vout.size() == 2 && DecodeStakingOpRet(block.vtx[txn_count-1].vout[1].scriptPubKey, merkleroot) != 0 )
+                newStakerActive++;
+            if ( newStakerActive == 2 || (newStakerActive == 0 && strcmp(destaddr,voutaddr) == 0 && (uint64_t)block.vtx[txn_count-1].vout[0].nValue == value) )
+            {
+                segid = squishy_segid32(voutaddr) & 0x3f;
+                //LogPrintf( "squishy_segid: ht.%i --> %i\n",height,segid);
+            }
+        } //else LogPrintf("squishy_segid ht.%d couldnt extract voutaddress\n",height);
+    }
+    return(segid);
+}
+
+/****
+ * @brief look up the utxo spent by a staking tx with the tx index, for squishy_blocksegid
+ */
+bool squishy_txprevout(const COutPoint &prevout,uint64_t *valuep,char *destaddr)
+{
+    CScript opret;
+    squishy_txtime(opret,valuep,prevout.hash,prevout.n,destaddr);
+    return(*valuep != 0);
+}
+
 int8_t squishy_segid(int32_t nocache,int32_t height)
 {
-    CTxDestination voutaddress; CBlock block; CBlockIndex *pindex; uint64_t value; uint32_t txtime; char voutaddr[64],destaddr[64]; int32_t txn_count,vout,newStakerActive; uint256 txid,merkleroot; CScript opret; int8_t segid = -1;
+    CBlock block; CBlockIndex *pindex; int8_t segid = -1;
     if ( height > 0 && (pindex= squishy_chainactive(height)) != 0 )
     {
         if ( nocache == 0 && pindex->segid >= -1 )
             return(pindex->segid);
         if ( squishy_blockload(block,pindex) == 0 )
-        {
-            newStakerActive = squishy_newStakerActive(height, block.nTime);
-            txn_count = block.vtx.size();
-            if ( txn_count > 1 && block.vtx[txn_count-1].vin.size() == 1 && block.vtx[txn_count-1].vout.size() == 1+squishy_hasOpRet(height,pindex->nTime) )
-            {
-                txid = block.vtx[txn_count-1].vin[0].prevout.hash;
-                vout = block.vtx[txn_count-1].vin[0].prevout.n;
-                txtime = squishy_txtime(opret,&value,txid,vout,destaddr);
-                if ( ExtractDestination(block.vtx[txn_count-1].vout[0].scriptPubKey,voutaddress) )
-                {
-                    strcpy(voutaddr,CBitcoinAddress(voutaddress).ToString().c_str());
-                    if ( newStakerActive == 1 && block.vtx[txn_count-1].vout.size() == 2 && DecodeStakingOpRet(block.vtx[txn_count-1].vout[1].scriptPubKey, merkleroot) != 0 )
-                        newStakerActive++;
-                    if ( newStakerActive == 2 || (newStakerActive == 0 && strcmp(destaddr,voutaddr) == 0 && block.vtx[txn_count-1].vout[0].nValue == value) )
-                    {
-                        segid = squishy_segid32(voutaddr) & 0x3f;
-                        //LogPrintf( "squishy_segid: ht.%i --> %i\n",height,pindex->segid);
-                    }
-                } //else LogPrintf("squishy_segid ht.%d couldnt extract voutaddress\n",height);
-            }
-        }
-        // The new staker sets segid in squishy_checkPOW, this persists after restart by being saved in the blockindex for blocks past the HF timestamp, to keep backwards compatibility.
-        // PoW blocks cannot contain a staking tx. If segid has not yet been set, we can set it here accurately.
+            segid = squishy_blocksegid(height,block,squishy_txprevout);
+        // The new staker sets segid in squishy_checkPOW, ConnectBlock sets it for the other blocks and it is persisted in the block index.
+        // Only block indexes written by older versions can still have it unset, so set it here.
         if ( pindex->segid == -2 ) 
             pindex->segid = segid;
     }
@@ -1269,21 +1294,136 @@ void squishy_segids(uint8_t *hashbuf,int32_t height,int32_t n)
     }
 }
 
-uint32_t squishy_stakehash(uint256 *hashp,char *address,uint8_t *hashbuf,uint256 txid,int32_t vout)
+/****
+ * The segids of the last SQUISHY_SEGID_WINDOW blocks of the active chain, with
+ * the per segid counts and the PoW block hash sum that squishy_PoWtarget needs.
+ * Rolled forward and back as blocks are connected and disconnected.
+ */
+struct squishy_segidwindow_state
 {
-    bits256 addrhash;
-    vcalc_sha256(0,(uint8_t *)&addrhash,(uint8_t *)address,(int32_t)strlen(address));
-    memcpy(&hashbuf[100],&addrhash,sizeof(addrhash));
+    std::deque<std::pair<int8_t,arith_uint256> > blocks; // oldest first
+    const CBlockIndex *tip;
+    int32_t counts[64],pow,notset; // pow includes the blocks with an unset segid, as squishy_PoWtarget counts them
+    arith_uint256 powsum;
+    squishy_segidwindow_state() : tip(0),pow(0),notset(0) { memset(counts,0,sizeof(counts)); }
+    void add(int8_t segid,const arith_uint256 &hash,int32_t dir)
+    {
+        if ( segid >= 0 )
+            counts[segid] += dir;
+        else
+        {
+            if ( segid < -1 )
+                notset += dir;
+            pow += dir;
+            if ( dir > 0 )
+                powsum += hash;
+            else powsum -= hash;
+        }
+    }
+    void clear() { blocks.clear(); tip = 0; pow = notset = 0; powsum = arith_uint256(0); memset(counts,0,sizeof(counts)); }
+};
+static squishy_segidwindow_state SQUISHY_SEGIDWINDOW;
+static CCriticalSection cs_segidwindow;
+
+void squishy_segidwindow_connect(const CBlockIndex *pindex)
+{
+    const CBlockIndex *pwalk; int32_t i; int8_t segid;
+    LOCK(cs_segidwindow);
+    squishy_segidwindow_state &w = SQUISHY_SEGIDWINDOW;
+    if ( pindex->nHeight <= 1 )
+    {
+        w.clear();
+        w.tip = pindex;
+        return;
+    }
+    if ( w.tip != 0 && w.tip == pindex->pprev )
+    {
+        segid = squishy_segid(0,pindex->nHeight);
+        w.blocks.push_back(std::make_pair(segid,UintToArith256(pindex->GetBlockHash())));
+        w.add(segid,w.blocks.back().second,1);
+        if ( w.blocks.size() > SQUISHY_SEGID_WINDOW )
+        {
+            w.add(w.blocks.front().first,w.blocks.front().second,-1);
+            w.blocks.pop_front();
+        }
+    }
+    else // first block after startup or a reorg we missed, refill from the chain
+    {
+        w.clear();
+        for (i=0,pwalk=pindex; i<SQUISHY_SEGID_WINDOW && pwalk != 0 && pwalk->nHeight > 1; i++,pwalk=pwalk->pprev)
+        {
+            segid = squishy_segid(0,pwalk->nHeight);
+            w.blocks.push_front(std::make_pair(segid,UintToArith256(pwalk->GetBlockHash())));
+            w.add(segid,w.blocks.front().second,1);
+        }
+    }
+    w.tip = pindex;
+}
+
+void squishy_segidwindow_disconnect(const CBlockIndex *pindex)
+{
+    const CBlockIndex *pold; int8_t segid;
+    LOCK(cs_segidwindow);
+    squishy_segidwindow_state &w = SQUISHY_SEGIDWINDOW;
+    if ( w.tip != pindex || w.blocks.empty() )
+    {
+        w.clear();
+        return;
+    }
+    w.add(w.blocks.back().first,w.blocks.back().second,-1);
+    w.blocks.pop_back();
+    if ( (pold= pindex->GetAncestor(pindex->nHeight - SQUISHY_SEGID_WINDOW)) != 0 && pold->nHeight > 1 )
+    {
+        segid = squishy_segid(0,pold->nHeight);
+        w.blocks.push_front(std::make_pair(segid,UintToArith256(pold->GetBlockHash())));
+        w.add(segid,w.blocks.front().second,1);
+    }
+    w.tip = pindex->pprev;
+}
+
+bool squishy_segidwindow(int32_t height,int32_t *segidcounts,int32_t *powp,arith_uint256 *powsump,int32_t *notsetp)
+{
+    LOCK(cs_segidwindow);
+    const squishy_segidwindow_state &w = SQUISHY_SEGIDWINDOW;
+    if ( w.tip == 0 || w.tip->nHeight+1 != height || w.blocks.size() != SQUISHY_SEGID_WINDOW || squishy_chainactive(height-1) != w.tip )
+        return(false);
+    memcpy(segidcounts,w.counts,sizeof(w.counts));
+    *powp = w.pow;
+    *powsump = w.powsum;
+    if ( notsetp != 0 )
+        *notsetp = w.notset;
+    return(true);
+}
+
+/****
+ * @brief the staking hash of a utxo when the hash of its address is already known
+ * @param[out] hashp the staking hash
+ * @param addrhash sha256 of the address string
+ * @param hashbuf the segids of the last 100 blocks, with room for 68 more bytes
+ * @param txid the utxo txid
+ * @param vout the utxo vout
+ */
+void squishy_stakehashaddr(uint256 *hashp,const uint256 &addrhash,uint8_t *hashbuf,uint256 txid,int32_t vout)
+{
+    memcpy(&hashbuf[100],addrhash.begin(),sizeof(addrhash));
     memcpy(&hashbuf[100+sizeof(addrhash)],&txid,sizeof(txid));
     memcpy(&hashbuf[100+sizeof(addrhash)+sizeof(txid)],&vout,sizeof(vout));
     vcalc_sha256(0,(uint8_t *)hashp,hashbuf,100 + (int32_t)sizeof(uint256)*2 + sizeof(vout));
+}
+
+uint32_t squishy_stakehash(uint256 *hashp,char *address,uint8_t *hashbuf,uint256 txid,int32_t vout)
+{
+    bits256 addrhash; uint256 hash256;
+    vcalc_sha256(0,(uint8_t *)&addrhash,(uint8_t *)address,(int32_t)strlen(address));
+    memcpy(hash256.begin(),&addrhash,sizeof(addrhash));
+    squishy_stakehashaddr(hashp,hash256,hashbuf,txid,vout);
     return(addrhash.uints[0]);
 }
 
 arith_uint256 squishy_PoWtarget(int32_t *percPoSp,arith_uint256 target,int32_t height,int32_t goalperc,int32_t newStakerActive)
 {
     int32_t oldflag = 0,dispflag = 0;
-    CBlockIndex *pindex; arith_uint256 easydiff,bnTarget,hashval,sum,ave; bool fNegative,fOverflow; int32_t i,n,m,ht,percPoS,diff,val;
+    CBlockIndex *pindex; arith_uint256 easydiff,bnTarget,hashval,sum,ave; bool fNegative,fOverflow; int32_t i,n=0,m=0,ht,percPoS,diff,val,segidcounts[64];
     *percPoSp = percPoS = 0;
     
     if ( newStakerActive == 0 && height <= 10 || (ASSETCHAINS_STAKED == 100 && height <= 100) ) 
@@ -1299,7 +1439,13 @@ arith_uint256 squishy_PoWtarget(int32_t *percPoSp,arith_uint256 target,int32_t h
     }    
     else 
         easydiff.SetCompact(STAKING_MIN_DIFF,&fNegative,&fOverflow);
-    for (i=n=m=0; i<100; i++)
+    if ( height > SQUISHY_SEGID_WINDOW+1 && squishy_segidwindow(height,segidcounts,&m,&sum) != 0 )
+    {
+        for (i=n=0; i<64; i++)
+            n += segidcounts[i];
+        percPoS = n;
+    }
+    else for (i=n=m=0; i<100; i++)
     {
         ht = height - 100 + i;
         if ( ht <= 1 )
@@ -1394,10 +1540,22 @@ arith_uint256 squishy_PoWtarget(int32_t *percPoSp,arith_uint256 target,int32_t h
     return(bnTarget);
 }
 
-uint32_t squishy_stake(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeight,uint256 txid,int32_t vout,uint32_t blocktime,uint32_t prevtime,char *destaddr,int32_t PoSperc)
+/****
+ * @brief the staking rule of squishy_stake once the utxo and the recent segids are known
+ * @param validateflag 0 to find the earliest blocktime the utxo can stake, 1 to check blocktime
+ * @param bnTarget the target
+ * @param nHeight the height of the staked block
+ * @param hash the staking hash, see squishy_stakehash
+ * @param segid32 the first word of the address hash, see squishy_stakehash
+ * @param txtime the time of the block that confirmed the utxo
+ * @param value the utxo value
+ * @param blocktime the block time to check, or the time to search from
+ * @param prevtime the time of the previous block
+ * @returns the blocktime the utxo is eligible at, or 0
+ */
+uint32_t squishy_stakeeligible(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeight,uint256 hash,uint32_t segid32,uint32_t txtime,uint64_t value,uint32_t blocktime,uint32_t prevtime)
 {
-    bool fNegative,fOverflow; uint8_t hashbuf[256]; char address[64]; bits256 addrhash; arith_uint256 hashval,mindiff,ratio,coinage256; uint256 hash,pasthash; int32_t segid,minage,i,iter=0; int64_t diff=0; uint32_t txtime,segid32,winner = 0 ; uint64_t value,coinage;
-    txtime = squishy_txtime2(&value,txid,vout,address);
+    bool fNegative,fOverflow; arith_uint256 hashval,mindiff,ratio,coinage256; int32_t segid,minage,i,iter=0; int64_t diff=0; uint32_t winner = 0; uint64_t coinage;
     if ( validateflag == 0 )
     {
         //LogPrintf("blocktime.%u -> ",blocktime);
@@ -1419,8 +1577,6 @@ uint32_t squishy_stake(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeig
     ratio = (mindiff / bnTarget);
     if ( (minage= nHeight*3) > 6000 ) // about 100 blocks
         minage = 6000;
-    squishy_segids(hashbuf,nHeight-101,100);
-    segid32 = squishy_stakehash(&hash,address,hashbuf,txid,vout);
     segid = ((nHeight + segid32) & 0x3f);
     for (iter=0; iter<600; iter++)
     {
@@ -1480,6 +1636,18 @@ uint32_t squishy_stake(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeig
     return(blocktime * winner);
 }
 
+uint32_t squishy_stake(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeight,uint256 txid,int32_t vout,uint32_t blocktime,uint32_t prevtime,char *destaddr,int32_t PoSperc)
+{
+    uint8_t hashbuf[256]; char address[64]; uint256 hash; uint32_t txtime,segid32; uint64_t value;
+    address[0] = 0;
+    txtime = squishy_txtime2(&value,txid,vout,address);
+    if ( value == 0 || txtime == 0 )
+        return(0);
+    squishy_segids(hashbuf,nHeight-101,100);
+    segid32 = squishy_stakehash(&hash,address,hashbuf,txid,vout);
+    return(squishy_stakeeligible(validateflag,bnTarget,nHeight,hash,segid32,txtime,value,blocktime,prevtime));
+}
+
 int32_t squishy_is_PoSblock(int32_t slowflag,int32_t height,CBlock *pblock,arith_uint256 bnTarget,arith_uint256 bhash)
 {
     CBlockIndex *previndex,*pindex; char voutaddr[64],destaddr[64]; uint256 txid, merkleroot; uint32_t txtime,prevtime=0; int32_t ret,vout,PoSperc,txn_count,eligible=0,isPoS = 0,segid; uint64_t value; arith_uint256 POWTarget;
@@ -2081,41 +2249,77 @@ int32_t squishy_acpublic(uint32_t tiptime)
     return(acpublic);
 }
 
-int64_t squishy_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock)
+/****
+ * @brief sum the transparent inputs spent by the non-coinbase transactions of a block
+ * @param[out] vinsump the sum
+ * @param pblock the block
+ * @returns false if a spent transaction could not be found
+ */
+bool squishy_blockvinsum(int64_t *vinsump,const CBlock *pblock)
 {
-    CTxDestination address; int32_t i,j,m,n,vout; uint8_t *script; uint256 txid,hashBlock; int64_t zfunds=0,vinsum=0,voutsum=0,sproutfunds=0;
+    int32_t i,j,n,m; uint32_t vout; uint256 txid,hashBlock; int64_t vinsum = 0;
+    *vinsump = 0;
     n = pblock->vtx.size();
-    for (i=0; i<n; i++)
+    for (i=1; i<n; i++)
     {
-        CTransaction vintx,&tx = pblock->vtx[i];
-        if ( (m= tx.vin.size()) > 0 )
+        CTransaction vintx; const CTransaction &tx = pblock->vtx[i];
+        m = tx.vin.size();
+        for (j=0; j<m; j++)
         {
-            for (j=0; j<m; j++)
+            txid = tx.vin[j].prevout.hash;
+            vout = tx.vin[j].prevout.n;
+            if ( !GetTransaction(txid,vintx,hashBlock, false) || vout >= vintx.vout.size() )
             {
-                if ( i == 0 )
-                    continue;
-                txid = tx.vin[j].prevout.hash;
-                vout = tx.vin[j].prevout.n;
-                if ( !GetTransaction(txid,vintx,hashBlock, false) || vout >= vintx.vout.size() )
-                {
-                    LogPrintf("ERROR: %s/v%d cant find\n",txid.ToString().c_str(),vout);
-                    return(0);
-                }
-                vinsum += vintx.vout[vout].nValue;
+                LogPrintf("ERROR: %s/v%u cant find\n",txid.ToString().c_str(),vout);
+                return(false);
             }
+            vinsum += vintx.vout[vout].nValue;
         }
+    }
+    *vinsump = vinsum;
+    return(true);
+}
+
+/****
+ * @brief check if an output counts towards the coin supply: it pays an address and not the burn address
+ * @param txout the output
+ * @returns true if the output counts
+ */
+static bool squishy_supplyvout(const CTxOut &txout)
+{
+    // the script is built once, the check runs for every output of every connected block
+    static const CScript burnScript = GetScriptForDestination(CBitcoinAddress("RD6GgnrMpPaTSMn8vai6yiGA7mN4QGPVMY").Get());
+    CTxDestination address;
+    return ( ExtractDestination(txout.scriptPubKey,address) != 0 && txout.scriptPubKey != burnScript );
+}
+
+/****
+ * @brief the coins created by a block, given the transparent inputs it spends
+ * @param[out] zfundsp the change in shielded funds
+ * @param[out] sproutfundsp the change in sprout funds
+ * @param nHeight the height of the block
+ * @param pblock the block
+ * @param vinsum the sum of the transparent inputs, see squishy_blockvinsum
+ * @returns the change in transparent supply
+ */
+int64_t squishy_blocknewcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,const CBlock *pblock,int64_t vinsum)
+{
+    int32_t i,j,m,n; int64_t zfunds=0,voutsum=0,sproutfunds=0;
+    n = pblock->vtx.size();
+    for (i=0; i<n; i++)
+    {
+        const CTransaction &tx = pblock->vtx[i];
         if ( (m= tx.vout.size()) > 0 )
         {
             for (j=0; j<m-1; j++)
             {
-                if ( ExtractDestination(tx.vout[j].scriptPubKey,address) != 0 && strcmp("RD6GgnrMpPaTSMn8vai6yiGA7mN4QGPVMY",CBitcoinAddress(address).ToString().c_str()) != 0 )
+                if ( squishy_supplyvout(tx.vout[j]) )
                     voutsum += tx.vout[j].nValue;
-                else LogPrintf("skip %.8f -> %s\n",dstr(tx.vout[j].nValue),CBitcoinAddress(address).ToString().c_str());
             }
-            script = (uint8_t *)&tx.vout[j].scriptPubKey[0];
-            if ( script == 0 || script[0] != 0x6a )
+            const CScript &script = tx.vout[j].scriptPubKey;
+            if ( script.size() == 0 || script[0] != OP_RETURN )
             {
-                if ( ExtractDestination(tx.vout[j].scriptPubKey,address) != 0 && strcmp("RD6GgnrMpPaTSMn8vai6yiGA7mN4QGPVMY",CBitcoinAddress(address).ToString().c_str()) != 0 )
+                if ( squishy_supplyvout(tx.vout[j]) )
                     voutsum += tx.vout[j].nValue;
             }
         }
@@ -2137,6 +2341,17 @@ int64_t squishy_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,
     return(voutsum - vinsum);
 }
 
+int64_t squishy_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock)
+{
+    int64_t vinsum;
+    if ( !squishy_blockvinsum(&vinsum,pblock) )
+    {
+        *zfundsp = *sproutfundsp = 0;
+        return(0);
+    }
+    return(squishy_blocknewcoins(zfundsp,sproutfundsp,nHeight,pblock,vinsum));
+}
+
 int64_t squishy_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height)
 {
     CBlockIndex *pindex; CBlock block; int64_t zfunds=0,sproutfunds=0,supply = 0;
@@ -2146,6 +2361,14 @@ int64_t squishy_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height
     {
         while ( pindex != 0 && pindex->nHeight > 0 )
         {
+            if ( (pindex->nStatus & BLOCK_HAVE_SUPPLY) != 0 )
+            {
+                // the rest of the chain is already summed up in the block index
+                supply += pindex->nChainSupply;
+                zfunds += pindex->nChainZFunds;
+                sproutfunds += pindex->nChainSproutFunds;
+                break;
+            }
             if ( pindex->newcoins == 0 && pindex->zfunds == 0 )
             {
                 if ( squishy_blockload(block,pindex) == 0 )
@@ -2168,36 +2391,61 @@ int64_t squishy_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height
     return(supply);
 }
 
-void squishy_addutxo(std::vector<squishy_staking> &array,uint32_t txtime,uint64_t nValue,uint256 txid,int32_t vout,char *address,uint8_t *hashbuf,CScript pk)
+struct squishy_stakebest
 {
-    uint256 hash; uint32_t segid32; squishy_staking kp;
-    segid32 = squishy_stakehash(&hash,address,hashbuf,txid,vout);
-    if ( array.size() >= array.capacity() )
+    uint32_t eligible;
+    const CStakingCandidate *candidate;
+    squishy_stakebest() : eligible(0), candidate(0) {}
+    bool isbetter(uint32_t eligible2,const CStakingCandidate &candidate2) const
     {
-        array.reserve(array.capacity() + 1000);
-        //LogPrintf("%s realloc array.size().%d array.capacity().%d\n", __func__, array.size(), array.capacity());
+        return(eligible == 0 || eligible2 < eligible || (eligible2 == eligible && candidate2.nValue < candidate->nValue));
+    }
+};
+
+/****
+ * @brief find the earliest eligible staking candidate in a range, run by the staking worker threads
+ * @param candidates all candidates
+ * @param begin first candidate of the range
+ * @param end end of the range
+ * @param segids the segids of the 100 blocks before the previous one
+ * @param bnTarget the target
+ * @param nHeight the height of the staked block
+ * @param prevtime the time the block may be staked from
+ * @param[in,out] abortp set when the chain tip changed or staking was stopped
+ * @param[out] bestp the earliest eligible candidate found
+ */
+static void squishy_stakescan(const std::vector<CStakingCandidate> *candidates,size_t begin,size_t end,const uint8_t *segids,arith_uint256 bnTarget,int32_t nHeight,uint32_t prevtime,std::atomic<bool> *abortp,squishy_stakebest *bestp)
+{
+    uint8_t hashbuf[256]; uint256 hash; uint32_t eligible; size_t i;
+    memcpy(hashbuf,segids,100);
+    for (i=begin; i<end; i++)
+    {
+        if ( ((i - begin) % 1024) == 0 )
+        {
+            if ( *abortp || ShutdownRequested() || !GetBoolArg("-gen",false) )
+                break;
+            LOCK(cs_main);
+            if ( chainActive.Tip() == 0 || chainActive.Tip()->nHeight+1 > nHeight )
+            {
+                *abortp = true;
+                break;
+            }
+        }
+        const CStakingCandidate &kp = (*candidates)[i];
+        squishy_stakehashaddr(&hash,kp.addrhash,hashbuf,kp.outpoint.hash,kp.outpoint.n);
+        eligible = squishy_stakeeligible(0,bnTarget,nHeight,hash,kp.segid32,kp.txtime,kp.nValue,0,prevtime);
+        if ( eligible > 0 && eligible == squishy_stakeeligible(1,bnTarget,nHeight,hash,kp.segid32,kp.txtime,kp.nValue,eligible,prevtime) && bestp->isbetter(eligible,kp) )
+        {
+            bestp->eligible = eligible;
+            bestp->candidate = &kp;
+        }
     }
-    //memset(&kp,0,sizeof(kp));
-    strcpy(kp.address, address);
-    kp.txid = txid;
-    kp.vout = vout;
-    kp.hashval = UintToArith256(hash);
-    kp.txtime = txtime;
-    kp.segid32 = segid32;
-    kp.nValue = nValue;
-    kp.scriptPubKey = pk;
-    array.push_back(kp);
-    //LogPrintf("kp.%p array.size().%d\n",kp,array.size());
 }
 
 int32_t squishy_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *blocktimep,uint32_t *txtimep,uint256 *utxotxidp,int32_t *utxovoutp,uint64_t *utxovaluep,uint8_t *utxosig, uint256 merkleroot)
 {
-    // use thread_local to prevent crash in case of accidental thread overlapping
-    thread_local std::vector<squishy_staking> array; 
-    thread_local uint32_t lasttime;
-
     int32_t PoSperc = 0, newStakerActive; 
-    std::set<CBitcoinAddress> setAddress; int32_t winners,segid,minage,nHeight,counter=0,i,m,siglen=0,nMinDepth = 1,nMaxDepth = 99999999; std::vector<COutput> vecOutputs; uint32_t block_from_future_rejecttime,besttime,eligible,earliest = 0; CScript best_scriptPubKey; arith_uint256 mindiff,ratio,bnTarget,tmpTarget; CBlockIndex *pindex; CTxDestination address; bool fNegative,fOverflow; uint8_t hashbuf[256]; CTransaction tx; uint256 hashBlock;
+    int32_t nHeight,i,siglen=0,nThreads; uint32_t earliest = 0; CScript best_scriptPubKey; arith_uint256 bnTarget; bool fNegative,fOverflow; uint8_t hashbuf[256]; size_t n,chunk;
     uint64_t cbPerc = *utxovaluep, tocoinbase = 0;
     if (!EnsureWalletIsAvailable(0))
         return 0;
@@ -2216,111 +2464,52 @@ int32_t squishy_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *block
     if ( tipindex == nullptr )
         return(0);
     nHeight = tipindex->nHeight + 1;
-    if ( (minage= nHeight*3) > 6000 ) // about 100 blocks
-        minage = 6000;
     if ( *blocktimep < tipindex->nTime+60 )
         *blocktimep = tipindex->nTime+60;
     squishy_segids(hashbuf,nHeight-101,100);
     // this was for VerusHash PoS64
     //tmpTarget = squishy_PoWtarget(&PoSperc,bnTarget,nHeight,ASSETCHAINS_STAKED);
-    bool resetstaker = false;
-    if ( array.size() != 0 )
-    {
-        LOCK(cs_main);
-        CBlockIndex* pblockindex = chainActive[tipindex->nHeight];
-        CBlock block; CTxDestination addressout;
-        if ( ReadBlockFromDisk(block, pblockindex, 1) && squishy_isPoS(&block, nHeight, &addressout) != 0 && IsMine(*pwalletMain,addressout) != 0 )
-        {
-              resetstaker = true;
-              LogPrintf( "[%s:%d] Reset ram staker after mining a block!\n",chainName.symbol().c_str(),nHeight);
-        }
-    }
 
-    if ( resetstaker || array.size() == 0 || time(NULL) > lasttime+600 )
+    // the wallet keeps the candidates up to date as blocks connect, a full rebuild is only needed after reorgs and rescans
+    if ( pwalletMain->stakingCache.IsStale(GetTime(),WALLET_OUTPUT_CACHE_MAX_AGE) )
+        pwalletMain->RebuildStakingCache();
+    std::vector<CStakingCandidate> candidates = pwalletMain->GetStakingCandidates();
+
+    // evaluate the candidates on worker threads without holding cs_main or cs_wallet
+    n = candidates.size();
+    nThreads = std::max(1,std::min(GetNumCores(),(int32_t)(n / 1000) + 1));
+    chunk = (n + nThreads - 1) / nThreads;
+    std::vector<squishy_stakebest> bests(nThreads);
+    std::atomic<bool> fAbort(false);
     {
-        LOCK2(cs_main, pwalletMain->cs_wallet);
-        pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
-        if ( array.size() != 0 )
-        {
-            array.clear();
-            lasttime = 0;
-        }
-        BOOST_FOREACH(const COutput& out, vecOutputs)
-        {
-            if ( (tipindex= chainActive.Tip()) == 0 || tipindex->nHeight+1 > nHeight )
-            {
-                LogPrintf("[%s:%d] chain tip changed during staking loop t.%u counter.%d\n",chainName.symbol().c_str(),nHeight,(uint32_t)time(NULL),counter);
-                return(0);
-            }
-            counter++;
-            if ( out.nDepth < nMinDepth || out.nDepth > nMaxDepth )
-            {
-                //LogPrintf("squishy_staked invalid depth %d\n",(int32_t)out.nDepth);
-                continue;
-            }
-            CAmount nValue = out.tx->vout[out.i].nValue;
-            if ( nValue < COIN  || !out.fSpendable )
-                continue;
-            const CScript& pk = out.tx->vout[out.i].scriptPubKey;
-            if ( ExtractDestination(pk,address) != 0 )
-            {
-                if ( IsMine(*pwalletMain,address) == 0 )
-                    continue;
-                if ( myGetTransaction(out.tx->GetHash(),tx,hashBlock) != 0 && (pindex= squishy_getblockindex(hashBlock)) != 0 )
-                {
-                    squishy_addutxo(array,(uint32_t)pindex->nTime,(uint64_t)nValue,out.tx->GetHash(),out.i,(char *)CBitcoinAddress(address).ToString().c_str(),hashbuf,(CScript)pk);
-                    //LogPrintf("%s array.size().%d vs array.capacity().%d\n", __func__,array.size(),array.capacity());
-                }
-            }
-        }
-        lasttime = (uint32_t)time(NULL);
-        //LogPrintf("%s finished kp data of utxo for staking %u ht.%d array.size().%d array.capacity().%d\n", __func__,(uint32_t)time(NULL),nHeight,array.size(),array.capacity());
+        boost::thread_group workers;
+        for (i=0; i<nThreads; i++)
+            workers.create_thread(boost::bind(&squishy_stakescan,&candidates,std::min(n,i*chunk),std::min(n,(i+1)*chunk),hashbuf,bnTarget,nHeight,(uint32_t)tipindex->nTime+ASSETCHAINS_STAKED_BLOCK_FUTURE_HALF,&fAbort,&bests[i]));
+        workers.join_all();
     }
-    block_from_future_rejecttime = (uint32_t)GetTime() + ASSETCHAINS_STAKED_BLOCK_FUTURE_MAX;    
-    for (i=winners=0; i<array.size(); i++)
+    if ( fAbort )
     {
-        if ( ShutdownRequested() || !GetBoolArg("-gen",false) )
-            return(0);
-        {
-            LOCK(cs_main);
-            tipindex = chainActive.Tip();
-        }
-        if ( tipindex == nullptr || tipindex->nHeight+1 > nHeight )
-        {
-            LogPrintf("[%s:%d] chain tip changed during staking loop t.%u counter.%d\n",chainName.symbol().c_str(),nHeight,(uint32_t)time(NULL),i);
-            return 0;
-        }
-        squishy_staking &kp = array[i];
-        eligible = squishy_stake(0,bnTarget,nHeight,kp.txid,kp.vout,0,(uint32_t)tipindex->nTime+ASSETCHAINS_STAKED_BLOCK_FUTURE_HALF,kp.address,PoSperc);
-        if ( eligible > 0 )
-        {
-            besttime = 0;
-            if ( eligible == squishy_stake(1,bnTarget,nHeight,kp.txid,kp.vout,eligible,(uint32_t)tipindex->nTime+ASSETCHAINS_STAKED_BLOCK_FUTURE_HALF,kp.address,PoSperc) )
-            {
-                // have elegible utxo to stake with. 
-                if ( earliest == 0 || eligible < earliest || (eligible == earliest && (*utxovaluep == 0 || kp.nValue < *utxovaluep)) )
-                {
-                    // is better than the previous best, so use it instead.
-                    earliest = eligible;
-                    best_scriptPubKey = kp.scriptPubKey;
-                    *utxovaluep = (uint64_t)kp.nValue;
-                    decode_hex((uint8_t *)utxotxidp,32,(char *)kp.txid.GetHex().c_str());
-                    *utxovoutp = kp.vout;
-                    *txtimep = kp.txtime;
-                }
-                /*if ( eligible < block_from_future_rejecttime )
-                { 
-                    // better to scan all and choose earliest! 
-                    LogPrintf( "block_from_future_rejecttime.%u vs eligible.%u \n", block_from_future_rejecttime, eligible);
-                    break;
-                } */ 
-            }
-        }
+        LogPrintf("[%s:%d] chain tip changed during staking loop t.%u\n",chainName.symbol().c_str(),nHeight,(uint32_t)time(NULL));
+        return(0);
     }
-    if ( array.size() < 500 && array.size() != 0 )
-    {
-        array.clear();
-        lasttime = 0;
+    if ( ShutdownRequested() || !GetBoolArg("-gen",false) )
+        return(0);
+    squishy_stakebest best;
+    for (i=0; i<nThreads; i++)
+    {
+        if ( bests[i].eligible != 0 && best.isbetter(bests[i].eligible,*bests[i].candidate) )
+            best = bests[i];
+    }
+    if ( best.eligible != 0 )
+    {
+        // have elegible utxo to stake with. 
+        const CStakingCandidate &kp = *best.candidate;
+        earliest = best.eligible;
+        best_scriptPubKey = kp.scriptPubKey;
+        *utxovaluep = (uint64_t)kp.nValue;
+        decode_hex((uint8_t *)utxotxidp,32,(char *)kp.outpoint.hash.GetHex().c_str());
+        *utxovoutp = kp.outpoint.n;
+        *txtimep = kp.txtime;
     }
     if ( earliest != 0 )
     {
@@ -17,6 +17,7 @@
 
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include <functional>
 #include "consensus/params.h"
 #include "squishy_defs.h"
 #include "script/standard.h"
@@ -184,14 +185,39 @@ uint64_t squishy_commission(const CBlock *pblock,int32_t height);
 
 uint32_t squishy_segid32(char *coinaddr);
 
+int8_t squishy_blocksegid(int32_t height,const CBlock &block,const std::function<bool(const COutPoint&,uint64_t*,char*)> &getprevout);
+
+bool squishy_txprevout(const COutPoint &prevout,uint64_t *valuep,char *destaddr);
+
 int8_t squishy_segid(int32_t nocache,int32_t height);
 
+#define SQUISHY_SEGID_WINDOW 100 // blocks looked back at by squishy_PoWtarget
+
+void squishy_segidwindow_connect(const CBlockIndex *pindex);
+
+void squishy_segidwindow_disconnect(const CBlockIndex *pindex);
+
+/****
+ * @brief the segid counts of the SQUISHY_SEGID_WINDOW blocks before a height, without looking at the blocks
+ * @param height the height the window ends before, must be the active tip + 1
+ * @param[out] segidcounts the number of blocks staked by each of the 64 segids
+ * @param[out] powp the number of PoW blocks, including the ones with an unset segid
+ * @param[out] powsump the sum of the PoW block hashes
+ * @param[out] notsetp the number of blocks with an unset segid, can be null
+ * @returns false if the window is not at that height yet
+ */
+bool squishy_segidwindow(int32_t height,int32_t *segidcounts,int32_t *powp,arith_uint256 *powsump,int32_t *notsetp = 0);
+
 void squishy_segids(uint8_t *hashbuf,int32_t height,int32_t n);
 
+void squishy_stakehashaddr(uint256 *hashp,const uint256 &addrhash,uint8_t *hashbuf,uint256 txid,int32_t vout);
+
 uint32_t squishy_stakehash(uint256 *hashp,char *address,uint8_t *hashbuf,uint256 txid,int32_t vout);
 
 arith_uint256 squishy_PoWtarget(int32_t *percPoSp,arith_uint256 target,int32_t height,int32_t goalperc,int32_t newStakerActive);
 
+uint32_t squishy_stakeeligible(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeight,uint256 hash,uint32_t segid32,uint32_t txtime,uint64_t value,uint32_t blocktime,uint32_t prevtime);
+
 uint32_t squishy_stake(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeight,uint256 txid,int32_t vout,uint32_t blocktime,uint32_t prevtime,char *destaddr,int32_t PoSperc);
 
 int32_t squishy_is_PoSblock(int32_t slowflag,int32_t height,CBlock *pblock,arith_uint256 bnTarget,arith_uint256 bhash);
@@ -218,21 +244,12 @@ int32_t squishy_checkPOW(int64_t stakeTxValue, int32_t slowflag,CBlock *pblock,i
 
 int32_t squishy_acpublic(uint32_t tiptime);
 
+bool squishy_blockvinsum(int64_t *vinsump,const CBlock *pblock);
+
+int64_t squishy_blocknewcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,const CBlock *pblock,int64_t vinsum);
+
 int64_t squishy_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock);
 
 int64_t squishy_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height);
 
-struct squishy_staking
-{
-    char address[64];
-    uint256 txid;
-    arith_uint256 hashval;
-    uint64_t nValue;
-    uint32_t segid32,txtime;
-    int32_t vout;
-    CScript scriptPubKey;
-};
-
-void squishy_addutxo(std::vector<squishy_staking> &array,uint32_t txtime,uint64_t nValue,uint256 txid,int32_t vout,char *address,uint8_t *hashbuf,CScript pk);
-
 int32_t squishy_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *blocktimep,uint32_t *txtimep,uint256 *utxotxidp,int32_t *utxovoutp,uint64_t *utxovaluep,uint8_t *utxosig, uint256 merkleroot);
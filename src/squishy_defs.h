@@ -83,6 +83,8 @@ int32_t getkmdseason(int32_t height);
 */
 #define SQUISHY_KVDURATION 1440
 #define SQUISHY_KVPROTECTED 1
+#define SQUISHY_KVPURGEDEPTH SQUISHY_KVDURATION // expired updates are kept this many blocks for reorgs
+#define SQUISHY_KVPURGEBATCH 256
 /*#define PRICES_MAXDATAPOINTS 8
 int32_t squishy_notaries(uint8_t pubkeys[64][33],int32_t height,uint32_t timestamp);
 char *bitcoin_address(char *coinaddr,uint8_t addrtype,uint8_t *pubkey_or_rmd160,int32_t len);
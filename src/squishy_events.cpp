@@ -74,6 +74,7 @@ void squishy_eventadd_pubkeys(squishy_state *sp, const char *symbol, int32_t hei
     if (sp != nullptr)
     {
         sp->add_event(symbol, height, pk);
+        sp->notary_pubkeys.push_back(pk);
         squishy_notarysinit(height, pk.pubkeys, pk.num);
     }
 }
@@ -109,7 +110,7 @@ void squishy_eventadd_opreturn( squishy_state *sp, const char *symbol, int32_t h
         //squishy_opreturn(height, opret->value, opret->opret.data(), opret->opret.size(), opret->txid, opret->vout, symbol);
         if ( opret.opret.data()[0] == 'K' && opret.opret.size() != 40 )
         {
-            squishy_kvupdate(opret.opret.data(), opret.opret.size(), opret.value);
+            squishy_kvupdate(opret.opret.data(), opret.opret.size(), opret.value, height, opret.txid, opret.vout);
         }
     }
 }
@@ -152,6 +153,11 @@ void squishy_event_rewind(squishy_state *sp, const char *symbol, int32_t height)
             squishy_event_undo(sp, *ev);
             sp->events.pop_back();
         }
+        // the snapshot replays these, keep them in step with the events
+        while ( sp->notary_pubkeys.size() > 0 && sp->notary_pubkeys.back().height >= height )
+            sp->notary_pubkeys.pop_back();
+        if ( !chainName.isKMD() )
+            squishy_kvrewind(height);
     }
 }
 
@@ -13,10 +13,15 @@
  *                                                                            *
  ******************************************************************************/
 #include "squishy.h"
+#include "squishy_gateway.h"
 #include "squishy_globals.h"
 #include "squishy_utils.h" // squishy_stateptrget
 #include "squishy_bitcoind.h" // squishy_checkcommission
 #include "squishy_notary.h"
+#include "squishy_events.h"
+#include "hash.h"
+#include "streams.h"
+#include "util.h"
 
 const char *banned_txids[] =
 {
@@ -445,8 +450,141 @@ long squishy_indfile_update(FILE *indfp,uint32_t *prevpos100p,long lastfpos,long
     return newfpos;
 }
 
+/***
+ * @brief hash the bytes of the events file just before a position, to tell if a snapshot belongs to it
+ * @param[out] hashp the hash
+ * @param fname the events file
+ * @param fpos the position
+ * @returns false if the file is shorter than fpos
+ */
+static bool squishy_statetailhash(uint256 *hashp,const char *fname,long fpos)
+{
+    FILE *fp;
+    if ( fpos < 0 || (fp= fopen(fname,"rb")) == nullptr )
+        return false;
+    long start = std::max(fpos - SQUISHY_STATESNAPSHOT_TAILSIZE,0L);
+    std::vector<uint8_t> tail(fpos - start);
+    bool retval = fseek(fp,start,SEEK_SET) == 0 && fread(tail.data(),1,tail.size(),fp) == tail.size();
+    fclose(fp);
+    if ( retval )
+        *hashp = Hash(tail.begin(),tail.end());
+    return retval;
+}
+
+/***
+ * @brief write a snapshot of the state rebuilt from the events file
+ * @param sp the squishy_state struct
+ * @param fname the events file
+ * @param height the height of the last event
+ * @param fpos the length of the events file the state was built from
+ * @returns true on success
+ */
+bool squishy_statesnapshot_write(const squishy_state *sp,const char *fname,int32_t height,long fpos)
+{
+    uint256 tailhash;
+    if ( sp == nullptr || !squishy_statetailhash(&tailhash,fname,fpos) )
+        return false;
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << SQUISHY_STATESNAPSHOT_VERSION << sp->symbol << height << (int64_t)fpos << tailhash;
+    ss << sp->SAVEDHEIGHT << sp->CURRENT_HEIGHT << sp->SAVEDTIMESTAMP;
+    ss << sp->Checkpoints() << sp->LastCheckpoint();
+    ss << (uint32_t)sp->notary_pubkeys.size();
+    for (const squishy::event_pubkeys &pk : sp->notary_pubkeys)
+        ss << pk.height << pk.num << FLATDATA(pk.pubkeys);
+    uint256 hash = Hash(ss.begin(),ss.end());
+    ss << hash;
+
+    std::string snapfname = std::string(fname) + ".snapshot";
+    std::string tmpfname = snapfname + ".tmp";
+    CAutoFile fileout(fopen(tmpfname.c_str(),"wb"), SER_DISK, CLIENT_VERSION);
+    if ( fileout.IsNull() )
+        return error("%s: Failed to open file %s", __func__, tmpfname);
+    try {
+        fileout << ss;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    if ( !RenameOver(tmpfname,snapfname) )
+        return error("%s: Rename-into-place failed", __func__);
+    LogPrint("squishy","wrote %s at ht.%d fpos.%ld checkpoints.%d\n",snapfname,height,fpos,(int32_t)sp->NumCheckpoints());
+    return true;
+}
+
+/***
+ * @brief restore the state from the snapshot of the events file, if it still matches the file
+ * @param sp the squishy_state struct
+ * @param fname the events file
+ * @param symbol the chain symbol
+ * @returns the position in the events file to continue parsing at, -1 if there is no usable snapshot
+ */
+long squishy_statesnapshot_read(squishy_state *sp,const char *fname,const char *symbol)
+{
+    std::string snapfname = std::string(fname) + ".snapshot";
+    CAutoFile filein(fopen(snapfname.c_str(),"rb"), SER_DISK, CLIENT_VERSION);
+    if ( filein.IsNull() )
+        return -1;
+
+    int32_t version,height,savedheight,currentheight; int64_t fpos; uint32_t savedtimestamp,numpubkeys;
+    std::string snapsymbol; uint256 tailhash,hashIn,tailhashnow;
+    std::vector<notarized_checkpoint> checkpoints; notarized_checkpoint lastcp;
+    std::vector<squishy::event_pubkeys> pubkeys;
+    std::vector<unsigned char> vchData;
+    try {
+        long datasize = (long)boost::filesystem::file_size(snapfname) - (long)sizeof(uint256);
+        vchData.resize(std::max(datasize,0L));
+        filein.read((char *)vchData.data(),vchData.size());
+        filein >> hashIn;
+        filein.fclose();
+        if ( hashIn != Hash(vchData.begin(),vchData.end()) )
+        {
+            LogPrintf("%s: checksum mismatch, ignoring %s\n",__func__,snapfname);
+            return -1;
+        }
+        CDataStream ss(vchData, SER_DISK, CLIENT_VERSION);
+        ss >> version;
+        if ( version != SQUISHY_STATESNAPSHOT_VERSION )
+            return -1;
+        ss >> snapsymbol >> height >> fpos >> tailhash;
+        ss >> savedheight >> currentheight >> savedtimestamp;
+        ss >> checkpoints >> lastcp;
+        ss >> numpubkeys;
+        for (uint32_t i=0; i<numpubkeys; i++)
+        {
+            int32_t ht;
+            ss >> ht;
+            squishy::event_pubkeys pk(ht);
+            ss >> pk.num >> FLATDATA(pk.pubkeys);
+            pubkeys.push_back(pk);
+        }
+    }
+    catch (const std::exception& e) {
+        LogPrintf("%s: Deserialize or I/O error - %s\n",__func__,e.what());
+        return -1;
+    }
+    if ( snapsymbol != sp->symbol || !squishy_statetailhash(&tailhashnow,fname,fpos) || tailhashnow != tailhash )
+    {
+        LogPrintf("%s does not match %s, ignoring it\n",snapfname,fname);
+        return -1;
+    }
+
+    sp->SAVEDHEIGHT = savedheight;
+    sp->CURRENT_HEIGHT = currentheight;
+    sp->SAVEDTIMESTAMP = savedtimestamp;
+    sp->RestoreCheckpoints(checkpoints,lastcp);
+    for (squishy::event_pubkeys &pk : pubkeys)
+        squishy_eventadd_pubkeys(sp,symbol,pk.height,pk);
+    LogPrintf("restored %s at ht.%d fpos.%ld checkpoints.%d\n",snapfname,height,(long)fpos,(int32_t)checkpoints.size());
+    return (long)fpos;
+}
+
 /***
  * @brief read the squishystate file
+ * @note when a snapshot of the state matches the file only the events after it are parsed,
+ * and the .ind file is left as the last full parse wrote it
  * @param sp the squishy_state struct
  * @param fname the filename
  * @param symbol the chain symbol
@@ -457,6 +595,28 @@ bool squishy_faststateinit(squishy_state *sp,const char *fname,char *symbol, con
 {
     uint32_t starttime = (uint32_t)time(NULL);
 
+    long snapshotfpos = squishy_statesnapshot_read(sp,fname,symbol);
+    if ( snapshotfpos >= 0 )
+    {
+        FILE *fp;
+        if ( (fp= fopen(fname,"rb")) == nullptr )
+            return false;
+        fseek(fp,0,SEEK_END);
+        long datalen = ftell(fp) - snapshotfpos;
+        std::vector<uint8_t> filedata(datalen + 1);
+        fseek(fp,snapshotfpos,SEEK_SET);
+        if ( fread(filedata.data(),1,datalen,fp) != (size_t)datalen )
+            LogPrintf("error reading %s tail %ld\n",fname,datalen);
+        fclose(fp);
+        long fpos = 0;
+        while (!ShutdownRequested() && squishy_parsestatefiledata(sp,filedata.data(),&fpos,datalen,symbol,dest) >= 0)
+            ;
+        if (ShutdownRequested())
+            return false;
+        LogPrintf("took %d seconds to process %s tail %ldKB\n",(int32_t)(time(NULL)-starttime),fname,datalen/1024);
+        return true;
+    }
+
     uint8_t *filedata = nullptr;
     long datalen;
     if ( (filedata= OS_fileptr(&datalen,fname)) != 0 )
@@ -18,6 +18,11 @@
 struct squishy_state;
 class CBlock;
 
+static const int32_t SQUISHY_STATESNAPSHOT_VERSION = 1;
+static const int32_t SQUISHY_STATESNAPSHOT_INTERVAL = 1000; // blocks between snapshots of the state
+static const int64_t SQUISHY_STATESNAPSHOT_MINSECONDS = 3600; // and at least this long, so the initial sync doesn't write them back to back
+static const long SQUISHY_STATESNAPSHOT_TAILSIZE = 4096; // bytes of the events file hashed into the snapshot
+
 /****
  * @brief Check if the n of the vout matches one that is banned
  * @param vout the "n" of the vout
@@ -50,8 +55,28 @@ void squishy_update_interest();
  */
 int32_t squishy_check_deposit(int32_t height,const CBlock& block);
 
+/***
+ * @brief write a snapshot of the state rebuilt from the events file
+ * @param sp the squishy_state struct
+ * @param fname the events file
+ * @param height the height of the last event
+ * @param fpos the length of the events file the state was built from
+ * @returns true on success
+ */
+bool squishy_statesnapshot_write(const squishy_state *sp,const char *fname,int32_t height,long fpos);
+
+/***
+ * @brief restore the state from the snapshot of the events file, if it still matches the file
+ * @param sp the squishy_state struct
+ * @param fname the events file
+ * @param symbol the chain symbol
+ * @returns the position in the events file to continue parsing at, -1 if there is no usable snapshot
+ */
+long squishy_statesnapshot_read(squishy_state *sp,const char *fname,const char *symbol);
+
 /***
  * @brief read the squishystate file
+ * @note when a snapshot of the state matches the file only the events after it are parsed
  * @param sp the squishy_state struct
  * @param fname the filename
  * @param symbol the chain symbol
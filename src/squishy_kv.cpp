@@ -16,23 +16,28 @@
 #include "squishy_globals.h"
 #include "squishy_utils.h" // portable_mutex_lock
 #include "squishy_curve25519.h" // for squishy_kvsigverify
-#include <mutex>
+#include "hash.h"
+#include "kvdb.h"
+#include "primitives/transaction.h"
+#include "script/cc.h" // GetOpReturnData
 
-std::mutex kv_mutex;
+#include <boost/thread/shared_mutex.hpp>
 
-struct squishy_kv 
-{ 
-    UT_hash_handle hh; 
-    bits256 pubkey; 
-    uint8_t *key;
-    uint8_t *value; 
-    int32_t height; 
-    uint32_t flags; 
-    uint16_t keylen;
-    uint16_t valuesize; 
-};
+#include <cassert>
+#include <map>
 
-squishy_kv *SQUISHY_KV;
+/***
+ * Guards the KV database and the mempool overlay. Searches only read, so
+ * concurrent kvsearch calls share the lock while updates and rollbacks take it exclusively.
+ */
+static boost::shared_mutex cs_kv;
+
+/***
+ * The KV updates of mempool transactions by key hash, so pending updates can be found
+ * before they are mined. Each holds the txid it came from and the resulting state of the key.
+ */
+static std::map<uint256, std::pair<uint256, CKVRecord> > mapKVMempool;
+static std::map<uint256, std::vector<uint256> > mapKVMempoolTxids;
 
 /****
  * @brief build a private key from the public key and passphrase
@@ -141,6 +146,36 @@ uint64_t squishy_kvfee(uint32_t flags,int32_t opretlen,int32_t keylen)
     return(fee);
 }
 
+/***
+ * @returns the KV database, opened by init before any block or event is processed
+ */
+static CKVDB *squishy_kvdb()
+{
+    assert(pkvdb != nullptr);
+    return pkvdb;
+}
+
+static uint256 squishy_kvkeyhash(const uint8_t *key,int32_t keylen)
+{
+    return Hash(key,key+keylen);
+}
+
+/***
+ * @brief find the newest update of a key that has not expired, caller holds cs_kv
+ * @param[out] record the update
+ * @param keyhash the hash of the key
+ * @param current_height current chain height
+ * @return -1 if there is none, otherwise size of the value
+ */
+static int32_t squishy_kvread(CKVRecord &record,const uint256 &keyhash,int32_t current_height)
+{
+    if ( !squishy_kvdb()->ReadLatest(keyhash,record) )
+        return -1;
+    if ( current_height > record.height + squishy_kvduration(record.flags) )
+        return -1; // expired, left for squishy_kvpurge
+    return (int32_t)record.value.size();
+}
+
 /***
  * @brief find a value
  * @param[out] pubkeyp the found pubkey
@@ -157,60 +192,48 @@ int32_t squishy_kvsearch(uint256 *pubkeyp, int32_t current_height, uint32_t *fla
 {
     *heightp = -1;
     *flagsp = 0;
-
-    squishy_kv *ptr; 
-    int32_t retval = -1;
     memset(pubkeyp,0,sizeof(*pubkeyp));
-    std::lock_guard<std::mutex> lock(kv_mutex);
-    // look in hashtable for key
-    HASH_FIND(hh,SQUISHY_KV,key,keylen,ptr);
-    if ( ptr != nullptr )
+
+    uint256 keyhash = squishy_kvkeyhash(key,keylen);
+    CKVRecord record;
+    boost::shared_lock<boost::shared_mutex> lock(cs_kv);
+    int32_t retval = squishy_kvread(record,keyhash,current_height);
+    if ( retval < 0 )
     {
-        int32_t duration = squishy_kvduration(ptr->flags);
-        if ( current_height > (ptr->height + duration) )
-        {
-            // entry has expired, remove it
-            HASH_DELETE(hh,SQUISHY_KV,ptr);
-            if ( ptr->value != 0 )
-                free(ptr->value);
-            if ( ptr->key != 0 )
-                free(ptr->key);
-            free(ptr);
-        }
-        else
+        // search rawmempool
+        std::map<uint256, std::pair<uint256, CKVRecord> >::const_iterator it = mapKVMempool.find(keyhash);
+        if ( it != mapKVMempool.end() && current_height <= it->second.second.height + squishy_kvduration(it->second.second.flags) )
         {
-            // place values into parameters
-            *heightp = ptr->height;
-            *flagsp = ptr->flags;
-            for (int32_t i=0; i<32; i++)
-            {
-                ((uint8_t *)pubkeyp)[i] = ((uint8_t *)&ptr->pubkey)[31-i];
-            }
-            memcpy(pubkeyp,&ptr->pubkey,sizeof(*pubkeyp));
-            if ( (retval= ptr->valuesize) > 0 )
-                memcpy(value,ptr->value,retval);
+            record = it->second.second;
+            retval = (int32_t)record.value.size();
         }
     }
-    if ( retval < 0 )
+    if ( retval >= 0 )
     {
-        // search rawmempool
+        // place values into parameters
+        *heightp = record.height;
+        *flagsp = record.flags;
+        *pubkeyp = record.pubkey;
+        if ( retval > 0 )
+            memcpy(value,record.value.data(),std::min(retval,(int32_t)IGUANA_MAXSCRIPTSIZE));
     }
     return retval;
 }
 
 /****
- * @brief update value
- * @param opretbuf what to write
+ * @brief validate an update against the stored value of its key, caller holds cs_kv
+ * @param[out] record the state of the key after the update
+ * @param opretbuf the update
  * @param opretlen length of opretbuf
  * @param value the value to be related to the key
+ * @returns true if the update is valid
  */
-void squishy_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
+static bool squishy_kvvalidate(CKVRecord &record,uint8_t *opretbuf,int32_t opretlen,uint64_t value)
 {
     static uint256 zeroes;
 
-    if (chainName.isKMD()) // disable KV for KMD
-        return;
-
+    if ( opretlen < 13 )
+        return false;
     // parse opretbuf
     uint16_t keylen;
     uint16_t valuesize;
@@ -226,106 +249,187 @@ void squishy_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
         static uint32_t counter;
         if ( ++counter < 1 )
             LogPrintf("squishy_kvupdate: keylen.%d + 13 > opretlen.%d, this can be ignored\n",keylen,opretlen);
-        return;
+        return false;
     }
     uint8_t *valueptr = &key[keylen];
     uint64_t fee = squishy_kvfee(flags,opretlen,keylen);
-    if ( value >= fee )
+    if ( value < fee )
+    {
+        LogPrintf("not enough fee\n");
+        return false;
+    }
+    int32_t coresize = (int32_t)(sizeof(flags)
+            +sizeof(height)
+            +sizeof(keylen)
+            +sizeof(valuesize)
+            +keylen+valuesize+1);
+    if ( opretlen != coresize 
+            && opretlen != coresize+sizeof(uint256) 
+            && opretlen != coresize+2*sizeof(uint256) )
     {
-        // we have enough for the fee
-        int32_t coresize = (int32_t)(sizeof(flags)
-                +sizeof(height)
-                +sizeof(keylen)
-                +sizeof(valuesize)
-                +keylen+valuesize+1);
-        uint256 pubkey;
-        if ( opretlen == coresize 
-                || opretlen == coresize+sizeof(uint256) 
-                || opretlen == coresize+2*sizeof(uint256) )
+        LogPrintf("KV update size mismatch %d vs %d\n",opretlen,coresize);
+        return false;
+    }
+    // end could be pubkey or pubkey+signature
+    uint256 pubkey;
+    if ( opretlen >= coresize+sizeof(uint256) )
+    {
+        for (uint8_t i=0; i<32; i++)
+            ((uint8_t *)&pubkey)[i] = opretbuf[coresize+i];
+    }
+    uint256 sig;
+    if ( opretlen == coresize+sizeof(uint256)*2 )
+    {
+        for (uint8_t i=0; i<32; i++)
+            ((uint8_t *)&sig)[i] = opretbuf[coresize+sizeof(uint256)+i];
+    }
+
+    CKVRecord ref;
+    int32_t refvaluesize = squishy_kvread(ref,squishy_kvkeyhash(key,keylen),height);
+    // as with the former hashtable search, the update keeps the flags of the entry it replaces
+    flags = refvaluesize >= 0 ? ref.flags : 0;
+    if ( refvaluesize >= 0 && zeroes != ref.pubkey )
+    {
+        // validate signature
+        std::vector<uint8_t> keyvalue(key,key+keylen);
+        keyvalue.insert(keyvalue.end(),ref.value.begin(),ref.value.end());
+        if ( squishy_kvsigverify(keyvalue.data(),(int32_t)keyvalue.size(),ref.pubkey,sig) < 0 )
+            return false;
+    }
+    bool newflag = refvaluesize < 0;
+    if ( !newflag )
+    {
+        // We are updating an existing entry
+        // if we are doing a transfer, log it and insert the pubkey
+        char *tstr = (char *)"transfer:";
+        char *transferpubstr = (char *)&valueptr[strlen(tstr)];
+        if ( strncmp(tstr,(char *)valueptr,strlen(tstr)) == 0 && is_hexstr(transferpubstr,0) == 64 )
         {
-            // end could be pubkey or pubkey+signature
-            if ( opretlen >= coresize+sizeof(uint256) )
-            {
-                for (uint8_t i=0; i<32; i++)
-                    ((uint8_t *)&pubkey)[i] = opretbuf[coresize+i];
-            }
-            uint256 sig;
-            if ( opretlen == coresize+sizeof(uint256)*2 )
-            {
-                for (uint8_t i=0; i<32; i++)
-                    ((uint8_t *)&sig)[i] = opretbuf[coresize+sizeof(uint256)+i];
-            }
+            LogPrintf("transfer.(%s) to [%s]? ishex.%d\n",key,transferpubstr,is_hexstr(transferpubstr,0));
+            for (uint8_t i=0; i<32; i++)
+                ((uint8_t *)&pubkey)[31-i] = _decode_hex(&transferpubstr[i*2]);
+        }
+    }
+    record.key.assign(key,key+keylen);
+    if ( newflag || (ref.flags & SQUISHY_KVPROTECTED) == 0 ) // can we edit the value?
+        record.value.assign(valueptr,valueptr+valuesize);
+    else
+    {
+        LogPrintf("newflag.%d zero or protected %d\n",(uint16_t)newflag,
+                (ref.flags & SQUISHY_KVPROTECTED));
+        record.value = ref.value;
+    }
+    record.pubkey = pubkey;
+    record.height = height;
+    record.flags = flags; // jl777 used to or in KVPROTECTED
+    return true;
+}
 
-            uint8_t keyvalue[IGUANA_MAXSCRIPTSIZE*8]; 
-            memcpy(keyvalue,key,keylen);
-            uint256 refpubkey;
-            int32_t kvheight;
-            int32_t refvaluesize = squishy_kvsearch(&refpubkey,height,
-                    &flags,&kvheight,&keyvalue[keylen],key,keylen);
-            if ( refvaluesize  >= 0 )
-            {
-                if ( zeroes != refpubkey )
-                {
-                    // validate signature
-                    if ( squishy_kvsigverify(keyvalue,keylen+refvaluesize,refpubkey,sig) < 0 )
-                    {
-                        return;
-                    }
-                }
-            }
-            // with validation complete, update internal storage
-            std::lock_guard<std::mutex> lock(kv_mutex);
-            squishy_kv *ptr;
-            bool newflag = false;
-            HASH_FIND(hh,SQUISHY_KV,key,keylen,ptr);
-            if ( ptr != 0 )
-            {
-                // We are updating an existing entry
-                // if we are doing a transfer, log it and insert the pubkey
-                char *tstr = (char *)"transfer:";
-                char *transferpubstr = (char *)&valueptr[strlen(tstr)];
-                if ( strncmp(tstr,(char *)valueptr,strlen(tstr)) == 0 && is_hexstr(transferpubstr,0) == 64 )
-                {
-                    LogPrintf("transfer.(%s) to [%s]? ishex.%d\n",key,transferpubstr,is_hexstr(transferpubstr,0));
-                    for (uint8_t i=0; i<32; i++)
-                        ((uint8_t *)&pubkey)[31-i] = _decode_hex(&transferpubstr[i*2]);
-                }
-            }
-            else if ( ptr == 0 )
-            {
-                // add a new entry to the hashtable
-                ptr = (squishy_kv *)calloc(1,sizeof(*ptr));
-                ptr->key = (uint8_t *)calloc(1,keylen);
-                ptr->keylen = keylen;
-                memcpy(ptr->key,key,keylen);
-                newflag = true;
-                HASH_ADD_KEYPTR(hh,SQUISHY_KV,ptr->key,ptr->keylen,ptr);
-            }
-            if ( newflag || (ptr->flags & SQUISHY_KVPROTECTED) == 0 ) // can we edit the value?
-            {
-                if ( ptr->value != nullptr )
-                {
-                    // clear out old value
-                    free(ptr->value);
-                    ptr->value = nullptr;
-                }
-                if ( (ptr->valuesize= valuesize) != 0 )
-                {
-                    // add value
-                    ptr->value = (uint8_t *)calloc(1,valuesize);
-                    memcpy(ptr->value,valueptr,valuesize);
-                }
-            } 
-            else 
-                LogPrintf("newflag.%d zero or protected %d\n",(uint16_t)newflag,
-                        (ptr->flags & SQUISHY_KVPROTECTED));
-            memcpy(&ptr->pubkey,&pubkey,sizeof(ptr->pubkey));
-            ptr->height = height;
-            ptr->flags = flags; // jl777 used to or in KVPROTECTED
-        } 
-        else 
-            LogPrintf("KV update size mismatch %d vs %d\n",opretlen,coresize);
-    } 
-    else 
-        LogPrintf("not enough fee\n");
+/****
+ * @brief update value
+ * @param opretbuf what to write
+ * @param opretlen length of opretbuf
+ * @param value the value to be related to the key
+ * @param blockheight the height of the block with the update
+ * @param txid the transaction with the update
+ * @param vout the output with the update
+ */
+void squishy_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value,int32_t blockheight,uint256 txid,uint16_t vout)
+{
+    if (chainName.isKMD()) // disable KV for KMD
+        return;
+
+    if ( opretlen < 13 )
+        return;
+    uint16_t keylen;
+    iguana_rwnum(0,&opretbuf[1],sizeof(keylen),&keylen);
+    if ( keylen+13 > opretlen )
+        return;
+    CKVHistoryKey update(squishy_kvkeyhash(&opretbuf[13],keylen),blockheight,txid,vout);
+
+    boost::unique_lock<boost::shared_mutex> lock(cs_kv);
+    CKVDB *kvdb = squishy_kvdb();
+    // updates of blocks already in the database are seen again when the state file is replayed
+    if ( blockheight < kvdb->ReadBestHeight() || kvdb->HaveUpdate(update) )
+        return;
+    CKVRecord record;
+    if ( squishy_kvvalidate(record,opretbuf,opretlen,value) )
+    {
+        if ( !kvdb->WriteUpdate(update,record,record.height + squishy_kvduration(record.flags)) )
+            LogPrintf("squishy_kvupdate: failed to write update %s/%d\n",txid.ToString().c_str(),vout);
+    }
+    if ( kvdb->Purge(blockheight - SQUISHY_KVPURGEDEPTH,SQUISHY_KVPURGEBATCH) < 0 )
+        LogPrintf("squishy_kvupdate: failed to purge expired updates\n");
+}
+
+/****
+ * @brief forget the updates of rewound blocks
+ * @param height the first height rewound
+ */
+void squishy_kvrewind(int32_t height)
+{
+    if (chainName.isKMD())
+        return;
+    boost::unique_lock<boost::shared_mutex> lock(cs_kv);
+    if ( !squishy_kvdb()->Rollback(height) )
+        LogPrintf("squishy_kvrewind: failed to roll back to %d\n",height);
+}
+
+/****
+ * @brief make the KV updates of a transaction entering the mempool visible to squishy_kvsearch
+ * @param tx the transaction
+ */
+void squishy_kvmempool_add(const CTransaction &tx)
+{
+    if (chainName.isKMD())
+        return;
+    std::vector<std::pair<uint256, CKVRecord> > pending;
+    boost::unique_lock<boost::shared_mutex> lock(cs_kv);
+    for (const CTxOut &txout : tx.vout)
+    {
+        std::vector<uint8_t> opret;
+        if ( !GetOpReturnData(txout.scriptPubKey,opret) || opret.size() < 13 || opret[0] != 'K' )
+            continue;
+        CKVRecord record;
+        if ( squishy_kvvalidate(record,opret.data(),(int32_t)opret.size(),(uint64_t)txout.nValue) )
+            pending.push_back(std::make_pair(squishy_kvkeyhash(record.key.data(),(int32_t)record.key.size()),record));
+    }
+    if ( pending.empty() )
+        return;
+    const uint256 &txid = tx.GetHash();
+    std::vector<uint256> &keyhashes = mapKVMempoolTxids[txid];
+    for (const auto &entry : pending)
+    {
+        mapKVMempool[entry.first] = std::make_pair(txid,entry.second);
+        keyhashes.push_back(entry.first);
+    }
+}
+
+/****
+ * @brief forget the KV updates of a transaction leaving the mempool
+ * @param txid the transaction
+ */
+void squishy_kvmempool_remove(const uint256 &txid)
+{
+    boost::unique_lock<boost::shared_mutex> lock(cs_kv);
+    std::map<uint256, std::vector<uint256> >::iterator it = mapKVMempoolTxids.find(txid);
+    if ( it == mapKVMempoolTxids.end() )
+        return;
+    for (const uint256 &keyhash : it->second)
+    {
+        std::map<uint256, std::pair<uint256, CKVRecord> >::iterator mit = mapKVMempool.find(keyhash);
+        if ( mit != mapKVMempool.end() && mit->second.first == txid )
+            mapKVMempool.erase(mit);
+    }
+    mapKVMempoolTxids.erase(it);
+}
+
+/****
+ * @brief forget the KV updates of all mempool transactions
+ */
+void squishy_kvmempool_clear()
+{
+    boost::unique_lock<boost::shared_mutex> lock(cs_kv);
+    mapKVMempool.clear();
+    mapKVMempoolTxids.clear();
 }
@@ -17,6 +17,8 @@
 #include "squishy_defs.h"
 #include <cstdint>
 
+class CTransaction;
+
 /***
  * @brief calculate the duration in minutes
  * @param flags
@@ -52,8 +54,34 @@ int32_t squishy_kvsearch(uint256 *pubkeyp,int32_t current_height,uint32_t *flags
  * @param opretbuf what to write
  * @param opretlen length of opretbuf
  * @param value the value to be related to the key
+ * @param blockheight the height of the block with the update
+ * @param txid the transaction with the update
+ * @param vout the output with the update
+ */
+void squishy_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value,int32_t blockheight,uint256 txid,uint16_t vout);
+
+/****
+ * @brief forget the updates of rewound blocks
+ * @param height the first height rewound
+ */
+void squishy_kvrewind(int32_t height);
+
+/****
+ * @brief make the KV updates of a transaction entering the mempool visible to squishy_kvsearch
+ * @param tx the transaction
+ */
+void squishy_kvmempool_add(const CTransaction &tx);
+
+/****
+ * @brief forget the KV updates of a transaction leaving the mempool
+ * @param txid the transaction
+ */
+void squishy_kvmempool_remove(const uint256 &txid);
+
+/****
+ * @brief forget the KV updates of all mempool transactions
  */
-void squishy_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value);
+void squishy_kvmempool_clear();
 
 /****
  * @brief build a private key from the public key and passphrase
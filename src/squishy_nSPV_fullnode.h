@@ -547,6 +547,53 @@ int32_t NSPV_mempoolfuncs(bits256 *satoshisp,int32_t *vindexp,std::vector<uint25
         func = (vout >> 8) & 0xff;
     }
     LOCK(mempool.cs);
+    if ( funcid == NSPV_MEMPOOL_CCEVALCODE || (funcid == NSPV_MEMPOOL_ADDRESS && isCC) )
+    {
+        // served from the mempool CC indexes, only the matching transactions are looked at
+        std::vector<uint256> indexed;
+        if ( funcid == NSPV_MEMPOOL_CCEVALCODE )
+        {
+            // the index also has the contract data wrapped in token oprets, only the outer opreturn counts here
+            mempool.getCCFuncTxids(evalcode,func,indexed);
+            for (const uint256 &hash : indexed)
+            {
+                CTransaction tx;
+                if ( !mempool.lookup(hash,tx) || tx.vout.size() <= 1 )
+                    continue;
+                if ( GetOpReturnData(tx.vout.back().scriptPubKey,vopret) != 0 && vopret[0] == evalcode && vopret[1] == func )
+                {
+                    txids.push_back(hash);
+                    num++;
+                }
+            }
+            return(num);
+        }
+        mempool.getCCAddressTxids(coinaddr,indexed);
+        for (const uint256 &hash : indexed)
+        {
+            CTransaction tx;
+            if ( !mempool.lookup(hash,tx) )
+                continue;
+            vouti = 0;
+            BOOST_FOREACH(const CTxOut &txout,tx.vout)
+            {
+                if ( txout.scriptPubKey.IsPayToCryptoCondition() )
+                {
+                    Getscriptaddress(destaddr,txout.scriptPubKey);
+                    if ( strcmp(destaddr,coinaddr) == 0 )
+                    {
+                        txids.push_back(hash);
+                        *vindexp = vouti;
+                        if ( num < 4 )
+                            satoshisp->ulongs[num] = txout.nValue;
+                        num++;
+                    }
+                }
+                vouti++;
+            }
+        }
+        return(num);
+    }
     BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
     {
         const CTransaction &tx = e.GetTx();
@@ -874,364 +921,509 @@ int32_t NSPV_getspentinfo(struct NSPV_spentinfo *ptr,uint256 txid,int32_t vout)
     return(len);
 }
 
-void squishy_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a request
+/****
+ * @brief build the answer to a getnSPV request
+ * @param[out] response the nSPV message to send back
+ * @param request the getnSPV payload
+ * @returns true if there is a response to send
+ */
+static bool squishy_nSPVresponse(std::vector<uint8_t> &response,std::vector<uint8_t> request)
 {
-    int32_t len,slen,ind,reqheight,n; std::vector<uint8_t> response; uint32_t timestamp = (uint32_t)time(NULL);
+    int32_t len,slen,reqheight,n; bool retval = false;
     if ( (len= request.size()) > 0 )
     {
-        if ( (ind= request[0]>>1) >= sizeof(pfrom->prevtimes)/sizeof(*pfrom->prevtimes) )
-            ind = (int32_t)(sizeof(pfrom->prevtimes)/sizeof(*pfrom->prevtimes)) - 1;
-        if ( pfrom->prevtimes[ind] > timestamp )
-            pfrom->prevtimes[ind] = 0;
         if ( request[0] == NSPV_INFO ) // info
         {
-            //LogPrintf("check info %u vs %u, ind.%d\n",timestamp,pfrom->prevtimes[ind],ind);
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_inforesp I;
+            if ( len == 1+sizeof(reqheight) )
+                iguana_rwnum(0,&request[1],sizeof(reqheight),&reqheight);
+            else reqheight = 0;
+            //LogPrintf("request height.%d\n",reqheight);
+            memset(&I,0,sizeof(I));
+            if ( (slen= NSPV_getinfo(&I,reqheight)) > 0 )
             {
-                struct NSPV_inforesp I;
-                if ( len == 1+sizeof(reqheight) )
-                    iguana_rwnum(0,&request[1],sizeof(reqheight),&reqheight);
-                else reqheight = 0;
-                //LogPrintf("request height.%d\n",reqheight);
-                memset(&I,0,sizeof(I));
-                if ( (slen= NSPV_getinfo(&I,reqheight)) > 0 )
-                {
-                    response.resize(1 + slen);
-                    response[0] = NSPV_INFORESP;
-                    //LogPrintf("slen.%d version.%d\n",slen,I.version);
-                    if ( NSPV_rwinforesp(1,&response[1],&I) == slen )
-                    {
-                        //LogPrintf("send info resp to id %d\n",(int32_t)pfrom->id);
-                        pfrom->PushMessage("nSPV",response);
-                        pfrom->prevtimes[ind] = timestamp;
-                    }
-                    NSPV_inforesp_purge(&I);
-                }
+                response.resize(1 + slen);
+                response[0] = NSPV_INFORESP;
+                //LogPrintf("slen.%d version.%d\n",slen,I.version);
+                if ( NSPV_rwinforesp(1,&response[1],&I) == slen )
+                    retval = true;
+                NSPV_inforesp_purge(&I);
             }
         }
         else if ( request[0] == NSPV_UTXOS )
         {
-            //LogPrintf("utxos: %u > %u, ind.%d, len.%d\n",timestamp,pfrom->prevtimes[ind],ind,len);
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_utxosresp U;
+            if ( len < 64+5 && (request[1] == len-3 || request[1] == len-7 || request[1] == len-11) )
             {
-                struct NSPV_utxosresp U;
-                if ( len < 64+5 && (request[1] == len-3 || request[1] == len-7 || request[1] == len-11) )
+                int32_t skipcount = 0; char coinaddr[64]; uint8_t filter; uint8_t isCC = 0;
+                memcpy(coinaddr,&request[2],request[1]);
+                coinaddr[request[1]] = 0;
+                if ( request[1] == len-3 )
+                    isCC = (request[len-1] != 0);
+                else if ( request[1] == len-7 )
                 {
-                    int32_t skipcount = 0; char coinaddr[64]; uint8_t filter; uint8_t isCC = 0;
-                    memcpy(coinaddr,&request[2],request[1]);
-                    coinaddr[request[1]] = 0;
-                    if ( request[1] == len-3 )
-                        isCC = (request[len-1] != 0);
-                    else if ( request[1] == len-7 )
-                    {
-                        isCC = (request[len-5] != 0);
-                        iguana_rwnum(0,&request[len-4],sizeof(skipcount),&skipcount);
-                    }
-                    else
-                    {
-                        isCC = (request[len-9] != 0);
-                        iguana_rwnum(0,&request[len-8],sizeof(skipcount),&skipcount);
-                        iguana_rwnum(0,&request[len-4],sizeof(filter),&filter);
-                    }
-                    if ( 0 && isCC != 0 )
-                        LogPrintf("utxos %s isCC.%d skipcount.%d filter.%x\n",coinaddr,isCC,skipcount,filter);
-                    memset(&U,0,sizeof(U));
-                    if ( (slen= NSPV_getaddressutxos(&U,coinaddr,isCC,skipcount,filter)) > 0 )
-                    {
-                        response.resize(1 + slen);
-                        response[0] = NSPV_UTXOSRESP;
-                        if ( NSPV_rwutxosresp(1,&response[1],&U) == slen )
-                        {
-                            pfrom->PushMessage("nSPV",response);
-                            pfrom->prevtimes[ind] = timestamp;
-                        }
-                        NSPV_utxosresp_purge(&U);
-                    }
+                    isCC = (request[len-5] != 0);
+                    iguana_rwnum(0,&request[len-4],sizeof(skipcount),&skipcount);
+                }
+                else
+                {
+                    isCC = (request[len-9] != 0);
+                    iguana_rwnum(0,&request[len-8],sizeof(skipcount),&skipcount);
+                    iguana_rwnum(0,&request[len-4],sizeof(filter),&filter);
+                }
+                if ( 0 && isCC != 0 )
+                    LogPrintf("utxos %s isCC.%d skipcount.%d filter.%x\n",coinaddr,isCC,skipcount,filter);
+                memset(&U,0,sizeof(U));
+                if ( (slen= NSPV_getaddressutxos(&U,coinaddr,isCC,skipcount,filter)) > 0 )
+                {
+                    response.resize(1 + slen);
+                    response[0] = NSPV_UTXOSRESP;
+                    if ( NSPV_rwutxosresp(1,&response[1],&U) == slen )
+                        retval = true;
+                    NSPV_utxosresp_purge(&U);
                 }
             }
         }
         else if ( request[0] == NSPV_TXIDS )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_txidsresp T;
+            if ( len < 64+5 && (request[1] == len-3 || request[1] == len-7 || request[1] == len-11) )
             {
-                struct NSPV_txidsresp T;
-                if ( len < 64+5 && (request[1] == len-3 || request[1] == len-7 || request[1] == len-11) )
+                int32_t skipcount = 0; char coinaddr[64]; uint32_t filter; uint8_t isCC = 0;
+                memcpy(coinaddr,&request[2],request[1]);
+                coinaddr[request[1]] = 0;
+                if ( request[1] == len-3 )
+                    isCC = (request[len-1] != 0);
+                else if ( request[1] == len-7 )
+                {
+                    isCC = (request[len-5] != 0);
+                    iguana_rwnum(0,&request[len-4],sizeof(skipcount),&skipcount);
+                }
+                else
+                {
+                    isCC = (request[len-9] != 0);
+                    iguana_rwnum(0,&request[len-8],sizeof(skipcount),&skipcount);
+                    iguana_rwnum(0,&request[len-4],sizeof(filter),&filter);
+                }
+                if ( 0 && isCC != 0 )
+                    LogPrintf("txids %s isCC.%d skipcount.%d filter.%d\n",coinaddr,isCC,skipcount,filter);
+                memset(&T,0,sizeof(T));
+                if ( (slen= NSPV_getaddresstxids(&T,coinaddr,isCC,skipcount,filter)) > 0 )
                 {
-                    int32_t skipcount = 0; char coinaddr[64]; uint32_t filter; uint8_t isCC = 0;
-                    memcpy(coinaddr,&request[2],request[1]);
-                    coinaddr[request[1]] = 0;
-                    if ( request[1] == len-3 )
-                        isCC = (request[len-1] != 0);
-                    else if ( request[1] == len-7 )
-                    {
-                        isCC = (request[len-5] != 0);
-                        iguana_rwnum(0,&request[len-4],sizeof(skipcount),&skipcount);
-                    }
-                    else
-                    {
-                        isCC = (request[len-9] != 0);
-                        iguana_rwnum(0,&request[len-8],sizeof(skipcount),&skipcount);
-                        iguana_rwnum(0,&request[len-4],sizeof(filter),&filter);
-                    }
-                    if ( 0 && isCC != 0 )
-                        LogPrintf("txids %s isCC.%d skipcount.%d filter.%d\n",coinaddr,isCC,skipcount,filter);
-                    memset(&T,0,sizeof(T));
-                    if ( (slen= NSPV_getaddresstxids(&T,coinaddr,isCC,skipcount,filter)) > 0 )
-                    {
 //LogPrintf("slen.%d\n",slen);
-                        response.resize(1 + slen);
-                        response[0] = NSPV_TXIDSRESP;
-                        if ( NSPV_rwtxidsresp(1,&response[1],&T) == slen )
-                        {
-                            pfrom->PushMessage("nSPV",response);
-                            pfrom->prevtimes[ind] = timestamp;
-                        }
-                        NSPV_txidsresp_purge(&T);
-                    }
-                } else LogPrintf("len.%d req1.%d\n",len,request[1]);
-            }
+                    response.resize(1 + slen);
+                    response[0] = NSPV_TXIDSRESP;
+                    if ( NSPV_rwtxidsresp(1,&response[1],&T) == slen )
+                        retval = true;
+                    NSPV_txidsresp_purge(&T);
+                }
+            } else LogPrintf("len.%d req1.%d\n",len,request[1]);
         }
         else if ( request[0] == NSPV_MEMPOOL )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_mempoolresp M; char coinaddr[64];
+            if ( len < sizeof(M)+64 )
             {
-                struct NSPV_mempoolresp M; char coinaddr[64];
-                if ( len < sizeof(M)+64 )
+                int32_t vout; uint256 txid; uint8_t funcid,isCC = 0;
+                n = 1;
+                n += iguana_rwnum(0,&request[n],sizeof(isCC),&isCC);
+                n += iguana_rwnum(0,&request[n],sizeof(funcid),&funcid);
+                n += iguana_rwnum(0,&request[n],sizeof(vout),&vout);
+                n += iguana_rwbignum(0,&request[n],sizeof(txid),(uint8_t *)&txid);
+                slen = request[n++];
+                if ( slen < 63 )
                 {
-                    int32_t vout; uint256 txid; uint8_t funcid,isCC = 0;
-                    n = 1;
-                    n += iguana_rwnum(0,&request[n],sizeof(isCC),&isCC);
-                    n += iguana_rwnum(0,&request[n],sizeof(funcid),&funcid);
-                    n += iguana_rwnum(0,&request[n],sizeof(vout),&vout);
-                    n += iguana_rwbignum(0,&request[n],sizeof(txid),(uint8_t *)&txid);
-                    slen = request[n++];
-                    if ( slen < 63 )
+                    memcpy(coinaddr,&request[n],slen), n += slen;
+                    coinaddr[slen] = 0;
+                    if ( isCC != 0 )
+                        LogPrintf("(%s) isCC.%d funcid.%d %s/v%d len.%d slen.%d\n",coinaddr,isCC,funcid,txid.GetHex().c_str(),vout,len,slen);
+                    memset(&M,0,sizeof(M));
+                    if ( (slen= NSPV_mempooltxids(&M,coinaddr,isCC,funcid,txid,vout)) > 0 )
                     {
-                        memcpy(coinaddr,&request[n],slen), n += slen;
-                        coinaddr[slen] = 0;
-                        if ( isCC != 0 )
-                            LogPrintf("(%s) isCC.%d funcid.%d %s/v%d len.%d slen.%d\n",coinaddr,isCC,funcid,txid.GetHex().c_str(),vout,len,slen);
-                        memset(&M,0,sizeof(M));
-                        if ( (slen= NSPV_mempooltxids(&M,coinaddr,isCC,funcid,txid,vout)) > 0 )
-                        {
-                            //LogPrintf("NSPV_mempooltxids slen.%d\n",slen);
-                            response.resize(1 + slen);
-                            response[0] = NSPV_MEMPOOLRESP;
-                            if ( NSPV_rwmempoolresp(1,&response[1],&M) == slen )
-                            {
-                                pfrom->PushMessage("nSPV",response);
-                                pfrom->prevtimes[ind] = timestamp;
-                            }
-                            NSPV_mempoolresp_purge(&M);
-                        }
+                        //LogPrintf("NSPV_mempooltxids slen.%d\n",slen);
+                        response.resize(1 + slen);
+                        response[0] = NSPV_MEMPOOLRESP;
+                        if ( NSPV_rwmempoolresp(1,&response[1],&M) == slen )
+                            retval = true;
+                        NSPV_mempoolresp_purge(&M);
                     }
-                } else LogPrintf("len.%d req1.%d\n",len,request[1]);
-            }
+                }
+            } else LogPrintf("len.%d req1.%d\n",len,request[1]);
         }
         else if ( request[0] == NSPV_NTZS )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_ntzsresp N; int32_t height;
+            if ( len == 1+sizeof(height) )
             {
-                struct NSPV_ntzsresp N; int32_t height;
-                if ( len == 1+sizeof(height) )
+                iguana_rwnum(0,&request[1],sizeof(height),&height);
+                memset(&N,0,sizeof(N));
+                if ( (slen= NSPV_getntzsresp(&N,height)) > 0 )
                 {
-                    iguana_rwnum(0,&request[1],sizeof(height),&height);
-                    memset(&N,0,sizeof(N));
-                    if ( (slen= NSPV_getntzsresp(&N,height)) > 0 )
-                    {
-                        response.resize(1 + slen);
-                        response[0] = NSPV_NTZSRESP;
-                        if ( NSPV_rwntzsresp(1,&response[1],&N) == slen )
-                        {
-                            pfrom->PushMessage("nSPV",response);
-                            pfrom->prevtimes[ind] = timestamp;
-                        }
-                        NSPV_ntzsresp_purge(&N);
-                    }
+                    response.resize(1 + slen);
+                    response[0] = NSPV_NTZSRESP;
+                    if ( NSPV_rwntzsresp(1,&response[1],&N) == slen )
+                        retval = true;
+                    NSPV_ntzsresp_purge(&N);
                 }
             }
         }
         else if ( request[0] == NSPV_NTZSPROOF )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_ntzsproofresp P; uint256 prevntz,nextntz;
+            if ( len == 1+sizeof(prevntz)+sizeof(nextntz) )
             {
-                struct NSPV_ntzsproofresp P; uint256 prevntz,nextntz;
-                if ( len == 1+sizeof(prevntz)+sizeof(nextntz) )
+                iguana_rwbignum(0,&request[1],sizeof(prevntz),(uint8_t *)&prevntz);
+                iguana_rwbignum(0,&request[1+sizeof(prevntz)],sizeof(nextntz),(uint8_t *)&nextntz);
+                memset(&P,0,sizeof(P));
+                if ( (slen= NSPV_getntzsproofresp(&P,prevntz,nextntz)) > 0 )
                 {
-                    iguana_rwbignum(0,&request[1],sizeof(prevntz),(uint8_t *)&prevntz);
-                    iguana_rwbignum(0,&request[1+sizeof(prevntz)],sizeof(nextntz),(uint8_t *)&nextntz);
-                    memset(&P,0,sizeof(P));
-                    if ( (slen= NSPV_getntzsproofresp(&P,prevntz,nextntz)) > 0 )
-                    {
-                        // LogPrintf("slen.%d msg prev.%s next.%s\n",slen,prevntz.GetHex().c_str(),nextntz.GetHex().c_str());
-                        response.resize(1 + slen);
-                        response[0] = NSPV_NTZSPROOFRESP;
-                        if ( NSPV_rwntzsproofresp(1,&response[1],&P) == slen )
-                        {
-                            pfrom->PushMessage("nSPV",response);
-                            pfrom->prevtimes[ind] = timestamp;
-                        }
-                        NSPV_ntzsproofresp_purge(&P);
-                    } else LogPrintf("err.%d\n",slen);
-                }
+                    // LogPrintf("slen.%d msg prev.%s next.%s\n",slen,prevntz.GetHex().c_str(),nextntz.GetHex().c_str());
+                    response.resize(1 + slen);
+                    response[0] = NSPV_NTZSPROOFRESP;
+                    if ( NSPV_rwntzsproofresp(1,&response[1],&P) == slen )
+                        retval = true;
+                    NSPV_ntzsproofresp_purge(&P);
+                } else LogPrintf("err.%d\n",slen);
             }
         }
         else if ( request[0] == NSPV_TXPROOF )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_txproof P; uint256 txid; int32_t height,vout;
+            if ( len == 1+sizeof(txid)+sizeof(height)+sizeof(vout) )
             {
-                struct NSPV_txproof P; uint256 txid; int32_t height,vout;
-                if ( len == 1+sizeof(txid)+sizeof(height)+sizeof(vout) )
+                iguana_rwnum(0,&request[1],sizeof(height),&height);
+                iguana_rwnum(0,&request[1+sizeof(height)],sizeof(vout),&vout);
+                iguana_rwbignum(0,&request[1+sizeof(height)+sizeof(vout)],sizeof(txid),(uint8_t *)&txid);
+                //LogPrintf("got txid %s/v%d ht.%d\n",txid.GetHex().c_str(),vout,height);
+                memset(&P,0,sizeof(P));
+                if ( (slen= NSPV_gettxproof(&P,vout,txid,height)) > 0 )
                 {
-                    iguana_rwnum(0,&request[1],sizeof(height),&height);
-                    iguana_rwnum(0,&request[1+sizeof(height)],sizeof(vout),&vout);
-                    iguana_rwbignum(0,&request[1+sizeof(height)+sizeof(vout)],sizeof(txid),(uint8_t *)&txid);
-                    //LogPrintf("got txid %s/v%d ht.%d\n",txid.GetHex().c_str(),vout,height);
-                    memset(&P,0,sizeof(P));
-                    if ( (slen= NSPV_gettxproof(&P,vout,txid,height)) > 0 )
+                    //LogPrintf("slen.%d\n",slen);
+                    response.resize(1 + slen);
+                    response[0] = NSPV_TXPROOFRESP;
+                    if ( NSPV_rwtxproof(1,&response[1],&P) == slen )
                     {
-                        //LogPrintf("slen.%d\n",slen);
-                        response.resize(1 + slen);
-                        response[0] = NSPV_TXPROOFRESP;
-                        if ( NSPV_rwtxproof(1,&response[1],&P) == slen )
-                        {
-                            //LogPrintf("send response\n");
-                            pfrom->PushMessage("nSPV",response);
-                            pfrom->prevtimes[ind] = timestamp;
-                        }
-                        NSPV_txproof_purge(&P);
-                    } else LogPrintf("gettxproof error.%d\n",slen);
-                } else LogPrintf("txproof reqlen.%d\n",len);
-            }
+                        //LogPrintf("send response\n");
+                        retval = true;
+                    }
+                    NSPV_txproof_purge(&P);
+                } else LogPrintf("gettxproof error.%d\n",slen);
+            } else LogPrintf("txproof reqlen.%d\n",len);
         }
         else if ( request[0] == NSPV_SPENTINFO )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_spentinfo S; int32_t vout; uint256 txid;
+            if ( len == 1+sizeof(txid)+sizeof(vout) )
             {
-                struct NSPV_spentinfo S; int32_t vout; uint256 txid;
-                if ( len == 1+sizeof(txid)+sizeof(vout) )
+                iguana_rwnum(0,&request[1],sizeof(vout),&vout);
+                iguana_rwbignum(0,&request[1+sizeof(vout)],sizeof(txid),(uint8_t *)&txid);
+                memset(&S,0,sizeof(S));
+                if ( (slen= NSPV_getspentinfo(&S,txid,vout)) > 0 )
                 {
-                    iguana_rwnum(0,&request[1],sizeof(vout),&vout);
-                    iguana_rwbignum(0,&request[1+sizeof(vout)],sizeof(txid),(uint8_t *)&txid);
-                    memset(&S,0,sizeof(S));
-                    if ( (slen= NSPV_getspentinfo(&S,txid,vout)) > 0 )
-                    {
-                        response.resize(1 + slen);
-                        response[0] = NSPV_SPENTINFORESP;
-                        if ( NSPV_rwspentinfo(1,&response[1],&S) == slen )
-                        {
-                            pfrom->PushMessage("nSPV",response);
-                            pfrom->prevtimes[ind] = timestamp;
-                        }
-                        NSPV_spentinfo_purge(&S);
-                    }
+                    response.resize(1 + slen);
+                    response[0] = NSPV_SPENTINFORESP;
+                    if ( NSPV_rwspentinfo(1,&response[1],&S) == slen )
+                        retval = true;
+                    NSPV_spentinfo_purge(&S);
                 }
             }
         }
         else if ( request[0] == NSPV_BROADCAST )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_broadcastresp B; uint32_t n,offset; uint256 txid;
+            if ( len > 1+sizeof(txid)+sizeof(n) )
             {
-                struct NSPV_broadcastresp B; uint32_t n,offset; uint256 txid;
-                if ( len > 1+sizeof(txid)+sizeof(n) )
+                iguana_rwbignum(0,&request[1],sizeof(txid),(uint8_t *)&txid);
+                iguana_rwnum(0,&request[1+sizeof(txid)],sizeof(n),&n);
+                memset(&B,0,sizeof(B));
+                offset = 1 + sizeof(txid) + sizeof(n);
+                if ( n < MAX_TX_SIZE_AFTER_SAPLING && request.size() == offset+n && (slen= NSPV_sendrawtransaction(&B,&request[offset],n)) > 0 )
                 {
-                    iguana_rwbignum(0,&request[1],sizeof(txid),(uint8_t *)&txid);
-                    iguana_rwnum(0,&request[1+sizeof(txid)],sizeof(n),&n);
-                    memset(&B,0,sizeof(B));
-                    offset = 1 + sizeof(txid) + sizeof(n);
-                    if ( n < MAX_TX_SIZE_AFTER_SAPLING && request.size() == offset+n && (slen= NSPV_sendrawtransaction(&B,&request[offset],n)) > 0 )
-                    {
-                        response.resize(1 + slen);
-                        response[0] = NSPV_BROADCASTRESP;
-                        if ( NSPV_rwbroadcastresp(1,&response[1],&B) == slen )
-                        {
-                            pfrom->PushMessage("nSPV",response);
-                            pfrom->prevtimes[ind] = timestamp;
-                        }
-                        NSPV_broadcast_purge(&B);
-                    }
+                    response.resize(1 + slen);
+                    response[0] = NSPV_BROADCASTRESP;
+                    if ( NSPV_rwbroadcastresp(1,&response[1],&B) == slen )
+                        retval = true;
+                    NSPV_broadcast_purge(&B);
                 }
             }
         }
         else if ( request[0] == NSPV_REMOTERPC )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            struct NSPV_remoterpcresp R; int32_t p;
+            p = 1;
+            p+=iguana_rwnum(0,&request[p],sizeof(slen),&slen);
+            memset(&R,0,sizeof(R));
+            if (request.size() == p+slen && (slen=NSPV_remoterpc(&R,(char *)&request[p],slen))>0 )
             {
-                struct NSPV_remoterpcresp R; int32_t p;
-                p = 1;
-                p+=iguana_rwnum(0,&request[p],sizeof(slen),&slen);
-                memset(&R,0,sizeof(R));
-                if (request.size() == p+slen && (slen=NSPV_remoterpc(&R,(char *)&request[p],slen))>0 )
-                {
-                    response.resize(1 + slen);
-                    response[0] = NSPV_REMOTERPCRESP;
-                    NSPV_rwremoterpcresp(1,&response[1],&R,slen);
-                    pfrom->PushMessage("nSPV",response);
-                    pfrom->prevtimes[ind] = timestamp;
-                    NSPV_remoterpc_purge(&R);
-                }                
-            }
+                response.resize(1 + slen);
+                response[0] = NSPV_REMOTERPCRESP;
+                NSPV_rwremoterpcresp(1,&response[1],&R,slen);
+                retval = true;
+                NSPV_remoterpc_purge(&R);
+            }                
         }
         else if (request[0] == NSPV_CCMODULEUTXOS)  // get cc module utxos from coinaddr for the requested amount, evalcode, funcid list and txid
         {
-            //LogPrintf("utxos: %u > %u, ind.%d, len.%d\n",timestamp,pfrom->prevtimes[ind],ind,len);
-            if (timestamp > pfrom->prevtimes[ind])
+            struct NSPV_utxosresp U;
+            char coinaddr[64];
+            int64_t amount;
+            uint8_t evalcode;
+            char funcids[27];
+            uint256 filtertxid;
+            bool errorFormat = false;
+            const int32_t BITCOINADDRESSMINLEN = 20;
+
+            int32_t minreqlen = sizeof(uint8_t) + sizeof(uint8_t) + BITCOINADDRESSMINLEN + sizeof(amount) + sizeof(evalcode) + sizeof(uint8_t) + sizeof(filtertxid);
+            int32_t maxreqlen = sizeof(uint8_t) + sizeof(uint8_t) + sizeof(coinaddr)-1 + sizeof(amount) + sizeof(evalcode) + sizeof(uint8_t) + sizeof(funcids)-1 + sizeof(filtertxid);
+
+            if (len >= minreqlen && len <= maxreqlen)
             {
-                struct NSPV_utxosresp U;
-                char coinaddr[64];
-                int64_t amount;
-                uint8_t evalcode;
-                char funcids[27];
-                uint256 filtertxid;
-                bool errorFormat = false;
-                const int32_t BITCOINADDRESSMINLEN = 20;
-
-                int32_t minreqlen = sizeof(uint8_t) + sizeof(uint8_t) + BITCOINADDRESSMINLEN + sizeof(amount) + sizeof(evalcode) + sizeof(uint8_t) + sizeof(filtertxid);
-                int32_t maxreqlen = sizeof(uint8_t) + sizeof(uint8_t) + sizeof(coinaddr)-1 + sizeof(amount) + sizeof(evalcode) + sizeof(uint8_t) + sizeof(funcids)-1 + sizeof(filtertxid);
-
-                if (len >= minreqlen && len <= maxreqlen)
+                n = 1;
+                int32_t addrlen = request[n++];
+                if (addrlen < sizeof(coinaddr))
                 {
-                    n = 1;
-                    int32_t addrlen = request[n++];
-                    if (addrlen < sizeof(coinaddr))
+                    memcpy(coinaddr, &request[n], addrlen);
+                    coinaddr[addrlen] = 0;
+                    n += addrlen;
+                    iguana_rwnum(0, &request[n], sizeof(amount), &amount);
+                    n += sizeof(amount);
+                    iguana_rwnum(0, &request[n], sizeof(evalcode), &evalcode);
+                    n += sizeof(evalcode);
+
+                    int32_t funcidslen = request[n++];
+                    if (funcidslen < sizeof(funcids))
                     {
-                        memcpy(coinaddr, &request[n], addrlen);
-                        coinaddr[addrlen] = 0;
-                        n += addrlen;
-                        iguana_rwnum(0, &request[n], sizeof(amount), &amount);
-                        n += sizeof(amount);
-                        iguana_rwnum(0, &request[n], sizeof(evalcode), &evalcode);
-                        n += sizeof(evalcode);
-
-                        int32_t funcidslen = request[n++];
-                        if (funcidslen < sizeof(funcids))
+                        memcpy(funcids, &request[n], funcidslen);
+                        funcids[funcidslen] = 0;
+                        n += funcidslen;
+                        iguana_rwbignum(0, &request[n], sizeof(filtertxid), (uint8_t *)&filtertxid);
+                        std::cerr << __func__ << " " << "request addr=" << coinaddr << " amount=" << amount << " evalcode=" << (int)evalcode << " funcids=" << funcids << " filtertxid=" << filtertxid.GetHex() << std::endl;
+
+                        memset(&U, 0, sizeof(U));
+                        if ((slen = NSPV_getccmoduleutxos(&U, coinaddr, amount, evalcode, funcids, filtertxid)) > 0)
                         {
-                            memcpy(funcids, &request[n], funcidslen);
-                            funcids[funcidslen] = 0;
-                            n += funcidslen;
-                            iguana_rwbignum(0, &request[n], sizeof(filtertxid), (uint8_t *)&filtertxid);
-                            std::cerr << __func__ << " " << "request addr=" << coinaddr << " amount=" << amount << " evalcode=" << (int)evalcode << " funcids=" << funcids << " filtertxid=" << filtertxid.GetHex() << std::endl;
-
-                            memset(&U, 0, sizeof(U));
-                            if ((slen = NSPV_getccmoduleutxos(&U, coinaddr, amount, evalcode, funcids, filtertxid)) > 0)
+                            std::cerr << __func__ << " " << "created utxos, slen=" << slen << std::endl;
+                            response.resize(1 + slen);
+                            response[0] = NSPV_CCMODULEUTXOSRESP;
+                            if (NSPV_rwutxosresp(1, &response[1], &U) == slen)
                             {
-                                std::cerr << __func__ << " " << "created utxos, slen=" << slen << std::endl;
-                                response.resize(1 + slen);
-                                response[0] = NSPV_CCMODULEUTXOSRESP;
-                                if (NSPV_rwutxosresp(1, &response[1], &U) == slen)
-                                {
-                                    pfrom->PushMessage("nSPV", response);
-                                    pfrom->prevtimes[ind] = timestamp;
-                                    std::cerr << __func__ << " " << "returned nSPV response" << std::endl;
-                                }
-                                NSPV_utxosresp_purge(&U);
+                                retval = true;
+                                std::cerr << __func__ << " " << "returned nSPV response" << std::endl;
                             }
+                            NSPV_utxosresp_purge(&U);
                         }
                     }
                 }
             }
         }
     }
+    return(retval);
+}
+
+/****
+ * getnSPV requests waiting for a worker thread. Every peer has its own queue and at most
+ * one of its requests is answered at a time. Peers with queued requests take turns, so a
+ * peer sending a burst of requests delays its own answers, not the other peers'.
+ */
+class CNSPVRequestQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::map<CNode*,std::deque<std::vector<uint8_t> > > mapPending; // peers with a queued or running request, holding a reference
+    std::deque<CNode*> vReady; // peers with queued requests and none running, in turn order
+    size_t nQueued;
+
+public:
+    CNSPVRequestQueue() : nQueued(0) {}
+
+    /****
+     * @param pnode the peer that sent the request
+     * @param request the getnSPV payload
+     * @returns false if the request is dropped because a queue is full
+     */
+    bool Push(CNode *pnode,const std::vector<uint8_t> &request)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<CNode*,std::deque<std::vector<uint8_t> > >::iterator it = mapPending.find(pnode);
+        if ( nQueued >= MAX_NSPV_QUEUE || (it != mapPending.end() && it->second.size() >= MAX_NSPV_PEER_QUEUE) )
+            return false;
+        if ( it == mapPending.end() )
+        {
+            pnode->AddRef();
+            it = mapPending.insert(std::make_pair(pnode,std::deque<std::vector<uint8_t> >())).first;
+            vReady.push_back(pnode);
+            cond.notify_one();
+        }
+        it->second.push_back(request);
+        nspvServerStats.nQueued = ++nQueued;
+        return true;
+    }
+
+    /****
+     * Wait for the next request to answer, Done() must be called when it is answered
+     * @param[out] pnode the peer that sent it
+     * @param[out] request the getnSPV payload
+     */
+    void Pop(CNode *&pnode,std::vector<uint8_t> &request)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while ( vReady.empty() )
+            cond.wait(lock);
+        pnode = vReady.front();
+        vReady.pop_front();
+        std::deque<std::vector<uint8_t> > &pending = mapPending[pnode];
+        request.swap(pending.front());
+        pending.pop_front();
+        nspvServerStats.nQueued = --nQueued;
+    }
+
+    /****
+     * @param pnode the peer whose request was answered, it gets back in turn if it has more
+     */
+    void Done(CNode *pnode)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<CNode*,std::deque<std::vector<uint8_t> > >::iterator it = mapPending.find(pnode);
+        if ( it->second.empty() )
+        {
+            mapPending.erase(it);
+            pnode->Release();
+        }
+        else
+        {
+            vReady.push_back(pnode);
+            cond.notify_one();
+        }
+    }
+};
+
+/****
+ * Responses to requests that only depend on the active chain, valid until the tip changes
+ */
+class CNSPVResponseCache
+{
+private:
+    CCriticalSection cs;
+    uint256 hashTip; // tip the cached responses were built on
+    std::map<std::vector<uint8_t>,std::vector<uint8_t> > mapResponses;
+
+    void SetTip(const uint256 &tip)
+    {
+        if ( tip != hashTip )
+        {
+            mapResponses.clear();
+            hashTip = tip;
+        }
+    }
+
+public:
+    bool Get(const uint256 &tip,const std::vector<uint8_t> &request,std::vector<uint8_t> &response)
+    {
+        LOCK(cs);
+        SetTip(tip);
+        std::map<std::vector<uint8_t>,std::vector<uint8_t> >::const_iterator it = mapResponses.find(request);
+        if ( it == mapResponses.end() )
+            return false;
+        response = it->second;
+        return true;
+    }
+
+    void Put(const uint256 &tip,const std::vector<uint8_t> &request,const std::vector<uint8_t> &response)
+    {
+        LOCK(cs);
+        SetTip(tip);
+        if ( mapResponses.size() >= MAX_NSPV_CACHE )
+            mapResponses.clear();
+        mapResponses[request] = response;
+    }
+};
+
+static CNSPVRequestQueue nspvRequests;
+static CNSPVResponseCache nspvResponses;
+
+/****
+ * @param reqtype the getnSPV request type
+ * @returns true if the answer only changes with the tip, NSPV_TXPROOF is not: its unspent value and txs without a height come from the mempool
+ */
+static bool squishy_nSPVcacheable(uint8_t reqtype)
+{
+    return(reqtype == NSPV_INFO || reqtype == NSPV_NTZS || reqtype == NSPV_NTZSPROOF);
+}
+
+static uint256 squishy_nSPVtiphash()
+{
+    LOCK(cs_main);
+    return(chainActive.Tip() != 0 ? chainActive.Tip()->GetBlockHash() : uint256());
+}
+
+/****
+ * @brief answer a getnSPV request, at most once a second for every request type of a peer
+ * @note answers to requests that only depend on the chain come from the response cache
+ * @param pfrom the peer that sent the request
+ * @param request the getnSPV payload
+ */
+static void squishy_nSPVserve(CNode *pfrom,std::vector<uint8_t> &request)
+{
+    std::vector<uint8_t> response; uint256 hashTip; int32_t ind; uint32_t timestamp = (uint32_t)time(NULL); bool fCache,fSend = false;
+    if ( (ind= request[0]>>1) >= sizeof(pfrom->prevtimes)/sizeof(*pfrom->prevtimes) )
+        ind = (int32_t)(sizeof(pfrom->prevtimes)/sizeof(*pfrom->prevtimes)) - 1;
+    if ( pfrom->prevtimes[ind] > timestamp )
+        pfrom->prevtimes[ind] = 0;
+    if ( timestamp <= pfrom->prevtimes[ind] )
+        return;
+    if ( (fCache= squishy_nSPVcacheable(request[0])) )
+    {
+        hashTip = squishy_nSPVtiphash();
+        if ( (fSend= nspvResponses.Get(hashTip,request,response)) )
+            nspvServerStats.nCacheHits++;
+        else nspvServerStats.nCacheMisses++;
+    }
+    if ( !fSend )
+    {
+        // built without cs_main like before, so scans and remote rpcs do not hold up block connection
+        if ( (fSend= squishy_nSPVresponse(response,request)) && fCache && squishy_nSPVtiphash() == hashTip )
+            nspvResponses.Put(hashTip,request,response);
+    }
+    if ( fSend )
+    {
+        pfrom->PushMessage("nSPV",response);
+        pfrom->prevtimes[ind] = timestamp;
+    }
+}
+
+void squishy_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a request
+{
+    if ( request.size() > 0 && !nspvRequests.Push(pfrom,request) )
+    {
+        nspvServerStats.nDropped++;
+        LogPrint("nspv","dropped getnSPV request %d from peer=%d, queue full\n",request[0],pfrom->id);
+    }
+}
+
+void ThreadNSPVRequests()
+{
+    CNode *pnode; std::vector<uint8_t> request;
+    RenameThread("squishy-nspv");
+    while ( true )
+    {
+        nspvRequests.Pop(pnode,request);
+        // a failed answer must not stop the thread or leave the peer out of turn
+        try
+        {
+            if ( !pnode->fDisconnect )
+                squishy_nSPVserve(pnode,request);
+        }
+        catch ( const std::exception &e )
+        {
+            LogPrintf("%s: getnSPV request %d from peer=%d: %s\n",__func__,request[0],pnode->id,e.what());
+        }
+        catch ( ... )
+        {
+            LogPrintf("%s: getnSPV request %d from peer=%d: unknown exception\n",__func__,request[0],pnode->id);
+        }
+        nspvRequests.Done(pnode);
+    }
 }
 
 #endif // SQUISHY_NSPVFULLNODE_H
@@ -16,6 +16,7 @@
 #include "squishy_globals.h"
 #include "squishy_bitcoind.h"
 #include "mem_read.h"
+#include <algorithm>
 
 namespace squishy {
 
@@ -353,6 +354,22 @@ void squishy_state::AddCheckpoint(const notarized_checkpoint &in)
 {
     NPOINTS.push_back(in);
     last = in;
+    checkpoint_interval interval;
+    interval.end = in.notarized_height;
+    interval.span = in.MoMdepth & 0xffff; // 2s compliment if negative
+    interval.idx = NPOINTS.size() - 1;
+    if ( in.MoMdepth == 0 || interval.span == 0 )
+        return; // can never be returned by CheckpointAtHeight
+    if ( MoM_intervals.empty() || MoM_intervals.back().end <= interval.end )
+        MoM_intervals.push_back(interval); // notarized heights normally only go up
+    else
+    {
+        auto itr = std::upper_bound(MoM_intervals.begin(), MoM_intervals.end(), interval,
+                [](const checkpoint_interval& lhs, const checkpoint_interval& rhs) { return lhs.end < rhs.end; });
+        MoM_intervals.insert(itr, interval);
+    }
+    if ( interval.span > MoM_maxspan )
+        MoM_maxspan = interval.span;
 }
 
 /****
@@ -471,21 +488,41 @@ int32_t squishy_state::PrevMoMHeight() const
  */
 const notarized_checkpoint *squishy_state::CheckpointAtHeight(int32_t height) const
 {
-    // find the nearest notarization_height
-    // work backwards, get the first one that meets our criteria
-    for(auto itr = NPOINTS.rbegin(); itr != NPOINTS.rend(); ++itr)
+    // only intervals ending at or above height can contain it, and none ending
+    // MoM_maxspan or more above height can reach down to it
+    auto itr = std::lower_bound(MoM_intervals.begin(), MoM_intervals.end(), height,
+            [](const checkpoint_interval& lhs, int32_t rhs) { return lhs.end < rhs; });
+    const checkpoint_interval *found = nullptr;
+    for( ; itr != MoM_intervals.end() && (int64_t)itr->end - MoM_maxspan < height; ++itr)
     {
-        if ( itr->MoMdepth != 0 
-                && height > itr->notarized_height-(itr->MoMdepth&0xffff) // 2s compliment if negative
-                && height <= itr->notarized_height )
-        {
-            return &(*itr);
-        }
+        // of all matches, the most recently added one wins
+        if ( height > itr->end - itr->span && (found == nullptr || itr->idx > found->idx) )
+            found = &(*itr);
     }
+    if ( found != nullptr )
+        return &NPOINTS[found->idx];
     return nullptr;
 }
 
-void squishy_state::clear_checkpoints() { NPOINTS.clear(); }
+const std::vector<notarized_checkpoint> &squishy_state::Checkpoints() const { return NPOINTS; }
+const notarized_checkpoint &squishy_state::LastCheckpoint() const { return last; }
+
+void squishy_state::RestoreCheckpoints(const std::vector<notarized_checkpoint> &checkpoints, const notarized_checkpoint &lastcp)
+{
+    clear_checkpoints();
+    NPOINTS_last_index = 0;
+    NPOINTS.reserve(checkpoints.size());
+    for (const notarized_checkpoint &cp : checkpoints)
+        AddCheckpoint(cp);
+    last = lastcp;
+}
+
+void squishy_state::clear_checkpoints()
+{
+    NPOINTS.clear();
+    MoM_intervals.clear();
+    MoM_maxspan = 0;
+}
 const uint256& squishy_state::LastNotarizedHash() const { return last.notarized_hash; }
 void squishy_state::SetLastNotarizedHash(const uint256 &in) { last.notarized_hash = in; }
 const uint256& squishy_state::LastNotarizedDestTxId() const { return last.notarized_desttxid; }
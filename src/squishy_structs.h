@@ -18,6 +18,7 @@
 #include <vector>
 #include <cstdint>
 
+#include "serialize.h"
 #include "squishy_defs.h"
 #include "squishy_extern_globals.h"
 
@@ -240,6 +241,23 @@ struct notarized_checkpoint
     int32_t kmdstarti = 0;
     int32_t kmdendi = 0;
     friend bool operator==(const notarized_checkpoint& lhs, const notarized_checkpoint& rhs);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(notarized_hash);
+        READWRITE(notarized_desttxid);
+        READWRITE(MoM);
+        READWRITE(MoMoM);
+        READWRITE(nHeight);
+        READWRITE(notarized_height);
+        READWRITE(MoMdepth);
+        READWRITE(MoMoMdepth);
+        READWRITE(MoMoMoffset);
+        READWRITE(kmdstarti);
+        READWRITE(kmdendi);
+    }
 };
 
 bool operator==(const notarized_checkpoint& lhs, const notarized_checkpoint& rhs);
@@ -282,6 +300,7 @@ public:
     uint64_t redeemed;
     uint64_t shorted;
     std::list<std::shared_ptr<squishy::event>> events;
+    std::vector<squishy::event_pubkeys> notary_pubkeys; // applied pubkeys events, replayed when restoring a snapshot
     uint32_t RTbufs[64][3]; uint64_t RTmask;
     template<class T>
     bool add_event(const std::string& symbol, const uint32_t height, T& in)
@@ -304,6 +323,18 @@ protected:
     void clear_checkpoints();
     std::vector<notarized_checkpoint> NPOINTS; // collection of notarizations
     mutable size_t NPOINTS_last_index = 0; // caches checkpoint linear search position
+    /***
+     * The block range (notarized_height-MoMdepth, notarized_height] covered by a
+     * checkpoint that has a MoM
+     */
+    struct checkpoint_interval
+    {
+        int32_t end; // notarized_height
+        int32_t span; // MoMdepth & 0xffff
+        size_t idx; // position within NPOINTS
+    };
+    std::vector<checkpoint_interval> MoM_intervals; // ordered by end, then by idx
+    int32_t MoM_maxspan = 0; // widest interval in MoM_intervals
     notarized_checkpoint last;
 
 public:
@@ -326,6 +357,19 @@ public:
 
     uint64_t NumCheckpoints() const;
 
+    /****
+     * @returns the checkpoints in the order they were added
+     */
+    const std::vector<notarized_checkpoint> &Checkpoints() const;
+    const notarized_checkpoint &LastCheckpoint() const;
+
+    /****
+     * @brief replace the checkpoints, as when restoring a snapshot
+     * @param checkpoints the checkpoints in the order they were added
+     * @param lastcp the last notarization values, which may have been set apart from the checkpoints
+     */
+    void RestoreCheckpoints(const std::vector<notarized_checkpoint> &checkpoints, const notarized_checkpoint &lastcp);
+
     /****
      * Get the notarization data below a particular height
      * @param[in] nHeight the height desired
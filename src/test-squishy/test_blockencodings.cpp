@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include "blockencodings.h"
+#include "hash.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+namespace TestBlockEncodings {
+
+CBlock build_block()
+{
+    CBlock block;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].scriptSig = CScript() << i;
+        mtx.vin[0].prevout.n = i;
+        if ( i == 0 )
+            mtx.vin[0].prevout.SetNull();
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = 42 + i;
+        block.vtx.push_back(CTransaction(mtx));
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+TEST(TestBlockEncodings, siphash_vector)
+{
+    // reference value of SipHash-2-4 over the bytes 00..1f
+    uint256 val = uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100");
+    EXPECT_EQ(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val), 0x7127512f72f27cceULL);
+}
+
+TEST(TestBlockEncodings, reconstruct_with_round_trip)
+{
+    CBlock block = build_block();
+    CTxMemPool pool(::minRelayTxFee);
+    pool.addUnchecked(block.vtx[2].GetHash(), CTxMemPoolEntry(block.vtx[2], 0, 0, 0.0, 1, true, false, 0));
+
+    // send it over the wire
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CBlockHeaderAndShortTxIDs(block);
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    stream >> cmpctblock;
+    EXPECT_EQ(cmpctblock.BlockTxCount(), block.vtx.size());
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    ASSERT_EQ(partialBlock.InitData(cmpctblock), READ_STATUS_OK);
+    EXPECT_TRUE(partialBlock.IsTxAvailable(0));  // prefilled coinbase
+    EXPECT_FALSE(partialBlock.IsTxAvailable(1));
+    EXPECT_TRUE(partialBlock.IsTxAvailable(2));  // from the mempool
+    EXPECT_FALSE(partialBlock.IsTxAvailable(3));
+    EXPECT_EQ(partialBlock.GetMempoolCount(), 1u);
+
+    // the missing transactions are answered in the order they were requested
+    std::vector<CTransactionRef> vtx_missing;
+    vtx_missing.push_back(MakeTransactionRef(block.vtx[1]));
+    vtx_missing.push_back(MakeTransactionRef(block.vtx[3]));
+    CBlock reconstructed;
+    ASSERT_EQ(partialBlock.FillBlock(reconstructed, vtx_missing), READ_STATUS_OK);
+    EXPECT_EQ(reconstructed.GetHash(), block.GetHash());
+    ASSERT_EQ(reconstructed.vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        EXPECT_EQ(reconstructed.vtx[i].GetHash(), block.vtx[i].GetHash());
+}
+
+TEST(TestBlockEncodings, wrong_transaction_fails)
+{
+    CBlock block = build_block();
+    CTxMemPool pool(::minRelayTxFee);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    ASSERT_EQ(partialBlock.InitData(cmpctblock), READ_STATUS_OK);
+
+    // a transaction that does not belong there breaks the merkle root
+    std::vector<CTransactionRef> vtx_missing;
+    vtx_missing.push_back(MakeTransactionRef(block.vtx[1]));
+    vtx_missing.push_back(MakeTransactionRef(block.vtx[1]));
+    vtx_missing.push_back(MakeTransactionRef(block.vtx[3]));
+    CBlock reconstructed;
+    EXPECT_EQ(partialBlock.FillBlock(reconstructed, vtx_missing), READ_STATUS_FAILED);
+}
+
+TEST(TestBlockEncodings, blocktxn_request_roundtrip)
+{
+    BlockTransactionsRequest req;
+    req.blockhash = uint256S("01");
+    req.indexes = {1, 3, 4, 1000};
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << req;
+    BlockTransactionsRequest req2;
+    stream >> req2;
+    EXPECT_EQ(req2.blockhash, req.blockhash);
+    EXPECT_EQ(req2.indexes, req.indexes);
+}
+
+}
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include "cc/eval.h"
+#include "main.h"
+#include "txdb.h"
+
+namespace TestCCIndex {
+
+std::pair<CCCIndexKey, CCCIndexValue> oracle_record(uint8_t funcid, const uint256 &reftxid, int height, const uint256 &txid, const uint160 &addr)
+{
+    CCCIndexValue value;
+    value.addresses.push_back(CAddressIndexIteratorKey(3, addr));
+    return std::make_pair(CCCIndexKey(EVAL_ORACLES, funcid, reftxid, height, txid), value);
+}
+
+TEST(TestCCIndex, prefix_scan_newest_first)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint256 oracle1 = uint256S("a1"), oracle2 = uint256S("a2");
+    uint160 baton1, baton2;
+    *baton1.begin() = 1;
+    *baton2.begin() = 2;
+    std::vector<std::pair<CCCIndexKey, CCCIndexValue> > records;
+    records.push_back(oracle_record('C', oracle1, 10, oracle1, baton1));
+    records.push_back(oracle_record('D', oracle1, 11, uint256S("01"), baton1));
+    records.push_back(oracle_record('D', oracle1, 12, uint256S("02"), baton2));
+    records.push_back(oracle_record('D', oracle1, 13, uint256S("03"), baton1));
+    records.push_back(oracle_record('D', oracle2, 14, uint256S("04"), baton1));
+    ASSERT_TRUE(db.WriteCCIndex(records));
+
+    std::vector<CCCIndexKey> keys;
+    ASSERT_TRUE(db.ReadCCIndex(EVAL_ORACLES, 'D', oracle1, CAddressIndexIteratorKey(3, baton1), keys));
+    ASSERT_EQ(keys.size(), 2u);
+    EXPECT_EQ(keys[0].txhash, uint256S("03"));
+    EXPECT_EQ(keys[1].txhash, uint256S("01"));
+
+    ASSERT_TRUE(db.ReadCCIndex(EVAL_ORACLES, 'D', oracle1, CAddressIndexIteratorKey(), keys, 1, 1));
+    ASSERT_EQ(keys.size(), 1u);
+    EXPECT_EQ(keys[0].txhash, uint256S("02"));
+
+    // any reference txid, sorted across the references
+    ASSERT_TRUE(db.ReadCCIndex(EVAL_ORACLES, 'D', uint256(), CAddressIndexIteratorKey(3, baton1), keys));
+    ASSERT_EQ(keys.size(), 3u);
+    EXPECT_EQ(keys[0].txhash, uint256S("04"));
+    EXPECT_EQ(keys[2].txhash, uint256S("01"));
+
+    // any funcid of one oracle, the creation tx refers to itself
+    ASSERT_TRUE(db.ReadCCIndex(EVAL_ORACLES, 0, oracle1, CAddressIndexIteratorKey(), keys));
+    ASSERT_EQ(keys.size(), 4u);
+    EXPECT_EQ(keys[3].txhash, oracle1);
+
+    ASSERT_TRUE(db.EraseCCIndex(records));
+    ASSERT_TRUE(db.ReadCCIndex(EVAL_ORACLES, 0, uint256(), CAddressIndexIteratorKey(), keys));
+    EXPECT_TRUE(keys.empty());
+}
+
+TEST(TestCCIndex, token_balances_connect_disconnect)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint256 tokenid = uint256S("c0"), transfer = uint256S("c1");
+    uint160 alice, bob;
+    *alice.begin() = 1;
+    *bob.begin() = 2;
+    CTokenAddressKey aliceKey(tokenid, 3, alice), bobKey(tokenid, 3, bob);
+
+    // tokenbase gives 100 to alice, in the same block alice sends 30 to bob and keeps 70
+    std::vector<std::pair<CTokenUnspentKey, CAmount> > records;
+    std::vector<std::pair<uint256, CAmount> > supplies;
+    supplies.push_back(std::make_pair(tokenid, 100));
+    records.push_back(std::make_pair(CTokenUnspentKey(aliceKey, tokenid, 1), 100));
+    records.push_back(std::make_pair(CTokenUnspentKey(aliceKey, tokenid, 1), -100));
+    records.push_back(std::make_pair(CTokenUnspentKey(bobKey, transfer, 0), 30));
+    records.push_back(std::make_pair(CTokenUnspentKey(aliceKey, transfer, 1), 70));
+    ASSERT_TRUE(db.WriteTokenIndex(records, supplies));
+
+    CAmount balance;
+    db.ReadTokenBalance(aliceKey, balance);
+    EXPECT_EQ(balance, 70);
+    db.ReadTokenBalance(bobKey, balance);
+    EXPECT_EQ(balance, 30);
+    std::vector<std::pair<CTokenUnspentKey, CAmount> > unspent;
+    ASSERT_TRUE(db.ReadTokenUnspent(aliceKey, unspent));
+    ASSERT_EQ(unspent.size(), 1u);
+    EXPECT_EQ(unspent[0].first.txhash, transfer);
+    CTokenStats stats;
+    ASSERT_TRUE(db.ReadTokenStats(tokenid, stats));
+    EXPECT_EQ(stats.supply, 100);
+    EXPECT_EQ(stats.unspent, 100);
+    EXPECT_EQ(stats.holders, 2);
+    CTokenOutputValue output;
+    EXPECT_TRUE(db.ReadTokenOutput(COutPoint(tokenid, 1), output));
+
+    ASSERT_TRUE(db.EraseTokenIndex(records, supplies));
+    EXPECT_FALSE(db.ReadTokenBalance(aliceKey, balance));
+    EXPECT_FALSE(db.ReadTokenStats(tokenid, stats));
+    EXPECT_FALSE(db.ReadTokenOutput(COutPoint(tokenid, 1), output));
+    unspent.clear();
+    ASSERT_TRUE(db.ReadTokenUnspent(aliceKey, unspent));
+    EXPECT_TRUE(unspent.empty());
+}
+
+}
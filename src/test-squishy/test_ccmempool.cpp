@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+
+#include "cc/eval.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "txmempool.h"
+
+namespace TestCCMempool {
+
+CTransaction opret_tx(uint8_t evalcode, uint8_t funcid, uint32_t n)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.n = n;
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 10000;
+    std::vector<uint8_t> vopret = { evalcode, funcid, (uint8_t)n };
+    mtx.vout[1].scriptPubKey = CScript() << OP_RETURN << vopret;
+    return CTransaction(mtx);
+}
+
+TEST(TestCCMempool, funcid_index)
+{
+    CTxMemPool pool(::minRelayTxFee);
+    CTransaction tx1 = opret_tx(EVAL_ORACLES, 'D', 1);
+    CTransaction tx2 = opret_tx(EVAL_ORACLES, 'D', 2);
+    CTransaction tx3 = opret_tx(EVAL_ORACLES, 'R', 3);
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 0, 0, 0.0, 1, true, false, 0));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 0, 0, 0.0, 1, true, false, 0));
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 0, 0, 0.0, 1, true, false, 0));
+
+    std::vector<uint256> txids;
+    pool.getCCFuncTxids(EVAL_ORACLES, 'D', txids);
+    ASSERT_EQ(txids.size(), 2u);
+    EXPECT_TRUE(std::find(txids.begin(), txids.end(), tx1.GetHash()) != txids.end());
+    EXPECT_TRUE(std::find(txids.begin(), txids.end(), tx2.GetHash()) != txids.end());
+
+    std::list<CTransaction> removed;
+    pool.remove(tx1, removed);
+    txids.clear();
+    pool.getCCFuncTxids(EVAL_ORACLES, 'D', txids);
+    ASSERT_EQ(txids.size(), 1u);
+    EXPECT_EQ(txids[0], tx2.GetHash());
+
+    pool.clear();
+    txids.clear();
+    pool.getCCFuncTxids(EVAL_ORACLES, 'R', txids);
+    EXPECT_TRUE(txids.empty());
+}
+
+}
@@ -7,8 +7,10 @@
 #include "squishy.h"
 #include "squishy_structs.h"
 #include "squishy_gateway.h"
+#include "squishy_events.h"
 #include "squishy_notary.h"
 #include "squishy_extern_globals.h"
+#include "kvdb.h"
 
 namespace test_events {
 
@@ -279,6 +281,17 @@ void clear_state(const char* symbol)
     state->events.clear();
 }
 
+/****
+ * An in-memory KV database for the length of a test, the opreturn events
+ * and rewinds of an assetchain update it
+ */
+struct test_kvdb
+{
+    CKVDB db;
+    test_kvdb() : db(1 << 20, true) { pkvdb = &db; }
+    ~test_kvdb() { pkvdb = nullptr; }
+};
+
 /****
  * The main purpose of this test is to verify that
  * state files created continue to be readable despite logic
@@ -289,6 +302,7 @@ TEST(test_events, squishy_faststateinit_test)
 {
     char symbol[] = "TST";
     chainName = assetchain("TST");
+    test_kvdb kvdb;
     SQUISHY_EXTERNAL_NOTARIES = 1;
     IS_SQUISHY_NOTARY = false;   // avoid calling squishy_verifynotarization
 
@@ -929,6 +943,7 @@ TEST(test_events, DISABLED_write_test) // test from dev branch from S6 season
 {
     char symbol[] = "TST";
     chainName = assetchain(symbol);
+    test_kvdb kvdb;
     SQUISHY_EXTERNAL_NOTARIES = 1;
 
     clear_state(symbol);
@@ -979,6 +994,7 @@ TEST(test_events, write_test_event_fix3)  // same test from jmj_event_fix3
     // test serialization of the different event records
     char symbol[] = "TST";
     chainName = assetchain(symbol);
+    test_kvdb kvdb;
     SQUISHY_EXTERNAL_NOTARIES = 1;
 
     clear_state(symbol);
@@ -1060,4 +1076,120 @@ TEST(test_events, event_copy)
 
 }
 
+TEST(test_events, checkpoint_at_height)
+{
+    squishy_state state;
+    EXPECT_EQ(state.CheckpointAtHeight(10), nullptr);
+
+    // reference implementation, the last added checkpoint covering the height
+    std::vector<notarized_checkpoint> added;
+    auto reference = [&added](int32_t height) -> int32_t {
+        for(auto itr = added.rbegin(); itr != added.rend(); ++itr)
+        {
+            if ( itr->MoMdepth != 0 && height > itr->notarized_height-(itr->MoMdepth&0xffff)
+                    && height <= itr->notarized_height )
+                return itr->nHeight;
+        }
+        return -1;
+    };
+
+    int32_t notarized_height = 0;
+    for(int32_t i = 0; i < 500; ++i)
+    {
+        notarized_checkpoint cp;
+        cp.nHeight = i + 1;
+        // mostly increasing, with the occasional step backwards
+        notarized_height += (i % 17 == 0) ? -25 : (i % 3) * 7;
+        cp.notarized_height = notarized_height;
+        cp.MoMdepth = (i % 5 == 0) ? 0 : (i % 11) * 6;
+        state.AddCheckpoint(cp);
+        added.push_back(cp);
+    }
+    EXPECT_EQ(state.NumCheckpoints(), added.size());
+    for(int32_t height = -50; height < notarized_height + 100; ++height)
+    {
+        const notarized_checkpoint* cp = state.CheckpointAtHeight(height);
+        int32_t expected = reference(height);
+        if (expected < 0)
+            EXPECT_EQ(cp, nullptr) << "height " << height;
+        else
+        {
+            ASSERT_NE(cp, nullptr) << "height " << height;
+            EXPECT_EQ(cp->nHeight, expected) << "height " << height;
+        }
+    }
+}
+
+/****
+ * A snapshot restores the notarizations, then only the events appended after it are parsed
+ */
+TEST(test_events, squishy_statesnapshot_test)
+{
+    char symbol[] = "TST";
+    chainName = assetchain("TST");
+    test_kvdb kvdb;
+    SQUISHY_EXTERNAL_NOTARIES = 1;
+    IS_SQUISHY_NOTARY = false;   // avoid calling squishy_verifynotarization
+
+    boost::filesystem::path temp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(temp);
+    const std::string full_filename = (temp / "snapshot.tmp").string();
+    char* dest = (char*)"123456789012345";
+    squishy_state* state = squishy_stateptrget((char*)symbol);
+    ASSERT_TRUE(state != nullptr);
+    state->symbol = symbol;
+
+    std::FILE* fp = std::fopen(full_filename.c_str(), "wb+");
+    ASSERT_TRUE(fp != nullptr);
+    write_n_record(fp);
+    long fpos = std::ftell(fp);
+    std::fclose(fp);
+    clear_state(symbol);
+    state->RestoreCheckpoints(std::vector<notarized_checkpoint>(), notarized_checkpoint());
+    EXPECT_TRUE(squishy_faststateinit(state, full_filename.c_str(), symbol, dest));
+    EXPECT_EQ(state->NumCheckpoints(), 1u);
+    // a rewind drops the pubkeys of the orphaned blocks, the snapshot must not replay them
+    size_t numpubkeys = state->notary_pubkeys.size();
+    squishy::event_pubkeys pk9(9);
+    pk9.num = 1;
+    memset(pk9.pubkeys[0], 2, 33);
+    squishy_eventadd_pubkeys(state, symbol, 9, pk9);
+    EXPECT_EQ(state->notary_pubkeys.size(), numpubkeys + 1);
+    squishy_event_rewind(state, symbol, 9);
+    EXPECT_EQ(state->notary_pubkeys.size(), numpubkeys);
+    EXPECT_TRUE(squishy_statesnapshot_write(state, full_filename.c_str(), 10, fpos));
+
+    // a notarization of height 3 at height 11 is appended after the snapshot
+    fp = std::fopen(full_filename.c_str(), "ab");
+    ASSERT_TRUE(fp != nullptr);
+    char data[73] = {'N', 11, 0, 0, 0, 3, 0, 0, 0};
+    memset(&data[9], 3, 32);
+    memset(&data[41], 4, 32);
+    std::fwrite(data, sizeof(data), 1, fp);
+    std::fclose(fp);
+
+    clear_state(symbol);
+    state->RestoreCheckpoints(std::vector<notarized_checkpoint>(), notarized_checkpoint());
+    EXPECT_EQ(squishy_statesnapshot_read(state, full_filename.c_str(), symbol), fpos);
+    EXPECT_EQ(state->NumCheckpoints(), 1u);
+    EXPECT_EQ(state->LastNotarizedHeight(), 2);
+
+    clear_state(symbol);
+    state->RestoreCheckpoints(std::vector<notarized_checkpoint>(), notarized_checkpoint());
+    EXPECT_TRUE(squishy_faststateinit(state, full_filename.c_str(), symbol, dest));
+    EXPECT_EQ(state->NumCheckpoints(), 2u);
+    EXPECT_EQ(state->LastNotarizedHeight(), 3);
+    EXPECT_EQ(state->events.size(), 1u); // only the tail was parsed
+
+    // the snapshot no longer matches a rewritten events file
+    fp = std::fopen(full_filename.c_str(), "wb+");
+    ASSERT_TRUE(fp != nullptr);
+    write_p_record(fp);
+    write_n_record(fp);
+    std::fclose(fp);
+    EXPECT_EQ(squishy_statesnapshot_read(state, full_filename.c_str(), symbol), -1);
+
+    boost::filesystem::remove_all(temp);
+}
+
 } // namespace test_events
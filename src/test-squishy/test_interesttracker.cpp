@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include "primitives/transaction.h"
+#include "squishy_interest.h"
+#include "wallet/interesttracker.h"
+
+namespace TestInterestTracker {
+
+const uint32_t locktime = 1600000000;
+const uint32_t tiptime = locktime + 30 * 24 * 3600;
+
+CInterestOutput interest_output(int32_t txheight, int32_t matureheight = 0)
+{
+    CInterestOutput output;
+    output.nValue = 1000 * COIN;
+    output.txheight = txheight;
+    output.locktime = locktime;
+    output.matureheight = matureheight;
+    return output;
+}
+
+uint64_t interest_at(int32_t txheight)
+{
+    return squishy_interest(txheight, 1000 * COIN, locktime, tiptime);
+}
+
+CTransaction spend_tx(const COutPoint &prevout)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = prevout;
+    mtx.vout.resize(1);
+    return CTransaction(mtx);
+}
+
+TEST(TestInterestTracker, coinbase_maturity)
+{
+    CInterestTracker tracker;
+    std::map<COutPoint, CInterestOutput> outputs;
+    outputs[COutPoint(uint256S("01"), 0)] = interest_output(2000000);
+    outputs[COutPoint(uint256S("02"), 0)] = interest_output(2000100, 2000199);
+    tracker.Rebuild(outputs, 1000);
+
+    // the coinbase output counts from the first tip height it can be spent at
+    EXPECT_EQ(tracker.GetInterestSum(2000198, tiptime), interest_at(2000000));
+    EXPECT_EQ(tracker.GetInterestSum(2000199, tiptime), interest_at(2000000) + interest_at(2000100));
+}
+
+TEST(TestInterestTracker, locked_coins)
+{
+    CInterestTracker tracker;
+    COutPoint one(uint256S("01"), 0), two(uint256S("02"), 0);
+    std::map<COutPoint, CInterestOutput> outputs;
+    outputs[one] = interest_output(2000000);
+    outputs[two] = interest_output(2000100);
+
+    // a lock taken before the outputs are known still applies after a rebuild
+    tracker.SetLocked(one, true);
+    tracker.Rebuild(outputs, 1000);
+    EXPECT_EQ(tracker.GetInterestSum(2000200, tiptime), interest_at(2000100));
+    tracker.SetLocked(two, true);
+    EXPECT_EQ(tracker.GetInterestSum(2000200, tiptime), 0u);
+    tracker.SetLocked(one, false);
+    EXPECT_EQ(tracker.GetInterestSum(2000200, tiptime), interest_at(2000000));
+    tracker.UnlockAll();
+    EXPECT_EQ(tracker.GetInterestSum(2000200, tiptime), interest_at(2000000) + interest_at(2000100));
+}
+
+TEST(TestInterestTracker, abandoned_unconfirmed_spend)
+{
+    CInterestTracker tracker;
+    COutPoint one(uint256S("01"), 0), two(uint256S("02"), 0);
+    std::map<COutPoint, CInterestOutput> outputs;
+    outputs[one] = interest_output(2000000);
+    outputs[two] = interest_output(2000100);
+    tracker.Rebuild(outputs, 1000);
+    EXPECT_FALSE(tracker.IsStale(1000, WALLET_OUTPUT_CACHE_MAX_AGE));
+
+    // an unconfirmed spend takes its input out of the sum and adds nothing yet
+    tracker.UpdateTransaction(spend_tx(one), std::map<COutPoint, CInterestOutput>());
+    EXPECT_EQ(tracker.GetInterestSum(2000200, tiptime), interest_at(2000100));
+
+    // the wallet drops the spend and marks the tracker stale, the next sum
+    // rebuilds it with the input back instead of waiting for the hourly rebuild
+    tracker.SetStale();
+    EXPECT_TRUE(tracker.IsStale(1001, WALLET_OUTPUT_CACHE_MAX_AGE));
+    tracker.Rebuild(outputs, 1001);
+    EXPECT_EQ(tracker.GetInterestSum(2000200, tiptime), interest_at(2000000) + interest_at(2000100));
+
+    // once confirmed, its own output accrues from the confirming height
+    CTransaction tx = spend_tx(one);
+    std::map<COutPoint, CInterestOutput> added;
+    added[COutPoint(tx.GetHash(), 0)] = interest_output(2000300);
+    tracker.UpdateTransaction(tx, added);
+    EXPECT_EQ(tracker.Size(), 2u);
+    EXPECT_EQ(tracker.GetInterestSum(2000300, tiptime), interest_at(2000100) + interest_at(2000300));
+}
+
+}
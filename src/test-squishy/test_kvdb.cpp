@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+
+#include "kvdb.h"
+
+namespace TestKVDB {
+
+CKVRecord kv_record(const std::string &value, int32_t height)
+{
+    CKVRecord record;
+    record.key.assign((const uint8_t *)"key", (const uint8_t *)"key" + 3);
+    record.value.assign(value.begin(), value.end());
+    record.height = height;
+    return record;
+}
+
+TEST(TestKVDB, history_rollback_purge)
+{
+    CKVDB db(1 << 20, true);
+    uint256 keyhash = uint256S("aa"), otherhash = uint256S("bb");
+    CKVHistoryKey first(keyhash, 10, uint256S("01"), 1), second(keyhash, 20, uint256S("02"), 1);
+    CKVHistoryKey other(otherhash, 15, uint256S("03"), 1);
+    ASSERT_TRUE(db.WriteUpdate(first, kv_record("one", 10), 100));
+    ASSERT_TRUE(db.WriteUpdate(other, kv_record("other", 15), 50));
+    ASSERT_TRUE(db.WriteUpdate(second, kv_record("two", 20), 200));
+    EXPECT_EQ(db.ReadBestHeight(), 20);
+
+    CKVRecord record;
+    ASSERT_TRUE(db.ReadLatest(keyhash, record));
+    EXPECT_EQ(std::string(record.value.begin(), record.value.end()), "two");
+    EXPECT_TRUE(db.HaveUpdate(first));
+
+    // disconnecting the block at 20 brings back the older value
+    ASSERT_TRUE(db.Rollback(20));
+    EXPECT_EQ(db.ReadBestHeight(), 19);
+    EXPECT_FALSE(db.HaveUpdate(second));
+    ASSERT_TRUE(db.ReadLatest(keyhash, record));
+    EXPECT_EQ(std::string(record.value.begin(), record.value.end()), "one");
+
+    // purge in height order, at most limit updates at a time
+    EXPECT_EQ(db.Purge(150, 1), 1);
+    EXPECT_FALSE(db.ReadLatest(otherhash, record));
+    EXPECT_TRUE(db.ReadLatest(keyhash, record));
+    EXPECT_EQ(db.Purge(150, 10), 1);
+    EXPECT_FALSE(db.ReadLatest(keyhash, record));
+    EXPECT_EQ(db.Purge(150, 10), 0);
+}
+
+}
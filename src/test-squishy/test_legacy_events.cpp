@@ -8,6 +8,7 @@
 
 #include "squishy_globals.h"
 #include "main.h"
+#include "kvdb.h"
 #include "primitives/transaction.h"
 #include "core_io.h"
 #include "squishy.h"
@@ -143,6 +144,9 @@ namespace LegacyEventsTests {
                 SQUISHY_REWIND = 0;
                 chainActive.SetTip(nullptr);
 
+                // assetchain blocks update and rewind the KV store
+                pkvdb = new CKVDB(1 << 20, true);
+
                 mempool.clear();
                 ClearKomodoGlobals();
                 /* We want to ensure that global variables are cleared after the current test execution
@@ -169,6 +173,8 @@ namespace LegacyEventsTests {
 
                 mempool.clear();
                 ClearKomodoGlobals();
+                delete pkvdb;
+                pkvdb = nullptr;
             }
     };
 
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include "main.h"
+#include "primitives/transaction.h"
+#include "txmempool.h"
+
+namespace TestMempoolPackages {
+
+CTransaction chain_tx(const uint256 &parent, uint32_t n)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(parent, n);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 10000;
+    return CTransaction(mtx);
+}
+
+void add_tx(CTxMemPool &pool, const CTransaction &tx, CAmount nFee)
+{
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, 0, 0.0, 1, pool.HasNoInputsOf(tx), false, 0));
+}
+
+TEST(TestMempoolPackages, baton_chain)
+{
+    CTxMemPool pool(::minRelayTxFee);
+    CTransaction a = chain_tx(uint256S("01"), 0);
+    CTransaction b = chain_tx(a.GetHash(), 0);
+    CTransaction c = chain_tx(b.GetHash(), 0);
+    add_tx(pool, a, 0);
+    add_tx(pool, b, 1000);
+    add_tx(pool, c, 10000);
+
+    CTxMemPool::txiter ita = pool.mapTx.find(a.GetHash());
+    CTxMemPool::txiter itc = pool.mapTx.find(c.GetHash());
+    EXPECT_EQ(ita->GetCountWithDescendants(), 3u);
+    EXPECT_EQ(ita->GetModFeesWithDescendants(), 11000);
+    EXPECT_EQ(itc->GetCountWithAncestors(), 3u);
+    EXPECT_EQ(itc->GetSizeWithAncestors(), ita->GetTxSize() * 3);
+
+    // the zero fee head of the chain is valued by the fees of the chain,
+    // an unrelated transaction paying less than that gets evicted first
+    CTransaction e = chain_tx(uint256S("02"), 0);
+    add_tx(pool, e, 2000);
+    EXPECT_TRUE(pool.mapTx.get<descendant_score>().begin()->GetTx() == e);
+    // and the tail of the chain brings the whole chain into a block first
+    EXPECT_TRUE(pool.mapTx.get<ancestor_score>().begin()->GetTx() == c);
+
+    pool.PrioritiseTransaction(b.GetHash(), b.GetHash().ToString(), 0.0, 500);
+    EXPECT_EQ(ita->GetModFeesWithDescendants(), 11500);
+    EXPECT_EQ(itc->GetModFeesWithAncestors(), 11500);
+
+    std::string errString;
+    CTxMemPool::setEntries setAncestors;
+    CTransaction d = chain_tx(c.GetHash(), 0);
+    CTxMemPoolEntry entry(d, 0, 0, 0.0, 1, false, false, 0);
+    EXPECT_FALSE(pool.CalculateMemPoolAncestors(entry, setAncestors, 3, 1000000, 100, 1000000, errString));
+    setAncestors.clear();
+    EXPECT_TRUE(pool.CalculateMemPoolAncestors(entry, setAncestors, 4, 1000000, 100, 1000000, errString));
+    EXPECT_EQ(setAncestors.size(), 3u);
+
+    // a block mines the head, the rest of the chain stays
+    std::list<CTransaction> removed;
+    pool.remove(a, removed, false);
+    CTxMemPool::txiter itb = pool.mapTx.find(b.GetHash());
+    EXPECT_EQ(itb->GetCountWithAncestors(), 1u);
+    EXPECT_EQ(itc->GetCountWithAncestors(), 2u);
+    EXPECT_EQ(itc->GetModFeesWithAncestors(), 11500);
+
+    // disconnecting the block puts the head back under its descendants
+    add_tx(pool, a, 0);
+    ita = pool.mapTx.find(a.GetHash());
+    EXPECT_EQ(ita->GetCountWithDescendants(), 3u);
+    EXPECT_EQ(itc->GetCountWithAncestors(), 3u);
+    EXPECT_EQ(itb->GetModFeesWithAncestors(), 1500);
+
+    pool.TrimToSize(0);
+    EXPECT_EQ(pool.size(), 0u);
+}
+
+}
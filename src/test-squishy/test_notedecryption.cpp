@@ -0,0 +1,41 @@
+#include <gtest/gtest.h>
+
+#include "wallet/notedecryption.h"
+
+#include <atomic>
+
+namespace TestNoteDecryption {
+
+TEST(TestNoteDecryption, trial_decrypt_first_key)
+{
+    // output o is opened by the keys that are multiples of o+1 from 3*o on, odd outputs by none
+    size_t nOutputs = 9, nKeys = 200;
+    auto opens = [](size_t o, size_t k) { return o % 2 == 0 && k >= 3 * o && k % (o + 1) == 0; };
+    std::atomic<size_t> nTried(0);
+    auto tryKey = [&](size_t o, size_t k) { nTried++; return opens(o, k); };
+
+    std::vector<int> serial = TrialDecrypt(nOutputs, nKeys, 1, tryKey);
+    size_t nSerialTried = nTried.load();
+    nTried = 0;
+    std::vector<int> parallel = TrialDecrypt(nOutputs, nKeys, 4, tryKey);
+    ASSERT_EQ(serial.size(), nOutputs);
+    EXPECT_EQ(serial, parallel);
+    size_t nExpectedTried = 0;
+    for (size_t o = 0; o < nOutputs; o++)
+    {
+        int expected = -1;
+        for (size_t k = 0; k < nKeys && expected < 0; k++)
+            if ( opens(o, k) )
+                expected = k;
+        EXPECT_EQ(serial[o], expected);
+        nExpectedTried += expected < 0 ? nKeys : expected + 1;
+    }
+    // the serial path stops at the first key that opens an output
+    EXPECT_EQ(nSerialTried, nExpectedTried);
+    EXPECT_LE(nTried.load(), nOutputs * nKeys);
+
+    EXPECT_TRUE(TrialDecrypt(0, nKeys, 4, tryKey).empty());
+    EXPECT_EQ(TrialDecrypt(3, 0, 4, tryKey), std::vector<int>(3, -1));
+}
+
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include "primitives/transaction.h"
+#include "squishy_bitcoind.h"
+#include "squishy_utils.h"
+#include "wallet/stakingcache.h"
+
+namespace TestStakingCache {
+
+CStakingCandidate staking_candidate(const uint256 &txid, uint32_t n)
+{
+    CStakingCandidate candidate;
+    candidate.outpoint = COutPoint(txid, n);
+    candidate.nValue = 10 * COIN;
+    candidate.txtime = 1600000000;
+    return candidate;
+}
+
+TEST(TestStakingCache, spend_and_confirm)
+{
+    CStakingCache cache;
+    EXPECT_TRUE(cache.IsStale(0, WALLET_OUTPUT_CACHE_MAX_AGE));
+    std::map<COutPoint, CStakingCandidate> initial;
+    initial[COutPoint(uint256S("01"), 0)] = staking_candidate(uint256S("01"), 0);
+    initial[COutPoint(uint256S("02"), 1)] = staking_candidate(uint256S("02"), 1);
+    cache.Rebuild(initial, 1000);
+    EXPECT_FALSE(cache.IsStale(1000, WALLET_OUTPUT_CACHE_MAX_AGE));
+    EXPECT_TRUE(cache.IsStale(1000 + WALLET_OUTPUT_CACHE_MAX_AGE + 1, WALLET_OUTPUT_CACHE_MAX_AGE));
+
+    // a confirmed transaction spends the first candidate and pays back to the wallet
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(uint256S("01"), 0);
+    mtx.vout.resize(1);
+    CTransaction tx(mtx);
+    std::map<COutPoint, CStakingCandidate> added;
+    added[COutPoint(tx.GetHash(), 0)] = staking_candidate(tx.GetHash(), 0);
+    cache.UpdateTransaction(tx, added);
+    ASSERT_EQ(cache.Size(), 2u);
+    std::vector<CStakingCandidate> candidates = cache.GetCandidates();
+    for (const CStakingCandidate &candidate : candidates)
+        EXPECT_FALSE(candidate.outpoint == COutPoint(uint256S("01"), 0));
+
+    // seen again unconfirmed after a disconnect, its output cannot stake
+    cache.UpdateTransaction(tx, std::map<COutPoint, CStakingCandidate>());
+    EXPECT_EQ(cache.Size(), 1u);
+    cache.SetStale();
+    EXPECT_TRUE(cache.IsStale(1000, WALLET_OUTPUT_CACHE_MAX_AGE));
+}
+
+TEST(TestStakingCache, precomputed_address_hash)
+{
+    char address[64] = "RXL3YXG2ceaB6C5hfJcN4fvmLH2C34knhA";
+    uint8_t hashbuf[256], hashbuf2[256];
+    memset(hashbuf, 7, sizeof(hashbuf));
+    memcpy(hashbuf2, hashbuf, sizeof(hashbuf));
+    uint256 txid = uint256S("abcd"), hash, hash2, addrhash;
+    uint32_t segid32 = squishy_stakehash(&hash, address, hashbuf, txid, 3);
+
+    vcalc_sha256(0, addrhash.begin(), (uint8_t *)address, (int32_t)strlen(address));
+    squishy_stakehashaddr(&hash2, addrhash, hashbuf2, txid, 3);
+    EXPECT_EQ(hash, hash2);
+    uint32_t segid32b;
+    memcpy(&segid32b, addrhash.begin(), sizeof(segid32b));
+    EXPECT_EQ(segid32, segid32b);
+}
+
+}
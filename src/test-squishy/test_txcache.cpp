@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "txcache.h"
+
+namespace TestTxCache {
+
+CTransactionRef make_tx(uint32_t nLockTime)
+{
+    CMutableTransaction mtx;
+    mtx.nLockTime = nLockTime;
+    return MakeTransactionRef(mtx);
+}
+
+TEST(TestTxCache, lru_eviction)
+{
+    CTxLookupCache cache;
+    cache.SetMaxEntries(2);
+    uint256 hashBlock = uint256S("01");
+    CTransactionRef tx1 = make_tx(1), tx2 = make_tx(2), tx3 = make_tx(3);
+    cache.Insert(tx1, hashBlock);
+    cache.Insert(tx2, hashBlock);
+
+    CTransaction txOut; uint256 hashOut;
+    // touch tx1 so tx2 becomes the least recently used
+    ASSERT_TRUE(cache.Lookup(tx1->GetHash(), txOut, hashOut));
+    EXPECT_EQ(txOut.GetHash(), tx1->GetHash());
+    EXPECT_EQ(hashOut, hashBlock);
+
+    cache.Insert(tx3, hashBlock);
+    EXPECT_EQ(cache.GetStats().nEntries, 2u);
+    EXPECT_TRUE(cache.Lookup(tx1->GetHash(), txOut, hashOut));
+    EXPECT_FALSE(cache.Lookup(tx2->GetHash(), txOut, hashOut));
+    EXPECT_TRUE(cache.Lookup(tx3->GetHash(), txOut, hashOut));
+}
+
+TEST(TestTxCache, erase_disconnected_block)
+{
+    CTxLookupCache cache;
+    CTransactionRef tx1 = make_tx(1), tx2 = make_tx(2);
+    cache.Insert(tx1, uint256S("01"));
+    cache.Insert(tx2, uint256S("02"));
+
+    CBlock block;
+    block.vtx.push_back(*tx1);
+    cache.EraseBlock(block);
+
+    CTransaction txOut; uint256 hashOut;
+    EXPECT_FALSE(cache.Lookup(tx1->GetHash(), txOut, hashOut));
+    EXPECT_TRUE(cache.Lookup(tx2->GetHash(), txOut, hashOut));
+    EXPECT_EQ(hashOut, uint256S("02"));
+}
+
+TEST(TestTxCache, disabled)
+{
+    CTxLookupCache cache;
+    cache.SetMaxEntries(0);
+    CTransactionRef tx1 = make_tx(1);
+    cache.Insert(tx1, uint256S("01"));
+    CTransaction txOut; uint256 hashOut;
+    EXPECT_FALSE(cache.Lookup(tx1->GetHash(), txOut, hashOut));
+}
+
+TEST(TestTxCache, raw_block_lru)
+{
+    CRawBlockCache cache;
+    cache.SetMaxEntries(2);
+    CRawBlockCache::RawBlockRef block1 = std::make_shared<const std::vector<uint8_t> >(100, 1);
+    CRawBlockCache::RawBlockRef block2 = std::make_shared<const std::vector<uint8_t> >(200, 2);
+    CRawBlockCache::RawBlockRef block3 = std::make_shared<const std::vector<uint8_t> >(300, 3);
+    cache.Insert(uint256S("01"), block1);
+    cache.Insert(uint256S("02"), block2);
+
+    // many peers asking for the same block share one copy
+    CRawBlockCache::RawBlockRef pblock;
+    ASSERT_TRUE(cache.Lookup(uint256S("01"), pblock));
+    EXPECT_EQ(pblock, block1);
+
+    cache.Insert(uint256S("03"), block3);
+    EXPECT_FALSE(cache.Lookup(uint256S("02"), pblock));
+    EXPECT_TRUE(cache.Lookup(uint256S("03"), pblock));
+    CRawBlockCache::Stats stats = cache.GetStats();
+    EXPECT_EQ(stats.nEntries, 2u);
+    EXPECT_EQ(stats.nBytes, 400u);
+    EXPECT_EQ(stats.nHits, 2u);
+    EXPECT_EQ(stats.nMisses, 1u);
+
+    cache.SetMaxEntries(0);
+    EXPECT_EQ(cache.GetStats().nBytes, 0u);
+    cache.Insert(uint256S("01"), block1);
+    EXPECT_FALSE(cache.Lookup(uint256S("01"), pblock));
+}
+
+}
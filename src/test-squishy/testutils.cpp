@@ -4,6 +4,7 @@
 
 #include "core_io.h"
 #include "key.h"
+#include "kvdb.h"
 #include "main.h"
 #include "miner.h"
 #include "notarisationdb.h"
@@ -62,6 +63,7 @@ void setupChain()
     CCoinsViewDB *pcoinsdbview = new CCoinsViewDB(1 << 23, true);
     pcoinsTip = new CCoinsViewCache(pcoinsdbview);
     pnotarisations = new NotarisationDB(1 << 20, true);
+    pkvdb = new CKVDB(1 << 20, true);
     InitBlockIndex();
 }
 
@@ -0,0 +1,380 @@
+/******************************************************************************
+ * Copyright © 2021 Squishy Core Developers                                   *
+ *                                                                            *
+ * See the AUTHORS, DEVELOPER-AGREEMENT and LICENSE files at                  *
+ * the top-level directory of this distribution for the individual copyright  *
+ * holder information and the developer policies on copyright and licensing.  *
+ *                                                                            *
+ * Unless otherwise agreed in a custom licensing agreement, no part of the    *
+ * SuperNET software, including this file may be copied, modified, propagated *
+ * or distributed except according to the terms contained in the LICENSE file *
+ *                                                                            *
+ * Removal or modification of this copyright notice is prohibited.            *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "txcache.h"
+
+#include "clientversion.h"
+#include "compat.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "protocol.h"
+#include "serialize.h"
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+CTxLookupCache txLookupCache;
+CRawBlockCache rawBlockCache;
+CBlockFileMapper blockFileMapper;
+
+/** Upper bound of remembered block header positions, the map is simply reset when it is reached */
+static const size_t MAX_HEADER_POSITIONS = 4096;
+
+bool CTxLookupCache::Lookup(const uint256 &txid, CTransaction &txOut, uint256 &hashBlock)
+{
+    CTransactionRef ptx;
+    {
+        LOCK(cs);
+        auto it = mapEntries.find(txid);
+        if ( it == mapEntries.end() )
+            return false;
+        lru.splice(lru.begin(), lru, it->second);
+        ptx = it->second->tx;
+        hashBlock = it->second->hashBlock;
+    }
+    txOut = *ptx;
+    return true;
+}
+
+void CTxLookupCache::Insert(const CTransactionRef &ptx, const uint256 &hashBlock)
+{
+    LOCK(cs);
+    if ( nMaxEntries == 0 )
+        return;
+    const uint256 &txid = ptx->GetHash();
+    auto it = mapEntries.find(txid);
+    if ( it != mapEntries.end() )
+    {
+        it->second->tx = ptx;
+        it->second->hashBlock = hashBlock;
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+    while ( mapEntries.size() >= nMaxEntries )
+    {
+        mapEntries.erase(lru.back().tx->GetHash());
+        lru.pop_back();
+    }
+    CEntry entry;
+    entry.tx = ptx;
+    entry.hashBlock = hashBlock;
+    lru.push_front(entry);
+    mapEntries[txid] = lru.begin();
+}
+
+void CTxLookupCache::EraseBlock(const CBlock &block)
+{
+    LOCK(cs);
+    for (const CTransaction &tx : block.vtx)
+    {
+        auto it = mapEntries.find(tx.GetHash());
+        if ( it != mapEntries.end() )
+        {
+            lru.erase(it->second);
+            mapEntries.erase(it);
+        }
+    }
+}
+
+void CTxLookupCache::InsertHeader(const CDiskBlockPos &pos, const uint256 &hashBlock, uint32_t nHeaderSize)
+{
+    LOCK(cs);
+    if ( mapHeaders.size() >= MAX_HEADER_POSITIONS )
+        mapHeaders.clear();
+    mapHeaders[std::make_pair(pos.nFile, pos.nPos)] = std::make_pair(hashBlock, nHeaderSize);
+}
+
+bool CTxLookupCache::LookupHeader(const CDiskBlockPos &pos, uint256 &hashBlock, uint32_t &nHeaderSize)
+{
+    LOCK(cs);
+    auto it = mapHeaders.find(std::make_pair(pos.nFile, pos.nPos));
+    if ( it == mapHeaders.end() )
+        return false;
+    hashBlock = it->second.first;
+    nHeaderSize = it->second.second;
+    return true;
+}
+
+void CTxLookupCache::SetMaxEntries(size_t nMax)
+{
+    LOCK(cs);
+    nMaxEntries = nMax;
+    while ( mapEntries.size() > nMaxEntries )
+    {
+        mapEntries.erase(lru.back().tx->GetHash());
+        lru.pop_back();
+    }
+}
+
+void CTxLookupCache::Clear()
+{
+    LOCK(cs);
+    lru.clear();
+    mapEntries.clear();
+    mapHeaders.clear();
+}
+
+CTxLookupCache::Stats CTxLookupCache::GetStats()
+{
+    Stats stats;
+    {
+        LOCK(cs);
+        stats.nEntries = mapEntries.size();
+        stats.nMaxEntries = nMaxEntries;
+    }
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nHitMicros = nHitMicros;
+    stats.nMissMicros = nMissMicros;
+    return stats;
+}
+
+bool CRawBlockCache::Lookup(const uint256 &hash, RawBlockRef &pblock)
+{
+    LOCK(cs);
+    auto it = mapEntries.find(hash);
+    if ( it == mapEntries.end() )
+    {
+        ++nMisses;
+        return false;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    pblock = it->second->second;
+    ++nHits;
+    return true;
+}
+
+void CRawBlockCache::Insert(const uint256 &hash, const RawBlockRef &pblock)
+{
+    LOCK(cs);
+    if ( nMaxEntries == 0 || mapEntries.count(hash) != 0 )
+        return;
+    EvictTo(nMaxEntries - 1);
+    lru.push_front(std::make_pair(hash, pblock));
+    mapEntries[hash] = lru.begin();
+    nBytes += pblock->size();
+}
+
+void CRawBlockCache::EvictTo(size_t nMax)
+{
+    while ( mapEntries.size() > nMax )
+    {
+        nBytes -= lru.back().second->size();
+        mapEntries.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+void CRawBlockCache::SetMaxEntries(size_t nMax)
+{
+    LOCK(cs);
+    nMaxEntries = nMax;
+    EvictTo(nMaxEntries);
+}
+
+void CRawBlockCache::Clear()
+{
+    LOCK(cs);
+    EvictTo(0);
+}
+
+CRawBlockCache::Stats CRawBlockCache::GetStats()
+{
+    Stats stats;
+    {
+        LOCK(cs);
+        stats.nEntries = mapEntries.size();
+        stats.nMaxEntries = nMaxEntries;
+        stats.nBytes = nBytes;
+    }
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    return stats;
+}
+
+/****
+ * Minimal read-only stream over a chunk of memory, used to deserialize
+ * directly from a mapped block file
+ */
+class CMemoryReader
+{
+private:
+    const unsigned char *pbegin;
+    size_t nSize;
+    size_t nReadPos;
+    const int nType;
+    const int nVersion;
+
+public:
+    CMemoryReader(const unsigned char *pbeginIn, size_t nSizeIn, size_t nPos, int nTypeIn, int nVersionIn) :
+        pbegin(pbeginIn), nSize(nSizeIn), nReadPos(nPos), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    size_t GetPos() const { return nReadPos; }
+
+    void read(char *pch, size_t n)
+    {
+        if ( n > nSize || nReadPos > nSize - n )
+            throw std::ios_base::failure("CMemoryReader::read(): end of data");
+        memcpy(pch, pbegin + nReadPos, n);
+        nReadPos += n;
+    }
+
+    void ignore(size_t n)
+    {
+        if ( n > nSize || nReadPos > nSize - n )
+            throw std::ios_base::failure("CMemoryReader::ignore(): end of data");
+        nReadPos += n;
+    }
+
+    template<typename T>
+    CMemoryReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+class CBlockFileMapper::CMappedFile
+{
+public:
+    const unsigned char *data;
+    size_t nSize;
+
+    CMappedFile(const unsigned char *dataIn, size_t nSizeIn) : data(dataIn), nSize(nSizeIn) {}
+    ~CMappedFile()
+    {
+#ifndef WIN32
+        if ( data != nullptr )
+            munmap((void *)data, nSize);
+#endif
+    }
+};
+
+/***
+ * Get the mapping of a block file, (re)mapping it when it has grown past nMinSize
+ * @returns nullptr if the file could not be mapped
+ */
+std::shared_ptr<CBlockFileMapper::CMappedFile> CBlockFileMapper::GetFile(int nFile, size_t nMinSize)
+{
+    LOCK(cs);
+    auto it = mapFiles.find(nFile);
+    if ( it != mapFiles.end() && it->second->nSize > nMinSize )
+        return it->second;
+#ifdef WIN32
+    return nullptr;
+#else
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if ( fd < 0 )
+        return nullptr;
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || (size_t)st.st_size <= nMinSize )
+    {
+        close(fd);
+        return nullptr;
+    }
+    void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( ptr == MAP_FAILED )
+    {
+        LogPrintf("%s: unable to map %s\n", __func__, path.string());
+        return nullptr;
+    }
+    std::shared_ptr<CMappedFile> file = std::make_shared<CMappedFile>((const unsigned char *)ptr, (size_t)st.st_size);
+    // readers still holding the previous mapping keep it alive until they are done
+    mapFiles[nFile] = file;
+    return file;
+#endif
+}
+
+bool CBlockFileMapper::ReadTransaction(const CDiskTxPos &postx, CTransactionRef &ptx, uint256 &hashBlock, CTxLookupCache &cache)
+{
+    if ( !fEnabled )
+        return false;
+    std::shared_ptr<CMappedFile> file = GetFile(postx.nFile, postx.nPos + postx.nTxOffset);
+    if ( file == nullptr )
+        return false;
+    try {
+        uint32_t nHeaderSize;
+        if ( !cache.LookupHeader(postx, hashBlock, nHeaderSize) )
+        {
+            CMemoryReader header_reader(file->data, file->nSize, postx.nPos, SER_DISK, CLIENT_VERSION);
+            CBlockHeader header;
+            header_reader >> header;
+            hashBlock = header.GetHash();
+            nHeaderSize = header_reader.GetPos() - postx.nPos;
+            cache.InsertHeader(postx, hashBlock, nHeaderSize);
+        }
+        CMemoryReader reader(file->data, file->nSize, (size_t)postx.nPos + nHeaderSize + postx.nTxOffset, SER_DISK, CLIENT_VERSION);
+        ptx = std::make_shared<const CTransaction>(deserialize, reader);
+    } catch (const std::exception& e) {
+        // the mapping may predate data appended to the file, remap on next access
+        Unmap(postx.nFile);
+        return error("%s: Deserialize error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CBlockFileMapper::ReadRawBlock(const CDiskBlockPos &pos, const unsigned char *messageStart, std::vector<uint8_t> &vBlock)
+{
+    // the block is preceded by the message start and its size
+    static const unsigned int nPrefixSize = MESSAGE_START_SIZE + sizeof(uint32_t);
+    if ( !fEnabled || pos.nPos < nPrefixSize )
+        return false;
+    std::shared_ptr<CMappedFile> file = GetFile(pos.nFile, pos.nPos);
+    if ( file == nullptr )
+        return false;
+    const unsigned char *prefix = file->data + pos.nPos - nPrefixSize;
+    if ( memcmp(prefix, messageStart, MESSAGE_START_SIZE) != 0 )
+        return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+    uint32_t nSize = ReadLE32(prefix + MESSAGE_START_SIZE);
+    if ( nSize == 0 || nSize > MAX_SIZE )
+        return error("%s: invalid block size %u at %s", __func__, nSize, pos.ToString());
+    if ( (size_t)pos.nPos + nSize > file->nSize )
+    {
+        // mapped before the block was appended
+        file = GetFile(pos.nFile, (size_t)pos.nPos + nSize - 1);
+        if ( file == nullptr )
+            return false;
+    }
+    vBlock.assign(file->data + pos.nPos, file->data + pos.nPos + nSize);
+    return true;
+}
+
+void CBlockFileMapper::Unmap(int nFile)
+{
+    LOCK(cs);
+    mapFiles.erase(nFile);
+}
+
+void CBlockFileMapper::UnmapAll()
+{
+    LOCK(cs);
+    mapFiles.clear();
+}
+
+size_t CBlockFileMapper::GetMappedFiles(uint64_t &nBytes)
+{
+    LOCK(cs);
+    nBytes = 0;
+    for (const auto &it : mapFiles)
+        nBytes += it.second->nSize;
+    return mapFiles.size();
+}
@@ -0,0 +1,223 @@
+/******************************************************************************
+ * Copyright © 2021 Squishy Core Developers                                   *
+ *                                                                            *
+ * See the AUTHORS, DEVELOPER-AGREEMENT and LICENSE files at                  *
+ * the top-level directory of this distribution for the individual copyright  *
+ * holder information and the developer policies on copyright and licensing.  *
+ *                                                                            *
+ * Unless otherwise agreed in a custom licensing agreement, no part of the    *
+ * SuperNET software, including this file may be copied, modified, propagated *
+ * or distributed except according to the terms contained in the LICENSE file *
+ *                                                                            *
+ * Removal or modification of this copyright notice is prohibited.            *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef SQUISHY_TXCACHE_H
+#define SQUISHY_TXCACHE_H
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+struct CDiskBlockPos;
+struct CDiskTxPos;
+
+/** Default for -txlookupcache, the number of confirmed transactions kept by myGetTransaction() */
+static const unsigned int DEFAULT_TXLOOKUP_CACHE_SIZE = 20000;
+/** Default for -mmapblockfiles */
+static const bool DEFAULT_MMAP_BLOCKFILES = false;
+/** Default for -rawblockcache, the number of serialized blocks kept for serving peers */
+static const unsigned int DEFAULT_RAW_BLOCK_CACHE_SIZE = 16;
+
+/****
+ * A bounded, thread-safe LRU cache of confirmed transactions keyed by txid.
+ * Filled by myGetTransaction() from the tx index, invalidated when the block
+ * holding a transaction is disconnected.
+ */
+class CTxLookupCache
+{
+public:
+    struct Stats
+    {
+        uint64_t nEntries;
+        uint64_t nMaxEntries;
+        uint64_t nHits;
+        uint64_t nMisses;
+        uint64_t nHitMicros;  // total time spent answering hits
+        uint64_t nMissMicros; // total time spent loading misses from disk
+    };
+
+    CTxLookupCache() : nMaxEntries(DEFAULT_TXLOOKUP_CACHE_SIZE), nHits(0), nMisses(0), nHitMicros(0), nMissMicros(0) {}
+
+    /***
+     * Look up a transaction
+     * @param[in] txid the transaction to look for
+     * @param[out] txOut the transaction
+     * @param[out] hashBlock the block that contains it
+     * @returns true if found
+     */
+    bool Lookup(const uint256 &txid, CTransaction &txOut, uint256 &hashBlock);
+    /***
+     * Add a transaction read from disk, evicting the least recently used entry when full
+     */
+    void Insert(const CTransactionRef &ptx, const uint256 &hashBlock);
+    /***
+     * Remove all transactions of a block (called when it is disconnected)
+     */
+    void EraseBlock(const CBlock &block);
+    /***
+     * Remember where in a block file a header starts, its hash and serialized size
+     */
+    void InsertHeader(const CDiskBlockPos &pos, const uint256 &hashBlock, uint32_t nHeaderSize);
+    bool LookupHeader(const CDiskBlockPos &pos, uint256 &hashBlock, uint32_t &nHeaderSize);
+
+    void RecordHit(int64_t nMicros) { ++nHits; nHitMicros += nMicros; }
+    void RecordMiss(int64_t nMicros) { ++nMisses; nMissMicros += nMicros; }
+
+    void SetMaxEntries(size_t nMax);
+    void Clear();
+    Stats GetStats();
+
+private:
+    struct CEntry
+    {
+        CTransactionRef tx;
+        uint256 hashBlock;
+    };
+    struct TxidHasher
+    {
+        size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+    };
+    typedef std::list<CEntry> EntryList;
+
+    CCriticalSection cs;
+    EntryList lru; // most recently used at the front
+    boost::unordered_map<uint256, EntryList::iterator, TxidHasher> mapEntries;
+    std::map<std::pair<int, unsigned int>, std::pair<uint256, uint32_t> > mapHeaders;
+    size_t nMaxEntries;
+
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+    std::atomic<uint64_t> nHitMicros;
+    std::atomic<uint64_t> nMissMicros;
+};
+
+/****
+ * A small thread-safe LRU of serialized blocks recently sent to peers, keyed
+ * by block hash, so a new tip that many peers ask for is read from disk once.
+ * The bytes stored for a hash never change, so entries need no invalidation.
+ */
+class CRawBlockCache
+{
+public:
+    typedef std::shared_ptr<const std::vector<uint8_t> > RawBlockRef;
+
+    struct Stats
+    {
+        uint64_t nEntries;
+        uint64_t nMaxEntries;
+        uint64_t nBytes;
+        uint64_t nHits;
+        uint64_t nMisses;
+    };
+
+    CRawBlockCache() : nMaxEntries(DEFAULT_RAW_BLOCK_CACHE_SIZE), nBytes(0), nHits(0), nMisses(0) {}
+
+    /***
+     * Look up a serialized block, counting a hit or a miss
+     * @param[in] hash the block hash
+     * @param[out] pblock the serialized block
+     * @returns true if found
+     */
+    bool Lookup(const uint256 &hash, RawBlockRef &pblock);
+    /***
+     * Add a serialized block read from disk, evicting the least recently used entry when full
+     */
+    void Insert(const uint256 &hash, const RawBlockRef &pblock);
+
+    void SetMaxEntries(size_t nMax);
+    void Clear();
+    Stats GetStats();
+
+private:
+    struct BlockHasher
+    {
+        size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+    };
+    typedef std::list<std::pair<uint256, RawBlockRef> > EntryList;
+
+    void EvictTo(size_t nMax);
+
+    CCriticalSection cs;
+    EntryList lru; // most recently used at the front
+    boost::unordered_map<uint256, EntryList::iterator, BlockHasher> mapEntries;
+    size_t nMaxEntries;
+    uint64_t nBytes;
+
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+};
+
+/****
+ * Read-only memory maps of the blk?????.dat files, so transactions can be
+ * deserialized straight from the page cache without fopen/fseek.
+ * Mappings are grown when a file is appended to and dropped when it is pruned.
+ */
+class CBlockFileMapper
+{
+public:
+    CBlockFileMapper() : fEnabled(false) {}
+    ~CBlockFileMapper() { UnmapAll(); }
+
+    void SetEnabled(bool fEnable) { fEnabled = fEnable; }
+    bool IsEnabled() const { return fEnabled; }
+
+    /***
+     * Read a transaction from a mapped block file
+     * @param[in] postx where the transaction is
+     * @param[out] ptx the transaction
+     * @param[out] hashBlock the hash of the containing block
+     * @param[in] cache header hashes already known
+     * @returns false if the file could not be mapped or the data is invalid
+     */
+    bool ReadTransaction(const CDiskTxPos &postx, CTransactionRef &ptx, uint256 &hashBlock, CTxLookupCache &cache);
+    /***
+     * Copy a block as stored in a mapped block file, without deserializing it
+     * @param[in] pos where the block is, just past its message start and size
+     * @param[in] messageStart the message start the block was written with
+     * @param[out] vBlock the serialized block
+     * @returns false if the file could not be mapped or the data is invalid
+     */
+    bool ReadRawBlock(const CDiskBlockPos &pos, const unsigned char *messageStart, std::vector<uint8_t> &vBlock);
+    void Unmap(int nFile);
+    void UnmapAll();
+    /***
+     * @param[out] nBytes total bytes currently mapped
+     * @returns number of mapped files
+     */
+    size_t GetMappedFiles(uint64_t &nBytes);
+
+private:
+    class CMappedFile;
+    std::shared_ptr<CMappedFile> GetFile(int nFile, size_t nMinSize);
+
+    CCriticalSection cs;
+    std::atomic<bool> fEnabled;
+    std::map<int, std::shared_ptr<CMappedFile> > mapFiles;
+};
+
+extern CTxLookupCache txLookupCache;
+extern CRawBlockCache rawBlockCache;
+extern CBlockFileMapper blockFileMapper;
+
+#endif // SQUISHY_TXCACHE_H
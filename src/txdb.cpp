@@ -49,10 +49,19 @@ static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_ADDRESSINDEX = 'd';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCE = 'e';
+static const char DB_ADDRESSRICHLIST = 'r';
+static const char DB_ADDRESSSTATS = 'y';
+static const char DB_CCINDEX = 'C';
+static const char DB_TOKENUNSPENT = 'k';
+static const char DB_TOKENOUTPUT = 'o';
+static const char DB_TOKENBALANCE = 'n';
+static const char DB_TOKENSTATS = 'K';
 static const char DB_TIMESTAMPINDEX = 'S';
 static const char DB_BLOCKHASHINDEX = 'z';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_BLOCK_EXTRA = 'v';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_BEST_SPROUT_ANCHOR = 'a';
@@ -311,6 +320,11 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
         } catch (const runtime_error&) {
             return false;
         }
+        // only blocks that were connected once can have stale data to erase
+        if (it->nStatus & BLOCK_HAVE_EXTRA_MASK)
+            batch.Write(make_pair(DB_BLOCK_EXTRA, key.second), CDiskBlockExtra(it));
+        else if (it->nStatus & BLOCK_HAVE_UNDO)
+            batch.Erase(make_pair(DB_BLOCK_EXTRA, key.second));
     }
     return WriteBatch(batch, true);
 }
@@ -319,6 +333,7 @@ bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockin
     CDBBatch batch(*this);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Erase(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()));
+        batch.Erase(make_pair(DB_BLOCK_EXTRA, (*it)->GetBlockHash()));
     }
     return WriteBatch(batch, true);
 }
@@ -401,10 +416,82 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
     return true;
 }
 
+/****
+ * Add the balance, richlist and per type total changes caused by a block's
+ * address index records to a batch
+ * @param db the block tree db holding the current balances
+ * @param batch where to write the new balances
+ * @param vect the address index records of one block
+ * @param sign 1 when the block is connected, -1 when it is disconnected
+ */
+static void BatchAddressBalanceDeltas(const CBlockTreeDB &db, CDBBatch &batch,
+        const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, int sign)
+{
+    typedef std::pair<unsigned int, uint160> AddressKey;
+    std::map<AddressKey, CAddressBalanceValue> deltas;
+    std::map<unsigned int, CAddressTypeStats> typeDeltas;
+    std::set<std::pair<AddressKey, unsigned int> > txs;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+    {
+        AddressKey key(it->first.type, it->first.hashBytes);
+        CAddressBalanceValue &delta = deltas[key];
+        delta.balance += it->second;
+        if (it->second > 0)
+            delta.received += it->second;
+        // every record of a block has the same height, the tx position identifies the tx
+        if (txs.insert(make_pair(key, it->first.txindex)).second)
+            delta.txcount++;
+        // zero value outputs are not counted as utxos
+        if (it->second != 0)
+            typeDeltas[it->first.type].utxos += (it->first.spending ? -1 : 1);
+    }
+    for (std::map<AddressKey, CAddressBalanceValue>::const_iterator it=deltas.begin(); it!=deltas.end(); it++)
+    {
+        CAddressIndexIteratorKey dbkey(it->first.first, it->first.second);
+        CAddressBalanceValue value;
+        db.Read(make_pair(DB_ADDRESSBALANCE, dbkey), value);
+        CAmount oldBalance = value.balance;
+        value.balance += sign * it->second.balance;
+        value.received += sign * it->second.received;
+        value.txcount += sign * it->second.txcount;
+        if (value.IsNull())
+            batch.Erase(make_pair(DB_ADDRESSBALANCE, dbkey));
+        else
+            batch.Write(make_pair(DB_ADDRESSBALANCE, dbkey), value);
+
+        if (value.balance != oldBalance)
+        {
+            CAddressTypeStats &typeDelta = typeDeltas[dbkey.type];
+            typeDelta.total += value.balance - oldBalance;
+            if (oldBalance > 0)
+            {
+                batch.Erase(make_pair(DB_ADDRESSRICHLIST, CAddressRichlistKey(oldBalance, dbkey.type, dbkey.hashBytes)));
+                typeDelta.addresses--;
+            }
+            if (value.balance > 0)
+            {
+                batch.Write(make_pair(DB_ADDRESSRICHLIST, CAddressRichlistKey(value.balance, dbkey.type, dbkey.hashBytes)), '\0');
+                typeDelta.addresses++;
+            }
+        }
+    }
+    for (std::map<unsigned int, CAddressTypeStats>::const_iterator it=typeDeltas.begin(); it!=typeDeltas.end(); it++)
+    {
+        CAddressTypeStats stats;
+        db.Read(make_pair(DB_ADDRESSSTATS, (unsigned char)it->first), stats);
+        // balances were already updated with the sign applied, only the utxo count still needs it
+        stats.total += it->second.total;
+        stats.addresses += it->second.addresses;
+        stats.utxos += sign * it->second.utxos;
+        batch.Write(make_pair(DB_ADDRESSSTATS, (unsigned char)it->first), stats);
+    }
+}
+
 bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    BatchAddressBalanceDeltas(*this, batch, vect, 1);
     return WriteBatch(batch);
 }
 
@@ -412,9 +499,322 @@ bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKe
     CDBBatch batch(*this);
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    BatchAddressBalanceDeltas(*this, batch, vect, -1);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &balance) const {
+    balance.SetNull();
+    return Read(make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), balance);
+}
+
+bool CBlockTreeDB::BuildAddressBalanceIndex() {
+    LogPrintf("%s: building address balance index, this could take a while\n", __func__);
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    CDBBatch batch(*this);
+    CAddressIndexIteratorKey current;
+    CAddressBalanceValue value;
+    int lastHeight = -1; unsigned int lastTx = 0;
+    int64_t nAddresses = 0;
+    bool fHaveCurrent = false;
+
+    pcursor->Seek(DB_ADDRESSINDEX);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        pair<char, CAddressIndexKey> keyObj;
+        CAmount nValue;
+        try {
+            if (!pcursor->GetKey(keyObj) || keyObj.first != DB_ADDRESSINDEX)
+                break;
+            pcursor->GetValue(nValue);
+        } catch (const std::exception& e) {
+            return error("%s: failed to read address index - %s", __func__, e.what());
+        }
+        const CAddressIndexKey &indexKey = keyObj.second;
+        // records are sorted by address, then height and position in the block
+        if (!fHaveCurrent || indexKey.type != current.type || indexKey.hashBytes != current.hashBytes) {
+            if (fHaveCurrent && !value.IsNull())
+                batch.Write(make_pair(DB_ADDRESSBALANCE, current), value);
+            current = CAddressIndexIteratorKey(indexKey.type, indexKey.hashBytes);
+            value.SetNull();
+            lastHeight = -1;
+            fHaveCurrent = true;
+            if (++nAddresses % 100000 == 0) {
+                LogPrintf("%s: %lld addresses\n", __func__, (long long)nAddresses);
+                if (!WriteBatch(batch))
+                    return false;
+                batch.Clear();
+            }
+        }
+        value.balance += nValue;
+        if (nValue > 0)
+            value.received += nValue;
+        if (indexKey.blockHeight != lastHeight || indexKey.txindex != lastTx) {
+            value.txcount++;
+            lastHeight = indexKey.blockHeight;
+            lastTx = indexKey.txindex;
+        }
+        pcursor->Next();
+    }
+    if (fHaveCurrent && !value.IsNull())
+        batch.Write(make_pair(DB_ADDRESSBALANCE, current), value);
+    LogPrintf("%s: done, %lld addresses\n", __func__, (long long)nAddresses);
+    return WriteBatch(batch, true);
+}
+
+bool CBlockTreeDB::ReadAddressTypeStats(int type, CAddressTypeStats &stats) const {
+    stats.SetNull();
+    return Read(make_pair(DB_ADDRESSSTATS, (unsigned char)type), stats);
+}
+
+bool CBlockTreeDB::BuildAddressRichlistIndex() {
+    LogPrintf("%s: building address richlist\n", __func__);
+    std::map<unsigned int, CAddressTypeStats> stats;
+    CDBBatch batch(*this);
+    int64_t nRecords = 0;
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        for (pcursor->Seek(DB_ADDRESSBALANCE); pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            pair<char, CAddressIndexIteratorKey> keyObj;
+            CAddressBalanceValue value;
+            try {
+                if (!pcursor->GetKey(keyObj) || keyObj.first != DB_ADDRESSBALANCE)
+                    break;
+                pcursor->GetValue(value);
+            } catch (const std::exception& e) {
+                return error("%s: failed to read address balance - %s", __func__, e.what());
+            }
+            stats[keyObj.second.type].total += value.balance;
+            if (value.balance > 0) {
+                batch.Write(make_pair(DB_ADDRESSRICHLIST, CAddressRichlistKey(value.balance, keyObj.second.type, keyObj.second.hashBytes)), '\0');
+                stats[keyObj.second.type].addresses++;
+                if (++nRecords % 100000 == 0) {
+                    if (!WriteBatch(batch))
+                        return false;
+                    batch.Clear();
+                }
+            }
+        }
+    }
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        for (pcursor->Seek(DB_ADDRESSUNSPENTINDEX); pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            pair<char, CAddressUnspentKey> keyObj;
+            CAddressUnspentValue value;
+            try {
+                if (!pcursor->GetKey(keyObj) || keyObj.first != DB_ADDRESSUNSPENTINDEX)
+                    break;
+                pcursor->GetValue(value);
+            } catch (const std::exception& e) {
+                return error("%s: failed to read address unspent index - %s", __func__, e.what());
+            }
+            if (value.satoshis != 0)
+                stats[keyObj.second.type].utxos++;
+        }
+    }
+    for (std::map<unsigned int, CAddressTypeStats>::const_iterator it=stats.begin(); it!=stats.end(); it++)
+        batch.Write(make_pair(DB_ADDRESSSTATS, (unsigned char)it->first), it->second);
+    LogPrintf("%s: done, %lld addresses with a balance\n", __func__, (long long)nRecords);
+    return WriteBatch(batch, true);
+}
+
+bool CBlockTreeDB::WriteCCIndex(const std::vector<std::pair<CCCIndexKey, CCCIndexValue> > &vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CCCIndexKey, CCCIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair(DB_CCINDEX, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseCCIndex(const std::vector<std::pair<CCCIndexKey, CCCIndexValue> > &vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CCCIndexKey, CCCIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Erase(make_pair(DB_CCINDEX, it->first));
+    return WriteBatch(batch);
+}
+
+static bool CompareCCIndexKeysByHeight(const CCCIndexKey &a, const CCCIndexKey &b)
+{
+    return a.blockHeight > b.blockHeight;
+}
+
+bool CBlockTreeDB::ReadCCIndex(uint8_t evalcode, uint8_t funcid, const uint256 &reftxid, const CAddressIndexIteratorKey &address,
+                               std::vector<CCCIndexKey> &keys, int skip, int limit) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    // with the funcid and reference txid fixed the records come out newest first,
+    // otherwise they come in runs per funcid / reference and are sorted afterwards
+    bool fOrdered = (funcid != 0 && !reftxid.IsNull());
+    int nMatched = 0;
+    keys.clear();
+
+    pcursor->Seek(make_pair(DB_CCINDEX, CCCIndexIteratorKey(evalcode, funcid, reftxid)));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        pair<char, CCCIndexKey> keyObj;
+        if (!pcursor->GetKey(keyObj) || keyObj.first != DB_CCINDEX || keyObj.second.evalcode != evalcode)
+            break;
+        const CCCIndexKey &key = keyObj.second;
+        if (funcid != 0 && (key.funcid != funcid || (!reftxid.IsNull() && key.reftxid != reftxid)))
+            break;
+        if (reftxid.IsNull() || key.reftxid == reftxid) {
+            CCCIndexValue value;
+            if (!pcursor->GetValue(value))
+                return error("failed to get CC index value");
+            if (address.type == 0 || value.HasAddress(address.type, address.hashBytes)) {
+                if (!fOrdered)
+                    keys.push_back(key);
+                else if (nMatched++ >= skip) {
+                    keys.push_back(key);
+                    if (limit > 0 && (int)keys.size() >= limit)
+                        break;
+                }
+            }
+        }
+        pcursor->Next();
+    }
+    if (!fOrdered) {
+        std::stable_sort(keys.begin(), keys.end(), CompareCCIndexKeysByHeight);
+        if (skip > 0)
+            keys.erase(keys.begin(), keys.begin() + std::min((size_t)skip, keys.size()));
+        if (limit > 0 && (int)keys.size() > limit)
+            keys.resize(limit);
+    }
+    return true;
+}
+
+/****
+ * Add the token index changes of a block to a batch
+ * @param db the block tree db holding the current balances and totals
+ * @param batch where to write the changes
+ * @param vect the token outputs created (positive) and spent (negative) in block order
+ * @param supplies the units created by tokenbase txs
+ * @param sign 1 when the block is connected, -1 when it is disconnected
+ */
+static void BatchTokenIndex(const CBlockTreeDB &db, CDBBatch &batch,
+        const std::vector<std::pair<CTokenUnspentKey, CAmount> > &vect,
+        const std::vector<std::pair<uint256, CAmount> > &supplies, int sign)
+{
+    std::map<CTokenAddressKey, CAmount> balances;
+    std::map<uint256, CTokenStats> stats;
+    // a disconnect replays the block backwards, so outputs spent within the block are restored before they are erased
+    for (size_t i = 0; i < vect.size(); i++)
+    {
+        const std::pair<CTokenUnspentKey, CAmount> &record = sign > 0 ? vect[i] : vect[vect.size() - 1 - i];
+        const CTokenUnspentKey &key = record.first;
+        bool fCreate = (record.second > 0) == (sign > 0);
+        if (fCreate)
+            batch.Write(make_pair(DB_TOKENUNSPENT, key), sign * record.second);
+        else
+            batch.Erase(make_pair(DB_TOKENUNSPENT, key));
+        if (record.second > 0)
+        {
+            COutPoint outpoint(key.txhash, key.index);
+            if (sign > 0)
+                batch.Write(make_pair(DB_TOKENOUTPUT, outpoint), CTokenOutputValue(key.GetAddressKey(), record.second));
+            else
+                batch.Erase(make_pair(DB_TOKENOUTPUT, outpoint));
+        }
+        balances[key.GetAddressKey()] += sign * record.second;
+        stats[key.tokenid].unspent += sign * record.second;
+    }
+    for (std::vector<std::pair<uint256, CAmount> >::const_iterator it=supplies.begin(); it!=supplies.end(); it++)
+        stats[it->first].supply += sign * it->second;
+
+    for (std::map<CTokenAddressKey, CAmount>::const_iterator it=balances.begin(); it!=balances.end(); it++)
+    {
+        if (it->second == 0)
+            continue;
+        CAmount balance = 0;
+        db.Read(make_pair(DB_TOKENBALANCE, it->first), balance);
+        CAmount newBalance = balance + it->second;
+        if (balance <= 0 && newBalance > 0)
+            stats[it->first.tokenid].holders++;
+        else if (balance > 0 && newBalance <= 0)
+            stats[it->first.tokenid].holders--;
+        if (newBalance == 0)
+            batch.Erase(make_pair(DB_TOKENBALANCE, it->first));
+        else
+            batch.Write(make_pair(DB_TOKENBALANCE, it->first), newBalance);
+    }
+    for (std::map<uint256, CTokenStats>::const_iterator it=stats.begin(); it!=stats.end(); it++)
+    {
+        CTokenStats value;
+        db.Read(make_pair(DB_TOKENSTATS, it->first), value);
+        value.supply += it->second.supply;
+        value.unspent += it->second.unspent;
+        value.holders += it->second.holders;
+        if (value.IsNull())
+            batch.Erase(make_pair(DB_TOKENSTATS, it->first));
+        else
+            batch.Write(make_pair(DB_TOKENSTATS, it->first), value);
+    }
+}
+
+bool CBlockTreeDB::WriteTokenIndex(const std::vector<std::pair<CTokenUnspentKey, CAmount> > &vect,
+                                   const std::vector<std::pair<uint256, CAmount> > &supplies) {
+    CDBBatch batch(*this);
+    BatchTokenIndex(*this, batch, vect, supplies, 1);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseTokenIndex(const std::vector<std::pair<CTokenUnspentKey, CAmount> > &vect,
+                                   const std::vector<std::pair<uint256, CAmount> > &supplies) {
+    CDBBatch batch(*this);
+    BatchTokenIndex(*this, batch, vect, supplies, -1);
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadTokenOutput(const COutPoint &outpoint, CTokenOutputValue &value) const {
+    return Read(make_pair(DB_TOKENOUTPUT, outpoint), value);
+}
+
+bool CBlockTreeDB::ReadTokenBalance(const CTokenAddressKey &address, CAmount &balance) const {
+    balance = 0;
+    return Read(make_pair(DB_TOKENBALANCE, address), balance);
+}
+
+bool CBlockTreeDB::ReadTokenUnspent(const CTokenAddressKey &address, std::vector<std::pair<CTokenUnspentKey, CAmount> > &unspentOutputs) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_TOKENUNSPENT, address));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        pair<char, CTokenUnspentKey> keyObj;
+        if (!pcursor->GetKey(keyObj) || keyObj.first != DB_TOKENUNSPENT || keyObj.second.tokenid != address.tokenid ||
+            keyObj.second.type != address.type || keyObj.second.hashBytes != address.hashBytes)
+            break;
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("failed to get token unspent value");
+        unspentOutputs.push_back(make_pair(keyObj.second, nValue));
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadTokenStats(const uint256 &tokenid, CTokenStats &stats) const {
+    stats.SetNull();
+    return Read(make_pair(DB_TOKENSTATS, tokenid), stats);
+}
+
+bool CBlockTreeDB::ReadTokenList(std::vector<uint256> &tokenids) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    for (pcursor->Seek(DB_TOKENSTATS); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        pair<char, uint256> keyObj;
+        CTokenStats stats;
+        if (!pcursor->GetKey(keyObj) || keyObj.first != DB_TOKENSTATS)
+            break;
+        if (!pcursor->GetValue(stats))
+            return error("failed to get token stats");
+        if (stats.supply > 0)
+            tokenids.push_back(keyObj.second);
+    }
+    return true;
+}
+
 bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                                     int start, int end) {
@@ -481,104 +881,104 @@ bool getAddressFromIndex(const int &type, const uint160 &hash, std::string &addr
     {"RD6GgnrMpPaTSMn8vai6yiGA7mN4QGPVMY", 1} \
 };
 
-bool CBlockTreeDB::Snapshot2(std::map <std::string, CAmount> &addressAmounts, UniValue *ret)
+/****
+ * Fill the summary part of a snapshot from the per type totals
+ * @param db the block tree db
+ * @param ignoredMap addresses left out of the snapshot
+ * @param ret where to add the summary
+ */
+static void SnapshotSummary(CBlockTreeDB &db, const std::map<std::string,int> &ignoredMap, UniValue *ret)
 {
-    int64_t total = 0; int64_t totalAddresses = 0; std::string address;
-    int64_t utxos = 0; int64_t ignoredAddresses = 0, cryptoConditionsUTXOs = 0, cryptoConditionsTotals = 0;
-    DECLARE_IGNORELIST
-    boost::scoped_ptr<CDBIterator> iter(NewIterator());
-    //std::map <std::string, CAmount> addressAmounts;
-    for (iter->SeekToLast(); iter->Valid(); iter->Prev())
+    CAddressTypeStats pubkeyStats, scriptStats, ccStats;
+    db.ReadAddressTypeStats(1, pubkeyStats);
+    db.ReadAddressTypeStats(2, scriptStats);
+    db.ReadAddressTypeStats(3, ccStats);
+
+    // take the ignored addresses back out of the totals
+    CAmount ignoredTotal = 0; int64_t ignoredAddresses = 0, ignoredUtxos = 0;
+    for (std::map<std::string,int>::const_iterator it = ignoredMap.begin(); it != ignoredMap.end(); it++)
     {
-        boost::this_thread::interruption_point();
-        try
-        {
-            std::vector<unsigned char> slKey = std::vector<unsigned char>();
-            pair<char, CAddressIndexIteratorKey> keyObj;
-            iter->GetKey(keyObj);
-
-            char chType = keyObj.first;
-            CAddressIndexIteratorKey indexKey = keyObj.second;
-            //LogPrintf( "chType=%d\n", chType);
-            if (chType == DB_ADDRESSUNSPENTINDEX)
-            {
-                try {
-                    CAmount nValue;
-                    iter->GetValue(nValue);
-                    if ( nValue == 0 )
-                        continue;
-                    getAddressFromIndex(indexKey.type, indexKey.hashBytes, address);
-                    if ( indexKey.type == 3 )
-                    {
-                        cryptoConditionsUTXOs++;
-                        cryptoConditionsTotals += nValue;
-                        total += nValue;
-                        continue;
-                    }
-                    std::map <std::string, int>::iterator ignored = ignoredMap.find(address);
-                    if (ignored != ignoredMap.end())
-                    {
-                        LogPrintf("ignoring %s\n", address.c_str());
-                        ignoredAddresses++;
-                        continue;
-                    }
+        uint160 hashBytes; int type = 0; CAddressBalanceValue balance;
+        if ( !CBitcoinAddress(it->first).GetIndexKey(hashBytes, type, false) || !db.ReadAddressBalance(hashBytes, type, balance) || balance.balance <= 0 )
+            continue;
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+        db.ReadAddressUnspentIndex(hashBytes, type, unspentOutputs);
+        for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator u = unspentOutputs.begin(); u != unspentOutputs.end(); u++)
+            if ( u->second.satoshis != 0 )
+                ignoredUtxos++;
+        ignoredTotal += balance.balance;
+        ignoredAddresses++;
+    }
+    int64_t totalAddresses = pubkeyStats.addresses + scriptStats.addresses - ignoredAddresses;
+    int64_t utxos = pubkeyStats.utxos + scriptStats.utxos - ignoredUtxos;
+    CAmount total = pubkeyStats.total + scriptStats.total - ignoredTotal + ccStats.total;
+
+    // Total circulating supply without CC vouts.
+    ret->push_back(make_pair("total", (double) (total)/ COIN ));
+    // Average amount in each address of this snapshot
+    ret->push_back(make_pair("average",(double) (total/COIN) / totalAddresses ));
+    // Total number of utxos processed in this snaphot
+    ret->push_back(make_pair("utxos", utxos));
+    // Total number of addresses in this snaphot
+    ret->push_back(make_pair("total_addresses", totalAddresses ));
+    // Total number of ignored addresses in this snaphot
+    ret->push_back(make_pair("ignored_addresses", ignoredUtxos));
+    // Total number of crypto condition utxos we skipped
+    ret->push_back(make_pair("skipped_cc_utxos", ccStats.utxos));
+    // Total value of skipped crypto condition utxos
+    ret->push_back(make_pair("cc_utxo_value", (double) ccStats.total / COIN));
+    // total of all the address's, does not count coins in CC vouts.
+    ret->push_back(make_pair("total_includeCCvouts", (double) (total+ccStats.total)/ COIN ));
+    // The snapshot finished at this block height
+    ret->push_back(make_pair("ending_height", chainActive.Height()));
+}
 
-                    std::map <std::string, CAmount>::iterator pos = addressAmounts.find(address);
-                    if ( pos == addressAmounts.end() )
-                    {
-                        // insert new address + utxo amount
-                        //LogPrintf( "inserting new address %s with amount %li\n", address.c_str(), nValue);
-                        addressAmounts[address] = nValue;
-                        totalAddresses++;
-                    }
-                    else
-                    {
-                        // update unspent tally for this address
-                        //LogPrintf( "updating address %s with new utxo amount %li\n", address.c_str(), nValue);
-                        addressAmounts[address] += nValue;
-                    }
-                    //LogPrintf("{\"%s\", %.8f},\n",address.c_str(),(double)nValue/COIN);
-                    // total += nValue;
-                    utxos++;
-                    total += nValue;
-                }
-                catch (const std::exception& e)
-                {
-                    LogPrintf( "DONE %s: LevelDB addressindex exception! - %s\n", __func__, e.what());
-                    return false; //break; this means failiure of DB? we need to exit here if so for consensus code!
-                }
-            }
+/****
+ * Walk the richlist from the largest balance down, skipping CC and ignored addresses
+ * @param db the block tree db
+ * @param ignoredMap addresses to skip
+ * @param fn called with each address and its balance, returns false to stop
+ * @returns false if the index could not be read
+ */
+template <typename Callback>
+static bool ForEachRichlistAddress(CBlockTreeDB &db, const std::map<std::string,int> &ignoredMap, Callback fn)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    std::string address;
+    pcursor->Seek(DB_ADDRESSRICHLIST);
+    while (pcursor->Valid())
+    {
+        boost::this_thread::interruption_point();
+        pair<char, CAddressRichlistKey> keyObj;
+        try {
+            if ( !pcursor->GetKey(keyObj) || keyObj.first != DB_ADDRESSRICHLIST )
+                break;
+        } catch (const std::exception& e) {
+            return error("%s: LevelDB richlist exception - %s", __func__, e.what());
         }
-        catch (const std::exception& e)
+        const CAddressRichlistKey &key = keyObj.second;
+        if ( key.type != 3 && getAddressFromIndex(key.type, key.hashBytes, address) && ignoredMap.count(address) == 0 )
         {
-            LogPrintf( "DONE reading index entries\n");
-            break;
+            if ( !fn(address, key.balance) )
+                break;
         }
+        pcursor->Next();
     }
-    //LogPrintf( "total=%f, totalAddresses=%li, utxos=%li, ignored=%li\n", (double) total / COIN, totalAddresses, utxos, ignoredAddresses);
-    
+    return true;
+}
+
+bool CBlockTreeDB::Snapshot2(std::map <std::string, CAmount> &addressAmounts, UniValue *ret)
+{
+    DECLARE_IGNORELIST
+    bool fSuccess = ForEachRichlistAddress(*this, ignoredMap, [&addressAmounts](const std::string &address, CAmount amount) {
+        addressAmounts[address] = amount;
+        return true;
+    });
+    if ( !fSuccess )
+        return false;
     // this is for the snapshot RPC, you can skip this by passing a 0 as the last argument.
     if (ret)
-    {
-        // Total circulating supply without CC vouts.
-        ret->push_back(make_pair("total", (double) (total)/ COIN ));
-        // Average amount in each address of this snapshot
-        ret->push_back(make_pair("average",(double) (total/COIN) / totalAddresses ));
-        // Total number of utxos processed in this snaphot
-        ret->push_back(make_pair("utxos", utxos));
-        // Total number of addresses in this snaphot
-        ret->push_back(make_pair("total_addresses", totalAddresses ));
-        // Total number of ignored addresses in this snaphot
-        ret->push_back(make_pair("ignored_addresses", ignoredAddresses));
-        // Total number of crypto condition utxos we skipped
-        ret->push_back(make_pair("skipped_cc_utxos", cryptoConditionsUTXOs));
-        // Total value of skipped crypto condition utxos
-        ret->push_back(make_pair("cc_utxo_value", (double) cryptoConditionsTotals / COIN));
-        // total of all the address's, does not count coins in CC vouts.
-        ret->push_back(make_pair("total_includeCCvouts", (double) (total+cryptoConditionsTotals)/ COIN ));
-        // The snapshot finished at this block height
-        ret->push_back(make_pair("ending_height", chainActive.Height()));
-    }
+        SnapshotSummary(*this, ignoredMap, ret);
     return true;
 }
 
@@ -586,44 +986,47 @@ extern std::vector <std::pair<CAmount, CTxDestination>> vAddressSnapshot;
 
 UniValue CBlockTreeDB::Snapshot(int top)
 {
-    std::vector <std::pair<CAmount, std::string>> vaddr;
-    //std::vector <std::vector <std::pair<CAmount, CScript>>> tokenids;
-    std::map <std::string, CAmount> addressAmounts;
     UniValue result(UniValue::VOBJ);
     UniValue addressesSorted(UniValue::VARR);
     result.push_back(Pair("start_time", (int) time(NULL)));
-    if ( (vAddressSnapshot.size() > 0 && top < 0) || (Snapshot2(addressAmounts,&result) && top >= 0) )
+    auto addAddress = [&addressesSorted](const std::string &address, CAmount amount) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back( make_pair("addr", address.c_str() ) );
+        char str[32];
+        sprintf(str, "%.8f", (double) amount / COIN);
+        obj.push_back( make_pair("amount", str) );
+        obj.push_back( make_pair("segid",(int32_t)squishy_segid32((char *)address.c_str()) & 0x3f) );
+        addressesSorted.push_back(obj);
+    };
+    if ( vAddressSnapshot.size() > 0 && top < 0 )
     {
-        if ( top > -1 )
-        {
-            for (std::pair<std::string, CAmount> element : addressAmounts)
-                vaddr.push_back( make_pair(element.second, element.first) );
-            std::sort(vaddr.rbegin(), vaddr.rend());
-        }
-        else 
-        {
-            for ( auto address : vAddressSnapshot )
-                vaddr.push_back(make_pair(address.first, CBitcoinAddress(address.second).ToString()));
-            top = vAddressSnapshot.size();
-        }
+        for ( auto address : vAddressSnapshot )
+            addAddress(CBitcoinAddress(address.second).ToString(), address.first);
+    }
+    else if ( top >= 0 )
+    {
+        DECLARE_IGNORELIST
+        SnapshotSummary(*this, ignoredMap, &result);
+        // the richlist is already sorted, only the requested top N records are read
         int topN = 0;
-        for (std::vector<std::pair<CAmount, std::string>>::iterator it = vaddr.begin(); it!=vaddr.end(); ++it)
-        {
-          	UniValue obj(UniValue::VOBJ);
-          	obj.push_back( make_pair("addr", it->second.c_str() ) );
-          	char amount[32];
-          	sprintf(amount, "%.8f", (double) it->first / COIN);
-          	obj.push_back( make_pair("amount", amount) );
-            obj.push_back( make_pair("segid",(int32_t)squishy_segid32((char *)it->second.c_str()) & 0x3f) );
-          	addressesSorted.push_back(obj);
-            topN++;
+        bool fSuccess = ForEachRichlistAddress(*this, ignoredMap, [&](const std::string &address, CAmount amount) {
+            addAddress(address, amount);
             // If requested, only show top N addresses in output JSON
-           	if ( top == topN )
-                break;
+            return ++topN != top;
+        });
+        if ( !fSuccess )
+        {
+            result.push_back(make_pair("error", "problem doing snapshot"));
+            return(result);
         }
-    	// Array of all addreses with balances
-        result.push_back(make_pair("addresses", addressesSorted));
-    } else result.push_back(make_pair("error", "problem doing snapshot"));
+    }
+    else
+    {
+        result.push_back(make_pair("error", "problem doing snapshot"));
+        return(result);
+    }
+    // Array of all addreses with balances
+    result.push_back(make_pair("addresses", addressesSorted));
     return(result);
 }
 
@@ -739,8 +1142,10 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
             CDiskBlockIndex diskindex;
             if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
+                // Construct block index object, keyed by the hash it was written under
+                // so the header with its solution is not hashed again for every block,
+                // the heights are checked against the parents once all are loaded
+                CBlockIndex* pindexNew = InsertBlockIndex(key.second);
                 pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
                 pindexNew->nHeight = diskindex.nHeight;
                 pindexNew->nFile          = diskindex.nFile;
@@ -754,7 +1159,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nBits          = diskindex.nBits;
                 pindexNew->nNonce         = diskindex.nNonce;
                 // the Equihash solution will be loaded lazily from the dbindex entry
-                pindexNew->nStatus        = diskindex.nStatus;
+                pindexNew->nStatus        = diskindex.nStatus & ~BLOCK_HAVE_EXTRA_MASK;
                 pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
                 pindexNew->nTx            = diskindex.nTx;
                 pindexNew->nSproutValue   = diskindex.nSproutValue;
@@ -799,5 +1204,29 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     uiInterface.ShowProgress("", 100, false);
     LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
 
+    // Entries are keyed by the hash they were written under without rehashing them, so check
+    // that each one continues the entry its hashPrev points to (placeholders have no status yet)
+    for (const auto& item : mapBlockIndex)
+    {
+        const CBlockIndex* pindex = item.second;
+        if (pindex->pprev != NULL && pindex->pprev->nStatus != 0 && pindex->nHeight != pindex->pprev->nHeight + 1)
+            return error("LoadBlockIndex(): block index entry %s at height %d does not follow %s at height %d",
+                item.first.ToString(), pindex->nHeight, pindex->pprev->GetBlockHash().ToString(), pindex->pprev->nHeight);
+    }
+
+    // Load the data kept next to the index entries
+    for (pcursor->Seek(make_pair(DB_BLOCK_EXTRA, uint256())); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_BLOCK_EXTRA)
+            break;
+        CDiskBlockExtra extra;
+        if (!pcursor->GetValue(extra))
+            return error("LoadBlockIndex() : failed to read extra block index data");
+        BlockMap::iterator mi = mapBlockIndex.find(key.second);
+        if (mi != mapBlockIndex.end())
+            extra.ApplyTo(mi->second);
+    }
+
     return true;
 }
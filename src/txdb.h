@@ -39,6 +39,14 @@ struct CAddressUnspentValue;
 struct CAddressIndexKey;
 struct CAddressIndexIteratorKey;
 struct CAddressIndexIteratorHeightKey;
+struct CAddressBalanceValue;
+struct CAddressTypeStats;
+struct CCCIndexKey;
+struct CCCIndexValue;
+struct CTokenAddressKey;
+struct CTokenUnspentKey;
+struct CTokenOutputValue;
+struct CTokenStats;
 struct CTimestampIndexKey;
 struct CTimestampIndexIteratorKey;
 struct CTimestampBlockIndexKey;
@@ -102,6 +110,10 @@ public:
  * - spent index
  * - unspent index
  * - address / amount
+ * - address / balance
+ * - richlist (balance ordered) and per address type totals
+ * - CC evalcode / funcid / reference txid
+ * - token unspent outputs, balances and totals
  * - timestamp index
  * - block hash / timestamp index
  */
@@ -228,6 +240,104 @@ public:
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                           int start = 0, int end = 0);
+    /****
+     * Read the running totals of an address, maintained by Write/EraseAddressIndex
+     * @param addressHash the address to look for
+     * @param type the address type
+     * @param balance the totals (zero if the address has no record)
+     * @returns true if a record was found
+     */
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &balance) const;
+    /****
+     * Compute the address balance records from the full address index (one-time upgrade)
+     * @returns true on success
+     */
+    bool BuildAddressBalanceIndex();
+    /****
+     * Read the totals over all addresses of a type
+     * @param type the address type
+     * @param stats the totals (zero if there is no record)
+     * @returns true if a record was found
+     */
+    bool ReadAddressTypeStats(int type, CAddressTypeStats &stats) const;
+    /****
+     * Compute the richlist and the per type totals from the balance records (one-time upgrade)
+     * @returns true on success
+     */
+    bool BuildAddressRichlistIndex();
+    /****
+     * Write the CC index records of a block
+     * @param vect the records to write
+     * @returns true on success
+     */
+    bool WriteCCIndex(const std::vector<std::pair<CCCIndexKey, CCCIndexValue> > &vect);
+    /****
+     * Erase the CC index records of a block
+     * @param vect the records to erase
+     * @returns true on success
+     */
+    bool EraseCCIndex(const std::vector<std::pair<CCCIndexKey, CCCIndexValue> > &vect);
+    /****
+     * Read CC index records, newest first
+     * @param evalcode the contract
+     * @param funcid the function, 0 for any
+     * @param reftxid the creation txid the records refer to, null for any
+     * @param address only records with outputs on this address (type 0 for any)
+     * @param keys the records found
+     * @param skip number of matching records to leave out
+     * @param limit maximum number of records to return, 0 for no limit
+     * @returns true on success
+     */
+    bool ReadCCIndex(uint8_t evalcode, uint8_t funcid, const uint256 &reftxid, const CAddressIndexIteratorKey &address,
+                     std::vector<CCCIndexKey> &keys, int skip = 0, int limit = 0);
+    /****
+     * Add the token outputs created and spent by a block
+     * @param vect the outputs, positive amounts are created, negative amounts are spent
+     * @param supplies the units created by the tokenbase txs of the block
+     * @returns true on success
+     */
+    bool WriteTokenIndex(const std::vector<std::pair<CTokenUnspentKey, CAmount> > &vect,
+                         const std::vector<std::pair<uint256, CAmount> > &supplies);
+    /****
+     * Undo WriteTokenIndex() for a disconnected block
+     * @param vect the records passed to WriteTokenIndex()
+     * @param supplies the supplies passed to WriteTokenIndex()
+     * @returns true on success
+     */
+    bool EraseTokenIndex(const std::vector<std::pair<CTokenUnspentKey, CAmount> > &vect,
+                         const std::vector<std::pair<uint256, CAmount> > &supplies);
+    /****
+     * Find out if an output was indexed as a token output
+     * @param outpoint the output
+     * @param value its token, owner and amount
+     * @returns true if it is a token output
+     */
+    bool ReadTokenOutput(const COutPoint &outpoint, CTokenOutputValue &value) const;
+    /****
+     * @param address the token and address
+     * @param balance the units held in unspent outputs (zero if there is no record)
+     * @returns true if a record was found
+     */
+    bool ReadTokenBalance(const CTokenAddressKey &address, CAmount &balance) const;
+    /****
+     * Read the unspent token outputs of an address
+     * @param address the token and address
+     * @param unspentOutputs the outputs and their amounts
+     * @returns true on success
+     */
+    bool ReadTokenUnspent(const CTokenAddressKey &address, std::vector<std::pair<CTokenUnspentKey, CAmount> > &unspentOutputs);
+    /****
+     * @param tokenid the token
+     * @param stats its totals (zero if there is no record)
+     * @returns true if a record was found
+     */
+    bool ReadTokenStats(const uint256 &tokenid, CTokenStats &stats) const;
+    /****
+     * Read the ids of all tokens created on chain
+     * @param tokenids the tokenbase txids
+     * @returns true on success
+     */
+    bool ReadTokenList(std::vector<uint256> &tokenids);
     /****
      * Write a timestamp entry to the db
      * @param timestampIndex the record to write
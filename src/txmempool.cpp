@@ -34,12 +34,18 @@
 #include "squishy_globals.h"
 #include "squishy_utils.h"
 #include "squishy_bitcoind.h"
+#include "squishy_kv.h"
+#include "cc/CCinclude.h"
+
+#include <limits>
 
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
     nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
-    hadNoDependencies(false), spendsCoinbase(false)
+    hadNoDependencies(false), spendsCoinbase(false), nFeeDelta(0),
+    nCountWithDescendants(0), nSizeWithDescendants(0), nModFeesWithDescendants(0),
+    nCountWithAncestors(0), nSizeWithAncestors(0), nModFeesWithAncestors(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
@@ -50,12 +56,16 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  bool _spendsCoinbase, uint32_t _nBranchId):
     tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
     hadNoDependencies(poolHasNoInputsOf),
-    spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId)
+    spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId), nFeeDelta(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
     nModSize = tx.CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
     feeRate = CFeeRate(nFee, nTxSize);
+
+    nCountWithDescendants = nCountWithAncestors = 1;
+    nSizeWithDescendants = nSizeWithAncestors = nTxSize;
+    nModFeesWithDescendants = nModFeesWithAncestors = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -72,6 +82,31 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount newFeeDelta)
+{
+    nModFeesWithDescendants += newFeeDelta - nFeeDelta;
+    nModFeesWithAncestors += newFeeDelta - nFeeDelta;
+    nFeeDelta = newFeeDelta;
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
     nTransactionsUpdated(0)
 {
@@ -121,7 +156,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     mapTx.insert(entry);
-    const CTransaction& tx = mapTx.find(hash)->GetTx();
+    txiter newit = mapTx.find(hash);
+    const CTransaction& tx = newit->GetTx();
     mapRecentlyAddedTx[tx.GetHash()] = &tx;
     nRecentlyAddedSequence += 1;
     if (!tx.IsCoinImport()) {
@@ -130,6 +166,11 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
             mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
         }
     }
+    // Prioritisation made before the transaction arrived counts towards its packages
+    std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+    if (pos != mapDeltas.end() && pos->second.second != 0)
+        mapTx.modify(newit, update_fee_delta(pos->second.second));
+    UpdateForAdd(newit);
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
         BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
             mapSproutNullifiers[nf] = &tx;
@@ -138,6 +179,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
         mapSaplingNullifiers[spendDescription.nullifier] = &tx;
     }
+    addCCIndex(tx);
+    squishy_kvmempool_add(tx);
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
@@ -146,6 +189,245 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     return true;
 }
 
+void CTxMemPool::GetMemPoolParents(const CTransaction &tx, setEntries &parents) const
+{
+    if (tx.IsCoinImport())
+        return;
+    BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+        txiter piter = mapTx.find(txin.prevout.hash);
+        if (piter != mapTx.end())
+            parents.insert(piter);
+    }
+}
+
+void CTxMemPool::GetMemPoolChildren(txiter it, setEntries &children) const
+{
+    const uint256 &hash = it->GetTx().GetHash();
+    std::map<COutPoint, CInPoint>::const_iterator iter = mapNextTx.lower_bound(COutPoint(hash, 0));
+    for (; iter != mapNextTx.end() && iter->first.hash == hash; ++iter) {
+        txiter childiter = mapTx.find(iter->second.ptx->GetHash());
+        if (childiter != mapTx.end())
+            children.insert(childiter);
+    }
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors,
+                                           uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                           uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                           std::string &errString) const
+{
+    LOCK(cs);
+    setEntries parentHashes;
+    GetMemPoolParents(entry.GetTx(), parentHashes);
+    if (parentHashes.size() + 1 > limitAncestorCount) {
+        errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
+        return false;
+    }
+
+    uint64_t totalSizeWithAncestors = entry.GetTxSize();
+    while (!parentHashes.empty()) {
+        txiter stageit = *parentHashes.begin();
+        setAncestors.insert(stageit);
+        parentHashes.erase(parentHashes.begin());
+        totalSizeWithAncestors += stageit->GetTxSize();
+
+        if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantSize);
+            return false;
+        } else if (stageit->GetCountWithDescendants() + 1 > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantCount);
+            return false;
+        } else if (totalSizeWithAncestors > limitAncestorSize) {
+            errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+            return false;
+        }
+
+        setEntries setParents;
+        GetMemPoolParents(stageit->GetTx(), setParents);
+        BOOST_FOREACH(const txiter &phash, setParents) {
+            if (setAncestors.count(phash) == 0)
+                parentHashes.insert(phash);
+        }
+        if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+            errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+            return false;
+        }
+    }
+    return true;
+}
+
+void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants) const
+{
+    LOCK(cs);
+    setEntries stage;
+    if (setDescendants.count(entryit) == 0)
+        stage.insert(entryit);
+    // Traverse down the children of entry, only adding children that are not
+    // accounted for in setDescendants already (because those children have either
+    // already been walked, or will be walked in this iteration).
+    while (!stage.empty()) {
+        txiter it = *stage.begin();
+        setDescendants.insert(it);
+        stage.erase(stage.begin());
+
+        setEntries setChildren;
+        GetMemPoolChildren(it, setChildren);
+        BOOST_FOREACH(const txiter &childiter, setChildren) {
+            if (setDescendants.count(childiter) == 0)
+                stage.insert(childiter);
+        }
+    }
+}
+
+void CTxMemPool::RecalculateAncestorState(txiter it)
+{
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    setEntries setAncestors;
+    CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+
+    int64_t nSize = it->GetTxSize();
+    CAmount nModFees = it->GetModifiedFee();
+    BOOST_FOREACH(const txiter &ancestorit, setAncestors) {
+        nSize += ancestorit->GetTxSize();
+        nModFees += ancestorit->GetModifiedFee();
+    }
+    int64_t nCount = setAncestors.size() + 1;
+    mapTx.modify(it, update_ancestor_state(nSize - (int64_t)it->GetSizeWithAncestors(),
+                                           nModFees - it->GetModFeesWithAncestors(),
+                                           nCount - (int64_t)it->GetCountWithAncestors()));
+}
+
+void CTxMemPool::RecalculateDescendantState(txiter it)
+{
+    setEntries setDescendants;
+    CalculateDescendants(it, setDescendants);
+
+    int64_t nSize = 0;
+    CAmount nModFees = 0;
+    BOOST_FOREACH(const txiter &descendantit, setDescendants) {
+        nSize += descendantit->GetTxSize();
+        nModFees += descendantit->GetModifiedFee();
+    }
+    int64_t nCount = setDescendants.size();
+    mapTx.modify(it, update_descendant_state(nSize - (int64_t)it->GetSizeWithDescendants(),
+                                             nModFees - it->GetModFeesWithDescendants(),
+                                             nCount - (int64_t)it->GetCountWithDescendants()));
+}
+
+void CTxMemPool::UpdateForAdd(txiter it)
+{
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    setEntries setAncestors;
+    CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+    setEntries setDescendants;
+    CalculateDescendants(it, setDescendants);
+
+    if (setDescendants.size() > 1) {
+        // Re-added while transactions spending it stayed in the pool, as when
+        // a block is disconnected: the packages it joins overlap, recount them
+        BOOST_FOREACH(const txiter &descendantit, setDescendants)
+            RecalculateAncestorState(descendantit);
+        RecalculateDescendantState(it);
+        BOOST_FOREACH(const txiter &ancestorit, setAncestors)
+            RecalculateDescendantState(ancestorit);
+        return;
+    }
+
+    int64_t nSize = it->GetTxSize();
+    CAmount nModFees = it->GetModifiedFee();
+    int64_t nAncestorSize = 0;
+    CAmount nAncestorModFees = 0;
+    BOOST_FOREACH(const txiter &ancestorit, setAncestors) {
+        mapTx.modify(ancestorit, update_descendant_state(nSize, nModFees, 1));
+        nAncestorSize += ancestorit->GetTxSize();
+        nAncestorModFees += ancestorit->GetModifiedFee();
+    }
+    mapTx.modify(it, update_ancestor_state(nAncestorSize, nAncestorModFees, setAncestors.size()));
+}
+
+void CTxMemPool::UpdateForRemove(const setEntries &setRemove)
+{
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    BOOST_FOREACH(const txiter &removeit, setRemove) {
+        int64_t nSize = removeit->GetTxSize();
+        CAmount nModFees = removeit->GetModifiedFee();
+
+        setEntries setAncestors;
+        CalculateMemPoolAncestors(*removeit, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+        BOOST_FOREACH(const txiter &ancestorit, setAncestors) {
+            if (setRemove.count(ancestorit) == 0)
+                mapTx.modify(ancestorit, update_descendant_state(-nSize, -nModFees, -1));
+        }
+        // only left behind when removing non-recursively, as for the transactions of a block
+        setEntries setDescendants;
+        CalculateDescendants(removeit, setDescendants);
+        BOOST_FOREACH(const txiter &descendantit, setDescendants) {
+            if (setRemove.count(descendantit) == 0)
+                mapTx.modify(descendantit, update_ancestor_state(-nSize, -nModFees, -1));
+        }
+    }
+}
+
+void CTxMemPool::addCCIndex(const CTransaction &tx)
+{
+    std::vector<std::pair<uint8_t, uint8_t> > funcs;
+    std::vector<std::string> addresses;
+    GetCCOpretFuncs(tx, funcs);
+    for (const CTxOut &txout : tx.vout)
+    {
+        char destaddr[64];
+        if ( txout.scriptPubKey.IsPayToCryptoCondition() && Getscriptaddress(destaddr, txout.scriptPubKey) )
+            addresses.push_back(destaddr);
+    }
+    if ( funcs.empty() && addresses.empty() )
+        return;
+    const uint256 &txhash = tx.GetHash();
+    for (const auto &func : funcs)
+        mapCCFuncs[func].insert(txhash);
+    for (const std::string &addr : addresses)
+        mapCCAddresses[addr].insert(txhash);
+    mapCCInserted[txhash] = std::make_pair(funcs, addresses);
+}
+
+void CTxMemPool::removeCCIndex(const uint256 &txhash)
+{
+    ccIndexInserted::iterator it = mapCCInserted.find(txhash);
+    if ( it == mapCCInserted.end() )
+        return;
+    for (const auto &func : it->second.first)
+    {
+        ccFuncMap::iterator mit = mapCCFuncs.find(func);
+        if ( mit != mapCCFuncs.end() && mit->second.erase(txhash) != 0 && mit->second.empty() )
+            mapCCFuncs.erase(mit);
+    }
+    for (const std::string &addr : it->second.second)
+    {
+        ccAddressMap::iterator mit = mapCCAddresses.find(addr);
+        if ( mit != mapCCAddresses.end() && mit->second.erase(txhash) != 0 && mit->second.empty() )
+            mapCCAddresses.erase(mit);
+    }
+    mapCCInserted.erase(it);
+}
+
+void CTxMemPool::getCCFuncTxids(uint8_t evalcode, uint8_t funcid, std::vector<uint256> &txids) const
+{
+    LOCK(cs);
+    ccFuncMap::const_iterator it = mapCCFuncs.find(std::make_pair(evalcode, funcid));
+    if ( it != mapCCFuncs.end() )
+        txids.insert(txids.end(), it->second.begin(), it->second.end());
+}
+
+void CTxMemPool::getCCAddressTxids(const std::string &coinaddr, std::vector<uint256> &txids) const
+{
+    LOCK(cs);
+    ccAddressMap::const_iterator it = mapCCAddresses.find(coinaddr);
+    if ( it != mapCCAddresses.end() )
+        txids.insert(txids.end(), it->second.begin(), it->second.end());
+}
+
 void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
 {
     LOCK(cs);
@@ -354,14 +636,18 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 txToRemove.push_back(it->second.ptx->GetHash());
             }
         }
+        std::vector<txiter> vRemove;
+        setEntries setRemove;
         while (!txToRemove.empty())
         {
             uint256 hash = txToRemove.front();
             txToRemove.pop_front();
-            if (!mapTx.count(hash))
+            txiter removeit = mapTx.find(hash);
+            if (removeit == mapTx.end() || !setRemove.insert(removeit).second)
                 continue;
-            const CTransaction& tx = mapTx.find(hash)->GetTx();
+            vRemove.push_back(removeit);
             if (fRecursive) {
+                const CTransaction& tx = removeit->GetTx();
                 for (unsigned int i = 0; i < tx.vout.size(); i++) {
                     std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
                     if (it == mapNextTx.end())
@@ -369,6 +655,13 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                     txToRemove.push_back(it->second.ptx->GetHash());
                 }
             }
+        }
+        // the packages of what stays must not count what goes
+        UpdateForRemove(setRemove);
+        BOOST_FOREACH(const txiter &removeit, vRemove)
+        {
+            const uint256 hash = removeit->GetTx().GetHash();
+            const CTransaction& tx = removeit->GetTx();
             mapRecentlyAddedTx.erase(hash);
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
@@ -381,17 +674,34 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 mapSaplingNullifiers.erase(spendDescription.nullifier);
             }
             removed.push_back(tx);
-            totalTxSize -= mapTx.find(hash)->GetTxSize();
-            cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
-            mapTx.erase(hash);
+            totalTxSize -= removeit->GetTxSize();
+            cachedInnerUsage -= removeit->DynamicMemoryUsage();
+            mapTx.erase(removeit);
             nTransactionsUpdated++;
             minerPolicyEstimator->removeTx(hash);
             removeAddressIndex(hash);
             removeSpentIndex(hash);
+            removeCCIndex(hash);
+            squishy_kvmempool_remove(hash);
         }
     }
 }
 
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+    unsigned int nTxnRemoved = 0;
+    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
+        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+        const CTransaction tx = it->GetTx();
+        std::list<CTransaction> removed;
+        remove(tx, removed, true);
+        nTxnRemoved += removed.size();
+    }
+    if (nTxnRemoved > 0)
+        LogPrint("mempool", "Removed %u txn to trim the mempool to %u bytes\n", nTxnRemoved, sizelimit);
+}
+
 void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags)
 {
     // Remove transactions spending a coinbase which are now immature and no-longer-final transactions
@@ -586,6 +896,10 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapCCFuncs.clear();
+    mapCCAddresses.clear();
+    mapCCInserted.clear();
+    squishy_kvmempool_clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
@@ -634,6 +948,31 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             i++;
         }
 
+        // Check the package aggregates against a recount.
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        setEntries setAncestors, setDescendants;
+        CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+        CalculateDescendants(it, setDescendants);
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = it->GetModifiedFee();
+        BOOST_FOREACH(const txiter &ancestorit, setAncestors) {
+            nSizeCheck += ancestorit->GetTxSize();
+            nFeesCheck += ancestorit->GetModifiedFee();
+        }
+        assert(it->GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetModFeesWithAncestors() == nFeesCheck);
+        nSizeCheck = 0;
+        nFeesCheck = 0;
+        BOOST_FOREACH(const txiter &descendantit, setDescendants) {
+            nSizeCheck += descendantit->GetTxSize();
+            nFeesCheck += descendantit->GetModifiedFee();
+        }
+        assert(it->GetCountWithDescendants() == setDescendants.size());
+        assert(it->GetSizeWithDescendants() == nSizeCheck);
+        assert(it->GetModFeesWithDescendants() == nFeesCheck);
+
         boost::unordered_map<uint256, SproutMerkleTree, CCoinsKeyHasher> intermediates;
 
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
@@ -800,6 +1139,22 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end() && nFeeDelta != 0) {
+            mapTx.modify(it, update_fee_delta(deltas.second));
+            // the packages the transaction is part of are worth more (or less) too
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            setEntries setAncestors;
+            CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+            BOOST_FOREACH(const txiter &ancestorit, setAncestors)
+                mapTx.modify(ancestorit, update_descendant_state(0, nFeeDelta, 0));
+            setEntries setDescendants;
+            CalculateDescendants(it, setDescendants);
+            setDescendants.erase(it);
+            BOOST_FOREACH(const txiter &descendantit, setDescendants)
+                mapTx.modify(descendantit, update_ancestor_state(0, nFeeDelta, 0));
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -909,6 +1264,6 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 6 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 6 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+    // Estimate the overhead of mapTx to be 3 pointers for each of its 4 ordered indexes + an allocation, as no exact formula for boost::multi_index_contained is implemented.
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
 }
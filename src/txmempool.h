@@ -22,6 +22,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "addressindex.h"
 #include "spentindex.h"
@@ -53,6 +54,12 @@ static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
 /**
  * CTxMemPool stores these:
+ *
+ * Each entry also keeps the count, size and modified fee (fee plus any
+ * PrioritiseTransaction delta) of its in-mempool ancestors and descendants,
+ * itself included, so miner and eviction can value a transaction together
+ * with the package it belongs to. CTxMemPool updates them as transactions
+ * come and go.
  */
 class CTxMemPoolEntry
 {
@@ -69,6 +76,15 @@ private:
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
     bool spendsCoinbase; //! keep track of transactions that spend a coinbase
     uint32_t nBranchId; //! Branch ID this transaction is known to commit to, cached for efficiency
+    CAmount nFeeDelta; //! Fee delta from PrioritiseTransaction
+
+    uint64_t nCountWithDescendants; //! number of descendant transactions, including this one
+    uint64_t nSizeWithDescendants; //! ... and their total size
+    CAmount nModFeesWithDescendants; //! ... and their total modified fees
+
+    uint64_t nCountWithAncestors; //! number of ancestor transactions, including this one
+    uint64_t nSizeWithAncestors; //! ... and their total size
+    CAmount nModFeesWithAncestors; //! ... and their total modified fees
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -89,6 +105,62 @@ public:
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
     uint32_t GetValidatedBranchId() const { return nBranchId; }
+
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+
+    /** Set the PrioritiseTransaction fee delta, the package fees follow it */
+    void UpdateFeeDelta(CAmount newFeeDelta);
+    /** Adjust the descendant package when a descendant comes or goes */
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    /** Adjust the ancestor package when an ancestor comes or goes */
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+};
+
+// Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_ancestor_state
+{
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_fee_delta
+{
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
 };
 
 // extracts a TxMemPoolEntry's transaction hash
@@ -104,7 +176,7 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByFee
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         if (a.GetFeeRate() == b.GetFeeRate())
             return a.GetTime() < b.GetTime();
@@ -112,6 +184,82 @@ public:
     }
 };
 
+/** Sort an entry by max(own feerate, feerate of it and its descendants), lowest first */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+
+        if (f1 == f2)
+            return a.GetTime() > b.GetTime();
+        return f1 < f2;
+    }
+
+    // Whether the descendant package pays a better feerate than the entry alone
+    bool UseDescendantScore(const CTxMemPoolEntry &a) const
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/**
+ * Sort an entry by min(own feerate, feerate of it and its ancestors), highest first.
+ * Works on anything with the CTxMemPoolEntry package getters, so the miner can
+ * rank packages whose ancestors are already in the block the same way.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    template <typename T>
+    bool operator()(const T& a, const T& b) const
+    {
+        double aFees, aSize, bFees, bSize;
+        GetModFeeAndSize(a, aFees, aSize);
+        GetModFeeAndSize(b, bFees, bSize);
+
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
+
+    // The lower of the entry and ancestor package feerates, as fee and size
+    template <typename T>
+    void GetModFeeAndSize(const T &a, double &mod_fee, double &size) const
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithAncestors();
+        double f2 = (double)a.GetModFeesWithAncestors() * a.GetTxSize();
+
+        if (f1 > f2) {
+            mod_fee = a.GetModFeesWithAncestors();
+            size = a.GetSizeWithAncestors();
+        } else {
+            mod_fee = a.GetModifiedFee();
+            size = a.GetTxSize();
+        }
+    }
+};
+
+// multi_index tags
+struct descendant_score {};
+struct ancestor_score {};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -167,6 +315,18 @@ public:
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByFee
+            >,
+            // sorted by descendant score, worst first, for eviction
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore
+            >,
+            // sorted by ancestor score, best first, for package selection in CreateNewBlock
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee
             >
         >
     > indexed_transaction_set;
@@ -174,6 +334,14 @@ public:
     mutable CCriticalSection cs;
     indexed_transaction_set mapTx;
 
+    typedef indexed_transaction_set::iterator txiter;
+    struct CompareIteratorByHash {
+        bool operator()(const txiter &a, const txiter &b) const {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
 private:
     typedef std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> addressDeltaMap;
     addressDeltaMap mapAddress;
@@ -187,6 +355,32 @@ private:
     typedef std::map<uint256, std::vector<CSpentIndexKey> > mapSpentIndexInserted;
     mapSpentIndexInserted mapSpentInserted;
 
+    //! (evalcode, funcid) of the contract data a transaction carries -> transactions
+    typedef std::map<std::pair<uint8_t, uint8_t>, std::set<uint256> > ccFuncMap;
+    ccFuncMap mapCCFuncs;
+    //! CC address -> transactions with an output paying to it
+    typedef std::map<std::string, std::set<uint256> > ccAddressMap;
+    ccAddressMap mapCCAddresses;
+    //! keys inserted for a transaction, to remove them again
+    typedef std::map<uint256, std::pair<std::vector<std::pair<uint8_t, uint8_t> >, std::vector<std::string> > > ccIndexInserted;
+    ccIndexInserted mapCCInserted;
+
+    void addCCIndex(const CTransaction &tx);
+    void removeCCIndex(const uint256 &txhash);
+
+    /** In-mempool transactions tx spends outputs of */
+    void GetMemPoolParents(const CTransaction &tx, setEntries &parents) const;
+    /** In-mempool transactions spending outputs of an entry */
+    void GetMemPoolChildren(txiter it, setEntries &children) const;
+    /** Add a new entry to the packages of its ancestors and descendants */
+    void UpdateForAdd(txiter it);
+    /** Take a set of entries about to be erased out of the packages of the entries that stay */
+    void UpdateForRemove(const setEntries &setRemove);
+    /** Recount the ancestor package of an entry from scratch */
+    void RecalculateAncestorState(txiter it);
+    /** Recount the descendant package of an entry from scratch */
+    void RecalculateDescendantState(txiter it);
+
 public:
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
@@ -212,7 +406,20 @@ public:
     void addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
     bool getSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool removeSpentIndex(const uint256 txhash);
+
+    /**
+     * Transactions whose last output is an opreturn calling a contract function
+     * (including the contract data wrapped in token transfers), ordered by txid
+     */
+    void getCCFuncTxids(uint8_t evalcode, uint8_t funcid, std::vector<uint256> &txids) const;
+    /** Transactions with a CC output paying to coinaddr, ordered by txid */
+    void getCCAddressTxids(const std::string &coinaddr, std::vector<uint256> &txids) const;
     void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
+    /**
+     * Evict the transactions with the lowest descendant score, together with
+     * their descendants, until the pool uses at most sizelimit bytes
+     */
+    void TrimToSize(size_t sizelimit);
     void removeWithAnchor(const uint256 &invalidRoot, ShieldedType type);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
@@ -231,6 +438,25 @@ public:
      */
     bool HasNoInputsOf(const CTransaction& tx) const;
 
+    /**
+     * Collect the in-mempool ancestors of an entry, which does not need to
+     * be in the pool yet, and check them against the chain limits
+     * @param entry the transaction
+     * @param[out] setAncestors its in-mempool ancestors, not including itself
+     * @param limitAncestorCount the maximum number of ancestors, itself included
+     * @param limitAncestorSize the maximum size of itself and its ancestors
+     * @param limitDescendantCount the maximum number of descendants any ancestor may get
+     * @param limitDescendantSize the maximum descendant package size any ancestor may get
+     * @param[out] errString the limit that was exceeded
+     * @returns false if a limit was exceeded
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors,
+                                   uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                   uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                   std::string &errString) const;
+    /** Collect an entry and all its in-mempool descendants */
+    void CalculateDescendants(txiter it, setEntries &setDescendants) const;
+
     /** Affect CreateNewBlock prioritisation of transactions */
     void PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta);
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta);
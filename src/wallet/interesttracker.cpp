@@ -0,0 +1,46 @@
+/******************************************************************************
+ * Copyright © 2021 Squishy Core Developers                                   *
+ *                                                                            *
+ * See the AUTHORS, DEVELOPER-AGREEMENT and LICENSE files at                  *
+ * the top-level directory of this distribution for the individual copyright  *
+ * holder information and the developer policies on copyright and licensing.  *
+ *                                                                            *
+ * Unless otherwise agreed in a custom licensing agreement, no part of the    *
+ * SuperNET software, including this file may be copied, modified, propagated *
+ * or distributed except according to the terms contained in the LICENSE file *
+ *                                                                            *
+ * Removal or modification of this copyright notice is prohibited.            *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "wallet/interesttracker.h"
+#include "squishy_interest.h"
+
+void CInterestTracker::SetLocked(const COutPoint &outpoint, bool fLocked)
+{
+    LOCK(cs);
+    if ( fLocked )
+        setLocked.insert(outpoint);
+    else
+        setLocked.erase(outpoint);
+}
+
+void CInterestTracker::UnlockAll()
+{
+    LOCK(cs);
+    setLocked.clear();
+}
+
+uint64_t CInterestTracker::GetInterestSum(int32_t tipheight, uint32_t tiptime) const
+{
+    LOCK(cs);
+    uint64_t sum = 0;
+    for (const auto &entry : mapOutputs)
+    {
+        const CInterestOutput &output = entry.second;
+        if ( tipheight < output.matureheight || setLocked.count(entry.first) != 0 )
+            continue;
+        sum += squishy_interest(output.txheight, output.nValue, output.locktime, tiptime);
+    }
+    return sum;
+}
@@ -0,0 +1,66 @@
+/******************************************************************************
+ * Copyright © 2021 Squishy Core Developers                                   *
+ *                                                                            *
+ * See the AUTHORS, DEVELOPER-AGREEMENT and LICENSE files at                  *
+ * the top-level directory of this distribution for the individual copyright  *
+ * holder information and the developer policies on copyright and licensing.  *
+ *                                                                            *
+ * Unless otherwise agreed in a custom licensing agreement, no part of the    *
+ * SuperNET software, including this file may be copied, modified, propagated *
+ * or distributed except according to the terms contained in the LICENSE file *
+ *                                                                            *
+ * Removal or modification of this copyright notice is prohibited.            *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef SQUISHY_WALLET_INTERESTTRACKER_H
+#define SQUISHY_WALLET_INTERESTTRACKER_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "wallet/walletoutputcache.h"
+
+#include <set>
+
+/****
+ * The parameters squishy_interest needs for a confirmed wallet output,
+ * taken from the wallet when the output is added so no transaction
+ * lookup is needed to compute its interest.
+ */
+struct CInterestOutput
+{
+    CAmount nValue;
+    int32_t txheight;       // height of the block that confirmed the output
+    uint32_t locktime;      // nLockTime of the transaction
+    int32_t matureheight;   // first tip height the output can be spent at, for coinbase outputs
+
+    CInterestOutput() : nValue(0), txheight(0), locktime(0), matureheight(0) {}
+};
+
+/****
+ * The KMD outputs of a wallet that accrue interest, so the interest of the
+ * wallet is a sum over cached parameters instead of an AvailableCoins run
+ * with a transaction lookup per output.
+ */
+class CInterestTracker : public CWalletOutputCache<CInterestOutput>
+{
+public:
+    /***
+     * Keep a locked coin out of the sum, as AvailableCoins does
+     * @param outpoint the coin
+     * @param fLocked true if it was locked, false if it was unlocked
+     */
+    void SetLocked(const COutPoint &outpoint, bool fLocked);
+    void UnlockAll();
+    /***
+     * @param tipheight the height of the tip
+     * @param tiptime the time of the tip
+     * @returns the interest accrued by the spendable outputs at the tip
+     */
+    uint64_t GetInterestSum(int32_t tipheight, uint32_t tiptime) const;
+
+private:
+    std::set<COutPoint> setLocked;
+};
+
+#endif // SQUISHY_WALLET_INTERESTTRACKER_H
@@ -0,0 +1,110 @@
+/******************************************************************************
+ * Copyright © 2021 Squishy Core Developers                                   *
+ *                                                                            *
+ * See the AUTHORS, DEVELOPER-AGREEMENT and LICENSE files at                  *
+ * the top-level directory of this distribution for the individual copyright  *
+ * holder information and the developer policies on copyright and licensing.  *
+ *                                                                            *
+ * Unless otherwise agreed in a custom licensing agreement, no part of the    *
+ * SuperNET software, including this file may be copied, modified, propagated *
+ * or distributed except according to the terms contained in the LICENSE file *
+ *                                                                            *
+ * Removal or modification of this copyright notice is prohibited.            *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "wallet/notedecryption.h"
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <set>
+
+CSaplingTrialKeys::CSaplingTrialKeys(const SaplingFullViewingKeyMap &fullViewingKeys, const SaplingIncomingViewingKeyMap &incomingViewingKeys)
+{
+    for (const auto &entry : fullViewingKeys)
+        vIvk.push_back(entry.first);
+    nFullViewingKeys = vIvk.size();
+
+    std::set<libzcash::SaplingIncomingViewingKey> seen;
+    for (const auto &entry : incomingViewingKeys)
+    {
+        if ( fullViewingKeys.count(entry.second) == 0 && seen.insert(entry.second).second )
+            vIvk.push_back(entry.second);
+    }
+}
+
+std::vector<int> TrialDecrypt(size_t nOutputs, size_t nKeys, int nThreads, const std::function<bool(size_t, size_t)> &tryKey)
+{
+    std::vector<int> vMatch(nOutputs, -1);
+    if ( nOutputs == 0 || nKeys == 0 )
+        return vMatch;
+
+    if ( nThreads <= 1 || nOutputs * nKeys < MIN_PARALLEL_TRIAL_DECRYPTIONS )
+    {
+        for (size_t o = 0; o < nOutputs; o++)
+        {
+            for (size_t k = 0; k < nKeys; k++)
+            {
+                if ( tryKey(o, k) )
+                {
+                    vMatch[o] = k;
+                    break;
+                }
+            }
+        }
+        return vMatch;
+    }
+
+    // work items are the key chunks of each output, in output order so the
+    // first keys of an output are tried before the chunks that follow them
+    const size_t nChunks = (nKeys + TRIAL_DECRYPTION_CHUNK - 1) / TRIAL_DECRYPTION_CHUNK;
+    const size_t nItems = nOutputs * nChunks;
+    std::unique_ptr<std::atomic<int>[]> vFound(new std::atomic<int>[nOutputs]);
+    for (size_t o = 0; o < nOutputs; o++)
+        vFound[o] = std::numeric_limits<int>::max();
+    std::atomic<size_t> nextItem(0);
+
+    auto worker = [&]()
+    {
+        size_t item;
+        while ( (item = nextItem++) < nItems )
+        {
+            size_t o = item / nChunks;
+            size_t kBegin = (item % nChunks) * TRIAL_DECRYPTION_CHUNK;
+            size_t kEnd = std::min(kBegin + TRIAL_DECRYPTION_CHUNK, nKeys);
+            // an earlier key already opened this output, nothing left to find in the chunk
+            for (size_t k = kBegin; k < kEnd && (int)k < vFound[o].load(); k++)
+            {
+                if ( tryKey(o, k) )
+                {
+                    int prev = vFound[o].load();
+                    while ( (int)k < prev && !vFound[o].compare_exchange_weak(prev, (int)k) )
+                        ;
+                    break;
+                }
+            }
+        }
+    };
+
+    boost::thread_group threads;
+    for (size_t i = 1; i < std::min((size_t)nThreads, nItems); i++)
+        threads.create_thread(worker);
+    worker();
+    {
+        // the workers use this stack frame, they have to finish before it unwinds
+        boost::this_thread::disable_interruption di;
+        threads.join_all();
+    }
+
+    for (size_t o = 0; o < nOutputs; o++)
+    {
+        int k = vFound[o].load();
+        if ( k != std::numeric_limits<int>::max() )
+            vMatch[o] = k;
+    }
+    return vMatch;
+}
@@ -0,0 +1,57 @@
+/******************************************************************************
+ * Copyright © 2021 Squishy Core Developers                                   *
+ *                                                                            *
+ * See the AUTHORS, DEVELOPER-AGREEMENT and LICENSE files at                  *
+ * the top-level directory of this distribution for the individual copyright  *
+ * holder information and the developer policies on copyright and licensing.  *
+ *                                                                            *
+ * Unless otherwise agreed in a custom licensing agreement, no part of the    *
+ * SuperNET software, including this file may be copied, modified, propagated *
+ * or distributed except according to the terms contained in the LICENSE file *
+ *                                                                            *
+ * Removal or modification of this copyright notice is prohibited.            *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef SQUISHY_WALLET_NOTEDECRYPTION_H
+#define SQUISHY_WALLET_NOTEDECRYPTION_H
+
+#include "keystore.h"
+#include "zcash/Address.hpp"
+
+#include <functional>
+#include <vector>
+
+/** Transactions with fewer (output, key) trial decryptions than this are decrypted on the calling thread only */
+static const size_t MIN_PARALLEL_TRIAL_DECRYPTIONS = 64;
+/** Number of keys a trial decryption thread tries on one output before taking the next work item */
+static const size_t TRIAL_DECRYPTION_CHUNK = 16;
+
+/****
+ * The distinct Sapling incoming viewing keys of a wallet in the order they are
+ * tried: the keys with a full viewing key first, then the ones only known from
+ * imported addresses. The address map has an entry per diversified address,
+ * so the same key would otherwise be tried on an output once per address.
+ */
+struct CSaplingTrialKeys
+{
+    std::vector<libzcash::SaplingIncomingViewingKey> vIvk;
+    size_t nFullViewingKeys;    // the first nFullViewingKeys of vIvk have a full viewing key
+
+    CSaplingTrialKeys() : nFullViewingKeys(0) {}
+    CSaplingTrialKeys(const SaplingFullViewingKeyMap &fullViewingKeys, const SaplingIncomingViewingKeyMap &incomingViewingKeys);
+};
+
+/****
+ * Trial decrypt the outputs of a transaction or block with every key, spreading
+ * the (output, key range) work items over up to nThreads threads. An output is
+ * not tried with further keys once one opens it.
+ * @param nOutputs the number of outputs
+ * @param nKeys the number of keys
+ * @param nThreads the maximum number of threads, the calling thread included
+ * @param tryKey returns true if key k opens output o, called concurrently and must not throw
+ * @returns for each output the smallest index of a key that opens it, -1 if none does
+ */
+std::vector<int> TrialDecrypt(size_t nOutputs, size_t nKeys, int nThreads, const std::function<bool(size_t, size_t)> &tryKey);
+
+#endif  /* SQUISHY_WALLET_NOTEDECRYPTION_H */
@@ -183,10 +183,6 @@ UniValue importprivkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("importprivkey", "\"mykey\", \"testing\", true, 1000")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
-
     string strSecret = params[0].get_str();
     string strLabel = "";
     int32_t height = 0;
@@ -211,15 +207,20 @@ UniValue importprivkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
         key = DecodeSecret(strSecret);
     }
 
-    if ( height < 0 || height > chainActive.Height() )
-        throw JSONRPCError(RPC_WALLET_ERROR, "Rescan height is out of range.");
-    
     if (!key.IsValid()) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
 
     CPubKey pubkey = key.GetPubKey();
     assert(key.VerifyPubKey(pubkey));
     CKeyID vchAddress = pubkey.GetID();
+    CBlockIndex *pindexRescan = NULL;
     {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
+        if ( height < 0 || height > chainActive.Height() )
+            throw JSONRPCError(RPC_WALLET_ERROR, "Rescan height is out of range.");
+
         pwalletMain->MarkDirty();
         pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
 
@@ -236,10 +237,12 @@ UniValue importprivkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive[height], true);
-        }
+        if (fRescan)
+            pindexRescan = chainActive[height];
     }
+    // the rescan takes the locks for each batch of blocks, do not hold them meanwhile
+    if (pindexRescan != NULL)
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
 
     return EncodeDestination(vchAddress);
 }
@@ -267,8 +270,6 @@ UniValue importaddress(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("importaddress", "\"myaddress\", \"testing\", false")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     CScript script;
 
     CTxDestination dest = DecodeDestination(params[0].get_str());
@@ -290,7 +291,10 @@ UniValue importaddress(const UniValue& params, bool fHelp, const CPubKey& mypk)
     if (params.size() > 2)
         fRescan = params[2].get_bool();
 
+    CBlockIndex *pindexRescan = NULL;
     {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
         if (::IsMine(*pwalletMain, script) == ISMINE_SPENDABLE)
             throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this address or script");
 
@@ -308,10 +312,13 @@ UniValue importaddress(const UniValue& params, bool fHelp, const CPubKey& mypk)
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
 
         if (fRescan)
-        {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-            pwalletMain->ReacceptWalletTransactions();
-        }
+            pindexRescan = chainActive.Genesis();
+    }
+    // the rescan takes the locks for each batch of blocks, do not hold them meanwhile
+    if (pindexRescan != NULL)
+    {
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+        pwalletMain->ReacceptWalletTransactions();
     }
 
     return NullUniValue;
@@ -363,7 +370,8 @@ UniValue importwallet(const UniValue& params, bool fHelp, const CPubKey& mypk)
 	return importwallet_impl(params, fHelp, false);
 }
 
-UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys)
+/** Import the keys of a wallet dump under cs_main and cs_wallet, returns the block to rescan from */
+static CBlockIndex* ImportWalletKeys(const UniValue& params, bool fImportZKeys, bool& fGood)
 {
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
@@ -376,8 +384,6 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
 
     int64_t nTimeBegin = chainActive.Tip()->GetBlockTime();
 
-    bool fGood = true;
-
     int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
     file.seekg(0, file.beg);
 
@@ -463,6 +469,14 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
         pwalletMain->nTimeFirstKey = nTimeBegin;
 
     LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
+    return pindex;
+}
+
+UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys)
+{
+    bool fGood = true;
+    CBlockIndex *pindex = ImportWalletKeys(params, fImportZKeys, fGood);
+    // the rescan takes the locks for each batch of blocks, do not hold them meanwhile
     pwalletMain->ScanForWalletTransactions(pindex);
     pwalletMain->MarkDirty();
 
@@ -672,33 +686,9 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 }
 
 
-UniValue z_importkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
+/** Add the spending key of z_importkey under cs_main and cs_wallet, returns the block to rescan from or NULL */
+static CBlockIndex* ImportSpendingKey(const UniValue& params)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
-        return NullUniValue;
-
-    if (fHelp || params.size() < 1 || params.size() > 3)
-        throw runtime_error(
-            "z_importkey \"zkey\" ( rescan startHeight )\n"
-            "\nAdds a zkey (as returned by z_exportkey) to your wallet.\n"
-            "\nArguments:\n"
-            "1. \"zkey\"             (string, required) The zkey (see z_exportkey)\n"
-            "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
-            "3. startHeight        (numeric, optional, default=0) Block height to start rescan from\n"
-            "\nNote: This call can take minutes to complete if rescan is true.\n"
-            "\nExamples:\n"
-            "\nExport a zkey\n"
-            + HelpExampleCli("z_exportkey", "\"myaddress\"") +
-            "\nImport the zkey with rescan\n"
-            + HelpExampleCli("z_importkey", "\"mykey\"") +
-            "\nImport the zkey with partial rescan\n"
-            + HelpExampleCli("z_importkey", "\"mykey\" whenkeyisnew 30000") +
-            "\nRe-import the zkey with longer partial rescan\n"
-            + HelpExampleCli("z_importkey", "\"mykey\" yes 20000") +
-            "\nAs a JSON-RPC call\n"
-            + HelpExampleRpc("z_importkey", "\"mykey\", \"no\"")
-        );
-
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -745,7 +735,7 @@ UniValue z_importkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
     // Sapling support
     auto addResult = boost::apply_visitor(AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus()), spendingkey);
     if (addResult == KeyAlreadyExists && fIgnoreExistingKey) {
-        return NullUniValue;
+        return NULL;
     }
     pwalletMain->MarkDirty();
     if (addResult == KeyNotAdded) {
@@ -757,42 +747,49 @@ UniValue z_importkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
     
     // We want to scan for transactions and notes
     if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        return chainActive[nRescanHeight];
     }
-
-    return NullUniValue;
+    return NULL;
 }
 
-UniValue z_importviewingkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
+UniValue z_importkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() < 1 || params.size() > 4)
+    if (fHelp || params.size() < 1 || params.size() > 3)
         throw runtime_error(
-            "z_importviewingkey \"vkey\" ( rescan startHeight )\n"
-            "\nAdds a viewing key (as returned by z_exportviewingkey) to your wallet.\n"
+            "z_importkey \"zkey\" ( rescan startHeight )\n"
+            "\nAdds a zkey (as returned by z_exportkey) to your wallet.\n"
             "\nArguments:\n"
-            "1. \"vkey\"             (string, required) The viewing key (see z_exportviewingkey)\n"
+            "1. \"zkey\"             (string, required) The zkey (see z_exportkey)\n"
             "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
             "3. startHeight        (numeric, optional, default=0) Block height to start rescan from\n"
-            "4. zaddr               (string, optional, default=\"\") zaddr in case of importing viewing key for Sapling\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "\nExamples:\n"
-            "\nImport a viewing key\n"
-            + HelpExampleCli("z_importviewingkey", "\"vkey\"") +
-            "\nImport the viewing key without rescan\n"
-            + HelpExampleCli("z_importviewingkey", "\"vkey\", no") +
-            "\nImport the viewing key with partial rescan\n"
-            + HelpExampleCli("z_importviewingkey", "\"vkey\" whenkeyisnew 30000") +
-            "\nRe-import the viewing key with longer partial rescan\n"
-            + HelpExampleCli("z_importviewingkey", "\"vkey\" yes 20000") +
-            "\nImport the viewing key for Sapling address\n"
-            + HelpExampleCli("z_importviewingkey", "\"vkey\" no 0 \"zaddr\"") +
+            "\nExport a zkey\n"
+            + HelpExampleCli("z_exportkey", "\"myaddress\"") +
+            "\nImport the zkey with rescan\n"
+            + HelpExampleCli("z_importkey", "\"mykey\"") +
+            "\nImport the zkey with partial rescan\n"
+            + HelpExampleCli("z_importkey", "\"mykey\" whenkeyisnew 30000") +
+            "\nRe-import the zkey with longer partial rescan\n"
+            + HelpExampleCli("z_importkey", "\"mykey\" yes 20000") +
             "\nAs a JSON-RPC call\n"
-            + HelpExampleRpc("z_importviewingkey", "\"vkey\", \"no\"")
+            + HelpExampleRpc("z_importkey", "\"mykey\", \"no\"")
         );
 
+    CBlockIndex *pindexRescan = ImportSpendingKey(params);
+    // the rescan takes the locks for each batch of blocks, do not hold them meanwhile
+    if (pindexRescan != NULL)
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+
+    return NullUniValue;
+}
+
+/** Add the viewing key of z_importviewingkey under cs_main and cs_wallet, returns the block to rescan from or NULL */
+static CBlockIndex* ImportViewingKey(const UniValue& params)
+{
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -844,7 +841,7 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp, const CPubKey& m
 
         if (pwalletMain->HaveSaplingIncomingViewingKey(addr)) {
             if (fIgnoreExistingKey) {
-                return NullUniValue;
+                return NULL;
             }
         } else {
             pwalletMain->MarkDirty();
@@ -863,7 +860,7 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp, const CPubKey& m
         // Don't throw error in case a viewing key is already there
         if (pwalletMain->HaveSproutViewingKey(addr)) {
             if (fIgnoreExistingKey) {
-                return NullUniValue;
+                return NULL;
             }
         } else {
             pwalletMain->MarkDirty();
@@ -876,8 +873,45 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp, const CPubKey& m
 
     // We want to scan for transactions and notes
     if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        return chainActive[nRescanHeight];
     }
+    return NULL;
+}
+
+UniValue z_importviewingkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 4)
+        throw runtime_error(
+            "z_importviewingkey \"vkey\" ( rescan startHeight )\n"
+            "\nAdds a viewing key (as returned by z_exportviewingkey) to your wallet.\n"
+            "\nArguments:\n"
+            "1. \"vkey\"             (string, required) The viewing key (see z_exportviewingkey)\n"
+            "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
+            "3. startHeight        (numeric, optional, default=0) Block height to start rescan from\n"
+            "4. zaddr               (string, optional, default=\"\") zaddr in case of importing viewing key for Sapling\n"
+            "\nNote: This call can take minutes to complete if rescan is true.\n"
+            "\nExamples:\n"
+            "\nImport a viewing key\n"
+            + HelpExampleCli("z_importviewingkey", "\"vkey\"") +
+            "\nImport the viewing key without rescan\n"
+            + HelpExampleCli("z_importviewingkey", "\"vkey\", no") +
+            "\nImport the viewing key with partial rescan\n"
+            + HelpExampleCli("z_importviewingkey", "\"vkey\" whenkeyisnew 30000") +
+            "\nRe-import the viewing key with longer partial rescan\n"
+            + HelpExampleCli("z_importviewingkey", "\"vkey\" yes 20000") +
+            "\nImport the viewing key for Sapling address\n"
+            + HelpExampleCli("z_importviewingkey", "\"vkey\" no 0 \"zaddr\"") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("z_importviewingkey", "\"vkey\", \"no\"")
+        );
+
+    CBlockIndex *pindexRescan = ImportViewingKey(params);
+    // the rescan takes the locks for each batch of blocks, do not hold them meanwhile
+    if (pindexRescan != NULL)
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
     return NullUniValue;
 }
 
@@ -2720,6 +2720,14 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "  \"unlocked_until\": ttt,      (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
             "  \"paytxfee\": x.xxxx,         (numeric) the transaction fee configuration, set in " + CURRENCY_UNIT + "/kB\n"
             "  \"seedfp\": \"uint256\",        (string) the BLAKE2b-256 hash of the HD seed\n"
+            "  \"scanning\":                   (json object) the running rescan, or false\n"
+            "    {\n"
+            "      \"startheight\": xxxx,      (numeric) the height the rescan started at\n"
+            "      \"height\": xxxx,           (numeric) the last height added to the wallet\n"
+            "      \"duration\": xxxx,         (numeric) seconds since the rescan started\n"
+            "      \"progress\": x.xxxx,       (numeric) the scanned fraction of the blocks up to the tip\n"
+            "      \"eta\": xxxx,              (numeric) estimated seconds until the rescan reaches the tip\n"
+            "    }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getwalletinfo", "")
@@ -2742,6 +2750,21 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
     uint256 seedFp = pwalletMain->GetHDChain().seedFp;
     if (!seedFp.IsNull())
          obj.push_back(Pair("seedfp", seedFp.GetHex()));
+    int nStartHeight, nHeight; int64_t nStartTime;
+    if (pwalletMain->GetRescanProgress(nStartHeight, nHeight, nStartTime)) {
+        UniValue scanning(UniValue::VOBJ);
+        int64_t nDuration = GetTime() - nStartTime;
+        double dProgress = (double)(nHeight - nStartHeight + 1) / std::max(chainActive.Height() - nStartHeight + 1, 1);
+        scanning.push_back(Pair("startheight", nStartHeight));
+        scanning.push_back(Pair("height", nHeight));
+        scanning.push_back(Pair("duration", nDuration));
+        scanning.push_back(Pair("progress", dProgress));
+        if (dProgress > 0)
+            scanning.push_back(Pair("eta", (int64_t)(nDuration * (1 - dProgress) / dProgress)));
+        obj.push_back(Pair("scanning", scanning));
+    } else {
+        obj.push_back(Pair("scanning", false));
+    }
     return obj;
 }
 
@@ -2917,27 +2940,20 @@ uint64_t squishy_interestsum()
 #ifdef ENABLE_WALLET
     if ( chainName.isKMD() && GetBoolArg("-disablewallet", false) == 0 && SQUISHY_NSPV_FULLNODE )
     {
-        uint64_t interest,sum = 0; 
-        int32_t txheight; 
-        uint32_t locktime;
-        vector<COutput> vecOutputs;
         assert(pwalletMain != NULL);
-        LOCK2(cs_main, pwalletMain->cs_wallet);
-        pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
-        BOOST_FOREACH(const COutput& out,vecOutputs)
+        // the wallet keeps the outputs up to date as blocks connect, a full rebuild is only needed after reorgs and rescans
+        if ( pwalletMain->interestTracker.IsStale(GetTime(),WALLET_OUTPUT_CACHE_MAX_AGE) )
+            pwalletMain->RebuildInterestTracker();
+        int32_t tipheight; uint32_t tiptime;
         {
-            CAmount nValue = out.tx->vout[out.i].nValue;
-            if ( out.tx->nLockTime != 0 && out.fSpendable != 0 )
-            {
-                BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
-                CBlockIndex *tipindex,*pindex = it->second;
-                if ( pindex != 0 && (tipindex= chainActive.Tip()) != 0 )
-                {
-                    interest = squishy_accrued_interest(&txheight,&locktime,out.tx->GetHash(),out.i,0,nValue,(int32_t)tipindex->nHeight);
-                    sum += interest;
-                }
-            }
+            LOCK(cs_main);
+            CBlockIndex *tipindex = chainActive.Tip();
+            if ( tipindex == 0 )
+                return(0);
+            tipheight = tipindex->nHeight;
+            tiptime = (uint32_t)tipindex->nTime;
         }
+        uint64_t sum = pwalletMain->interestTracker.GetInterestSum(tipheight,tiptime);
         SQUISHY_INTERESTSUM = sum;
         SQUISHY_WALLETBALANCE = pwalletMain->GetBalance();
         return(sum);
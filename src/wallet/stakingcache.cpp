@@ -0,0 +1,26 @@
+/******************************************************************************
+ * Copyright © 2021 Squishy Core Developers                                   *
+ *                                                                            *
+ * See the AUTHORS, DEVELOPER-AGREEMENT and LICENSE files at                  *
+ * the top-level directory of this distribution for the individual copyright  *
+ * holder information and the developer policies on copyright and licensing.  *
+ *                                                                            *
+ * Unless otherwise agreed in a custom licensing agreement, no part of the    *
+ * SuperNET software, including this file may be copied, modified, propagated *
+ * or distributed except according to the terms contained in the LICENSE file *
+ *                                                                            *
+ * Removal or modification of this copyright notice is prohibited.            *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "wallet/stakingcache.h"
+
+std::vector<CStakingCandidate> CStakingCache::GetCandidates() const
+{
+    LOCK(cs);
+    std::vector<CStakingCandidate> vCandidates;
+    vCandidates.reserve(mapOutputs.size());
+    for (const auto &entry : mapOutputs)
+        vCandidates.push_back(entry.second);
+    return vCandidates;
+}
@@ -0,0 +1,56 @@
+/******************************************************************************
+ * Copyright © 2021 Squishy Core Developers                                   *
+ *                                                                            *
+ * See the AUTHORS, DEVELOPER-AGREEMENT and LICENSE files at                  *
+ * the top-level directory of this distribution for the individual copyright  *
+ * holder information and the developer policies on copyright and licensing.  *
+ *                                                                            *
+ * Unless otherwise agreed in a custom licensing agreement, no part of the    *
+ * SuperNET software, including this file may be copied, modified, propagated *
+ * or distributed except according to the terms contained in the LICENSE file *
+ *                                                                            *
+ * Removal or modification of this copyright notice is prohibited.            *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef SQUISHY_WALLET_STAKINGCACHE_H
+#define SQUISHY_WALLET_STAKINGCACHE_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "uint256.h"
+#include "wallet/walletoutputcache.h"
+
+#include <string>
+#include <vector>
+
+/****
+ * A confirmed wallet output that may stake, with everything squishy_staked
+ * needs precomputed so eligibility can be evaluated without wallet or chain lookups.
+ */
+struct CStakingCandidate
+{
+    COutPoint outpoint;
+    CAmount nValue;
+    uint32_t txtime;     // time of the block that confirmed the output
+    uint32_t segid32;    // first word of addrhash
+    uint256 addrhash;    // sha256 of the address string, see squishy_stakehash
+    bool fCoinBase;      // must be checked for maturity before staking
+    std::string address;
+    CScript scriptPubKey;
+
+    CStakingCandidate() : nValue(0), txtime(0), segid32(0), fCoinBase(false) {}
+};
+
+/****
+ * The staking candidates of a wallet, so squishy_staked does not run
+ * AvailableCoins for every staking attempt.
+ */
+class CStakingCache : public CWalletOutputCache<CStakingCandidate>
+{
+public:
+    std::vector<CStakingCandidate> GetCandidates() const;
+};
+
+#endif // SQUISHY_WALLET_STAKINGCACHE_H
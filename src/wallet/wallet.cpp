@@ -51,6 +51,8 @@
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
+#include <atomic>
+
 using namespace std;
 using namespace libzcash;
 
@@ -602,10 +604,21 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
                        SaplingMerkleTree saplingTree,
                        bool added)
 {
+    LOCK(cs_wallet);
+    if (fRescanning) {
+        // the rescan applies the blocks after the last one it committed itself, in chain order
+        if (pindexRescanned == NULL || pindex->nHeight > pindexRescanned->nHeight)
+            return;
+        if (!added)
+            pindexRescanned = pindex->pprev;
+    }
     if (added) {
         IncrementNoteWitnesses(pindex, pblock, sproutTree, saplingTree);
     } else {
         DecrementNoteWitnesses(pindex);
+        // outputs spent by the disconnected block may be spendable again
+        stakingCache.SetStale();
+        interestTracker.SetStale();
     }
     UpdateSaplingNullifierNoteMapForBlock(pblock);
 }
@@ -1655,6 +1668,24 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * If fUpdate is true, existing transactions will be updated.
  */
 bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+{
+    AssertLockHeld(cs_wallet);
+    if ( tx.IsCoinBase() && tx.vout[0].nValue == 0 )
+        return false;
+    if (!fUpdate && mapWallet.count(tx.GetHash()) != 0)
+        return false;
+    CWalletTxScan scan;
+    scan.sproutNoteData = FindMySproutNotes(tx);
+    scan.saplingNoteData = FindMySaplingNotes(tx);
+    scan.fIsMine = IsMine(tx);
+    return AddToWalletIfInvolvingMe(tx, pblock, fUpdate, scan);
+}
+
+/**
+ * Add a transaction to the wallet with the notes the trial decryption found in it,
+ * see ScanWalletTx.
+ */
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, const CWalletTxScan& scan)
 {
     {
         AssertLockHeld(cs_wallet);
@@ -1662,16 +1693,16 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             return false;
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto sproutNoteData = FindMySproutNotes(tx);
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx);
-        auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
-        auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
+        auto sproutNoteData = scan.sproutNoteData;
+        auto saplingNoteData = scan.saplingNoteData.first;
+        const auto &addressesToAdd = scan.saplingNoteData.second;
         for (const auto &addressToAdd : addressesToAdd) {
-            if (!AddSaplingIncomingViewingKey(addressToAdd.second, addressToAdd.first)) {
+            if (!HaveSaplingIncomingViewingKey(addressToAdd.first) &&
+                !AddSaplingIncomingViewingKey(addressToAdd.second, addressToAdd.first)) {
                 return false;
             }
         }
-        if (fExisted || IsMine(tx) || IsFromMe(tx) || sproutNoteData.size() > 0 || saplingNoteData.size() > 0)
+        if (fExisted || scan.fIsMine || IsFromMe(tx) || sproutNoteData.size() > 0 || saplingNoteData.size() > 0)
         {
             CWalletTx wtx(this,tx);
 
@@ -1748,6 +1779,29 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
         return; // Not one of ours
 
+    if ( ASSETCHAINS_STAKED != 0 )
+    {
+        // only confirmed outputs can stake, the outputs tx spends never again
+        std::map<COutPoint, CStakingCandidate> mapStaking; CStakingCandidate candidate;
+        for (uint32_t i = 0; pblock != NULL && i < tx.vout.size(); i++)
+        {
+            if ( GetStakingCandidate(tx, i, pblock->nTime, candidate) )
+                mapStaking[candidate.outpoint] = candidate;
+        }
+        stakingCache.UpdateTransaction(tx, mapStaking);
+    }
+    if ( chainName.isKMD() )
+    {
+        // only confirmed outputs accrue interest, the outputs tx spends never again
+        std::map<COutPoint, CInterestOutput> mapInterest; CInterestOutput output;
+        BlockMap::const_iterator mi = pblock != NULL ? mapBlockIndex.find(pblock->GetHash()) : mapBlockIndex.end();
+        for (uint32_t i = 0; mi != mapBlockIndex.end() && mi->second != NULL && i < tx.vout.size(); i++)
+        {
+            if ( GetInterestOutput(tx, i, mi->second->nHeight, output) )
+                mapInterest[COutPoint(tx.GetHash(), i)] = output;
+        }
+        interestTracker.UpdateTransaction(tx, mapInterest);
+    }
     MarkAffectedTransactionsDirty(tx);
 }
 
@@ -1786,7 +1840,12 @@ void CWallet::EraseFromWallet(const uint256 &hash)
     {
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
+        {
             CWalletDB(strWalletFile).EraseTx(hash);
+            // an unconfirmed spend that is dropped gives its inputs back
+            stakingCache.SetStale();
+            interestTracker.SetStale();
+        }
     }
     return;
 }
@@ -1842,37 +1901,76 @@ boost::optional<uint256> CWallet::GetSproutNoteNullifier(const JSDescription &js
 mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
 {
     LOCK(cs_SpendingKeyStore);
+    return FindMySproutNotes(tx, mapNoteDecryptors, GetNumCores());
+}
+
+/**
+ * Same as FindMySproutNotes(tx) with a copy of the note decryptors, see
+ * GetNoteDecryptionKeys. The ciphertexts of all joinsplits are trial decrypted
+ * together on up to nThreads threads, see TrialDecrypt.
+ */
+mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx, const NoteDecryptorMap &decryptors, int nThreads) const
+{
     uint256 hash = tx.GetHash();
 
     mapSproutNoteData_t noteData;
+    if (tx.vjoinsplit.empty() || decryptors.empty())
+        return noteData;
+
+    // h_sig is shared by the ciphertexts of a joinsplit, compute it once
+    std::vector<uint256> vHSig;
+    std::vector<std::pair<size_t, uint8_t>> vOutputs;
     for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
-        auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
-        for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
-                try {
-                    auto address = item.first;
-                    JSOutPoint jsoutpt {hash, i, j};
-                    auto nullifier = GetSproutNoteNullifier(
-                        tx.vjoinsplit[i],
-                        address,
-                        item.second,
-                        hSig, j);
-                    if (nullifier) {
-                        SproutNoteData nd {address, *nullifier};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    } else {
-                        SproutNoteData nd {address};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    }
-                    break;
-                } catch (const note_decryption_failed &err) {
-                    // Couldn't decrypt with this decryptor
-                } catch (const std::exception &exc) {
-                    // Unexpected failure
-                    LogPrintf("FindMySproutNotes(): Unexpected error while testing decrypt:\n");
-                    LogPrintf("%s\n", exc.what());
-                }
+        vHSig.push_back(tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey));
+        for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++)
+            vOutputs.push_back(std::make_pair(i, j));
+    }
+    std::vector<NoteDecryptorMap::const_iterator> vDecryptors;
+    for (auto it = decryptors.begin(); it != decryptors.end(); ++it)
+        vDecryptors.push_back(it);
+
+    auto tryKey = [&](size_t o, size_t k) {
+        const JSDescription& jsdesc = tx.vjoinsplit[vOutputs[o].first];
+        uint8_t j = vOutputs[o].second;
+        try {
+            vDecryptors[k]->second.decrypt(jsdesc.ciphertexts[j], jsdesc.ephemeralKey, vHSig[vOutputs[o].first], j);
+            return true;
+        } catch (const note_decryption_failed &err) {
+            // Couldn't decrypt with this decryptor
+        } catch (const std::exception &exc) {
+            // Unexpected failure
+            LogPrintf("FindMySproutNotes(): Unexpected error while testing decrypt:\n");
+            LogPrintf("%s\n", exc.what());
+        }
+        return false;
+    };
+    std::vector<int> vMatch = TrialDecrypt(vOutputs.size(), vDecryptors.size(), nThreads, tryKey);
+
+    // the nullifier needs the spending key, look it up here rather than on the decryption threads
+    for (size_t o = 0; o < vOutputs.size(); o++) {
+        if (vMatch[o] < 0)
+            continue;
+        size_t i = vOutputs[o].first;
+        uint8_t j = vOutputs[o].second;
+        auto address = vDecryptors[vMatch[o]]->first;
+        JSOutPoint jsoutpt {hash, i, j};
+        try {
+            auto nullifier = GetSproutNoteNullifier(
+                tx.vjoinsplit[i],
+                address,
+                vDecryptors[vMatch[o]]->second,
+                vHSig[i], j);
+            if (nullifier) {
+                SproutNoteData nd {address, *nullifier};
+                noteData.insert(std::make_pair(jsoutpt, nd));
+            } else {
+                SproutNoteData nd {address};
+                noteData.insert(std::make_pair(jsoutpt, nd));
             }
+        } catch (const std::exception &exc) {
+            // Unexpected failure
+            LogPrintf("FindMySproutNotes(): Unexpected error while testing decrypt:\n");
+            LogPrintf("%s\n", exc.what());
         }
     }
     return noteData;
@@ -1890,54 +1988,81 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
 std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx) const
 {
     LOCK(cs_SpendingKeyStore);
+    if (tx.vShieldedOutput.empty())
+        return std::make_pair(mapSaplingNoteData_t(), SaplingIncomingViewingKeyMap());
+    CSaplingTrialKeys trialKeys(mapSaplingFullViewingKeys, mapSaplingIncomingViewingKeys);
+    return FindMySaplingNotes(tx, trialKeys, mapSaplingIncomingViewingKeys, GetNumCores());
+}
+
+/**
+ * Same as FindMySaplingNotes(tx) with a copy of the viewing keys, see
+ * GetNoteDecryptionKeys. All shielded outputs are trial decrypted together
+ * on up to nThreads threads, see TrialDecrypt.
+ */
+std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx,
+    const CSaplingTrialKeys &trialKeys, const SaplingIncomingViewingKeyMap &incomingViewingKeys, int nThreads) const
+{
     uint256 hash = tx.GetHash();
 
     mapSaplingNoteData_t noteData;
     SaplingIncomingViewingKeyMap viewingKeysToAdd;
 
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
+    auto tryKey = [&](size_t o, size_t k) {
+        const OutputDescription& output = tx.vShieldedOutput[o];
+        return (bool)SaplingNotePlaintext::decrypt(output.encCiphertext, trialKeys.vIvk[k], output.ephemeralKey, output.cm);
+    };
+    std::vector<int> vMatch = TrialDecrypt(tx.vShieldedOutput.size(), trialKeys.vIvk.size(), nThreads, tryKey);
+
     for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.vShieldedOutput[i];
-        bool found = false;
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
-            SaplingIncomingViewingKey ivk = it->first;
+        if (vMatch[i] < 0)
+            continue;
+        const SaplingIncomingViewingKey& ivk = trialKeys.vIvk[vMatch[i]];
+        if (vMatch[i] < (int)trialKeys.nFullViewingKeys) {
+            // only owned outputs get here, decrypting once more for the diversifier is cheap
+            const OutputDescription& output = tx.vShieldedOutput[i];
             auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cm);
             if (result) {
                 auto address = ivk.address(result.get().d);
-                if (address && mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
+                if (address && incomingViewingKeys.count(address.get()) == 0) {
                     viewingKeysToAdd[address.get()] = ivk;
                 }
-                // We don't cache the nullifier here as computing it requires knowledge of the note position
-                // in the commitment tree, which can only be determined when the transaction has been mined.
-                SaplingOutPoint op {hash, i};
-                SaplingNoteData nd;
-                nd.ivk = ivk;
-                noteData.insert(std::make_pair(op, nd));
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            for (auto it = mapSaplingIncomingViewingKeys.begin(); it != mapSaplingIncomingViewingKeys.end(); ++it) {
-                SaplingIncomingViewingKey ivk = it-> second;
-                auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cm);
-                if (!result) {
-                    continue;
-                }
-                // We don't cache the nullifier here as computing it requires knowledge of the note position
-                // in the commitment tree, which can only be determined when the transaction has been mined.
-                SaplingOutPoint op {hash, i};
-                SaplingNoteData nd;
-                nd.ivk = ivk;
-                noteData.insert(std::make_pair(op, nd));
-                break;
             }
         }
+        // We don't cache the nullifier here as computing it requires knowledge of the note position
+        // in the commitment tree, which can only be determined when the transaction has been mined.
+        SaplingOutPoint op {hash, i};
+        SaplingNoteData nd;
+        nd.ivk = ivk;
+        noteData.insert(std::make_pair(op, nd));
     }
 
     return std::make_pair(noteData, viewingKeysToAdd);
 }
 
+CNoteDecryptionKeys CWallet::GetNoteDecryptionKeys() const
+{
+    LOCK(cs_SpendingKeyStore);
+    CNoteDecryptionKeys keys;
+    keys.sproutDecryptors = mapNoteDecryptors;
+    keys.saplingIncomingViewingKeys = mapSaplingIncomingViewingKeys;
+    keys.saplingTrialKeys = CSaplingTrialKeys(mapSaplingFullViewingKeys, mapSaplingIncomingViewingKeys);
+    return keys;
+}
+
+/**
+ * Run the IsMine check and the trial decryption of a transaction without
+ * cs_wallet, for AddToWalletIfInvolvingMe to add it later.
+ */
+CWalletTxScan CWallet::ScanWalletTx(const CTransaction& tx, const CNoteDecryptionKeys& keys)
+{
+    CWalletTxScan scan;
+    scan.fIsMine = IsMine(tx);
+    scan.sproutNoteData = FindMySproutNotes(tx, keys.sproutDecryptors, 1);
+    scan.saplingNoteData = FindMySaplingNotes(tx, keys.saplingTrialKeys, keys.saplingIncomingViewingKeys, 1);
+    return scan;
+}
+
 bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
 {
     {
@@ -2733,10 +2858,58 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     }
 }
 
+/** A block a rescan reads ahead, with what its transactions hold for the wallet */
+struct CWalletRescanBlock
+{
+    CBlockIndex *pindex;
+    CBlock block;
+    std::vector<CWalletTxScan> vtxScan;
+
+    CWalletRescanBlock(CBlockIndex *pindexIn) : pindex(pindexIn) {}
+};
+
+/** Queue up to WALLET_RESCAN_BATCH blocks of the active chain from pindex on, cs_main must be held */
+static void GetRescanBatch(CBlockIndex *pindex, std::vector<CWalletRescanBlock> &vBlocks)
+{
+    AssertLockHeld(cs_main);
+    vBlocks.clear();
+    for (; pindex != NULL && vBlocks.size() < WALLET_RESCAN_BATCH; pindex = chainActive.Next(pindex))
+        vBlocks.push_back(CWalletRescanBlock(pindex));
+}
+
+/**
+ * Read a batch of blocks and run the IsMine checks and the trial decryption of
+ * their transactions on all cores, without cs_main and cs_wallet.
+ */
+static void PrepareRescanBatch(CWallet *pwallet, const CNoteDecryptionKeys *keys, std::vector<CWalletRescanBlock> *vBlocks)
+{
+    std::atomic<size_t> nNext(0);
+    auto scanBlocks = [&]() {
+        size_t i;
+        while ((i = nNext++) < vBlocks->size()) {
+            CWalletRescanBlock &item = (*vBlocks)[i];
+            ReadBlockFromDisk(item.block, item.pindex, 0);
+            item.vtxScan.resize(item.block.vtx.size());
+            for (size_t j = 0; j < item.block.vtx.size(); j++)
+                item.vtxScan[j] = pwallet->ScanWalletTx(item.block.vtx[j], *keys);
+        }
+    };
+    boost::thread_group threads;
+    for (int i = 1; i < std::min(GetNumCores(), (int)vBlocks->size()); i++)
+        threads.create_thread(scanBlocks);
+    scanBlocks();
+    threads.join_all();
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read and trial decrypted a batch ahead on all cores while the
+ * previous batch is added to the wallet under cs_main and cs_wallet, in chain
+ * order. The locks are released between batches, the rescan applies the blocks
+ * connected meanwhile itself until it reaches the tip.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -2745,9 +2918,15 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
+    stakingCache.SetStale();
+    interestTracker.SetStale();
 
     std::vector<uint256> myTxHashes;
 
+    LOCK(cs_rescan);
+    double dProgressStart = 0, dProgressTip = 0;
+    std::vector<CWalletRescanBlock> vBlocks, vNextBlocks;
+    CBlockIndex *pindexNextBatch = NULL;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -2757,19 +2936,61 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        if (pindex)
+        {
+            dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+            dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+            fRescanning = true;
+            pindexRescanned = pindex->pprev;
+            nRescanStartHeight = pindex->nHeight;
+            nRescanStartTime = nNow;
+            GetRescanBatch(pindex, vNextBlocks);
+            pindexNextBatch = pindex;
+        }
+    }
+
+    CNoteDecryptionKeys keys = GetNoteDecryptionKeys();
+    boost::thread prefetch(PrepareRescanBatch, this, &keys, &vNextBlocks);
+    // the prefetch thread uses keys and vNextBlocks, join it however this scope is left,
+    // and hand the blocks back to ChainTip if the scan loop throws
+    struct CPrefetchJoin {
+        boost::thread &thread;
+        CWallet *pwallet;
+        ~CPrefetchJoin() {
+            boost::this_thread::disable_interruption noInterrupt; // join() must not throw while unwinding
+            if (thread.joinable())
+                thread.join();
+            LOCK(pwallet->cs_wallet);
+            pwallet->fRescanning = false;
+            pwallet->pindexRescanned = NULL;
+        }
+    } prefetchJoin = {prefetch, this};
+    while (pindexNextBatch != NULL)
+    {
+        prefetch.join();
+        vBlocks.swap(vNextBlocks);
         {
+            LOCK(cs_main);
+            // read and decrypt the next batch while this one is added to the wallet
+            pindexNextBatch = chainActive.Next(vBlocks.back().pindex);
+            GetRescanBatch(pindexNextBatch, vNextBlocks);
+        }
+        prefetch = boost::thread(PrepareRescanBatch, this, &keys, &vNextBlocks);
+
+        LOCK2(cs_main, cs_wallet);
+        for (CWalletRescanBlock& item : vBlocks)
+        {
+            // a reorganization disconnected the rest of the batch
+            if (item.pindex->pprev != pindexRescanned || !chainActive.Contains(item.pindex))
+                break;
+            pindex = item.pindex;
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex,1);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            for (size_t i = 0; i < item.block.vtx.size(); i++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate)) {
-                    myTxHashes.push_back(tx.GetHash());
+                if (AddToWalletIfInvolvingMe(item.block.vtx[i], &item.block, fUpdate, item.vtxScan[i])) {
+                    myTxHashes.push_back(item.block.vtx[i].GetHash());
                     ret++;
                 }
             }
@@ -2785,15 +3006,37 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
                 }
             }
             // Increment note witness caches
-            ChainTip(pindex, &block, sproutTree, saplingTree, true);
+            pindexRescanned = pindex;
+            ChainTip(pindex, &item.block, sproutTree, saplingTree, true);
 
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
             }
         }
 
+        CBlockIndex *pindexNext = pindexRescanned != NULL ? chainActive.Next(pindexRescanned) : chainActive.Genesis();
+        if (pindexNext == NULL)
+        {
+            // caught up with the tip, ChainTip applies the next blocks
+            fRescanning = false;
+            pindexRescanned = NULL;
+            pindexNextBatch = NULL;
+        }
+        else if (pindexNext != pindexNextBatch)
+        {
+            // blocks were disconnected or connected at the tip since the next batch was queued
+            prefetch.join();
+            pindexNextBatch = pindexNext;
+            GetRescanBatch(pindexNextBatch, vNextBlocks);
+            prefetch = boost::thread(PrepareRescanBatch, this, &keys, &vNextBlocks);
+        }
+    }
+    prefetch.join();
+
+    {
+        LOCK2(cs_main, cs_wallet);
+
         // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
         // Do not flush the wallet here for performance reasons.
         CWalletDB walletdb(strWalletFile, "r+", false);
@@ -2808,9 +3051,23 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+    // a rebuild while the rescan ran saw only part of the wallet
+    stakingCache.SetStale();
+    interestTracker.SetStale();
     return ret;
 }
 
+bool CWallet::GetRescanProgress(int& nStartHeight, int& nHeight, int64_t& nStartTime) const
+{
+    AssertLockHeld(cs_wallet);
+    if (!fRescanning)
+        return false;
+    nStartHeight = nRescanStartHeight;
+    nHeight = pindexRescanned != NULL ? pindexRescanned->nHeight : nRescanStartHeight - 1;
+    nStartTime = nRescanStartTime;
+    return true;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     if ( IsInitialBlockDownload() )
@@ -3352,6 +3609,105 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
+bool CWallet::GetStakingCandidate(const CTransaction& tx, uint32_t i, uint32_t txtime, CStakingCandidate& candidate) const
+{
+    CTxDestination address; std::string straddr;
+    if ( i >= tx.vout.size() || tx.vout[i].nValue < COIN )
+        return false;
+    const CScript &pk = tx.vout[i].scriptPubKey;
+    if ( (::IsMine(*this, pk) & ISMINE_SPENDABLE) == ISMINE_NO || !ExtractDestination(pk, address) || ::IsMine(*this, address) == ISMINE_NO )
+        return false;
+    straddr = CBitcoinAddress(address).ToString();
+    candidate.outpoint = COutPoint(tx.GetHash(), i);
+    candidate.nValue = tx.vout[i].nValue;
+    candidate.txtime = txtime;
+    vcalc_sha256(0, candidate.addrhash.begin(), (uint8_t *)straddr.c_str(), (int32_t)straddr.size());
+    memcpy(&candidate.segid32, candidate.addrhash.begin(), sizeof(candidate.segid32));
+    candidate.fCoinBase = tx.IsCoinBase();
+    candidate.address = straddr;
+    candidate.scriptPubKey = pk;
+    return true;
+}
+
+void CWallet::RebuildStakingCache()
+{
+    std::map<COutPoint, CStakingCandidate> mapCandidates; CStakingCandidate candidate;
+    int64_t nNow = GetTime();
+    LOCK2(cs_main, cs_wallet);
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        const CWalletTx &wtx = it->second;
+        if ( wtx.GetDepthInMainChain() < 1 )
+            continue;
+        BlockMap::const_iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if ( mi == mapBlockIndex.end() || mi->second == NULL )
+            continue;
+        for (uint32_t i = 0; i < wtx.vout.size(); i++)
+        {
+            if ( !IsSpent(it->first, i) && GetStakingCandidate(wtx, i, mi->second->nTime, candidate) )
+                mapCandidates[candidate.outpoint] = candidate;
+        }
+    }
+    // under cs_wallet so that no SyncTransaction update is lost
+    stakingCache.Rebuild(mapCandidates, nNow);
+    LogPrint("staking", "%s: %u staking candidates\n", __func__, (uint32_t)mapCandidates.size());
+}
+
+bool CWallet::GetInterestOutput(const CTransaction& tx, uint32_t i, int32_t txheight, CInterestOutput& output) const
+{
+    // squishy_interest is zero for these
+    if ( i >= tx.vout.size() || tx.nLockTime == 0 || tx.vout[i].nValue < 10*COIN || txheight >= SQUISHY_ENDOFERA )
+        return false;
+    if ( (IsMine(tx.vout[i]) & ISMINE_SPENDABLE) == ISMINE_NO )
+        return false;
+    output.nValue = tx.vout[i].nValue;
+    output.txheight = txheight;
+    output.locktime = tx.nLockTime;
+    output.matureheight = tx.IsCoinBase() ? txheight + Params().CoinbaseMaturity() - 1 : 0;
+    return true;
+}
+
+void CWallet::RebuildInterestTracker()
+{
+    std::map<COutPoint, CInterestOutput> mapInterest; CInterestOutput output;
+    int64_t nNow = GetTime();
+    LOCK2(cs_main, cs_wallet);
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        const CWalletTx &wtx = it->second;
+        if ( wtx.nLockTime == 0 || wtx.GetDepthInMainChain() < 1 )
+            continue;
+        BlockMap::const_iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if ( mi == mapBlockIndex.end() || mi->second == NULL )
+            continue;
+        for (uint32_t i = 0; i < wtx.vout.size(); i++)
+        {
+            if ( !IsSpent(it->first, i) && GetInterestOutput(wtx, i, mi->second->nHeight, output) )
+                mapInterest[COutPoint(it->first, i)] = output;
+        }
+    }
+    // under cs_wallet so that no SyncTransaction update is lost
+    interestTracker.Rebuild(mapInterest, nNow);
+    LogPrint("interest", "%s: %u outputs accrue interest\n", __func__, (uint32_t)mapInterest.size());
+}
+
+std::vector<CStakingCandidate> CWallet::GetStakingCandidates() const
+{
+    std::vector<CStakingCandidate> vCandidates = stakingCache.GetCandidates();
+    LOCK2(cs_main, cs_wallet);
+    vCandidates.erase(std::remove_if(vCandidates.begin(), vCandidates.end(), [this](const CStakingCandidate &candidate) {
+        if ( IsLockedCoin(candidate.outpoint.hash, candidate.outpoint.n) )
+            return true;
+        if ( candidate.fCoinBase )
+        {
+            const CWalletTx *wtx = GetWalletTx(candidate.outpoint.hash);
+            return wtx == NULL || wtx->GetBlocksToMaturity() > 0;
+        }
+        return false;
+    }), vCandidates.end());
+    return vCandidates;
+}
+
 std::map<CTxDestination, std::vector<COutput>> CWallet::ListCoins() const
 {
     // TODO: Add AssertLockHeld(cs_wallet) here.
@@ -4669,18 +5025,21 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    interestTracker.SetLocked(output, true);
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    interestTracker.SetLocked(output, false);
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    interestTracker.UnlockAll();
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -34,9 +34,12 @@
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 #include "wallet/crypter.h"
+#include "wallet/interesttracker.h"
 #include "wallet/wallet_ismine.h"
 #include "wallet/walletdb.h"
 #include "wallet/rpcwallet.h"
+#include "wallet/notedecryption.h"
+#include "wallet/stakingcache.h"
 #include "zcash/Address.hpp"
 #include "zcash/zip32.h"
 #include "base58.h"
@@ -81,6 +84,9 @@ static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 //! target minimum change amount
 static const CAmount MIN_CHANGE = CENT;
 
+//! Number of blocks a rescan commits to the wallet under one lock of cs_main and cs_wallet
+static const unsigned int WALLET_RESCAN_BATCH = 100;
+
 static const bool DEFAULT_DISABLE_WALLET = false;
 static const bool DEFAULT_WALLET_RBF = false;
 
@@ -759,6 +765,24 @@ private:
 };
 
 
+/** Copy of the keys trial decryption uses, so a rescan decrypts on several threads without holding cs_SpendingKeyStore */
+struct CNoteDecryptionKeys
+{
+    NoteDecryptorMap sproutDecryptors;
+    SaplingIncomingViewingKeyMap saplingIncomingViewingKeys;
+    CSaplingTrialKeys saplingTrialKeys;
+};
+
+/** What the IsMine check and the trial decryption found in a transaction, before it is added to the wallet */
+struct CWalletTxScan
+{
+    bool fIsMine;
+    mapSproutNoteData_t sproutNoteData;
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> saplingNoteData;
+
+    CWalletTxScan() : fIsMine(false) {}
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -802,6 +826,15 @@ private:
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    //! Serializes rescans, taken before cs_main and cs_wallet
+    CCriticalSection cs_rescan;
+    //! While a rescan runs, ChainTip leaves the blocks after pindexRescanned to it so
+    //! witnesses are incremented in chain order. Guarded by cs_wallet.
+    bool fRescanning;
+    const CBlockIndex *pindexRescanned;
+    int nRescanStartHeight;
+    int64_t nRescanStartTime;
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -948,6 +981,10 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        fRescanning = false;
+        pindexRescanned = NULL;
+        nRescanStartHeight = 0;
+        nRescanStartTime = 0;
     }
 
     /**
@@ -1017,6 +1054,11 @@ public:
 
     int64_t nTimeFirstKey;
 
+    //! confirmed outputs that may stake, maintained for squishy_staked
+    CStakingCache stakingCache;
+    //! confirmed KMD outputs that accrue interest, maintained for squishy_interestsum
+    CInterestTracker interestTracker;
+
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
     //! check whether we are allowed to upgrade (or already support) to the named feature
@@ -1028,6 +1070,31 @@ public:
      */
     std::map<CTxDestination, std::vector<COutput>> ListCoins() const;
 
+    /**
+     * Describe an output for the staking cache.
+     * @param tx the confirmed transaction
+     * @param i the output index
+     * @param txtime the time of the block that confirmed tx
+     * @param[out] candidate the staking candidate
+     * @returns false if the output cannot stake: too small, not spendable or not to an address
+     */
+    bool GetStakingCandidate(const CTransaction& tx, uint32_t i, uint32_t txtime, CStakingCandidate& candidate) const;
+    /** Refill the staking cache from the unspent outputs of the confirmed transactions in mapWallet */
+    void RebuildStakingCache();
+    /** The cached staking candidates, without locked coins and immature coinbases */
+    std::vector<CStakingCandidate> GetStakingCandidates() const;
+    /**
+     * Describe an output for the interest tracker.
+     * @param tx the confirmed transaction
+     * @param i the output index
+     * @param txheight the height of the block that confirmed tx
+     * @param[out] output the interest parameters of the output
+     * @returns false if the output cannot accrue interest or is not spendable
+     */
+    bool GetInterestOutput(const CTransaction& tx, uint32_t i, int32_t txheight, CInterestOutput& output) const;
+    /** Refill the interest tracker from the unspent wallet outputs */
+    void RebuildInterestTracker();
+
     /**
      * Find non-change parent output.
      */
@@ -1181,11 +1248,22 @@ public:
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     void RescanWallet();
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, const CWalletTxScan& scan);
+    CWalletTxScan ScanWalletTx(const CTransaction& tx, const CNoteDecryptionKeys& keys);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<boost::optional<SproutWitness>>& witnesses,
          uint256 &final_anchor);
+    /**
+     * Must be called without cs_main and cs_wallet held, the rescan takes them
+     * for every batch of blocks it commits.
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    /**
+     * @returns true if a rescan runs, with the height it started at, the last
+     * height it committed and when it started. cs_wallet must be held.
+     */
+    bool GetRescanProgress(int& nStartHeight, int& nHeight, int64_t& nStartTime) const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
@@ -1228,7 +1306,11 @@ public:
         const uint256& hSig,
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
+    mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx, const NoteDecryptorMap& decryptors, int nThreads) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx) const;
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx,
+        const CSaplingTrialKeys& trialKeys, const SaplingIncomingViewingKeyMap& incomingViewingKeys, int nThreads) const;
+    CNoteDecryptionKeys GetNoteDecryptionKeys() const;
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
@@ -0,0 +1,101 @@
+/******************************************************************************
+ * Copyright © 2021 Squishy Core Developers                                   *
+ *                                                                            *
+ * See the AUTHORS, DEVELOPER-AGREEMENT and LICENSE files at                  *
+ * the top-level directory of this distribution for the individual copyright  *
+ * holder information and the developer policies on copyright and licensing.  *
+ *                                                                            *
+ * Unless otherwise agreed in a custom licensing agreement, no part of the    *
+ * SuperNET software, including this file may be copied, modified, propagated *
+ * or distributed except according to the terms contained in the LICENSE file *
+ *                                                                            *
+ * Removal or modification of this copyright notice is prohibited.            *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef SQUISHY_WALLET_WALLETOUTPUTCACHE_H
+#define SQUISHY_WALLET_WALLETOUTPUTCACHE_H
+
+#include "primitives/transaction.h"
+#include "sync.h"
+
+#include <map>
+
+/** Maximum age in seconds of a wallet output cache before it is rebuilt from the wallet anyway */
+static const int64_t WALLET_OUTPUT_CACHE_MAX_AGE = 3600;
+
+/****
+ * Confirmed unspent wallet outputs with the data a caller needs about each,
+ * kept up to date from SyncTransaction instead of being gathered from the
+ * wallet for every use. Marked stale on reorgs, rescans and when a spend
+ * leaves the wallet, when it has to be rebuilt from the wallet.
+ */
+template <typename T>
+class CWalletOutputCache
+{
+public:
+    CWalletOutputCache() : fStale(true), nLastBuild(0) {}
+
+    /***
+     * Forget the outputs spent by a transaction and its own outputs, then add the given ones
+     * @param tx the transaction seen by the wallet
+     * @param mapAdded its outputs to keep, empty unless it is confirmed
+     */
+    void UpdateTransaction(const CTransaction &tx, const std::map<COutPoint, T> &mapAdded)
+    {
+        LOCK(cs);
+        for (const CTxIn &txin : tx.vin)
+            mapOutputs.erase(txin.prevout);
+        uint256 txid = tx.GetHash();
+        for (uint32_t i = 0; i < tx.vout.size(); i++)
+            mapOutputs.erase(COutPoint(txid, i));
+        for (const auto &entry : mapAdded)
+            mapOutputs[entry.first] = entry.second;
+    }
+
+    /***
+     * Replace all outputs
+     * @param mapAdded the outputs found in the wallet
+     * @param nTime when they were gathered
+     */
+    void Rebuild(const std::map<COutPoint, T> &mapAdded, int64_t nTime)
+    {
+        LOCK(cs);
+        mapOutputs = mapAdded;
+        fStale = false;
+        nLastBuild = nTime;
+    }
+
+    void SetStale()
+    {
+        LOCK(cs);
+        fStale = true;
+    }
+
+    /***
+     * @param nNow the current time
+     * @param nMaxAge seconds after which a full rebuild is due anyway
+     * @returns true if the outputs must be rebuilt from the wallet
+     */
+    bool IsStale(int64_t nNow, int64_t nMaxAge) const
+    {
+        LOCK(cs);
+        return fStale || nNow > nLastBuild + nMaxAge;
+    }
+
+    size_t Size() const
+    {
+        LOCK(cs);
+        return mapOutputs.size();
+    }
+
+protected:
+    mutable CCriticalSection cs;
+    std::map<COutPoint, T> mapOutputs;
+
+private:
+    bool fStale;
+    int64_t nLastBuild;
+};
+
+#endif // SQUISHY_WALLET_WALLETOUTPUTCACHE_H